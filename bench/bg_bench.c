@@ -0,0 +1,626 @@
+// Host benchmark for the background image decoder
+// bench/bg_bench.c
+//
+// Builds the same synthetic picture as a BMP and as a PNG (24 bit and 8 bit
+// palette), decodes each into a malloc'd framebuffer and reports decode
+// throughput in MB/s of file read and of pixels written, plus a checksum of
+// the result. The PNGs use dynamic Huffman blocks like real encoders, with
+// extra cases for fixed-code and stored blocks. A BMP and the PNG of the
+// same picture must decode to the same pixels, which checks the inflate and
+// the PNG filters against the trivial BMP path. Build and run with `make bg-bench`;
+// `bg_bench [width height]` picks the source image size (default 1920x1080).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fb.h"
+#include "background.h"
+
+typedef struct {
+    unsigned char *data;
+    size_t size;
+} blob_t;
+
+typedef struct {
+    const unsigned char *data;
+    size_t size, pos;
+} memsrc_t;
+
+static unsigned int img_w, img_h;
+static unsigned char *surface;
+static unsigned int surface_w, surface_h, surface_pitch;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Smooth gradients with a little noise and some hard edges, roughly what a
+// wallpaper compresses like
+static void pixel(unsigned int x, unsigned int y, unsigned char rgb[3])
+{
+    unsigned int noise = ((x * 2654435761u) ^ (y * 40503u)) >> 29;
+
+    rgb[0] = x * 255 / img_w + noise;
+    rgb[1] = y * 255 / img_h;
+    rgb[2] = (((x + y) / 64) & 1) ? 200 - noise : 60;
+}
+
+static unsigned char pixelIndex(unsigned int x, unsigned int y)
+{
+    return (x / 24 + (y / 24) * 7) & 0xFF;
+}
+
+static void paletteColor(int i, unsigned char rgb[3])
+{
+    rgb[0] = i * 37;
+    rgb[1] = i * 91 + 11;
+    rgb[2] = 255 - i;
+}
+
+static void put16(unsigned char *p, unsigned int v) { p[0] = v; p[1] = v >> 8; }
+static void put32(unsigned char *p, unsigned int v) { put16(p, v); put16(p + 2, v >> 16); }
+static void putBe32(unsigned char *p, unsigned int v) { p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v; }
+
+static blob_t makeBmp(int indexed)
+{
+    unsigned int bpp = indexed ? 8 : 24, colors = indexed ? 256 : 0;
+    unsigned int stride = (img_w * bpp / 8 + 3) & ~3u, offset = 54 + colors * 4;
+    blob_t b = { calloc(1, offset + (size_t)stride * img_h), offset + (size_t)stride * img_h };
+
+    b.data[0] = 'B';
+    b.data[1] = 'M';
+    put32(b.data + 2, b.size);
+    put32(b.data + 10, offset);
+    put32(b.data + 14, 40);
+    put32(b.data + 18, img_w);
+    put32(b.data + 22, img_h);  // bottom-up
+    put16(b.data + 26, 1);
+    put16(b.data + 28, bpp);
+    put32(b.data + 46, colors);
+
+    for (unsigned int i = 0; i < colors; i++) {
+        unsigned char rgb[3];
+        paletteColor(i, rgb);
+        b.data[54 + i * 4] = rgb[2];
+        b.data[55 + i * 4] = rgb[1];
+        b.data[56 + i * 4] = rgb[0];
+    }
+
+    for (unsigned int y = 0; y < img_h; y++) {
+        unsigned char *row = b.data + offset + (size_t)(img_h - 1 - y) * stride;
+        for (unsigned int x = 0; x < img_w; x++) {
+            if (indexed) {
+                row[x] = pixelIndex(x, y);
+            } else {
+                unsigned char rgb[3];
+                pixel(x, y, rgb);
+                row[x * 3] = rgb[2];
+                row[x * 3 + 1] = rgb[1];
+                row[x * 3 + 2] = rgb[0];
+            }
+        }
+    }
+    return b;
+}
+
+// Minimal DEFLATE encoder: greedy matches from a one-entry hash table, then
+// stored, fixed Huffman or dynamic Huffman blocks. Dynamic blocks are what
+// real encoders write, the other two cover the rest of the decoder.
+enum {
+    DEFLATE_STORED,
+    DEFLATE_FIXED,
+    DEFLATE_DYNAMIC
+};
+
+#define DEFLATE_BLOCK_TOKENS 16384  // dynamic: new code tables this often, as zlib does
+
+typedef struct {
+    unsigned char *out;
+    size_t pos;
+    unsigned long bits;
+    int count;
+} bitw_t;
+
+typedef struct {
+    unsigned short lit;         // byte, or the match length if dist is set
+    unsigned short dist;
+} token_t;
+
+static void putBits(bitw_t *w, unsigned int v, int n)
+{
+    w->bits |= (unsigned long)v << w->count;
+    w->count += n;
+    while (w->count >= 8) {
+        w->out[w->pos++] = w->bits;
+        w->bits >>= 8;
+        w->count -= 8;
+    }
+}
+
+static void putCode(bitw_t *w, unsigned int code, int len)
+{
+    unsigned int rev = 0;
+    for (int i = 0; i < len; i++) rev |= ((code >> i) & 1) << (len - 1 - i);
+    putBits(w, rev, len);
+}
+
+static void putLiteral(bitw_t *w, unsigned int sym)
+{
+    if (sym < 144) putCode(w, 0x30 + sym, 8);
+    else if (sym < 256) putCode(w, 0x190 + sym - 144, 9);
+    else if (sym < 280) putCode(w, sym - 256, 7);
+    else putCode(w, 0xC0 + sym - 280, 8);
+}
+
+static const unsigned short lenBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char lenExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short distBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char distExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const unsigned char clenOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static int lenIndex(unsigned int length)
+{
+    int l = 28;
+    while (lenBase[l] > length) l--;
+    return l;
+}
+
+static int distIndex(unsigned int distance)
+{
+    int d = 29;
+    while (distBase[d] > distance) d--;
+    return d;
+}
+
+static size_t tokenize(const unsigned char *in, size_t n, token_t *t)
+{
+    static int head[1 << 15];
+    size_t count = 0;
+
+    for (int i = 0; i < (1 << 15); i++) head[i] = -1;
+
+    for (size_t i = 0; i < n;) {
+        unsigned int length = 0, distance = 0;
+
+        if (i + 3 <= n) {
+            unsigned int h = ((in[i] << 10) ^ (in[i + 1] << 5) ^ in[i + 2]) & 0x7FFF;
+            int cand = head[h];
+            head[h] = i;
+            if (cand >= 0 && i - cand <= 32768) {
+                while (length < 258 && i + length < n && in[cand + length] == in[i + length]) length++;
+                distance = i - cand;
+            }
+        }
+
+        if (length >= 3) {
+            t[count].lit = length;
+            t[count++].dist = distance;
+            i += length;
+        } else {
+            t[count].lit = in[i++];
+            t[count++].dist = 0;
+        }
+    }
+    return count;
+}
+
+// Huffman code lengths for n symbols, at most `limit` bits: while the tree
+// is too deep the counts are halved, which flattens it
+static void huffLengths(const unsigned int *freq, int n, int limit, unsigned char *len)
+{
+    unsigned int weight[2 * 288];
+    int parent[2 * 288], alive[2 * 288];
+    unsigned int scale = 0;
+
+    for (;;) {
+        int nodes = n, used = 0;
+
+        for (int i = 0; i < n; i++) {
+            weight[i] = freq[i] ? (freq[i] >> scale) + 1 : 0;
+            alive[i] = freq[i] != 0;
+            parent[i] = -1;
+            used += alive[i];
+            len[i] = 0;
+        }
+        if (used == 1) {
+            for (int i = 0; i < n; i++) if (freq[i]) len[i] = 1;
+            return;
+        }
+
+        // O(n^2) pairing is fine for 286 symbols
+        for (int joins = 0; joins < used - 1; joins++) {
+            int a = -1, b = -1;
+            for (int i = 0; i < nodes; i++) {
+                if (!alive[i]) continue;
+                if (a < 0 || weight[i] < weight[a]) { b = a; a = i; }
+                else if (b < 0 || weight[i] < weight[b]) b = i;
+            }
+            weight[nodes] = weight[a] + weight[b];
+            alive[nodes] = 1;
+            parent[nodes] = -1;
+            alive[a] = alive[b] = 0;
+            parent[a] = parent[b] = nodes++;
+        }
+
+        int deepest = 0;
+        for (int i = 0; i < n; i++) {
+            if (!freq[i]) continue;
+            int depth = 0;
+            for (int p = parent[i]; p >= 0; p = parent[p]) depth++;
+            len[i] = depth;
+            if (depth > deepest) deepest = depth;
+        }
+        if (deepest <= limit) return;
+        scale++;
+    }
+}
+
+// Canonical codes from the lengths (RFC 1951, 3.2.2)
+static void huffCodes(const unsigned char *len, int n, unsigned short *code)
+{
+    unsigned short count[16] = { 0 }, next[16];
+
+    for (int i = 0; i < n; i++) count[len[i]]++;
+    count[0] = 0;
+    next[0] = 0;
+    for (int b = 1; b < 16; b++) next[b] = (next[b - 1] + count[b - 1]) << 1;
+    for (int i = 0; i < n; i++) code[i] = len[i] ? next[len[i]]++ : 0;
+}
+
+static void putDynamic(bitw_t *w, const token_t *t, size_t count, int final)
+{
+    unsigned int litFreq[286] = { 0 }, distFreq[30] = { 0 }, clenFreq[19] = { 0 };
+    unsigned char litLen[286], distLen[30], clenLen[19], lens[286 + 30];
+    unsigned short litCode[286], distCode[30], clenCode[19];
+    unsigned char rle[286 + 30], rleExtra[286 + 30];
+    int nlit = 286, ndist = 30, nclen = 19, nrle = 0, nlens;
+
+    for (size_t i = 0; i < count; i++) {
+        if (t[i].dist) {
+            litFreq[257 + lenIndex(t[i].lit)]++;
+            distFreq[distIndex(t[i].dist)]++;
+        } else {
+            litFreq[t[i].lit]++;
+        }
+    }
+    litFreq[256] = 1;
+    if (!distFreq[0] && !distFreq[1]) distFreq[0] = distFreq[1] = 1; // keep the distance code complete
+
+    huffLengths(litFreq, 286, 15, litLen);
+    huffLengths(distFreq, 30, 15, distLen);
+    huffCodes(litLen, 286, litCode);
+    huffCodes(distLen, 30, distCode);
+
+    while (nlit > 257 && !litLen[nlit - 1]) nlit--;
+    while (ndist > 1 && !distLen[ndist - 1]) ndist--;
+
+    // both length tables as one run-length coded sequence
+    nlens = nlit + ndist;
+    memcpy(lens, litLen, nlit);
+    memcpy(lens + nlit, distLen, ndist);
+    for (int i = 0; i < nlens;) {
+        int run = 1;
+        while (i + run < nlens && lens[i + run] == lens[i]) run++;
+
+        if (!lens[i] && run >= 11) {
+            if (run > 138) run = 138;
+            rle[nrle] = 18; rleExtra[nrle++] = run - 11;
+        } else if (!lens[i] && run >= 3) {
+            rle[nrle] = 17; rleExtra[nrle++] = run - 3;
+        } else if (lens[i] && run >= 4) {
+            if (run > 7) run = 7;
+            rle[nrle] = lens[i]; rleExtra[nrle++] = 0;
+            rle[nrle] = 16; rleExtra[nrle++] = run - 4;
+        } else {
+            run = 1;
+            rle[nrle] = lens[i]; rleExtra[nrle++] = 0;
+        }
+        i += run;
+    }
+
+    for (int i = 0; i < nrle; i++) clenFreq[rle[i]]++;
+    huffLengths(clenFreq, 19, 7, clenLen);
+    huffCodes(clenLen, 19, clenCode);
+    while (nclen > 4 && !clenLen[clenOrder[nclen - 1]]) nclen--;
+
+    putBits(w, final, 1);
+    putBits(w, 2, 2);
+    putBits(w, nlit - 257, 5);
+    putBits(w, ndist - 1, 5);
+    putBits(w, nclen - 4, 4);
+    for (int i = 0; i < nclen; i++) putBits(w, clenLen[clenOrder[i]], 3);
+    for (int i = 0; i < nrle; i++) {
+        putCode(w, clenCode[rle[i]], clenLen[rle[i]]);
+        if (rle[i] == 16) putBits(w, rleExtra[i], 2);
+        else if (rle[i] == 17) putBits(w, rleExtra[i], 3);
+        else if (rle[i] == 18) putBits(w, rleExtra[i], 7);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (!t[i].dist) {
+            putCode(w, litCode[t[i].lit], litLen[t[i].lit]);
+            continue;
+        }
+        int l = lenIndex(t[i].lit), d = distIndex(t[i].dist);
+        putCode(w, litCode[257 + l], litLen[257 + l]);
+        putBits(w, t[i].lit - lenBase[l], lenExtra[l]);
+        putCode(w, distCode[d], distLen[d]);
+        putBits(w, t[i].dist - distBase[d], distExtra[d]);
+    }
+    putCode(w, litCode[256], litLen[256]);
+}
+
+static void putFixed(bitw_t *w, const token_t *t, size_t count)
+{
+    putBits(w, 1, 1);           // final block
+    putBits(w, 1, 2);           // fixed codes
+
+    for (size_t i = 0; i < count; i++) {
+        if (!t[i].dist) {
+            putLiteral(w, t[i].lit);
+            continue;
+        }
+        int l = lenIndex(t[i].lit), d = distIndex(t[i].dist);
+        putLiteral(w, 257 + l);
+        putBits(w, t[i].lit - lenBase[l], lenExtra[l]);
+        putCode(w, d, 5);
+        putBits(w, t[i].dist - distBase[d], distExtra[d]);
+    }
+    putLiteral(w, 256);
+}
+
+static void putStored(bitw_t *w, const unsigned char *in, size_t n)
+{
+    size_t at = 0;
+
+    do {
+        size_t len = n - at < 65535 ? n - at : 65535;
+
+        putBits(w, at + len == n, 1);
+        putBits(w, 0, 2);
+        putBits(w, 0, (8 - w->count) & 7); // to a byte boundary
+        putBits(w, len, 16);
+        putBits(w, ~len & 0xFFFF, 16);
+        for (size_t i = 0; i < len; i++) putBits(w, in[at + i], 8);
+        at += len;
+    } while (at < n);
+}
+
+static size_t deflate(const unsigned char *in, size_t n, unsigned char *out, int mode)
+{
+    bitw_t w = { out, 0, 0, 0 };
+    unsigned int adlerA = 1, adlerB = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        adlerA = (adlerA + in[i]) % 65521;
+        adlerB = (adlerB + adlerA) % 65521;
+    }
+
+    putBits(&w, 0x78, 8);       // zlib: deflate, 32 KB window
+    putBits(&w, 0x01, 8);
+
+    if (mode == DEFLATE_STORED) {
+        putStored(&w, in, n);
+    } else {
+        token_t *t = malloc((n + 1) * sizeof(token_t));
+        size_t count = tokenize(in, n, t);
+
+        if (mode == DEFLATE_FIXED) {
+            putFixed(&w, t, count);
+        } else {
+            for (size_t at = 0; at < count || !at; at += DEFLATE_BLOCK_TOKENS) {
+                size_t len = count - at < DEFLATE_BLOCK_TOKENS ? count - at : DEFLATE_BLOCK_TOKENS;
+                putDynamic(&w, t + at, len, at + len == count);
+            }
+        }
+        free(t);
+    }
+    putBits(&w, 0, (8 - w.count) & 7); // flush to a byte
+
+    unsigned int adler = (adlerB << 16) | adlerA;
+    for (int i = 3; i >= 0; i--) putBits(&w, (adler >> (i * 8)) & 0xFF, 8);
+    return w.pos;
+}
+
+static unsigned int crc32(const unsigned char *p, size_t n)
+{
+    static unsigned int table[256];
+    unsigned int c = 0xFFFFFFFF;
+
+    if (!table[1]) {
+        for (unsigned int i = 0; i < 256; i++) {
+            unsigned int v = i;
+            for (int k = 0; k < 8; k++) v = (v & 1) ? 0xEDB88320 ^ (v >> 1) : v >> 1;
+            table[i] = v;
+        }
+    }
+    while (n--) c = table[(c ^ *p++) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFF;
+}
+
+static size_t putChunk(unsigned char *p, const char *type, const unsigned char *data, size_t n)
+{
+    putBe32(p, n);
+    memcpy(p + 4, type, 4);
+    memcpy(p + 8, data, n);
+    putBe32(p + 8 + n, crc32(p + 4, n + 4));
+    return n + 12;
+}
+
+// Every row uses a different filter (none, sub, up, average, paeth in turn)
+static blob_t makePng(int indexed, int mode)
+{
+    unsigned int bpp = indexed ? 1 : 3, stride = img_w * bpp;
+    size_t rawSize = (size_t)(stride + 1) * img_h;
+    unsigned char *raw = malloc(rawSize), *prev = calloc(1, stride), *cur = malloc(stride);
+    unsigned char *z = malloc(rawSize * 9 / 8 + 64);
+    blob_t b;
+
+    for (unsigned int y = 0; y < img_h; y++) {
+        unsigned char *out = raw + (size_t)y * (stride + 1);
+        int filter = y % 5;
+
+        for (unsigned int x = 0; x < img_w; x++) {
+            if (indexed) cur[x] = pixelIndex(x, y);
+            else pixel(x, y, cur + x * 3);
+        }
+
+        out[0] = filter;
+        for (unsigned int i = 0; i < stride; i++) {
+            int a = i >= bpp ? cur[i - bpp] : 0, up = prev[i], c = i >= bpp ? prev[i - bpp] : 0, p;
+            int pa = abs(up - c), pb = abs(a - c), pc = abs(a + up - 2 * c);
+
+            switch (filter) {
+            case 1:  p = a; break;
+            case 2:  p = up; break;
+            case 3:  p = (a + up) >> 1; break;
+            case 4:  p = (pa <= pb && pa <= pc) ? a : (pb <= pc ? up : c); break;
+            default: p = 0; break;
+            }
+            out[1 + i] = cur[i] - p;
+        }
+        memcpy(prev, cur, stride);
+    }
+
+    size_t zSize = deflate(raw, rawSize, z, mode);
+
+    b.data = malloc(zSize + zSize / 16384 * 12 + 2048);
+    memcpy(b.data, "\x89PNG\r\n\x1a\n", 8);
+    b.size = 8;
+
+    unsigned char ihdr[13];
+    putBe32(ihdr, img_w);
+    putBe32(ihdr + 4, img_h);
+    ihdr[8] = 8;
+    ihdr[9] = indexed ? 3 : 2;
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    b.size += putChunk(b.data + b.size, "IHDR", ihdr, 13);
+
+    if (indexed) {
+        unsigned char plte[768];
+        for (int i = 0; i < 256; i++) paletteColor(i, plte + i * 3);
+        b.size += putChunk(b.data + b.size, "PLTE", plte, 768);
+    }
+
+    // several IDAT chunks, as encoders write them
+    for (size_t at = 0; at < zSize; at += 16384) {
+        size_t n = zSize - at < 16384 ? zSize - at : 16384;
+        b.size += putChunk(b.data + b.size, "IDAT", z + at, n);
+    }
+    b.size += putChunk(b.data + b.size, "IEND", 0, 0);
+
+    free(raw);
+    free(prev);
+    free(cur);
+    free(z);
+    return b;
+}
+
+static long memRead(void *arg, void *buffer, unsigned long length)
+{
+    memsrc_t *m = arg;
+    size_t n = m->size - m->pos < length ? m->size - m->pos : length;
+
+    memcpy(buffer, m->data + m->pos, n);
+    m->pos += n;
+    return n;
+}
+
+static void toSurface(void *arg, int y, const void *pixels)
+{
+    memcpy(surface + (size_t)y * surface_pitch, pixels, surface_w * 4);
+}
+
+// FNV-1a over the visible part of every row
+static unsigned int checksum(unsigned int w, unsigned int h)
+{
+    unsigned int sum = 2166136261u;
+
+    for (unsigned int y = 0; y < h; y++) {
+        const unsigned char *row = surface + (size_t)y * surface_pitch;
+        for (unsigned int x = 0; x < w * 4; x++) sum = (sum ^ row[x]) * 16777619u;
+    }
+    return sum;
+}
+
+static unsigned int runCase(const char *name, blob_t *file, unsigned int w, unsigned int h, int reps)
+{
+    memsrc_t m = { file->data, file->size, 0 };
+    bg_source_t src = { memRead, &m };
+
+    memset(surface, 0, (size_t)surface_pitch * surface_h);
+    if (bg_decode(&src, w, h, toSurface, 0) != BG_OK) {
+        printf("  %-30s decode failed\n", name);
+        exit(1);
+    }
+    unsigned int sum = checksum(w ? w : img_w, h ? h : img_h);
+
+    double start = now_ns();
+    for (int i = 0; i < reps; i++) {
+        m.pos = 0;
+        bg_decode(&src, w, h, toSurface, 0);
+    }
+    double ns = (now_ns() - start) / reps;
+    double pixels = (double)(w ? w : img_w) * (h ? h : img_h);
+
+    printf("  %-30s %8.2f %10.1f %10.1f   %08x\n", name, ns / 1e6, file->size / ns * 1e3,
+           pixels * 4 / ns * 1e3, sum);
+    return sum;
+}
+
+int main(int argc, char **argv)
+{
+    img_w = argc > 1 ? atoi(argv[1]) : FB_DEFAULT_WIDTH;
+    img_h = argc > 2 ? atoi(argv[2]) : FB_DEFAULT_HEIGHT;
+    if (!img_w || !img_h || img_w > BG_MAX_WIDTH) {
+        fprintf(stderr, "bg_bench: width must be 1 to %d\n", BG_MAX_WIDTH);
+        return 1;
+    }
+
+    // big enough for the image at its own size and for the 1280x720 scaled cases
+    surface_w = img_w > 1280 ? img_w : 1280;
+    surface_h = img_h > 720 ? img_h : 720;
+    surface_pitch = surface_w * 4;
+    surface = aligned_alloc(64, ((size_t)surface_pitch * surface_h + 63) & ~(size_t)63);
+    if (!surface) return 1;
+    fb_initSurface(surface, surface_w, surface_h, surface_pitch, FB_FORMAT_XRGB8888);
+
+    blob_t bmp24 = makeBmp(0), png24 = makePng(0, DEFLATE_DYNAMIC), bmp8 = makeBmp(1), png8 = makePng(1, DEFLATE_DYNAMIC);
+    blob_t pngFixed = makePng(0, DEFLATE_FIXED), pngStored = makePng(0, DEFLATE_STORED);
+
+    printf("bg_bench: %ux%u source, png %zu KB rgb / %zu KB palette\n", img_w, img_h,
+           png24.size / 1024, png8.size / 1024);
+    printf("  %-30s %8s %10s %10s %10s\n", "case", "ms", "in MB/s", "out MB/s", "checksum");
+
+    unsigned int a = runCase("bmp 24 bit", &bmp24, 0, 0, 20);
+    unsigned int b = runCase("png rgb", &png24, 0, 0, 5);
+    unsigned int c = runCase("bmp 8 bit palette", &bmp8, 0, 0, 20);
+    unsigned int d = runCase("png palette", &png8, 0, 0, 5);
+    unsigned int e = runCase("bmp 24 bit -> 1280x720", &bmp24, 1280, 720, 20);
+    unsigned int f = runCase("png rgb -> 1280x720", &png24, 1280, 720, 5);
+    unsigned int g = runCase("png rgb, fixed codes only", &pngFixed, 0, 0, 5);
+    unsigned int h = runCase("png rgb, stored blocks", &pngStored, 0, 0, 5);
+
+    if (a != b || c != d || e != f || a != g || a != h) {
+        printf("bg_bench: png and bmp of the same picture decode differently\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,178 @@
+// Host benchmark for the graphics library
+// bench/fb_bench.c
+//
+// Runs the fb.c primitives against a malloc'd framebuffer and reports the
+// cost per pixel written plus a checksum of the buffer after each case, so
+// both speed and rendering regressions show up. The suite runs with the
+// scalar kernels, the NEON ones and with the glyph cache off, and the three
+// checksums must match. Build and run with
+// `make bench`; `fb_bench [width height pitch depth]` picks the buffer layout
+// (depth 16 runs everything on an RGB565 surface).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fb.h"
+
+typedef struct {
+    const char *name;
+    void (*run)(int i);
+    double pixels;  // pixels written per call
+    int reps;
+} bench_case_t;
+
+static unsigned int bench_w, bench_h, bench_depth;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// FNV-1a over the visible part of every row
+static unsigned int checksum(const unsigned char *buf, unsigned int pitch)
+{
+    unsigned int h = 2166136261u;
+
+    for (unsigned int y = 0; y < bench_h; y++) {
+        const unsigned char *row = buf + (size_t)y * pitch;
+        for (unsigned int x = 0; x < bench_w * bench_depth / 8; x++) h = (h ^ row[x]) * 16777619u;
+    }
+    return h;
+}
+
+static void run_clear(int i)        { clearScreen(i & 15); }
+static void run_rectFilled(int i)   { drawRect(100, 100, 1099, 799, 0x1e + (i & 0x70), 1); }
+static void run_rectOutline(int i)  { drawRect(100, 100, 1099, 799, 0x0e, 0); }
+static void run_rounded8(int i)     { drawRoundedRect(100, 100, 1099, 799, 8, 0x77, 1, 0x0c, 3); }
+static void run_rounded42(int i)    { drawRoundedRect(100, 100, 1099, 799, 42, 0x77, 1, 0x0c, 3); }
+static void run_rounded200(int i)   { drawRoundedRect(100, 100, 1099, 799, 200, 0x77, 1, 0x0c, 3); }
+static void run_loginBox(int i)     { drawRoundedRect(710, 800, 1210, 880, 42, 0x77, 1, 0x77, 3); }
+static void run_roundedAA(int i)    { drawRoundedRectAA(100, 100, 1099, 799, 42, 0x77, 1, 0x0c, 3); }
+static void run_circle(int i)       { drawCircle(600, 500, 300, 0x5a, 1); }
+static void run_circleOutline(int i){ drawCircle(600, 500, 300, 0x0a, 0); }
+static void run_line(int i)         { drawLine(100, 100, 1099, 599, 0x0e); }
+
+static fb_point_t chart[512];
+static void run_polyline(int i)     { drawPolyline(chart, 512, 0x0a); }
+
+static void run_circleClipped(int i)
+{
+    fb_pushViewport(500, 400, 200, 200);
+    drawCircle(100, 100, 300, 0x5a, 1);
+    fb_popClip();
+}
+
+static void run_string(int i)       { drawString(10, 10, "The quick brown fox jumps over the lazy dog 0123456789", 0x0f); }
+static void run_string16(int i)     { drawStringSized(10, 100, "The quick brown fox jumps", 0x0f, 16); }
+static void run_string32(int i)     { drawStringSized(10, 200, "The quick brown fox", 0x4f, 32); }
+static void run_string64(int i)     { drawStringSized(10, 300, "emexOS login screen", 0x8b, 64); }
+
+#define STR_PIXELS(chars, size) ((double)(chars) * (size) * (size))
+
+static bench_case_t cases[] = {
+    { "clearScreen",              run_clear,         0,                       20 },
+    { "drawRect filled 1000x700", run_rectFilled,    1000.0 * 700,            50 },
+    { "drawRect outline",         run_rectOutline,   2 * (1000.0 + 700),      2000 },
+    { "drawRoundedRect r=8",      run_rounded8,      1000.0 * 700,            50 },
+    { "drawRoundedRect r=42",     run_rounded42,     1000.0 * 700,            50 },
+    { "drawRoundedRect r=200",    run_rounded200,    1000.0 * 700,            50 },
+    { "drawRoundedRect login box",run_loginBox,      501.0 * 81,              500 },
+    { "drawRoundedRectAA r=42",   run_roundedAA,     1000.0 * 700,            50 },
+    { "drawCircle filled r=300",  run_circle,        3.14159 * 300 * 300,     20 },
+    { "drawCircle outline r=300", run_circleOutline, 2 * 3.14159 * 300,       2000 },
+    { "drawLine 1000x500",        run_line,          1000,                    5000 },
+    { "drawPolyline 511 segs",    run_polyline,      0,                       500 },
+    { "drawCircle r=300 clip 200", run_circleClipped, 200.0 * 200,             2000 },
+    { "drawString",               run_string,        STR_PIXELS(54, 8),       2000 },
+    { "drawStringSized 16",       run_string16,      STR_PIXELS(25, 16),      1000 },
+    { "drawStringSized 32",       run_string32,      STR_PIXELS(19, 32),      500 },
+    { "drawStringSized 64",       run_string64,      STR_PIXELS(19, 64),      200 },
+};
+
+static unsigned int run_suite(unsigned char *buf, unsigned int pitch, const char *label)
+{
+    unsigned int total = 2166136261u;
+
+    printf("%s\n", label);
+    printf("  %-28s %10s %10s %10s\n", "case", "us/call", "ns/pixel", "checksum");
+
+    for (unsigned int c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        bench_case_t *bc = &cases[c];
+        double pixels = bc->pixels ? bc->pixels : (double)bench_w * bench_h;
+
+        memset(buf, 0, (size_t)pitch * bench_h);
+        bc->run(0); // warm-up, also what the checksum covers
+
+        unsigned int sum = checksum(buf, pitch);
+        total = (total ^ sum) * 16777619u;
+
+        double start = now_ns();
+        for (int i = 0; i < bc->reps; i++) bc->run(i);
+        double ns = (now_ns() - start) / bc->reps;
+
+        printf("  %-28s %10.2f %10.3f   %08x\n", bc->name, ns / 1000, ns / pixels, sum);
+        fb_present(); // drop the damage list
+    }
+
+    printf("  suite checksum %08x\n", total);
+    return total;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int pitch;
+
+    bench_w = argc > 1 ? atoi(argv[1]) : FB_DEFAULT_WIDTH;
+    bench_h = argc > 2 ? atoi(argv[2]) : FB_DEFAULT_HEIGHT;
+    bench_depth = argc > 4 ? atoi(argv[4]) : 32;
+    pitch = argc > 3 ? atoi(argv[3]) : bench_w * bench_depth / 8;
+
+    if ((bench_depth != 16 && bench_depth != 32) || pitch < bench_w * bench_depth / 8) {
+        fprintf(stderr, "fb_bench: depth must be 16 or 32 and pitch >= width*depth/8\n");
+        return 1;
+    }
+
+    unsigned char *buf = aligned_alloc(64, ((size_t)pitch * bench_h + 63) & ~(size_t)63);
+    if (!buf) return 1;
+
+    fb_initSurface(buf, bench_w, bench_h, pitch, bench_depth == 16 ? FB_FORMAT_RGB565 : FB_FORMAT_XRGB8888);
+    printf("fb_bench: %ux%u, pitch %u, %ubpp\n", bench_w, bench_h, pitch, bench_depth);
+
+    // a jagged chart line: 3 px steps in x, deterministic y
+    double chartPixels = 0;
+    for (int i = 0; i < 512; i++) {
+        chart[i].x = 20 + i * 3;
+        chart[i].y = 600 + (int)((i * 2654435761u) >> 24) % 64 - 32;
+        if (i) chartPixels += abs(chart[i].y - chart[i - 1].y) > 3 ? abs(chart[i].y - chart[i - 1].y) + 1 : 4;
+    }
+    for (unsigned int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (cases[i].run == run_polyline) cases[i].pixels = chartPixels;
+    }
+
+    fb_setAccel(FB_ACCEL_SCALAR);
+    unsigned int scalar = run_suite(buf, pitch, "scalar kernels");
+
+    if (fb_setAccel(FB_ACCEL_NEON) == FB_ACCEL_NEON) {
+        unsigned int neon = run_suite(buf, pitch, "neon kernels");
+        if (neon != scalar) {
+            printf("fb_bench: neon output differs from scalar\n");
+            return 1;
+        }
+    }
+
+    // every glyph expanded on the spot must look like the cached tile
+    fb_glyphCacheEnable(0);
+    unsigned int uncached = run_suite(buf, pitch, "glyph cache off");
+    fb_glyphCacheEnable(1);
+    if (uncached != scalar) {
+        printf("fb_bench: output without the glyph cache differs\n");
+        return 1;
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,49 @@
+// Stand-ins for the kernel services fb.c links against, so the graphics
+// library can run as a normal host program. fb_initMemory never touches
+// the mailbox or the MMU, these only satisfy the linker.
+
+volatile unsigned int __attribute__((aligned(64))) mbox[48];
+
+unsigned int mbox_call(unsigned char ch)
+{
+    (void)ch;
+    return 0;
+}
+
+void mmu_mapRegion(unsigned long base, unsigned long size, int type)
+{
+    (void)base;
+    (void)size;
+    (void)type;
+}
+
+// No DMA engine on the host, the async fb calls take their CPU path
+int dma_available(void)
+{
+    return 0;
+}
+
+int dma_done(unsigned int fence)
+{
+    (void)fence;
+    return 1;
+}
+
+void dma_wait(unsigned int fence)
+{
+    (void)fence;
+}
+
+unsigned int dma_fill2d(void *dst, unsigned int dstPitch, unsigned int bytesPerRow,
+                        unsigned int rows, unsigned int pattern)
+{
+    (void)dst; (void)dstPitch; (void)bytesPerRow; (void)rows; (void)pattern;
+    return 0;
+}
+
+unsigned int dma_copy2d(void *dst, unsigned int dstPitch, const void *src, unsigned int srcPitch,
+                        unsigned int bytesPerRow, unsigned int rows)
+{
+    (void)dst; (void)dstPitch; (void)src; (void)srcPitch; (void)bytesPerRow; (void)rows;
+    return 0;
+}
@@ -0,0 +1,176 @@
+// Desktop background image (see background.h)
+// src/gui/desktop/background/background.c
+
+#include "../../../include/fb.h"
+#include "../../../include/mem.h"
+#include "../../../include/fat.h"
+#include "../../../include/timer.h"
+#include "../../../include/log.h"
+#include "../../../include/background.h"
+
+#define BG_PATH_MAX  64
+#define BG_MAX_BANDS 16     // 4 MB each, 3840x2160 at 32 bpp
+
+// The scaled image in framebuffer format. The page allocator hands out at
+// most PAGE_MAX_ORDER blocks, so larger screens are split into bands of rows.
+static struct {
+    int loaded;
+    int cached;
+    char path[BG_PATH_MAX];
+    int w, h, format, bpp;
+    unsigned int pitch;
+    int bandRows;
+    int bands;
+    unsigned int order;
+    unsigned char *band[BG_MAX_BANDS];
+    fb_rect_t paint;        // uncached repaints: the part of each row to put on screen
+} bg;
+
+static long bg_fatRead(void *arg, void *buffer, unsigned long length)
+{
+    return fat_read(arg, buffer, length);
+}
+
+static void bg_toCache(void *arg, int y, const void *pixels)
+{
+    unsigned char *row = bg.band[y / bg.bandRows] + (y % bg.bandRows) * bg.pitch;
+    fb_copy32((unsigned int *)row, pixels, (bg.w * bg.bpp + 3) / 4);
+}
+
+static void bg_toScreen(void *arg, int y, const void *pixels)
+{
+    if (y < bg.paint.y1 || y > bg.paint.y2) return;
+
+    const unsigned char *p = (const unsigned char *)pixels + bg.paint.x1 * bg.bpp;
+    fb_fence_t fence = fb_blitAsync(bg.paint.x1, y, p, bg.pitch, bg.paint.x2 - bg.paint.x1 + 1, 1);
+    if (fence) fb_fenceWait(fence); // the decoder reuses its row buffer
+}
+
+static int bg_decodeFile(bg_row_fn row)
+{
+    fat_file_t file;
+
+    if (!fat_open(&file, bg.path)) return BG_ERR_NOFILE;
+    if (file.isDir) {
+        fat_close(&file);
+        return BG_ERR_NOFILE;
+    }
+
+    bg_source_t src = { bg_fatRead, &file };
+    int err = bg_decode(&src, bg.w, bg.h, row, 0);
+    fat_close(&file);
+    return err;
+}
+
+static int bg_allocBands(void)
+{
+    unsigned long bandBytes = PAGE_SIZE << PAGE_MAX_ORDER, total = (unsigned long)bg.pitch * bg.h;
+
+    bg.order = PAGE_MAX_ORDER;
+    bg.bandRows = bandBytes / bg.pitch;
+    bg.bands = (bg.h + bg.bandRows - 1) / bg.bandRows;
+    if (bg.bands > BG_MAX_BANDS) return 0;
+
+    // a small screen fits in one block of the size it needs
+    if (bg.bands == 1) {
+        while (bg.order && (PAGE_SIZE << (bg.order - 1)) >= total) bg.order--;
+    }
+
+    for (int i = 0; i < bg.bands; i++) {
+        bg.band[i] = page_alloc(bg.order);
+        if (!bg.band[i]) return 0;
+    }
+    return 1;
+}
+
+void background_free(void)
+{
+    for (int i = 0; i < BG_MAX_BANDS; i++) {
+        if (bg.band[i]) page_free(bg.band[i], bg.order);
+        bg.band[i] = 0;
+    }
+    bg.loaded = 0;
+    bg.cached = 0;
+}
+
+int background_loaded(void)
+{
+    return bg.loaded;
+}
+
+// Decodes path scaled to the screen: into the cache, or straight onto the screen
+int background_load(const char *path, int cache)
+{
+    int i;
+
+    background_free();
+
+    for (i = 0; path[i] && i < BG_PATH_MAX - 1; i++) bg.path[i] = path[i];
+    bg.path[i] = 0;
+    if (path[i]) return BG_ERR_UNSUPPORTED;
+
+    bg.w = fb_getWidth();
+    bg.h = fb_getHeight();
+    bg.format = fb_getFormat();
+    bg.bpp = (bg.format == FB_FORMAT_RGB565 || bg.format == FB_FORMAT_BGR565) ? 2 : 4;
+    bg.pitch = (bg.w * bg.bpp + 63) & ~63;
+
+    if (cache && !bg_allocBands()) {
+        LOG_WARN("Background: No memory for a %dx%d cache, decoding on every repaint", bg.w, bg.h);
+        background_free();
+        cache = 0;
+    }
+    bg.cached = cache;
+
+    bg.paint.x1 = 0;
+    bg.paint.y1 = 0;
+    bg.paint.x2 = bg.w - 1;
+    bg.paint.y2 = bg.h - 1;
+
+    unsigned long start = timer_now_us();
+    int err = bg_decodeFile(cache ? bg_toCache : bg_toScreen);
+    if (err) {
+        if (err != BG_ERR_NOFILE) LOG_WARN("Background: %s: error %d", bg.path, err);
+        background_free();
+        return err;
+    }
+
+    LOG_INFO("Background: %s decoded in %lu ms%s", bg.path, (timer_now_us() - start) / 1000,
+             cache ? ", cached" : "");
+    bg.loaded = 1;
+    return BG_OK;
+}
+
+// Puts the background under x1,y1 - x2,y2; 0 if there is none to put
+int background_paint(int x1, int y1, int x2, int y2)
+{
+    if (!bg.loaded) return 0;
+    if (bg.w != (int)fb_getWidth() || bg.h != (int)fb_getHeight() || bg.format != fb_getFormat()) {
+        return 0; // the mode changed under us
+    }
+
+    if (x1 < 0) x1 = 0;
+    if (y1 < 0) y1 = 0;
+    if (x2 >= bg.w) x2 = bg.w - 1;
+    if (y2 >= bg.h) y2 = bg.h - 1;
+    if (x1 > x2 || y1 > y2) return 1;
+
+    if (!bg.cached) {
+        bg.paint.x1 = x1;
+        bg.paint.y1 = y1;
+        bg.paint.x2 = x2;
+        bg.paint.y2 = y2;
+        return bg_decodeFile(bg_toScreen) == BG_OK;
+    }
+
+    // one DMA copy per band the area touches
+    for (int i = 0; i < bg.bands; i++) {
+        int top = i * bg.bandRows, bottom = top + bg.bandRows - 1;
+        int from = y1 > top ? y1 : top, to = y2 < bottom ? y2 : bottom;
+        if (from > to) continue;
+
+        const unsigned char *src = bg.band[i] + (from - top) * bg.pitch + x1 * bg.bpp;
+        fb_blitAsync(x1, from, src, bg.pitch, x2 - x1 + 1, to - from + 1);
+    }
+    return 1;
+}
@@ -0,0 +1,401 @@
+// Streaming BMP and PNG decoder (see background.h)
+// src/gui/desktop/background/decode.c
+
+#include "../../../include/fb.h"
+#include "../../../include/inflate.h"
+#include "../../../include/background.h"
+
+#define BG_INPUT_SIZE 16384
+#define BG_ROW_MAX    (BG_MAX_WIDTH * 8)    // 16 bit RGBA
+
+typedef struct {
+    int srcW, srcH, dstW, dstH;
+    unsigned int stepX;         // source pixels per destination pixel, 16.16
+    int wide;                   // 32 bpp destination
+    int redShift, blueShift;    // where red and blue go in a destination pixel
+
+    int bytes;                  // per source pixel, 0 for indexed
+    int r, g, b;                // byte offsets within a source pixel
+    int bits;                   // indexed: bits per pixel, most significant first
+    unsigned int palette[256];  // indexed: destination pixel values
+
+    bg_row_fn row;
+    void *arg;
+} bg_job_t;
+
+static struct {
+    const bg_source_t *src;
+    unsigned long pos, length;
+    unsigned long consumed;     // bytes handed out since the start of the file
+    int error;
+    unsigned char data[BG_INPUT_SIZE];
+} bg_in;
+
+static bg_job_t bg_job;
+static unsigned char bg_rows[2][BG_ROW_MAX + 1];   // PNG: current and previous row, with the filter byte
+static unsigned int bg_out[BG_MAX_WIDTH];
+static unsigned long bg_idatLeft;
+static inflate_t bg_z;
+
+static unsigned int bg_le16(const unsigned char *p) { return p[0] | (p[1] << 8); }
+static unsigned int bg_le32(const unsigned char *p) { return bg_le16(p) | (bg_le16(p + 2) << 16); }
+static unsigned int bg_be32(const unsigned char *p)
+{
+    return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static int bg_refill(void)
+{
+    if (bg_in.pos < bg_in.length) return 1;
+
+    long n = bg_in.src->read(bg_in.src->arg, bg_in.data, BG_INPUT_SIZE);
+    if (n < 0) bg_in.error = 1;
+    if (n <= 0) return 0;
+
+    bg_in.pos = 0;
+    bg_in.length = n;
+    return 1;
+}
+
+static unsigned long bg_read(void *buffer, unsigned long length)
+{
+    unsigned char *dst = buffer;
+    unsigned long done = 0;
+
+    while (done < length && bg_refill()) {
+        unsigned long n = bg_in.length - bg_in.pos;
+        if (n > length - done) n = length - done;
+
+        const unsigned char *s = bg_in.data + bg_in.pos;
+        for (unsigned long i = 0; i < n; i++) dst[done + i] = s[i];
+        bg_in.pos += n;
+        done += n;
+    }
+    bg_in.consumed += done;
+    return done;
+}
+
+static int bg_skip(unsigned long length)
+{
+    while (length && bg_refill()) {
+        unsigned long n = bg_in.length - bg_in.pos;
+        if (n > length) n = length;
+        bg_in.pos += n;
+        bg_in.consumed += n;
+        length -= n;
+    }
+    return !length;
+}
+
+static int bg_begin(bg_job_t *j, int srcW, int srcH)
+{
+    if (srcW <= 0 || srcH <= 0) return BG_ERR_FORMAT;
+    if (srcW > BG_MAX_WIDTH) return BG_ERR_UNSUPPORTED;
+
+    j->srcW = srcW;
+    j->srcH = srcH;
+    if (!j->dstW || !j->dstH) {
+        j->dstW = srcW;
+        j->dstH = srcH;
+    }
+    if (j->dstW > BG_MAX_WIDTH) return BG_ERR_UNSUPPORTED;
+
+    j->stepX = ((unsigned long)srcW << 16) / j->dstW;
+    return BG_OK;
+}
+
+// Scales one source row across and converts it into bg_out
+static void bg_convert(const bg_job_t *j, const unsigned char *src)
+{
+    unsigned short *out16 = (unsigned short *)bg_out;
+    unsigned int fx = 0, rs = j->redShift, bs = j->blueShift;
+
+    if (!j->bytes) {
+        unsigned int mask = (1U << j->bits) - 1;
+
+        for (int dx = 0; dx < j->dstW; dx++, fx += j->stepX) {
+            unsigned int bit = (fx >> 16) * j->bits;
+            unsigned int pixel = j->palette[(src[bit >> 3] >> (8 - j->bits - (bit & 7))) & mask];
+
+            if (j->wide) bg_out[dx] = pixel;
+            else out16[dx] = pixel;
+        }
+    } else if (j->wide) {
+        for (int dx = 0; dx < j->dstW; dx++, fx += j->stepX) {
+            const unsigned char *p = src + (fx >> 16) * j->bytes;
+            bg_out[dx] = (p[j->r] << rs) | (p[j->g] << 8) | (p[j->b] << bs);
+        }
+    } else {
+        for (int dx = 0; dx < j->dstW; dx++, fx += j->stepX) {
+            const unsigned char *p = src + (fx >> 16) * j->bytes;
+            out16[dx] = ((p[j->r] >> 3) << rs) | ((p[j->g] >> 2) << 5) | ((p[j->b] >> 3) << bs);
+        }
+    }
+}
+
+// Hands source row sy to every destination row that samples it, if any
+static void bg_emit(bg_job_t *j, int sy, const unsigned char *src)
+{
+    unsigned long dy = ((unsigned long)sy * j->dstH + j->srcH - 1) / j->srcH;
+    unsigned long end = ((unsigned long)(sy + 1) * j->dstH + j->srcH - 1) / j->srcH;
+
+    if (dy >= end) return; // dropped by downscaling
+
+    bg_convert(j, src);
+    for (; dy < end; dy++) j->row(j->arg, dy, bg_out);
+}
+
+static int bg_bmp(bg_job_t *j)
+{
+    unsigned char h[56];
+
+    // rest of the file header, then the info header (BITMAPINFOHEADER or later)
+    if (bg_read(h, 12) != 12) return BG_ERR_FORMAT;
+    unsigned long offset = bg_le32(h + 8);
+
+    if (bg_read(h, 4) != 4) return BG_ERR_FORMAT;
+    unsigned int infoSize = bg_le32(h);
+    if (infoSize < 40) return BG_ERR_UNSUPPORTED; // OS/2 core header
+    unsigned int got = infoSize < sizeof(h) ? infoSize : sizeof(h);
+    if (bg_read(h + 4, got - 4) != got - 4 || !bg_skip(infoSize - got)) return BG_ERR_FORMAT;
+
+    int w = (int)bg_le32(h + 4), height = (int)bg_le32(h + 8);
+    unsigned int bpp = bg_le16(h + 14), compression = bg_le32(h + 16), colors = bg_le32(h + 32);
+
+    // BI_BITFIELDS follow a plain info header, later headers include them
+    if (compression == 3) {
+        if (infoSize < 52 && bg_read(h + 40, 12) != 12) return BG_ERR_FORMAT;
+        if (bpp != 32 || bg_le32(h + 40) != 0xFF0000 || bg_le32(h + 44) != 0xFF00 || bg_le32(h + 48) != 0xFF) {
+            return BG_ERR_UNSUPPORTED;
+        }
+    } else if (compression != 0) {
+        return BG_ERR_UNSUPPORTED; // RLE, JPEG, PNG inside BMP
+    }
+
+    int topDown = height < 0;
+    int err = bg_begin(j, w, topDown ? -height : height);
+    if (err) return err;
+
+    if (bpp == 24 || bpp == 32) {
+        j->bytes = bpp / 8;
+        j->r = 2;
+        j->g = 1;
+        j->b = 0;
+    } else if (bpp == 1 || bpp == 4 || bpp == 8) {
+        j->bytes = 0;
+        j->bits = bpp;
+        if (!colors || colors > 256) colors = 1U << bpp;
+        for (unsigned int i = 0; i < 256; i++) j->palette[i] = 0;
+        for (unsigned int i = 0; i < colors; i++) {
+            unsigned char q[4];
+            if (bg_read(q, 4) != 4) return BG_ERR_FORMAT;
+            j->palette[i] = fb_color((q[2] << 16) | (q[1] << 8) | q[0]);
+        }
+    } else {
+        return BG_ERR_UNSUPPORTED;
+    }
+
+    if (offset < bg_in.consumed || !bg_skip(offset - bg_in.consumed)) return BG_ERR_FORMAT;
+
+    unsigned long stride = (((unsigned long)j->srcW * bpp + 31) / 32) * 4;
+    for (int row = 0; row < j->srcH; row++) {
+        if (bg_read(bg_rows[0], stride) != stride) return BG_ERR_FORMAT;
+        bg_emit(j, topDown ? row : j->srcH - 1 - row, bg_rows[0]);
+    }
+    return BG_OK;
+}
+
+// Compressed bytes for inflate: IDAT payloads back to back, straight out of bg_in
+static const unsigned char *bg_pngFill(void *arg, unsigned long *length)
+{
+    unsigned char h[12];
+
+    while (!bg_idatLeft) {
+        // CRC of the chunk just finished, then the next header
+        if (bg_read(h, 12) != 12 || bg_be32(h + 8) != 0x49444154) return 0; // "IDAT"
+        bg_idatLeft = bg_be32(h + 4);
+    }
+    if (!bg_refill()) return 0;
+
+    unsigned long n = bg_in.length - bg_in.pos;
+    if (n > bg_idatLeft) n = bg_idatLeft;
+
+    const unsigned char *p = bg_in.data + bg_in.pos;
+    bg_in.pos += n;
+    bg_in.consumed += n;
+    bg_idatLeft -= n;
+    *length = n;
+    return p;
+}
+
+static int bg_abs(int v) { return v < 0 ? -v : v; }
+
+static int bg_unfilter(unsigned char *r, const unsigned char *prev, unsigned long n, int bpp, int filter)
+{
+    unsigned long i;
+
+    switch (filter) {
+    case 0:
+        break;
+    case 1: // sub
+        for (i = bpp; i < n; i++) r[i] += r[i - bpp];
+        break;
+    case 2: // up
+        for (i = 0; i < n; i++) r[i] += prev[i];
+        break;
+    case 3: // average
+        for (i = 0; i < (unsigned long)bpp; i++) r[i] += prev[i] >> 1;
+        for (; i < n; i++) r[i] += (r[i - bpp] + prev[i]) >> 1;
+        break;
+    case 4: // paeth
+        for (i = 0; i < (unsigned long)bpp; i++) r[i] += prev[i];
+        for (; i < n; i++) {
+            int a = r[i - bpp], b = prev[i], c = prev[i - bpp];
+            int pa = bg_abs(b - c), pb = bg_abs(a - c), pc = bg_abs(a + b - 2 * c);
+            r[i] += (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+        }
+        break;
+    default:
+        return 0;
+    }
+    return 1;
+}
+
+// Source layout for a PNG colour type and depth, 0 if the combination is invalid
+static int bg_pngLayout(bg_job_t *j, int type, int depth, int paletteSize)
+{
+    int step = depth / 8;
+
+    j->r = j->g = j->b = 0;
+    if ((type == 0 || type == 3) && depth < 8) {
+        if (depth != 1 && depth != 2 && depth != 4) return 0;
+    } else if (depth != 8 && (depth != 16 || type == 3)) {
+        return 0;
+    }
+
+    switch (type) {
+    case 0: // gray, low depths as a gray palette
+        if (depth < 8) {
+            j->bytes = 0;
+            j->bits = depth;
+            for (int i = 0; i < (1 << depth); i++) j->palette[i] = fb_color((i * 255 / ((1 << depth) - 1)) * 0x010101);
+        } else {
+            j->bytes = step;
+        }
+        return 1;
+    case 2: // rgb
+    case 6: // rgba
+        j->bytes = step * (type == 2 ? 3 : 4);
+        j->g = step;
+        j->b = step * 2;
+        return 1;
+    case 3:
+        j->bytes = 0;
+        j->bits = depth;
+        return paletteSize > 0;
+    case 4: // gray and alpha
+        j->bytes = step * 2;
+        return 1;
+    }
+    return 0;
+}
+
+static int bg_png(bg_job_t *j)
+{
+    unsigned char h[13];
+    int w = 0, height = 0, depth = 0, type = -1, paletteSize = 0;
+
+    for (;;) {
+        if (bg_read(h, 8) != 8) return BG_ERR_FORMAT;
+        unsigned long length = bg_be32(h), id = bg_be32(h + 4);
+
+        if (id == 0x49484452) { // IHDR
+            if (length != 13 || bg_read(h, 13) != 13) return BG_ERR_FORMAT;
+            w = bg_be32(h);
+            height = bg_be32(h + 4);
+            depth = h[8];
+            type = h[9];
+            if (h[10] || h[11]) return BG_ERR_FORMAT;
+            if (h[12]) return BG_ERR_UNSUPPORTED;   // Adam7 needs the whole image
+            length = 0;
+        } else if (id == 0x504C5445) { // PLTE
+            if (length % 3 || length > 768) return BG_ERR_FORMAT;
+            paletteSize = length / 3;
+            for (int i = 0; i < 256; i++) j->palette[i] = 0;
+            for (int i = 0; i < paletteSize; i++) {
+                if (bg_read(h, 3) != 3) return BG_ERR_FORMAT;
+                j->palette[i] = fb_color((h[0] << 16) | (h[1] << 8) | h[2]);
+            }
+            length = 0;
+        } else if (id == 0x49444154) { // IDAT
+            bg_idatLeft = length;
+            break;
+        } else if (id == 0x49454E44) { // IEND
+            return BG_ERR_FORMAT;
+        }
+
+        if (!bg_skip(length + 4)) return BG_ERR_FORMAT; // unread payload and the CRC
+    }
+
+    if (type < 0) return BG_ERR_FORMAT;
+    if (!bg_pngLayout(j, type, depth, paletteSize)) return BG_ERR_FORMAT;
+    int err = bg_begin(j, w, height);
+    if (err) return err;
+
+    static const unsigned char channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+    int bitsPerPixel = channels[type] * depth;
+    int filterBpp = bitsPerPixel < 8 ? 1 : bitsPerPixel / 8;
+    unsigned long stride = ((unsigned long)w * bitsPerPixel + 7) / 8;
+
+    unsigned char *prev = bg_rows[0], *cur = bg_rows[1];
+    for (unsigned long i = 0; i <= stride; i++) prev[i] = 0;
+
+    inflate_init(&bg_z, bg_pngFill, 0, 1);
+
+    for (int y = 0; y < height; y++) {
+        if (inflate_read(&bg_z, cur, stride + 1) != (long)stride + 1) return BG_ERR_FORMAT;
+        if (!bg_unfilter(cur + 1, prev + 1, stride, filterBpp, cur[0])) return BG_ERR_FORMAT;
+
+        bg_emit(j, y, cur + 1);
+
+        unsigned char *t = prev;
+        prev = cur;
+        cur = t;
+    }
+    return BG_OK;
+}
+
+int bg_decode(const bg_source_t *src, int w, int h, bg_row_fn row, void *arg)
+{
+    bg_job_t *j = &bg_job;
+    unsigned char sig[8];
+    int format = fb_getFormat(), err;
+
+    bg_in.src = src;
+    bg_in.pos = bg_in.length = 0;
+    bg_in.consumed = 0;
+    bg_in.error = 0;
+
+    j->dstW = w;
+    j->dstH = h;
+    j->row = row;
+    j->arg = arg;
+    j->wide = format == FB_FORMAT_XRGB8888 || format == FB_FORMAT_XBGR8888;
+    if (j->wide) j->redShift = format == FB_FORMAT_XRGB8888 ? 16 : 0;
+    else j->redShift = format == FB_FORMAT_RGB565 ? 11 : 0;
+    j->blueShift = (j->wide ? 16 : 11) - j->redShift;
+
+    if (bg_read(sig, 2) != 2) {
+        err = BG_ERR_FORMAT;
+    } else if (sig[0] == 'B' && sig[1] == 'M') {
+        err = bg_bmp(j);
+    } else if (sig[0] == 0x89 && sig[1] == 'P' && bg_read(sig + 2, 6) == 6 &&
+               bg_be32(sig) == 0x89504E47 && bg_be32(sig + 4) == 0x0D0A1A0A) {
+        err = bg_png(j);
+    } else {
+        err = BG_ERR_FORMAT;
+    }
+
+    if (err && bg_in.error) err = BG_ERR_IO;
+    return err;
+}
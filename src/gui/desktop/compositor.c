@@ -0,0 +1,80 @@
+#include "../../include/fb.h"
+#include "../../include/compositor.h"
+
+// Layers are kept in z order, index 0 is the bottom (the desktop background)
+static comp_layer_t layers[COMPOSITOR_MAX_LAYERS];
+static int layer_count = 0;
+
+// Areas that need repainting before the next frame
+static fb_damage_t pending;
+
+void compositor_init(void) {
+    layer_count = 0;
+    fb_damageClear(&pending);
+}
+
+comp_layer_t* compositor_addLayer(int x1, int y1, int x2, int y2,
+                                  void (*paint)(comp_layer_t *layer, const fb_rect_t *damage),
+                                  void *data) {
+    if (layer_count >= COMPOSITOR_MAX_LAYERS) return (comp_layer_t*)0;
+
+    comp_layer_t *layer = &layers[layer_count++];
+    layer->rect.x1 = x1;
+    layer->rect.y1 = y1;
+    layer->rect.x2 = x2;
+    layer->rect.y2 = y2;
+    layer->visible = 1;
+    layer->paint = paint;
+    layer->data = data;
+
+    compositor_invalidateLayer(layer);
+    return layer;
+}
+
+void compositor_invalidate(int x1, int y1, int x2, int y2) {
+    fb_damageAdd(&pending, x1, y1, x2, y2);
+}
+
+void compositor_invalidateLayer(comp_layer_t *layer) {
+    compositor_invalidate(layer->rect.x1, layer->rect.y1, layer->rect.x2, layer->rect.y2);
+}
+
+void compositor_moveLayer(comp_layer_t *layer, int x, int y) {
+    int w = layer->rect.x2 - layer->rect.x1;
+    int h = layer->rect.y2 - layer->rect.y1;
+
+    compositor_invalidateLayer(layer); // uncover the old position
+    layer->rect.x1 = x;
+    layer->rect.y1 = y;
+    layer->rect.x2 = x + w;
+    layer->rect.y2 = y + h;
+    compositor_invalidateLayer(layer);
+}
+
+void compositor_setVisible(comp_layer_t *layer, int visible) {
+    if (layer->visible == visible) return;
+
+    layer->visible = visible;
+    compositor_invalidateLayer(layer);
+}
+
+void compositor_frame(void) {
+    if (pending.count == 0) return;
+
+    for (int i = 0; i < pending.count; i++) {
+        for (int l = 0; l < layer_count; l++) {
+            fb_rect_t clip;
+
+            if (!layers[l].visible) continue;
+            if (!fb_rectIntersect(&clip, &pending.rects[i], &layers[l].rect)) continue;
+
+            // the layer may draw past the damage, the clip keeps it inside
+            fb_pushClip(clip.x1, clip.y1, clip.x2 - clip.x1 + 1, clip.y2 - clip.y1 + 1);
+            layers[l].paint(&layers[l], &clip);
+            fb_popClip();
+        }
+    }
+
+    fb_damageClear(&pending);
+    fb_present(); // only the painted areas are synced to the other page
+}
@@ -1,17 +1,168 @@
 #include "../../include/io.h"
 #include "../../include/fb.h"
 #include "../../include/desktop.h"
+#include "../../include/compositor.h"
+#include "../../include/timer.h"
+#include "../../include/input.h"
+#include "../../include/usb.h"
+#include "../../include/background.h"
+
+#define DESKTOP_TEXT_MAX 23     // characters that fit on the message box's input line
+#define DESKTOP_BATCH    32
+
+static char typed[DESKTOP_TEXT_MAX + 1];
+static int typedLength = 0;
+
+// mouse pointer: X outline, . fill, anything else transparent
+static const char *pointerShape[] = {
+    "X",
+    "XX",
+    "X.X",
+    "X..X",
+    "X...X",
+    "X....X",
+    "X.....X",
+    "X......X",
+    "X.......X",
+    "X........X",
+    "X.........X",
+    "X......XXXXX",
+    "X...X..X",
+    "X..XX..X",
+    "X.X  X..X",
+    "XX   X..X",
+    "X     X..X",
+    "      X..X",
+    "       XX",
+};
+
+static void setupPointer(void) {
+    static unsigned int image[FB_CURSOR_SIZE * FB_CURSOR_SIZE]; // zeroed: transparent
+    int x, y;
+
+    for (y = 0; y < (int)(sizeof(pointerShape) / sizeof(pointerShape[0])); y++) {
+        for (x = 0; pointerShape[y][x]; x++) {
+            if (pointerShape[y][x] == 'X') image[y * FB_CURSOR_SIZE + x] = 0xFF000000;
+            else if (pointerShape[y][x] == '.') image[y * FB_CURSOR_SIZE + x] = 0xFFFFFFFF;
+        }
+    }
+
+    fb_cursorSetImage(image, 0, 0);
+    fb_cursorMove(fb_getWidth() / 2, fb_getHeight() / 2);
+}
+
+// first one found on the SD card, kept scaled so repaints are a copy
+static const char *backgroundFiles[] = { "/background.png", "/background.bmp" };
+
+static void loadBackground(void) {
+    for (int i = 0; i < (int)(sizeof(backgroundFiles) / sizeof(backgroundFiles[0])); i++) {
+        if (background_load(backgroundFiles[i], 1) == BG_OK) return;
+    }
+}
+
+static void paintBackground(comp_layer_t *layer, const fb_rect_t *damage) {
+    if (!background_paint(damage->x1, damage->y1, damage->x2, damage->y2)) {
+        fb_fillRectAsync(damage->x1, damage->y1, damage->x2 - damage->x1 + 1, damage->y2 - damage->y1 + 1, 0);
+    }
+
+    // the title is part of the background
+    fb_rect_t title = { 90, 50, 90 + 11*16 - 1, 50 + 16 - 1 }, hit;
+    if (fb_rectIntersect(&hit, damage, &title)) {
+        drawStringSized(90, 50, "emexOS rpi4", 0x0f, 16);
+    }
+}
+
+static void paintMessageBox(comp_layer_t *layer, const fb_rect_t *damage) {
+    fb_rect_t *r = &layer->rect, hit;
+    fb_rect_t line1 = { r->x1 + 20, r->y1 + 10, r->x1 + 20 + 21*8 - 1, r->y1 + 17 };
+    fb_rect_t line2 = { r->x1 + 20, r->y1 + 20, r->x1 + 20 + 23*8 - 1, r->y1 + 27 };
+
+    // border and fill are both colour 0xc, so the damaged part is one solid rect
+    drawRect(damage->x1, damage->y1, damage->x2, damage->y2, 0xcc, 1);
+
+    if (fb_rectIntersect(&hit, damage, &line1))
+        drawString(line1.x1, line1.y1, "This is a message box", 0xcf);
+    if (fb_rectIntersect(&hit, damage, &line2))
+        drawString(line2.x1, line2.y1, "for testing graphics...", 0xcf);
+
+    fb_rect_t line3 = { r->x1 + 20, r->y1 + 35, r->x1 + 20 + typedLength*8 - 1, r->y1 + 42 };
+    if (typedLength && fb_rectIntersect(&hit, damage, &line3))
+        drawString(line3.x1, line3.y1, typed, 0xcf);
+}
+
+static void paintCursor(comp_layer_t *layer, const fb_rect_t *damage) {
+    fb_fillRect(damage->x1, damage->y1, damage->x2 - damage->x1 + 1, damage->y2 - damage->y1 + 1, 0xFFFFFF);
+}
+
+static void blinkCursor(void *arg) {
+    comp_layer_t *cursor = (comp_layer_t*)arg;
+
+    // only the 8x2 cursor area is repainted and synced, not the screen
+    compositor_setVisible(cursor, !cursor->visible);
+}
+
+// Typed text goes onto the message box's third line, the text cursor follows it;
+// mouse motion moves the pointer
+static void handleInput(comp_layer_t *box, comp_layer_t *cursor) {
+    input_event_t events[DESKTOP_BATCH];
+    int n, oldLength = typedLength, px, py;
+
+    fb_cursorGetPos(&px, &py);
+
+    while ((n = input_read(events, DESKTOP_BATCH)) > 0) {
+        for (int i = 0; i < n; i++) {
+            char c = events[i].ascii;
+
+            if (events[i].type == INPUT_MOTION) {
+                px += events[i].dx;
+                py += events[i].dy;
+                continue;
+            }
+
+            if (events[i].type != INPUT_KEY || !events[i].value || !c) continue;
+
+            if (c == '\b') { if (typedLength) typedLength--; }
+            else if (c >= ' ' && typedLength < DESKTOP_TEXT_MAX) typed[typedLength++] = c;
+        }
+    }
+
+    // the pointer is an overlay: moving it redraws nothing underneath
+    if (px < 0) px = 0;
+    if (py < 0) py = 0;
+    if (px >= (int)fb_getWidth()) px = fb_getWidth() - 1;
+    if (py >= (int)fb_getHeight()) py = fb_getHeight() - 1;
+    fb_cursorMove(px, py);
+    fb_cursorShow(input_mouseCount() > 0);
+
+    if (typedLength == oldLength) return;
+    typed[typedLength] = 0;
+
+    // only the changed part of the line is repainted
+    int from = oldLength < typedLength ? oldLength : typedLength;
+    int to = oldLength > typedLength ? oldLength : typedLength;
+    compositor_invalidate(box->rect.x1 + 20 + from*8, box->rect.y1 + 35, box->rect.x1 + 20 + to*8 - 1, box->rect.y1 + 42);
+    compositor_moveLayer(cursor, box->rect.x1 + 20 + typedLength*8, box->rect.y1 + 43);
+}
 
 void desktop() {
-    clearScreen(0x00);
+    loadBackground();
+    compositor_init();
+
+    compositor_addLayer(0, 0, fb_getWidth() - 1, fb_getHeight() - 1, paintBackground, 0);
+    comp_layer_t *box = compositor_addLayer(90, 90, 320, 150, paintMessageBox, 0);
+
+    // blinking cursor behind the second line of the message box
+    comp_layer_t *cursor = compositor_addLayer(110 + 23*8, 118, 110 + 23*8 + 7, 119, paintCursor, 0);
 
-    drawStringSized(90, 50, "emexOS rpi4", 0x0f, 16);
+    setupPointer();
+    compositor_frame();
 
-    drawRect(90,90,320,150,0xcc,1);
-    drawString(110,100,"This is a message box",0xcf);
-    drawString(110,110,"for testing graphics...",0xcf);
+    timer_add(500000, 500000, blinkCursor, cursor);
 
     while (1) {
-        for (volatile int i = 0; i < 10000; i++);
+        timer_idle(); // returns early when input arrives
+        usb_update();
+        handleInput(box, cursor);
+        compositor_frame();
     }
 }
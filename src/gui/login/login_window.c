@@ -1,9 +1,31 @@
 #include "../../include/io.h"
 #include "../../include/fb.h"
 #include "../../include/login_window.h"
+#include "../../include/input.h"
+#include "../../include/timer.h"
+#include "../../include/usb.h"
+
+#define LOGIN_PASSWORD_MAX 32
+#define LOGIN_FIELD_CHARS  12   // stars that fit into the input box
+#define LOGIN_BATCH        16   // events taken from the queue per pass
+
+// inside the rounded input box, so redrawing it never touches the border
+static void drawPasswordField(int length) {
+    char stars[LOGIN_FIELD_CHARS + 1];
+    int shown = length < LOGIN_FIELD_CHARS ? length : LOGIN_FIELD_CHARS;
+
+    for (int i = 0; i < shown; i++) stars[i] = '*';
+    stars[shown] = 0;
+
+    drawRect(760, 824, 1160, 856, 0x77, 1);
+    drawStringSized(760, 824, stars, 0x7f, 32);
+}
 
 void login() {
-    drawRect(0, 0, 1920, 1080, 0x88, 1); // gray
+    input_event_t events[LOGIN_BATCH];
+    int length = 0, done = 0;
+
+    clearScreenAsync(0x08); // gray, drawn by DMA; the text below waits only where it overlaps
 
     // Title
     drawStringSized(400, 300, "emexOS login screen", 0x8b, 64);
@@ -11,5 +33,36 @@ void login() {
     // Login Password Input Box
     drawRoundedRect(710, 800, 1210, 880, 42, 0x77, 1, 0x77, 3);
 
-    // input box logic will be here
+    fb_present();
+
+    if (!input_keyboardCount()) {
+        sleep_ms(4000); // nothing to type with (QEMU has no USB), just show the screen
+        return;
+    }
+
+    // there are no accounts yet: any password is accepted, so only its length is kept
+    while (!done) {
+        usb_update();
+
+        int n = input_read(events, LOGIN_BATCH);
+        int oldLength = length;
+
+        for (int i = 0; i < n && !done; i++) {
+            char c = events[i].ascii;
+
+            if (events[i].type != INPUT_KEY || !events[i].value || !c) continue;
+
+            if (c == '\n') done = 1;
+            else if (c == '\b') { if (length) length--; }
+            else if (c >= ' ' && length < LOGIN_PASSWORD_MAX) length++;
+        }
+
+        // one redraw for the whole batch
+        if (length != oldLength) {
+            drawPasswordField(length);
+            fb_present();
+        }
+
+        if (!n) timer_idle(); // the HID driver wakes us
+    }
 }
@@ -0,0 +1,47 @@
+#ifndef BACKGROUND_H
+#define BACKGROUND_H
+
+// Desktop background images
+//
+// bg_decode streams a BMP or PNG file: input is pulled through a small
+// buffer and the image is decoded one row at a time, scaled (nearest
+// neighbour) and converted to the framebuffer format on the way out, so
+// the whole image never sits in memory. BMP: 1, 4, 8, 24 and 32 bit
+// uncompressed. PNG: every colour type and depth, but not interlaced, and
+// chunk CRCs are not checked. Alpha is ignored.
+//
+// background_load puts a file from the SD card behind the desktop. With
+// caching on, the scaled image is kept in framebuffer format and repaints
+// are a DMA copy out of it; without, it is decoded straight onto the screen
+// and every repaint decodes the file again.
+
+#define BG_MAX_WIDTH 4096       // source and destination
+
+enum {
+    BG_OK          = 0,
+    BG_ERR_IO      = -1,
+    BG_ERR_FORMAT  = -2,        // not a BMP or PNG, or a corrupt one
+    BG_ERR_UNSUPPORTED = -3,
+    BG_ERR_NOFILE  = -4
+};
+
+typedef struct {
+    long (*read)(void *arg, void *buffer, unsigned long length); // 0 at the end, -1 on error
+    void *arg;
+} bg_source_t;
+
+// Called for every destination row in decode order (bottom-up BMPs come
+// last row first); pixels holds w pixels in the framebuffer format and is
+// only valid during the call.
+typedef void (*bg_row_fn)(void *arg, int y, const void *pixels);
+
+// Decodes to w x h, or the image's own size if either is 0. Not reentrant,
+// the decoder's buffers are static.
+int bg_decode(const bg_source_t *src, int w, int h, bg_row_fn row, void *arg);
+
+int background_load(const char *path, int cache);   // BG_OK or an error
+int background_paint(int x1, int y1, int x2, int y2);  // 0 if nothing is loaded
+int background_loaded(void);
+void background_free(void);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+// LRU cache of SD card sectors
+//
+// Sectors are cached in groups of BCACHE_SECTORS (4 KB), one emmc request
+// per group. When groups are touched in ascending order the next
+// BCACHE_READAHEAD groups are queued on the card in the background, so a
+// sequential reader finds its data already loaded. Read-only: nothing is
+// ever written back.
+
+#define BCACHE_SECTORS   8       // per group
+#define BCACHE_GROUPS    256     // 1 MB of cache
+#define BCACHE_READAHEAD 16      // groups (64 KB) queued ahead of a sequential reader
+#define BCACHE_BUCKETS   64
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long readahead;     // groups queued ahead of time
+    unsigned long evictions;
+} bcache_stats_t;
+
+int bcache_init(void);
+// The sector's 512 bytes, 0 on a read error. Valid until the next bcache call.
+const unsigned char *bcache_read(unsigned long lba);
+void bcache_getStats(bcache_stats_t *stats);
+
+#endif
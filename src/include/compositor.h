@@ -0,0 +1,29 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include "fb.h"
+
+#define COMPOSITOR_MAX_LAYERS 16
+
+// A layer is a rectangle on screen with a paint callback. The compositor calls
+// paint once for every damaged rectangle the layer overlaps (bottom to top),
+// passing that rectangle so the layer can limit itself to it. Drawing is
+// clipped to the rectangle while paint runs.
+typedef struct comp_layer {
+    fb_rect_t rect;
+    int visible;
+    void (*paint)(struct comp_layer *layer, const fb_rect_t *damage);
+    void *data;
+} comp_layer_t;
+
+void compositor_init(void);
+comp_layer_t* compositor_addLayer(int x1, int y1, int x2, int y2,
+                                  void (*paint)(comp_layer_t *layer, const fb_rect_t *damage),
+                                  void *data);
+void compositor_invalidate(int x1, int y1, int x2, int y2);
+void compositor_invalidateLayer(comp_layer_t *layer);
+void compositor_moveLayer(comp_layer_t *layer, int x, int y);
+void compositor_setVisible(comp_layer_t *layer, int visible);
+void compositor_frame(void); // repaint the damaged areas and present them
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef DMA_H
+#define DMA_H
+
+// BCM2711 DMA engine, one full (2D capable) channel used for framebuffer
+// fills and copies. Operations are queued as control blocks; those submitted
+// while the engine is busy are chained and started together when it goes
+// idle. Every operation returns a fence, a sequence number that completes
+// in submission order (0 means "nothing to wait for").
+//
+// Destinations must not be cached (the framebuffer is mapped non-cacheable);
+// sources are cleaned to memory by the driver before the engine reads them.
+
+#define DMA_CHANNEL 5
+#define DMA_MAX_CBS 64
+
+void dma_init(void);
+int dma_available(void);            // 0 until dma_init, callers fall back to the CPU
+void dma_enableInterrupts(void);    // complete fences from the IRQ instead of dma_poll
+
+// 2D operations: rows * bytesPerRow, rows are pitch bytes apart
+unsigned int dma_fill2d(void *dst, unsigned int dstPitch, unsigned int bytesPerRow,
+                        unsigned int rows, unsigned int pattern);
+unsigned int dma_copy2d(void *dst, unsigned int dstPitch, const void *src, unsigned int srcPitch,
+                        unsigned int bytesPerRow, unsigned int rows);
+
+int dma_done(unsigned int fence);
+void dma_wait(unsigned int fence);
+int dma_poll(void);                 // retires finished chains, returns how many operations completed
+
+#endif
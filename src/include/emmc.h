@@ -0,0 +1,54 @@
+#ifndef EMMC_H
+#define EMMC_H
+
+// SD card on the BCM2711 EMMC2 controller (SDHCI 3.0)
+//
+// Transfers are multi-block (CMD18/CMD25 with auto CMD12) and go through an
+// ADMA2 descriptor table, so the controller moves the data itself and the
+// CPU only sees one interrupt per request. Requests are queued: emmc_submit
+// returns at once and the next request is started from the completion
+// interrupt. Controllers without ADMA2 (QEMU's raspi4b) fall back to PIO,
+// in which case emmc_submit finishes the request before it returns.
+//
+// Only cache-line (64 byte) aligned buffers are moved by DMA: the driver
+// cleans and invalidates them around the transfer, and a line shared with
+// other data would lose whatever was written to it meanwhile. Requests with
+// any other buffer fall back to PIO.
+
+#define EMMC_BLOCK_SIZE    512
+#define EMMC_MAX_BLOCKS    1024        // per request (512 KB)
+#define EMMC_TIMEOUT_US    1000000
+
+enum {
+    EMMC_PENDING = 0,   // queued or on the controller
+    EMMC_OK      = 1,
+    EMMC_ERROR   = -1
+};
+
+typedef struct emmc_request {
+    unsigned long lba;
+    unsigned int count;             // blocks
+    void *buffer;
+    int write;
+    void (*done)(struct emmc_request *req); // called from the interrupt or emmc_poll, may be 0
+    void *arg;
+    volatile int status;
+    struct emmc_request *next;      // queue link, owned by the driver
+} emmc_request_t;
+
+int emmc_init(void);                // 0 if there is no usable card
+void emmc_enableInterrupts(void);   // complete requests from the IRQ instead of emmc_poll
+unsigned long emmc_blockCount(void);
+
+int emmc_submit(emmc_request_t *req);   // 0 if the request is invalid
+int emmc_wait(emmc_request_t *req);     // returns the final status
+int emmc_poll(void);                    // finishes completed requests, returns how many
+
+// Synchronous helpers, return the final status
+int emmc_read(unsigned long lba, unsigned int count, void *buffer);
+int emmc_write(unsigned long lba, unsigned int count, const void *buffer);
+
+// Sequential and 4 KB random read throughput, written to the log
+void emmc_benchmark(void);
+
+#endif
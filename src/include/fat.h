@@ -0,0 +1,54 @@
+#ifndef FAT_H
+#define FAT_H
+
+// Read-only FAT32 on the SD card
+//
+// Metadata (boot sector, FAT, directories) goes through the sector cache in
+// bcache.h. A file's cluster chain is walked once and kept as a list of
+// contiguous runs (extents), shared between opens of the same file, so bulk
+// reads never touch the FAT again. fat_readInto transfers whole sectors
+// straight from the card into the caller's buffer, one multi-block request
+// per extent.
+
+#define FAT_NAME_MAX     64     // long names are cut to fit, ASCII only
+#define FAT_MAX_EXTENTS  32     // per chain, further runs are found by walking the FAT
+#define FAT_CHAIN_CACHE  16
+
+typedef struct {
+    unsigned int fileCluster;   // first cluster of the run, counted from the start of the file
+    unsigned int cluster;       // on disk
+    unsigned int count;
+} fat_extent_t;
+
+typedef struct fat_chain fat_chain_t;
+
+typedef struct {
+    unsigned int firstCluster;
+    unsigned int size;          // bytes, directories report their chain length
+    unsigned int pos;
+    int isDir;
+    fat_chain_t *chain;
+} fat_file_t;
+
+typedef struct {
+    char name[FAT_NAME_MAX];
+    unsigned int size;
+    unsigned int cluster;
+    int isDir;
+} fat_dirent_t;
+
+int fat_mount(void);            // first FAT32 partition, or a partitionless card
+int fat_open(fat_file_t *file, const char *path);  // "/fonts/terminal.psf", 0 if missing
+void fat_close(fat_file_t *file);
+int fat_seek(fat_file_t *file, unsigned int pos);
+int fat_readDir(fat_file_t *dir, fat_dirent_t *entry);  // 0 at the end
+
+// Both return the bytes read, -1 on an I/O error.
+// fat_read copies through the sector cache and suits small sequential reads;
+// fat_readInto reads whole sectors straight into buffer, skipping the cache;
+// they are DMAed only if buffer is 64 byte aligned (PIO otherwise), and the
+// file position should be sector aligned.
+long fat_read(fat_file_t *file, void *buffer, unsigned long length);
+long fat_readInto(fat_file_t *file, void *buffer, unsigned long length);
+
+#endif
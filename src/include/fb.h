@@ -1,10 +1,30 @@
 #ifndef FB_H
 #define FB_H
 
-#define SCREEN_WIDTH 1920
-#define SCREEN_HEIGHT 1080
+// Mode requested by fb_init; the firmware may give us something else, so
+// draw code asks fb_getWidth/fb_getHeight instead of using these.
+#define FB_DEFAULT_WIDTH 1920
+#define FB_DEFAULT_HEIGHT 1080
+#ifndef FB_DEFAULT_DEPTH
+#define FB_DEFAULT_DEPTH 32 // `make FB_DEPTH=16` for RGB565
+#endif
+
+enum {
+    FB_FORMAT_XRGB8888 = 0, // 32bpp, 0x00RRGGBB
+    FB_FORMAT_XBGR8888 = 1, // 32bpp, 0x00BBGGRR (isrgb == 0)
+    FB_FORMAT_RGB565   = 2,
+    FB_FORMAT_BGR565   = 3
+};
 
 void fb_init();
+int fb_initMode(unsigned int w, unsigned int h, unsigned int depth); // 0 if no mode could be set
+void fb_present(); // flip the back buffer onto the screen
+void fb_initMemory(void *buffer, unsigned int w, unsigned int h, unsigned int p); // XRGB8888
+void fb_initSurface(void *buffer, unsigned int w, unsigned int h, unsigned int p, int format);
+unsigned int fb_getWidth(void);
+unsigned int fb_getHeight(void);
+int fb_getFormat(void);
+unsigned int fb_color(unsigned int rgb); // 0x00RRGGBB -> pixel value of the current format
 void drawPixel(int x, int y, unsigned char attr);
 void drawChar(unsigned char ch, int x, int y, unsigned char attr);
 void drawString(int x, int y, char *s, unsigned char attr);
@@ -14,10 +34,107 @@ void drawLine(int x1, int y1, int x2, int y2, unsigned char attr);
 void drawRoundedRect(int x1, int y1, int x2, int y2, int radius,
                      unsigned char fillAttr, int fill,
                      unsigned char borderAttr, int borderThickness);
+void drawRoundedRectAA(int x1, int y1, int x2, int y2, int radius,
+                       unsigned char fillAttr, int fill,
+                       unsigned char borderAttr, int borderThickness);
 
-void drawCharSized(char c, int x, int y, unsigned char attr, int scale);
-void drawStringSized(int x, int y, char *s, unsigned char attr, int scale);
+void drawCharSized(unsigned char ch, int x, int y, unsigned char attr, int size);
+void drawStringSized(int x, int y, char *s, unsigned char attr, int size);
 int getFontPixel(char c, int x, int y);
 void clearScreen(unsigned char color);
 
+// Span layer (colours are resolved 0x00RRGGBB values, not palette attrs).
+// fb_fill32/fb_copy32 are the raw 32-bit kernels and don't convert anything.
+void fb_fill32(unsigned int *dst, int n, unsigned int color);
+void fb_copy32(unsigned int *dst, const unsigned int *src, int n);
+void fb_span(int x1, int x2, int y, unsigned int color);
+void fb_fillRect(int x, int y, int w, int h, unsigned int color);
+
+// DMA-backed fills and copies (see dma.h). A fence is done once the engine
+// has written the area; 0 is always done. fb_present waits for all of them.
+typedef unsigned int fb_fence_t;
+
+fb_fence_t fb_fillRectAsync(int x, int y, int w, int h, unsigned int color);
+fb_fence_t fb_blitAsync(int x, int y, const void *src, unsigned int srcPitch, int w, int h);
+fb_fence_t clearScreenAsync(unsigned char color);
+int fb_fenceDone(fb_fence_t fence);
+void fb_fenceWait(fb_fence_t fence);
+
+// Cursor overlay: a 32x32 ARGB sprite on top of whatever is on screen. It is
+// drawn only into the page being shown, over a save-under copy of what it
+// covers, so moving it touches two small rectangles and needs no redraw or
+// fb_present. Drawing calls never see it.
+#define FB_CURSOR_SIZE 32
+
+void fb_cursorSetImage(const unsigned int *argb, int hotX, int hotY); // 0xAARRGGBB, not premultiplied
+void fb_cursorMove(int x, int y);   // hotspot position; may be partly off screen
+void fb_cursorShow(int visible);
+void fb_cursorGetPos(int *x, int *y);
+
+// Kernel selection; NEON is only available when built with FB_SIMD=neon
+enum {
+    FB_ACCEL_SCALAR = 0,
+    FB_ACCEL_NEON   = 1
+};
+
+int fb_setAccel(int accel); // returns the kernels actually in use
+int fb_getAccel(void);
+
+// Damage tracking (rectangles are inclusive, in screen coordinates)
+#define FB_MAX_DAMAGE 16
+
+typedef struct {
+    int x1, y1, x2, y2;
+} fb_rect_t;
+
+typedef struct {
+    int count;
+    fb_rect_t rects[FB_MAX_DAMAGE];
+} fb_damage_t;
+
+void fb_damageClear(fb_damage_t *d);
+void fb_damageAdd(fb_damage_t *d, int x1, int y1, int x2, int y2);
+int fb_rectIntersect(fb_rect_t *out, const fb_rect_t *a, const fb_rect_t *b);
+
+void fb_markDirty(int x1, int y1, int x2, int y2); // record drawing done outside fb.c
+
+// Clip/viewport stack. Every draw call above is clipped to the top rect;
+// a viewport also moves the origin so (0,0) is its top left corner.
+#define FB_CLIP_DEPTH 16
+
+int fb_pushClip(int x, int y, int w, int h);     // returns 0 if the stack is full
+int fb_pushViewport(int x, int y, int w, int h);
+void fb_popClip(void);                           // undoes either push
+void fb_resetClip(void);                         // whole screen, origin 0,0
+void fb_getClip(fb_rect_t *out);                 // in the current viewport's coordinates
+
+// Line batches; every segment is clipped to the screen and includes both endpoints
+typedef struct {
+    int x, y;
+} fb_point_t;
+
+void drawLines(const fb_point_t *pts, int count, unsigned char attr);    // count segments from pts[2i] to pts[2i+1]
+void drawPolyline(const fb_point_t *pts, int count, unsigned char attr); // count points, count - 1 segments
+int fb_clipLine(int *x1, int *y1, int *x2, int *y2, const fb_rect_t *clip); // 0 if nothing is left
+
+// Glyph cache used by drawCharSized (see fb_glyphcache.c), 32bpp surfaces
+// only. The limit is a scale, not a size: scale = size / 8, so sizes up to
+// 135 are cached (the size 64 login title is scale 8). Larger glyphs would
+// take 74 KB or more of the 1 MB arena each and are expanded on every call.
+#define FB_GLYPH_MAX_SCALE 16
+
+typedef struct {
+    unsigned int hits;
+    unsigned int misses;
+    unsigned int evictions;
+    unsigned int tiles;
+    unsigned int bytesUsed;
+} fb_glyph_stats_t;
+
+const unsigned int* fb_glyphCacheGet(unsigned char ch, const unsigned char *glyph, int scale,
+                                     unsigned int fg, unsigned int bg);
+void fb_glyphCacheEnable(int on);
+void fb_glyphCacheFlush(void);
+void fb_glyphCacheStats(fb_glyph_stats_t *out);
+
 #endif
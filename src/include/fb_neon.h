@@ -0,0 +1,13 @@
+#ifndef FB_NEON_H
+#define FB_NEON_H
+
+// NEON span kernels, see src/lib/fb_neon.c
+// Only built when the Makefile is run with FB_SIMD=neon (the default).
+
+void fb_neon_enable(void);
+void fb_fill32_neon(unsigned int *dst, int n, unsigned int color);
+void fb_copy32_neon(unsigned int *dst, const unsigned int *src, int n);
+void fb_glyphRow_neon(unsigned int *dst, unsigned char bits, int scale,
+                      unsigned int fg, unsigned int bg);
+
+#endif
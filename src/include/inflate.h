@@ -0,0 +1,47 @@
+#ifndef INFLATE_H
+#define INFLATE_H
+
+// Streaming DEFLATE (RFC 1951) decoder, optionally inside a zlib wrapper
+//
+// Compressed input is pulled through fill() a chunk at a time and output is
+// produced in whatever amounts the caller asks for, so neither side has to
+// be in memory as a whole. The state holds the 32 KB history window and the
+// code tables, about 37 KB; keep it static or in allocated memory.
+// The zlib Adler-32 trailer is not checked.
+
+#define INFLATE_WINDOW    32768
+#define INFLATE_FAST_BITS 9     // codes up to this long decode with one table lookup
+
+typedef struct {
+    unsigned short fast[1 << INFLATE_FAST_BITS];   // symbol | length << 9, 0 for longer codes
+    unsigned short count[16];                     // codes per length
+    unsigned short symbol[288];                   // in canonical order
+} inflate_huff_t;
+
+typedef struct {
+    // next chunk of compressed data and its length, 0 when there is no more
+    const unsigned char *(*fill)(void *arg, unsigned long *length);
+    void *arg;
+
+    const unsigned char *in, *inEnd;
+    unsigned long bitBuf;
+    unsigned int bitCount;
+
+    int state;
+    int final;                  // current block is the last one
+    unsigned int stored;        // bytes left in a stored block
+    unsigned int copyLength;    // match still being written out
+    unsigned int copyDistance;
+    unsigned long total;        // bytes produced, matches may not reach further back
+
+    unsigned int windowPos;
+    unsigned char window[INFLATE_WINDOW];
+    inflate_huff_t lit, dist;
+} inflate_t;
+
+void inflate_init(inflate_t *s, const unsigned char *(*fill)(void *arg, unsigned long *length),
+                  void *arg, int zlib);
+// Bytes written to out, fewer than length only at the end of the stream; -1 if corrupt
+long inflate_read(inflate_t *s, void *out, unsigned long length);
+
+#endif
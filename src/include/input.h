@@ -0,0 +1,55 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+// Input event queue
+//
+// Single producer (the HID driver, which only runs from xhci_poll) and single
+// consumer (the UI loop). Lock-free: the producer owns head, the consumer owns
+// tail, each only reads the other's index. Consumers drain in batches with
+// input_read, so a busy redraw costs a few late events rather than lost ones.
+//
+// Relative mouse motion is coalesced: while the newest motion event has not
+// been read yet, further motion is added to it instead of taking a new slot.
+// Any other event closes it, so motion never moves past a button or key.
+
+#define INPUT_QUEUE_SIZE 256 // events, power of two
+
+enum {
+    INPUT_KEY    = 1,   // code = HID usage, value = 1 press / 0 release
+    INPUT_BUTTON = 2,   // code = button (0 left, 1 right, 2 middle), value as above
+    INPUT_MOTION = 3    // dx, dy in mouse counts
+};
+
+// Modifier bits, as in the boot keyboard report
+enum {
+    INPUT_MOD_CTRL  = 0x11,
+    INPUT_MOD_SHIFT = 0x22,
+    INPUT_MOD_ALT   = 0x44,
+    INPUT_MOD_GUI   = 0x88
+};
+
+typedef struct {
+    unsigned long time;         // timer_now_us when the report arrived (first one if coalesced)
+    unsigned char type;
+    unsigned char code;
+    unsigned char value;
+    unsigned char modifiers;    // keys: modifier state after this event
+    char ascii;                 // keys: the character a press types, 0 if none
+    short dx, dy;
+} input_event_t;
+
+// Producer side
+int input_push(const input_event_t *ev);            // 0 if the queue is full (event dropped)
+int input_pushMotion(unsigned long time, int dx, int dy);
+
+// Consumer side
+int input_read(input_event_t *events, int max);     // returns how many were copied
+int input_pending(void);
+unsigned long input_dropped(void);
+
+// Devices report themselves so the UI knows whether to wait for input
+void input_addDevices(int keyboards, int mice);     // negative on detach
+int input_keyboardCount(void);
+int input_mouseCount(void);
+
+#endif
@@ -8,5 +8,9 @@ unsigned char uart_readByte();
 unsigned int uart_isReadByteReady();
 void uart_writeByteBlocking(unsigned char ch);
 void uart_update();
+void uart_drainOutputQueue();
+unsigned int uart_outputQueueFree();
+void uart_startOutput();
+void uart_enableInterrupts();
 void mmio_write(long reg, unsigned int val);
 unsigned int mmio_read(long reg);
@@ -0,0 +1,30 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+// GIC-400 interrupt numbers on the BCM2711
+enum {
+    IRQ_TIMER_PHYS = 30,        // PPI: EL1 physical timer (CNTP)
+    IRQ_MAILBOX    = 32 + 33,   // SPI: ARM mailbox 0 (VideoCore replies)
+    IRQ_VC_BASE    = 96,        // SPI: VideoCore peripheral IRQs start here
+    IRQ_DMA0       = 96 + 16,   // DMA channel n is IRQ_DMA0 + n (channels 0-10)
+    IRQ_AUX        = 96 + 29,   // mini UART / SPI1 / SPI2
+    IRQ_EMMC2      = 32 + 126,  // EMMC2 (SD card)
+    IRQ_PCIE_INTA  = 32 + 143,  // PCIe legacy INTA (the VL805)
+    IRQ_MAX        = 256
+};
+
+typedef void (*irq_handler_t)(void *arg);
+
+void irq_init(void);
+void irq_register(unsigned int irq, irq_handler_t handler, void *arg);
+void irq_unregister(unsigned int irq);
+
+void irq_enable(void);
+void irq_disable(void);
+int irq_enabled(void);
+
+// Mask IRQs around short critical sections; returns the previous state
+unsigned long irq_save(void);
+void irq_restore(unsigned long flags);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef LOG_H
+#define LOG_H
+
+// Structured kernel log
+//
+// LOG_INFO("PCIe: %02x:%02x.%x %04x:%04x", bus, dev, fn, vendor, device);
+//
+// A call stores a binary record (level, timestamp, the format string's
+// address as its id, raw argument words) in a lock-free multi-producer ring
+// and returns; it never formats and never waits for the UART. Records are
+// turned into text when the ring is drained: from the UART TX interrupt
+// once the output queue runs dry, from uart_update/uart_drainOutputQueue, or
+// by calling log_flush. A full ring drops the record and counts it.
+//
+// One record is one line, the newline is added when it is printed.
+// Formats: %d %i %u %x %X %p %s %c %% with optional '0', width and 'l'.
+// Up to LOG_MAX_ARGS arguments; %s ones are read at drain time, so they
+// must stay valid (literals).
+
+enum {
+    LOG_LEVEL_ERROR = 0,
+    LOG_LEVEL_WARN  = 1,
+    LOG_LEVEL_INFO  = 2,
+    LOG_LEVEL_DEBUG = 3
+};
+
+// Records above this level are compiled out (make LOG_LEVEL=3 for debug)
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_SIZE 256 // records, power of two
+#define LOG_MAX_ARGS  6
+#define LOG_LINE_MAX  160 // longer lines are cut
+
+void log_write(int level, const char *fmt, ...);
+void log_flush(void);             // format what is queued, as far as the UART queue has room
+unsigned long log_dropped(void);  // records lost to a full ring since boot
+
+#define LOG_AT(level, ...) do { if ((level) <= LOG_LEVEL) log_write((level), __VA_ARGS__); } while (0)
+
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#endif
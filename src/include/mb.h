@@ -1,4 +1,9 @@
-extern volatile unsigned int mbox[36];
+#ifndef MB_H
+#define MB_H
+
+#define MBOX_WORDS 48 // three cache lines
+
+extern volatile unsigned int mbox[MBOX_WORDS];
 
 enum {
     MBOX_REQUEST  = 0
@@ -17,8 +22,16 @@ enum {
 };
 
 enum {
+    MBOX_TAG_GETBOARDREV = 0x10002,
+    MBOX_TAG_GETARMMEM   = 0x10005,
+    MBOX_TAG_GETVCMEM    = 0x10006,
+
     MBOX_TAG_SETPOWER   = 0x28001,
+    MBOX_TAG_GETCLKRATE = 0x30002,
+    MBOX_TAG_GETTEMP    = 0x30006,
+    MBOX_TAG_GETMAXTEMP = 0x3000A,
     MBOX_TAG_SETCLKRATE = 0x38002,
+    MBOX_TAG_NOTIFYXHCIRESET = 0x30058, // VL805 reloads its firmware after a PCIe reset
 
     MBOX_TAG_SETPHYWH   = 0x48003,
     MBOX_TAG_SETVIRTWH  = 0x48004,
@@ -32,3 +45,45 @@ enum {
 };
 
 unsigned int mbox_call(unsigned char ch);
+
+// Asynchronous property messages
+//
+// Each message has its own aligned buffer, so several can be in flight at
+// once and independent queries can share one round-trip:
+//
+//     mbox_msg_t msg;
+//     mbox_msg_init(&msg);
+//     int clk  = mbox_msg_addTag(&msg, MBOX_TAG_GETCLKRATE, (unsigned int[]){ 3 }, 1, 2);
+//     int temp = mbox_msg_addTag(&msg, MBOX_TAG_GETTEMP, (unsigned int[]){ 0 }, 1, 2);
+//     mbox_submit(&msg, MBOX_CH_PROP);  // returns immediately
+//     ...
+//     if (mbox_wait(&msg)) arm_hz = msg.buf[clk + 1], millicelsius = msg.buf[temp + 1];
+
+#define MBOX_MSG_WORDS    64      // whole cache lines
+#define MBOX_MAX_INFLIGHT 8
+
+enum {
+    MBOX_MSG_IDLE   = 0,
+    MBOX_MSG_QUEUED = 1,
+    MBOX_MSG_DONE   = 2,
+    MBOX_MSG_ERROR  = 3
+};
+
+// buf has cache lines of its own: they are invalidated when the reply comes
+// in, so nothing else may live in them (words and state follow on the next line)
+typedef struct {
+    volatile unsigned int buf[MBOX_MSG_WORDS] __attribute__((aligned(64)));
+    unsigned int words;     // used so far, without MBOX_TAG_LAST
+    volatile int state;
+} mbox_msg_t;
+
+void mbox_msg_init(mbox_msg_t *msg);
+// Appends a tag, returns the index of its value buffer in msg->buf (-1 if full)
+int mbox_msg_addTag(mbox_msg_t *msg, unsigned int tag, const unsigned int *values,
+                    unsigned int valueWords, unsigned int bufferWords);
+int mbox_submit(mbox_msg_t *msg, unsigned char ch); // non-blocking, 0 if too many in flight
+int mbox_wait(mbox_msg_t *msg);                     // 1 on success
+int mbox_poll(void);                                // collect replies, returns completions
+void mbox_enableInterrupts(void);
+
+#endif
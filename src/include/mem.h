@@ -0,0 +1,83 @@
+#ifndef MEM_H
+#define MEM_H
+
+// Kernel memory: a buddy allocator for physical pages, fixed-size slab
+// caches on top of it and bump arenas for short-lived scratch data.
+// Everything is identity mapped, so page addresses are usable pointers.
+
+#define PAGE_SHIFT     12
+#define PAGE_SIZE      (1UL << PAGE_SHIFT)
+#define PAGE_MAX_ORDER 10 // largest block: 2^10 pages = 4 MB
+
+// Buddy page allocator, seeded with the ARM memory the firmware reports
+int page_init(void);                     // 0 if the memory query failed
+void *page_alloc(unsigned int order);    // 2^order pages, aligned to their size; 0 if none
+void page_free(void *addr, unsigned int order);
+
+typedef struct {
+    unsigned long total;                 // pages managed
+    unsigned long free;
+    unsigned long freeBlocks[PAGE_MAX_ORDER + 1];
+    unsigned int largestOrder;           // biggest block that can still be allocated
+    unsigned int fragmentation;          // percent of free memory outside the largest block size
+} page_stats_t;
+
+void page_getStats(page_stats_t *stats);
+
+// Slab caches: objects of one size carved out of page blocks. Free objects
+// are linked through their first word; the slab header sits at the start
+// of its block, so freeing needs no lookup.
+typedef struct slab slab_t;
+
+typedef struct {
+    const char *name;
+    unsigned int size;                   // object size, rounded up to the alignment
+    unsigned int order;                  // pages per slab, as a buddy order
+    unsigned int perSlab;                // 0: objects too big for a slab
+    unsigned int offset;                 // first object, after the header
+    slab_t *partial;                     // some objects free
+    slab_t *full;
+    slab_t *empty;                       // kept as a spare, at most one
+    unsigned long slabs;
+    unsigned long inUse;
+    unsigned long allocs;
+    volatile int lock;
+} slab_cache_t;
+
+void slab_cacheInit(slab_cache_t *cache, const char *name, unsigned int size, unsigned int align);
+void *slab_alloc(slab_cache_t *cache);
+void slab_free(slab_cache_t *cache, void *obj);
+void slab_cacheShrink(slab_cache_t *cache);      // give the spare slab back
+
+typedef struct {
+    unsigned long slabs;
+    unsigned long inUse;                 // objects handed out
+    unsigned long capacity;              // objects in all slabs
+    unsigned long allocs;                // total slab_alloc calls that succeeded
+    unsigned long bytes;                 // pages held, in bytes
+} slab_stats_t;
+
+void slab_getStats(slab_cache_t *cache, slab_stats_t *stats);
+
+// Bump arenas: allocation is a pointer increment, everything is dropped at
+// once by arena_reset (e.g. per frame). Chunks stay around for the next
+// round, arena_release hands them back to the page allocator. Arenas have
+// one owner and no lock.
+typedef struct arena_chunk arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t *first;
+    arena_chunk_t *current;
+    unsigned char *next;
+    unsigned char *end;
+    unsigned int order;                  // chunk size, as a buddy order
+    unsigned long used;                  // bytes since the last reset
+    unsigned long highWater;
+} arena_t;
+
+void arena_init(arena_t *arena, unsigned int order);
+void *arena_alloc(arena_t *arena, unsigned long size, unsigned long align); // 0 if it doesn't fit a chunk
+void arena_reset(arena_t *arena);
+void arena_release(arena_t *arena);
+
+#endif
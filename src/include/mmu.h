@@ -0,0 +1,22 @@
+#ifndef MMU_H
+#define MMU_H
+
+// Memory types for mmu_mapRegion (MAIR indices)
+enum {
+    MMU_DEVICE    = 0, // Device-nGnRE: peripherals, PCIe windows
+    MMU_NORMAL    = 1, // Normal write-back cacheable: RAM
+    MMU_NORMAL_NC = 2  // Normal non-cacheable (write-combining): framebuffer
+};
+
+void mmu_init(void);
+void mmu_initSecondary(void);
+int mmu_enabled(void);
+void mmu_mapRegion(unsigned long base, unsigned long size, int type);
+
+// Cache maintenance by virtual address, to the point of coherency.
+// Needed around anything another bus master reads or writes (mailbox, DMA).
+void dcache_clean(const volatile void *addr, unsigned long size);
+void dcache_invalidate(const volatile void *addr, unsigned long size);
+void dcache_cleanInvalidate(const volatile void *addr, unsigned long size);
+
+#endif
@@ -3,17 +3,21 @@
 
 #define MAX_PCIE_DEVICES 32
 
-// PCIe device structure
+// PCIe device structure, filled in once by pcie_init
 typedef struct {
     unsigned char bus;
     unsigned char device;
     unsigned char function;
     unsigned short vendor_id;
     unsigned short device_id;
-    unsigned short class_code;
+    unsigned short class_code;      // base class << 8 | subclass
     unsigned char subclass;
     unsigned char prog_if;
-    unsigned int bars[6];
+    unsigned char header_type;      // without the multi-function bit
+    unsigned char secondary_bus;    // bridges only
+    unsigned int bars[6];           // as programmed
+    unsigned long bar_addr[6];      // CPU address of each memory BAR, 0 if unused
+    unsigned long bar_size[6];      // a 64-bit BAR counts in its lower slot
 } pcie_device_t;
 
 // PCIe class codes
@@ -21,10 +25,16 @@ typedef struct {
 #define PCIE_SUBCLASS_USB               0x03
 #define PCIE_PROG_IF_XHCI               0x30
 
+// Configuration space registers
+#define PCIE_CFG_COMMAND                0x04
+#define PCIE_CMD_MEMORY                 (1 << 1)
+#define PCIE_CMD_BUS_MASTER             (1 << 2)
+
 // Function declarations
-int pcie_init(void);
+int pcie_init(void);                // link up, enumerate, assign BARs; 0 without a link
 int pcie_get_device_count(void);
 pcie_device_t* pcie_get_device(int index);
+// class_code is the base class (PCIE_CLASS_*); these only search the table
 pcie_device_t* pcie_find_device_by_class(unsigned short class_code, unsigned char subclass);
 pcie_device_t* pcie_find_device_by_vendor(unsigned short vendor_id, unsigned short device_id);
 
@@ -32,6 +42,14 @@ pcie_device_t* pcie_find_device_by_vendor(unsigned short vendor_id, unsigned sho
 unsigned int pcie_device_read_config32(pcie_device_t *dev, unsigned char offset);
 void pcie_device_write_config32(pcie_device_t *dev, unsigned char offset, unsigned int value);
 unsigned short pcie_device_read_config16(pcie_device_t *dev, unsigned char offset);
+void pcie_device_write_config16(pcie_device_t *dev, unsigned char offset, unsigned short value);
 unsigned char pcie_device_read_config8(pcie_device_t *dev, unsigned char offset);
 
+// Inbound window: devices see RAM at its physical address, first 3 GB only
+// (the outbound window sits above it at PCIe 0xF800_0000)
+static inline unsigned long pcie_bus_address(const volatile void *p)
+{
+    return (unsigned long)p;
+}
+
 #endif
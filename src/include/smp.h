@@ -0,0 +1,43 @@
+#ifndef SMP_H
+#define SMP_H
+
+#define SMP_MAX_CORES   4
+#define SMP_STACK_SHIFT 14 // smp_entry.S computes stack tops with a shift
+#define SMP_STACK_SIZE  (1 << SMP_STACK_SHIFT)
+#define SMP_QUEUE_SIZE  64 // power of two
+
+#ifndef __ASSEMBLER__
+
+#include "irq.h"
+
+// A job covers part `part` of `parts`, e.g. one horizontal band of a fill
+typedef void (*smp_job_fn)(void *arg, int part, int parts);
+
+int smp_init(void);          // release the secondary cores, returns cores online
+int smp_coreId(void);
+int smp_coreCount(void);
+
+int smp_submit(smp_job_fn fn, void *arg, int part, int parts, int *pending); // 0 if the queue is full
+void smp_parallel(smp_job_fn fn, void *arg, int parts); // split, help out, wait
+
+// Spinlock for short sections shared between cores and IRQ handlers.
+// IRQs stay masked on this core while it is held.
+static inline unsigned long smp_lock(volatile int *lock)
+{
+    unsigned long flags = irq_save();
+
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED)) asm volatile("yield");
+    }
+    return flags;
+}
+
+static inline void smp_unlock(volatile int *lock, unsigned long flags)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+    irq_restore(flags);
+}
+
+#endif // __ASSEMBLER__
+
+#endif
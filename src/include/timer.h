@@ -0,0 +1,27 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#define TIMER_MAX_CALLBACKS 16
+
+typedef void (*timer_callback_t)(void *arg);
+
+void timer_init(void);
+
+// Monotonic time from the ARM generic timer (CNTPCT), independent of CPU clock
+unsigned long timer_ticks(void);
+unsigned long timer_freq(void);
+unsigned long timer_now_us(void);
+
+void sleep_us(unsigned long us);
+void sleep_ms(unsigned long ms);
+
+// Callbacks run from timer_poll()/timer_idle() on the core that calls them.
+// period_us == 0 makes a one-shot timer. Returns an id or -1 if all slots are used.
+int timer_add(unsigned long delay_us, unsigned long period_us, timer_callback_t fn, void *arg);
+void timer_cancel(int id);
+void timer_poll(void);  // run every callback that is due
+void timer_idle(void);  // sleep until the next callback is due, then run it
+void timer_wake(void);  // make timer_idle return early (callable from interrupts)
+void timer_irq(void *arg); // IRQ_TIMER_PHYS handler
+
+#endif
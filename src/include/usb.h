@@ -1,6 +1,39 @@
 #ifndef USB_H
 #define USB_H
 
+#define USB_MAX_DEVICES 16
+#define USB_MAX_CONFIG  512     // configuration descriptor bytes kept per device
+
+// Standard requests and descriptor types
+enum {
+    USB_REQ_GET_STATUS        = 0,
+    USB_REQ_SET_ADDRESS       = 5,
+    USB_REQ_GET_DESCRIPTOR    = 6,
+    USB_REQ_SET_CONFIGURATION = 9,
+
+    USB_DESC_DEVICE        = 1,
+    USB_DESC_CONFIGURATION = 2,
+    USB_DESC_INTERFACE     = 4,
+    USB_DESC_ENDPOINT      = 5,
+
+    USB_DIR_IN        = 0x80,
+    USB_TYPE_CLASS    = 0x20,
+    USB_RECIP_IFACE   = 0x01
+};
+
+// An addressed and configured device on a root hub port
+typedef struct {
+    int slot;                   // xHCI slot id, 0 if the entry is free
+    int port;
+    int speed;
+    unsigned short vendor_id;
+    unsigned short product_id;
+    unsigned char device_class;
+    unsigned char configuration;
+    unsigned short config_length;
+    unsigned char config[USB_MAX_CONFIG];
+} usb_device_t;
+
 // USB system status structure
 typedef struct {
     int initialized;
@@ -13,7 +46,7 @@ typedef struct {
 // Main USB subsystem functions
 int usb_init(void);
 int usb_shutdown(void);
-void usb_update(void);
+void usb_update(void);          // completions and hotplug
 
 // Status and information
 void usb_get_status(usb_status_info_t *status);
@@ -21,5 +54,10 @@ void usb_print_info(void (*print_func)(const char*));
 
 // Device management
 int usb_enumerate_devices(void);
+int usb_device_count(void);
+usb_device_t* usb_get_device(int index);   // NULL for a free entry
+// Control transfer on the default pipe, returns the bytes moved or -1
+int usb_control(usb_device_t *dev, unsigned char requestType, unsigned char request,
+                unsigned short value, unsigned short index, void *data, unsigned short length);
 
 #endif
@@ -0,0 +1,211 @@
+// USB HID boot keyboard and mouse driver
+// src/input/usb/hid.c
+
+#include "../../include/input.h"
+#include "../../include/timer.h"
+#include "../../include/log.h"
+#include "xhci.h"
+#include "hid.h"
+
+enum {
+    HID_CLASS          = 3,
+    HID_SUBCLASS_BOOT  = 1,
+    HID_PROTO_KEYBOARD = 1,
+    HID_PROTO_MOUSE    = 2,
+
+    HID_REQ_SET_IDLE     = 0x0A,
+    HID_REQ_SET_PROTOCOL = 0x0B,
+
+    HID_KEY_ROLLOVER = 0x01,    // every key slot reads this when too many are down
+    HID_KEY_FIRST    = 0x04,
+    HID_KEY_LAST     = 0x38,
+    HID_KEY_LCTRL    = 0xE0
+};
+
+typedef struct {
+    usb_device_t *dev;          // 0 if the entry is free
+    int protocol;
+    unsigned char address;
+    unsigned int maxPacket;
+    unsigned char last[8];      // previous report, to turn state into press/release
+    void *buffers[HID_REPORTS]; // DMA memory, allocated once per entry and reused
+} hid_iface_t;
+
+static hid_iface_t hid_ifaces[HID_MAX_INTERFACES];
+
+// US layout, usages 0x04 (a) to 0x38 (/)
+static const char hid_keymap[] =
+    "abcdefghijklmnopqrstuvwxyz1234567890\n\x1b\b\t -=[]\\#;'`,./";
+static const char hid_keymapShift[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ!@#$%^&*()\n\x1b\b\t _+{}|~:\"~<>?";
+
+static char hid_ascii(unsigned char usage, unsigned char modifiers)
+{
+    if (usage < HID_KEY_FIRST || usage > HID_KEY_LAST) return 0;
+    if (modifiers & (INPUT_MOD_CTRL | INPUT_MOD_ALT | INPUT_MOD_GUI)) return 0;
+
+    return (modifiers & INPUT_MOD_SHIFT) ? hid_keymapShift[usage - HID_KEY_FIRST]
+                                         : hid_keymap[usage - HID_KEY_FIRST];
+}
+
+static void hid_key(unsigned long now, unsigned char usage, int pressed, unsigned char modifiers)
+{
+    input_event_t ev = { 0 };
+
+    ev.time = now;
+    ev.type = INPUT_KEY;
+    ev.code = usage;
+    ev.value = pressed;
+    ev.modifiers = modifiers;
+    ev.ascii = pressed ? hid_ascii(usage, modifiers) : 0;
+    input_push(&ev);
+}
+
+static int hid_hasKey(const unsigned char *report, unsigned char usage)
+{
+    for (int i = 2; i < 8; i++) {
+        if (report[i] == usage) return 1;
+    }
+    return 0;
+}
+
+// Boot keyboard report: modifiers, reserved, up to six pressed usages
+static void hid_keyboard(hid_iface_t *h, const unsigned char *r, unsigned long now)
+{
+    unsigned char changed = r[0] ^ h->last[0];
+
+    if (r[2] == HID_KEY_ROLLOVER) return; // keep the last good state
+
+    for (int bit = 0; bit < 8; bit++) {
+        if (changed & (1 << bit)) hid_key(now, HID_KEY_LCTRL + bit, (r[0] >> bit) & 1, r[0]);
+    }
+    for (int i = 2; i < 8; i++) {
+        if (h->last[i] && !hid_hasKey(r, h->last[i])) hid_key(now, h->last[i], 0, r[0]);
+    }
+    for (int i = 2; i < 8; i++) {
+        if (r[i] && !hid_hasKey(h->last, r[i])) hid_key(now, r[i], 1, r[0]);
+    }
+
+    for (int i = 0; i < 8; i++) h->last[i] = r[i];
+}
+
+// Boot mouse report: buttons, dx, dy (signed), anything after is ignored
+static void hid_mouse(hid_iface_t *h, const unsigned char *r, unsigned long now)
+{
+    unsigned char changed = (r[0] ^ h->last[0]) & 7;
+
+    input_pushMotion(now, (signed char)r[1], (signed char)r[2]);
+
+    for (int b = 0; b < 3; b++) {
+        if (!(changed & (1 << b))) continue;
+
+        input_event_t ev = { 0 };
+        ev.time = now;
+        ev.type = INPUT_BUTTON;
+        ev.code = b;
+        ev.value = (r[0] >> b) & 1;
+        input_push(&ev);
+    }
+    h->last[0] = r[0];
+}
+
+static void hid_complete(void *arg, void *buffer, unsigned int length, int code)
+{
+    hid_iface_t *h = arg;
+
+    if (!h->dev) return;
+    if (code != XHCI_CC_SUCCESS && code != XHCI_CC_SHORT) {
+        LOG_WARN("HID: Slot %d transfer error %d, endpoint stopped", h->dev->slot, code);
+        return;
+    }
+
+    unsigned long now = timer_now_us();
+    if (h->protocol == HID_PROTO_KEYBOARD && length >= 8) hid_keyboard(h, buffer, now);
+    else if (h->protocol == HID_PROTO_MOUSE && length >= 3) hid_mouse(h, buffer, now);
+
+    xhci_queueTransfers(h->dev->slot, h->address, &buffer, &h->maxPacket, 1);
+}
+
+static hid_iface_t *hid_freeIface(void)
+{
+    for (int i = 0; i < HID_MAX_INTERFACES; i++) {
+        if (!hid_ifaces[i].dev) return &hid_ifaces[i];
+    }
+    return 0;
+}
+
+static int hid_bind(usb_device_t *dev, int iface, int protocol, const unsigned char *ep)
+{
+    hid_iface_t *h = hid_freeIface();
+    unsigned int lengths[HID_REPORTS];
+
+    if (!h) return 0;
+
+    if (!h->buffers[0]) {
+        for (int i = 0; i < HID_REPORTS; i++) {
+            h->buffers[i] = xhci_dmaAlloc(64, 64);
+            if (!h->buffers[i]) return 0;
+        }
+    }
+
+    h->protocol = protocol;
+    h->address = ep[2];
+    h->maxPacket = (ep[4] | (ep[5] << 8)) & 0x7FF;
+    if (h->maxPacket > 64) h->maxPacket = 64;
+    for (int i = 0; i < 8; i++) h->last[i] = 0;
+
+    // boot layout, and keyboards report on change only
+    usb_control(dev, USB_TYPE_CLASS | USB_RECIP_IFACE, HID_REQ_SET_PROTOCOL, 0, iface, 0, 0);
+    if (protocol == HID_PROTO_KEYBOARD) {
+        usb_control(dev, USB_TYPE_CLASS | USB_RECIP_IFACE, HID_REQ_SET_IDLE, 0, iface, 0, 0);
+    }
+
+    if (!xhci_configureEndpoint(dev->slot, h->address, XHCI_EP_INTR_IN, h->maxPacket, ep[6], hid_complete, h)) {
+        return 0;
+    }
+
+    h->dev = dev;
+    for (int i = 0; i < HID_REPORTS; i++) lengths[i] = h->maxPacket;
+    xhci_queueTransfers(dev->slot, h->address, h->buffers, lengths, HID_REPORTS);
+
+    if (protocol == HID_PROTO_KEYBOARD) input_addDevices(1, 0);
+    else input_addDevices(0, 1);
+
+    LOG_INFO("HID: Slot %d interface %d: boot %s", dev->slot, iface,
+             protocol == HID_PROTO_KEYBOARD ? "keyboard" : "mouse");
+    return 1;
+}
+
+int hid_attach(usb_device_t *dev)
+{
+    const unsigned char *p = dev->config, *end = dev->config + dev->config_length;
+    int bound = 0, iface = -1, protocol = 0;
+
+    // interface descriptors are followed by their endpoints
+    while (p + 2 <= end && p[0] >= 2 && p + p[0] <= end) {
+        if (p[1] == USB_DESC_INTERFACE && p[0] >= 9) {
+            int boot = p[5] == HID_CLASS && p[6] == HID_SUBCLASS_BOOT &&
+                       (p[7] == HID_PROTO_KEYBOARD || p[7] == HID_PROTO_MOUSE);
+            iface = boot ? p[2] : -1;
+            protocol = p[7];
+        } else if (p[1] == USB_DESC_ENDPOINT && p[0] >= 7 && iface >= 0 &&
+                   (p[2] & USB_DIR_IN) && (p[3] & 3) == 3) {
+            bound += hid_bind(dev, iface, protocol, p);
+            iface = -1; // one interrupt IN endpoint per interface
+        }
+        p += p[0];
+    }
+    return bound;
+}
+
+void hid_detach(usb_device_t *dev)
+{
+    for (int i = 0; i < HID_MAX_INTERFACES; i++) {
+        hid_iface_t *h = &hid_ifaces[i];
+        if (h->dev != dev) continue;
+
+        if (h->protocol == HID_PROTO_KEYBOARD) input_addDevices(-1, 0);
+        else input_addDevices(0, -1);
+        h->dev = 0;
+    }
+}
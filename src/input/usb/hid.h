@@ -0,0 +1,19 @@
+#ifndef HID_H
+#define HID_H
+
+// USB HID boot protocol keyboards and mice
+//
+// Each bound interface keeps HID_REPORTS interrupt transfers queued; a
+// completed report is decoded into input events (input.h) and its buffer
+// queued again, all from xhci_poll. Nothing is parsed from report
+// descriptors: the boot protocol fixes the layout.
+
+#include "../../include/usb.h"
+
+#define HID_MAX_INTERFACES 8
+#define HID_REPORTS        4    // transfers in flight per interface
+
+int hid_attach(usb_device_t *dev);  // binds every boot interface, returns how many
+void hid_detach(usb_device_t *dev);
+
+#endif
@@ -0,0 +1,210 @@
+// USB core: root hub enumeration on top of the xHCI driver
+// src/input/usb/usb.c
+
+#include "../../include/usb.h"
+#include "../../include/pcie.h"
+#include "../../include/timer.h"
+#include "../../include/log.h"
+#include "xhci.h"
+#include "hid.h"
+
+static usb_status_info_t usb_status;
+static usb_device_t usb_devices[USB_MAX_DEVICES];
+
+static usb_device_t *usb_deviceOnPort(int port)
+{
+    for (int i = 0; i < USB_MAX_DEVICES; i++) {
+        if (usb_devices[i].slot && usb_devices[i].port == port) return &usb_devices[i];
+    }
+    return 0;
+}
+
+static usb_device_t *usb_freeDevice(void)
+{
+    for (int i = 0; i < USB_MAX_DEVICES; i++) {
+        if (!usb_devices[i].slot) return &usb_devices[i];
+    }
+    return 0;
+}
+
+static int usb_getDescriptor(usb_device_t *dev, int type, void *buffer, unsigned short length)
+{
+    return usb_control(dev, USB_DIR_IN, USB_REQ_GET_DESCRIPTOR, type << 8, 0, buffer, length);
+}
+
+static int usb_attach(int port)
+{
+    usb_device_t *dev = usb_freeDevice();
+    unsigned char desc[18];
+
+    if (!dev) return 0;
+
+    int speed = xhci_resetPort(port);
+    if (!speed) return 0;
+
+    int slot = xhci_enableSlot();
+    if (!slot) return 0;
+
+    dev->slot = slot;
+    dev->port = port;
+    dev->speed = speed;
+
+    if (!xhci_addressDevice(slot, port, speed)) goto fail;
+
+    // full speed devices may use 8, 16, 32 or 64 bytes on EP0, ask first
+    if (speed == XHCI_SPEED_FULL) {
+        if (usb_getDescriptor(dev, USB_DESC_DEVICE, desc, 8) < 8) goto fail;
+        if (desc[7] != 8 && !xhci_setMaxPacket0(slot, desc[7])) goto fail;
+    }
+
+    if (usb_getDescriptor(dev, USB_DESC_DEVICE, desc, sizeof(desc)) < (int)sizeof(desc)) goto fail;
+    dev->vendor_id = desc[8] | (desc[9] << 8);
+    dev->product_id = desc[10] | (desc[11] << 8);
+    dev->device_class = desc[4];
+
+    // header first for the total length, then as much of it as we keep
+    if (usb_getDescriptor(dev, USB_DESC_CONFIGURATION, dev->config, 9) < 9) goto fail;
+    unsigned short total = dev->config[2] | (dev->config[3] << 8);
+    if (total > USB_MAX_CONFIG) total = USB_MAX_CONFIG;
+    int got = usb_getDescriptor(dev, USB_DESC_CONFIGURATION, dev->config, total);
+    if (got < 9) goto fail;
+    dev->config_length = got;
+    dev->configuration = dev->config[5];
+
+    if (usb_control(dev, 0, USB_REQ_SET_CONFIGURATION, dev->configuration, 0, 0, 0) < 0) goto fail;
+
+    usb_status.usb_device_count++;
+    LOG_INFO("USB: Port %d slot %d: %04x:%04x class %02x, speed %d",
+             port, slot, dev->vendor_id, dev->product_id, dev->device_class, speed);
+    hid_attach(dev);
+    return 1;
+
+fail:
+    LOG_WARN("USB: Enumeration failed on port %d", port);
+    xhci_disableSlot(slot);
+    dev->slot = 0;
+    return 0;
+}
+
+static void usb_detach(usb_device_t *dev)
+{
+    LOG_INFO("USB: Port %d disconnected", dev->port);
+    hid_detach(dev);
+    xhci_disableSlot(dev->slot);
+    dev->slot = 0;
+    usb_status.usb_device_count--;
+}
+
+int usb_init(void) {
+    if (usb_status.initialized) return usb_status.xhci_initialized;
+    usb_status.initialized = 1;
+
+    pcie_init();
+    usb_status.pcie_device_count = pcie_get_device_count();
+
+    pcie_device_t *hc = pcie_find_device_by_class(PCIE_CLASS_SERIAL_BUS, PCIE_SUBCLASS_USB);
+    if (!hc || hc->prog_if != PCIE_PROG_IF_XHCI) {
+        LOG_INFO("USB: No xHCI controller");
+        return 0;
+    }
+
+    if (!xhci_init(hc)) {
+        LOG_ERROR("USB: xHCI init failed");
+        return 0;
+    }
+    xhci_enableInterrupts();
+
+    usb_status.xhci_initialized = 1;
+    usb_status.port_count = xhci_portCount();
+
+    sleep_ms(100); // let attached devices settle after port power
+    usb_enumerate_devices();
+    return 1;
+}
+
+int usb_shutdown(void) {
+    if (!usb_status.xhci_initialized) return 0;
+
+    for (int i = 0; i < USB_MAX_DEVICES; i++) {
+        if (usb_devices[i].slot) usb_detach(&usb_devices[i]);
+    }
+    return 1;
+}
+
+// Attaches whatever is connected and not known yet, drops what went away
+int usb_enumerate_devices(void) {
+    if (!usb_status.xhci_initialized) return 0;
+
+    for (int port = 1; port <= usb_status.port_count; port++) {
+        usb_device_t *dev = usb_deviceOnPort(port);
+        int connected = xhci_portConnected(port);
+
+        if (dev && !connected) usb_detach(dev);
+        else if (!dev && connected) usb_attach(port);
+    }
+    return usb_status.usb_device_count;
+}
+
+void usb_update(void) {
+    if (!usb_status.xhci_initialized) return;
+
+    xhci_poll();
+    if (xhci_portChanged()) usb_enumerate_devices();
+}
+
+int usb_device_count(void) {
+    return usb_status.usb_device_count;
+}
+
+usb_device_t* usb_get_device(int index) {
+    if (index < 0 || index >= USB_MAX_DEVICES || !usb_devices[index].slot) return 0;
+    return &usb_devices[index];
+}
+
+int usb_control(usb_device_t *dev, unsigned char requestType, unsigned char request,
+                unsigned short value, unsigned short index, void *data, unsigned short length) {
+    if (!dev || !dev->slot) return -1;
+    return xhci_control(dev->slot, requestType, request, value, index, data, length);
+}
+
+void usb_get_status(usb_status_info_t *status) {
+    *status = usb_status;
+}
+
+static char *usb_hex(char *p, unsigned int value, int digits)
+{
+    for (int i = digits - 1; i >= 0; i--) *p++ = "0123456789abcdef"[(value >> (i * 4)) & 0xF];
+    return p;
+}
+
+void usb_print_info(void (*print_func)(const char*)) {
+    char line[32];
+
+    if (!usb_status.xhci_initialized) {
+        print_func("USB: no controller\n");
+        return;
+    }
+
+    for (int i = 0; i < USB_MAX_DEVICES; i++) {
+        usb_device_t *dev = &usb_devices[i];
+        if (!dev->slot) continue;
+
+        // "port 1: 046d:c077 class 00"
+        char *p = line;
+        const char *s = "port ";
+        while (*s) *p++ = *s++;
+        *p++ = '0' + dev->port / 10 % 10;
+        *p++ = '0' + dev->port % 10;
+        *p++ = ':';
+        *p++ = ' ';
+        p = usb_hex(p, dev->vendor_id, 4);
+        *p++ = ':';
+        p = usb_hex(p, dev->product_id, 4);
+        s = " class ";
+        while (*s) *p++ = *s++;
+        p = usb_hex(p, dev->device_class, 2);
+        *p++ = '\n';
+        *p = 0;
+        print_func(line);
+    }
+}
@@ -0,0 +1,828 @@
+// xHCI host controller driver
+// src/input/usb/xhci.c
+//
+// One interrupter, one event ring segment, one segment per transfer ring.
+// Commands and control transfers are synchronous (enumeration only), the
+// interrupt/bulk endpoints complete through callbacks from xhci_poll.
+
+#include "../../include/io.h"
+#include "../../include/irq.h"
+#include "../../include/mmu.h"
+#include "../../include/mem.h"
+#include "../../include/timer.h"
+#include "../../include/log.h"
+#include "xhci.h"
+
+#define XHCI_POOL_ORDER 9 // 2 MB: one MMU block, mapped non-cacheable
+
+// Capability registers
+enum {
+    CAP_LENGTH     = 0x00,
+    CAP_HCSPARAMS1 = 0x04,
+    CAP_HCSPARAMS2 = 0x08,
+    CAP_HCCPARAMS1 = 0x10,
+    CAP_DBOFF      = 0x14,
+    CAP_RTSOFF     = 0x18
+};
+
+// Operational registers
+enum {
+    OP_USBCMD   = 0x00,
+    OP_USBSTS   = 0x04,
+    OP_CRCR     = 0x18,
+    OP_DCBAAP   = 0x30,
+    OP_CONFIG   = 0x38,
+    OP_PORTSC   = 0x400  // + 0x10 * (port - 1)
+};
+
+// Runtime registers, interrupter 0
+enum {
+    RT_IMAN   = 0x20,
+    RT_IMOD   = 0x24,
+    RT_ERSTSZ = 0x28,
+    RT_ERSTBA = 0x30,
+    RT_ERDP   = 0x38
+};
+
+enum {
+    USBCMD_RUN   = 1 << 0,
+    USBCMD_HCRST = 1 << 1,
+    USBCMD_INTE  = 1 << 2,
+
+    USBSTS_HCH   = 1 << 0,
+    USBSTS_EINT  = 1 << 3,
+    USBSTS_CNR   = 1 << 11,
+
+    IMAN_IP      = 1 << 0,
+    IMAN_IE      = 1 << 1,
+    ERDP_EHB     = 1 << 3,
+
+    PORTSC_CCS     = 1 << 0,
+    PORTSC_PED     = 1 << 1,  // write 1 disables the port
+    PORTSC_PR      = 1 << 4,
+    PORTSC_PP      = 1 << 9,
+    PORTSC_PRC     = 1 << 21,
+    PORTSC_CHANGES = 0x7F << 17, // CSC..CEC, write 1 to clear
+
+    LEGSUP_BIOS_OWNED = 1 << 16,
+    LEGSUP_OS_OWNED   = 1 << 24
+};
+
+// TRB control bits and types
+enum {
+    TRB_CYCLE  = 1 << 0,
+    TRB_TC     = 1 << 1,  // link: toggle cycle
+    TRB_ISP    = 1 << 2,
+    TRB_CH     = 1 << 4,
+    TRB_IOC    = 1 << 5,
+    TRB_IDT    = 1 << 6,
+    TRB_BEI    = 1 << 9,
+    TRB_DIR_IN = 1 << 16,
+
+    TRB_NORMAL          = 1,
+    TRB_SETUP           = 2,
+    TRB_DATA            = 3,
+    TRB_STATUS          = 4,
+    TRB_LINK            = 6,
+    TRB_ENABLE_SLOT     = 9,
+    TRB_DISABLE_SLOT    = 10,
+    TRB_ADDRESS_DEVICE  = 11,
+    TRB_CONFIGURE_EP    = 12,
+    TRB_EVALUATE        = 13,
+    TRB_RESET_EP        = 14,
+    TRB_STOP_EP         = 15,
+    TRB_SET_DEQUEUE     = 16,
+    TRB_EV_TRANSFER     = 32,
+    TRB_EV_COMMAND      = 33,
+    TRB_EV_PORT         = 34
+};
+
+#define TRB_TYPE(t) ((unsigned int)(t) << 10)
+
+typedef struct {
+    unsigned long param;
+    unsigned int status;
+    unsigned int control;
+} xhci_trb_t;
+
+// Indices run over the first XHCI_RING_TRBS - 1 entries, the last one is the link
+typedef struct {
+    volatile xhci_trb_t *trbs;
+    unsigned int enqueue;
+    unsigned int dequeue;   // oldest TRB the controller may still own
+    unsigned int cycle;
+    void *buffers[XHCI_RING_TRBS - 1];
+    unsigned int lengths[XHCI_RING_TRBS - 1];
+} xhci_ring_t;
+
+typedef struct {
+    xhci_ring_t ring;
+    xhci_complete_fn complete;
+    void *arg;
+} xhci_ep_t;
+
+typedef struct {
+    void *out;              // device context, owned by the controller
+    void *in;               // input context for commands
+    int speed;
+    xhci_ep_t *eps[32];     // by DCI
+} xhci_slot_t;
+
+static unsigned long xhci_base, xhci_op, xhci_rt, xhci_db;
+static int xhci_ready = 0;
+static int xhci_ports, xhci_slotCount;
+static unsigned int xhci_ctxSize;
+
+static unsigned char *xhci_pool;
+static unsigned long xhci_poolNext;
+static void *xhci_spareRings[XHCI_MAX_SLOTS];
+static int xhci_spareCount = 0;
+static slab_cache_t xhci_epCache;
+
+static volatile unsigned long *xhci_dcbaa;
+static xhci_slot_t xhci_slots[XHCI_MAX_SLOTS + 1];
+static xhci_ring_t xhci_cmdRing;
+
+static volatile xhci_trb_t *xhci_events;
+static unsigned int xhci_evDequeue = 0;
+static unsigned int xhci_evCycle = 1;
+static volatile int xhci_polling = 0;
+static volatile int xhci_repoll = 0;     // set by every xhci_poll, also the ones that found it held
+static volatile int xhci_portEvents = 0;
+
+// Synchronous commands and control transfers, one at a time
+static volatile int xhci_cmdDone, xhci_cmdCode, xhci_cmdSlot;
+static volatile int xhci_ctlDone, xhci_ctlCode;
+static volatile unsigned int xhci_ctlLength;
+static void *xhci_ctlBuffer;
+
+static inline unsigned int rd(unsigned long reg) { return mmio_read(reg); }
+static inline void wr(unsigned long reg, unsigned int v) { mmio_write(reg, v); }
+
+static inline void wr64(unsigned long reg, unsigned long v)
+{
+    mmio_write(reg, (unsigned int)v);
+    mmio_write(reg + 4, (unsigned int)(v >> 32));
+}
+
+static inline unsigned long xhci_bus(const volatile void *p)
+{
+    return pcie_bus_address(p);
+}
+
+static int xhci_waitReg(unsigned long reg, unsigned int mask, unsigned int value)
+{
+    unsigned long start = timer_now_us();
+
+    while ((rd(reg) & mask) != value) {
+        if (timer_now_us() - start > XHCI_TIMEOUT_US) return 0;
+    }
+    return 1;
+}
+
+// Memory
+
+void *xhci_dmaAlloc(unsigned long size, unsigned long align)
+{
+    unsigned long offset = (xhci_poolNext + align - 1) & ~(align - 1);
+
+    if (!xhci_pool || offset + size > (PAGE_SIZE << XHCI_POOL_ORDER)) return 0;
+
+    xhci_poolNext = offset + size;
+    unsigned char *p = xhci_pool + offset;
+    for (unsigned long i = 0; i < size; i++) p[i] = 0;
+    return p;
+}
+
+static volatile unsigned int *xhci_ctx(void *base, int index)
+{
+    return (volatile unsigned int *)((unsigned char *)base + index * xhci_ctxSize);
+}
+
+// Rings
+
+static int xhci_ringInit(xhci_ring_t *r)
+{
+    // a page never crosses the 64 KB boundary a segment must not cross
+    void *trbs = xhci_spareCount ? xhci_spareRings[--xhci_spareCount]
+                                 : xhci_dmaAlloc(XHCI_RING_TRBS * sizeof(xhci_trb_t), PAGE_SIZE);
+    if (!trbs) return 0;
+
+    r->trbs = trbs;
+    for (int i = 0; i < XHCI_RING_TRBS; i++) {
+        r->trbs[i].param = 0;
+        r->trbs[i].status = 0;
+        r->trbs[i].control = 0;
+    }
+    r->trbs[XHCI_RING_TRBS - 1].param = xhci_bus(trbs);
+    r->enqueue = r->dequeue = 0;
+    r->cycle = 1;
+    return 1;
+}
+
+static void xhci_ringRelease(xhci_ring_t *r)
+{
+    if (r->trbs && xhci_spareCount < XHCI_MAX_SLOTS) xhci_spareRings[xhci_spareCount++] = (void *)r->trbs;
+    r->trbs = 0;
+}
+
+static unsigned int xhci_ringFree(const xhci_ring_t *r)
+{
+    unsigned int used = (r->enqueue + (XHCI_RING_TRBS - 1) - r->dequeue) % (XHCI_RING_TRBS - 1);
+    return XHCI_RING_TRBS - 2 - used;
+}
+
+static unsigned int xhci_ringPush(xhci_ring_t *r, unsigned long param, unsigned int status,
+                                  unsigned int control, void *buffer)
+{
+    unsigned int i = r->enqueue;
+    volatile xhci_trb_t *t = &r->trbs[i];
+
+    r->buffers[i] = buffer;
+    r->lengths[i] = status & 0x1FFFF;
+
+    t->param = param;
+    t->status = status;
+    asm volatile("dmb oshst" ::: "memory"); // the cycle bit hands it over, it goes last
+    t->control = control | r->cycle;
+
+    if (++r->enqueue == XHCI_RING_TRBS - 1) {
+        volatile xhci_trb_t *link = &r->trbs[XHCI_RING_TRBS - 1];
+
+        asm volatile("dmb oshst" ::: "memory");
+        link->control = TRB_TYPE(TRB_LINK) | TRB_TC | (control & TRB_CH) | r->cycle;
+        r->enqueue = 0;
+        r->cycle ^= 1;
+    }
+    return i;
+}
+
+static void xhci_doorbell(int slot, unsigned int target)
+{
+    asm volatile("dsb st" ::: "memory"); // TRBs in memory before the controller looks
+    wr(xhci_db + slot * 4, target);
+}
+
+// Events
+
+static void xhci_transferEvent(unsigned long param, unsigned int status, unsigned int control)
+{
+    int slot = control >> 24;
+    int dci = (control >> 16) & 0x1F;
+    xhci_ep_t *ep = slot <= XHCI_MAX_SLOTS ? xhci_slots[slot].eps[dci] : 0;
+
+    if (!ep || !ep->ring.trbs) return;
+
+    unsigned long offset = param - xhci_bus(ep->ring.trbs);
+    if (offset >= (XHCI_RING_TRBS - 1) * sizeof(xhci_trb_t)) return;
+
+    unsigned int i = offset / sizeof(xhci_trb_t);
+    unsigned int residual = status & 0xFFFFFF;
+    unsigned int length = residual < ep->ring.lengths[i] ? ep->ring.lengths[i] - residual : 0;
+
+    // completions are in order, everything up to this TRB is ours again
+    ep->ring.dequeue = (i + 1) % (XHCI_RING_TRBS - 1);
+
+    if (ep->complete) ep->complete(ep->arg, ep->ring.buffers[i], length, status >> 24);
+}
+
+static void xhci_handleEvent(unsigned long param, unsigned int status, unsigned int control)
+{
+    switch ((control >> 10) & 0x3F) {
+    case TRB_EV_TRANSFER:
+        xhci_transferEvent(param, status, control);
+        break;
+    case TRB_EV_COMMAND: {
+        unsigned long offset = param - xhci_bus(xhci_cmdRing.trbs);
+        xhci_cmdRing.dequeue = (offset / sizeof(xhci_trb_t) + 1) % (XHCI_RING_TRBS - 1);
+        xhci_cmdCode = status >> 24;
+        xhci_cmdSlot = control >> 24;
+        __atomic_store_n(&xhci_cmdDone, 1, __ATOMIC_RELEASE);
+        break;
+    }
+    case TRB_EV_PORT:
+        __atomic_add_fetch(&xhci_portEvents, 1, __ATOMIC_RELAXED);
+        break;
+    default:
+        break;
+    }
+}
+
+int xhci_poll(void)
+{
+    int handled = 0;
+
+    if (!xhci_ready) return 0;
+
+    // Whoever holds xhci_polling looks at the ring again before letting go,
+    // so an event that arrives while the IRQ is locked out isn't left behind
+    __atomic_store_n(&xhci_repoll, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&xhci_polling, 1, __ATOMIC_SEQ_CST)) return 0; // the IRQ or another core has it
+
+    for (int pass = 0;; pass++) {
+        __atomic_store_n(&xhci_repoll, 0, __ATOMIC_SEQ_CST);
+
+        for (;;) {
+            volatile xhci_trb_t *ev = &xhci_events[xhci_evDequeue];
+            unsigned int control = ev->control;
+
+            if ((control & TRB_CYCLE) != xhci_evCycle) break;
+            asm volatile("dmb oshld" ::: "memory");
+
+            xhci_handleEvent(ev->param, ev->status, control);
+            handled++;
+
+            if (++xhci_evDequeue == XHCI_EVENT_TRBS) {
+                xhci_evDequeue = 0;
+                xhci_evCycle ^= 1;
+            }
+        }
+
+        // one dequeue pointer update for the whole batch. It also clears EHB,
+        // which an interrupt we answer for may have set after the last update.
+        if (handled || pass) wr64(xhci_rt + RT_ERDP, xhci_bus(&xhci_events[xhci_evDequeue]) | ERDP_EHB);
+
+        __atomic_store_n(&xhci_polling, 0, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&xhci_repoll, __ATOMIC_SEQ_CST) ||
+            __atomic_exchange_n(&xhci_polling, 1, __ATOMIC_SEQ_CST)) break;
+    }
+
+    return handled;
+}
+
+static void xhci_irqHandler(void *arg)
+{
+    (void)arg;
+
+    wr(xhci_op + OP_USBSTS, USBSTS_EINT);
+    wr(xhci_rt + RT_IMAN, IMAN_IE | IMAN_IP);
+    xhci_poll();
+}
+
+void xhci_enableInterrupts(void)
+{
+    if (!xhci_ready) return;
+    irq_register(IRQ_PCIE_INTA, xhci_irqHandler, 0);
+}
+
+// Commands
+
+static int xhci_command(unsigned long param, unsigned int control)
+{
+    xhci_cmdDone = 0;
+    xhci_ringPush(&xhci_cmdRing, param, 0, control, 0);
+    xhci_doorbell(0, 0);
+
+    unsigned long start = timer_now_us();
+    while (!__atomic_load_n(&xhci_cmdDone, __ATOMIC_ACQUIRE)) {
+        xhci_poll();
+        if (timer_now_us() - start > XHCI_TIMEOUT_US) {
+            LOG_WARN("xHCI: Command %d timed out", (control >> 10) & 0x3F);
+            return 0;
+        }
+    }
+    return xhci_cmdCode;
+}
+
+static void xhci_controlDone(void *arg, void *buffer, unsigned int length, int code)
+{
+    (void)arg;
+
+    if (code != XHCI_CC_SUCCESS && code != XHCI_CC_SHORT) {
+        xhci_ctlCode = code;
+        __atomic_store_n(&xhci_ctlDone, 1, __ATOMIC_RELEASE);
+    } else if (buffer) {
+        xhci_ctlLength = length; // data stage
+    } else {
+        xhci_ctlCode = XHCI_CC_SUCCESS; // status stage ends the transfer
+        __atomic_store_n(&xhci_ctlDone, 1, __ATOMIC_RELEASE);
+    }
+}
+
+// Endpoint states in the output context
+enum {
+    EP_STATE_RUNNING = 1,
+    EP_STATE_HALTED  = 2,
+    EP_STATE_STOPPED = 3
+};
+
+// Moves the ring past a failed transfer. A halted endpoint (STALL, babble)
+// is reset; one that is still running (timeout) has to be stopped instead,
+// Reset Endpoint only works on a halted one. The TRBs belong to the
+// controller until the Set TR Dequeue has succeeded.
+static void xhci_recoverEndpoint(int slot, int dci)
+{
+    xhci_ring_t *r = &xhci_slots[slot].eps[dci]->ring;
+    volatile unsigned int *ec = xhci_ctx(xhci_slots[slot].out, dci);
+    unsigned int target = (slot << 24) | (dci << 16);
+    int code = XHCI_CC_SUCCESS;
+
+    switch (ec[0] & 7) {
+    case EP_STATE_HALTED:
+        code = xhci_command(0, TRB_TYPE(TRB_RESET_EP) | target);
+        break;
+    case EP_STATE_RUNNING:
+        code = xhci_command(0, TRB_TYPE(TRB_STOP_EP) | target);
+        break;
+    }
+
+    if (code == XHCI_CC_SUCCESS && (ec[0] & 7) != EP_STATE_STOPPED) code = 0; // disabled or in error
+    if (code == XHCI_CC_SUCCESS) {
+        code = xhci_command(xhci_bus(&r->trbs[r->enqueue]) | r->cycle, TRB_TYPE(TRB_SET_DEQUEUE) | target);
+    }
+
+    if (code != XHCI_CC_SUCCESS) {
+        LOG_WARN("xHCI: Slot %d endpoint %d not recovered (state %d, code %d)", slot, dci, ec[0] & 7, code);
+        return;
+    }
+    r->dequeue = r->enqueue;
+}
+
+// Root hub
+
+static void xhci_takeOwnership(unsigned int xecp)
+{
+    unsigned long ptr = xhci_base + (xecp << 2);
+
+    while (xecp) {
+        unsigned int cap = rd(ptr);
+
+        if ((cap & 0xFF) == 1) {
+            wr(ptr, cap | LEGSUP_OS_OWNED);
+            if (!xhci_waitReg(ptr, LEGSUP_BIOS_OWNED, 0)) LOG_WARN("xHCI: BIOS handoff timed out");
+            wr(ptr + 4, 0xE0000000); // SMIs off, pending ones cleared
+        }
+
+        xecp = (cap >> 8) & 0xFF;
+        ptr += xecp << 2;
+    }
+}
+
+static unsigned long xhci_portReg(int port)
+{
+    return xhci_op + OP_PORTSC + (port - 1) * 0x10;
+}
+
+// Writes PORTSC without disabling the port or acking changes by accident
+static void xhci_portWrite(int port, unsigned int set)
+{
+    unsigned int v = rd(xhci_portReg(port)) & ~(PORTSC_PED | PORTSC_CHANGES);
+    wr(xhci_portReg(port), v | set);
+}
+
+int xhci_portCount(void)
+{
+    return xhci_ready ? xhci_ports : 0;
+}
+
+int xhci_portConnected(int port)
+{
+    if (port < 1 || port > xhci_portCount()) return 0;
+    return rd(xhci_portReg(port)) & PORTSC_CCS;
+}
+
+int xhci_portSpeed(int port)
+{
+    if (port < 1 || port > xhci_portCount()) return 0;
+    return (rd(xhci_portReg(port)) >> 10) & 0xF;
+}
+
+int xhci_portChanged(void)
+{
+    int events = __atomic_exchange_n(&xhci_portEvents, 0, __ATOMIC_RELAXED);
+
+    if (events) {
+        for (int port = 1; port <= xhci_portCount(); port++) xhci_portWrite(port, PORTSC_CHANGES & ~PORTSC_PRC);
+    }
+    return events;
+}
+
+int xhci_resetPort(int port)
+{
+    if (!xhci_portConnected(port)) return 0;
+
+    xhci_portWrite(port, PORTSC_PR);
+    if (!xhci_waitReg(xhci_portReg(port), PORTSC_PRC, PORTSC_PRC)) return 0;
+    xhci_portWrite(port, PORTSC_CHANGES);
+    sleep_ms(10); // reset recovery
+
+    unsigned int v = rd(xhci_portReg(port));
+    return (v & PORTSC_PED) ? (v >> 10) & 0xF : 0;
+}
+
+// Devices
+
+int xhci_enableSlot(void)
+{
+    if (xhci_command(0, TRB_TYPE(TRB_ENABLE_SLOT)) != XHCI_CC_SUCCESS) return 0;
+
+    int slot = xhci_cmdSlot;
+    if (slot < 1 || slot > xhci_slotCount) return 0;
+
+    xhci_slot_t *s = &xhci_slots[slot];
+    if (!s->out) {
+        // kept for the next device that gets this slot id
+        s->out = xhci_dmaAlloc(32 * xhci_ctxSize, 64);
+        s->in = xhci_dmaAlloc(33 * xhci_ctxSize, 64);
+        if (!s->out || !s->in) return 0;
+    } else {
+        for (unsigned int i = 0; i < 32 * xhci_ctxSize; i++) ((volatile unsigned char *)s->out)[i] = 0;
+    }
+
+    xhci_dcbaa[slot] = xhci_bus(s->out);
+    return slot;
+}
+
+static void xhci_freeEndpoint(xhci_slot_t *s, int dci)
+{
+    if (!s->eps[dci]) return;
+
+    xhci_ringRelease(&s->eps[dci]->ring);
+    slab_free(&xhci_epCache, s->eps[dci]);
+    s->eps[dci] = 0;
+}
+
+void xhci_disableSlot(int slot)
+{
+    if (slot < 1 || slot > xhci_slotCount) return;
+
+    xhci_command(0, TRB_TYPE(TRB_DISABLE_SLOT) | (slot << 24));
+    xhci_dcbaa[slot] = 0;
+    for (int dci = 1; dci < 32; dci++) xhci_freeEndpoint(&xhci_slots[slot], dci);
+}
+
+static xhci_ep_t *xhci_newEndpoint(xhci_slot_t *s, int dci, xhci_complete_fn complete, void *arg)
+{
+    xhci_freeEndpoint(s, dci);
+
+    xhci_ep_t *ep = slab_alloc(&xhci_epCache);
+    if (!ep) return 0;
+
+    ep->ring.trbs = 0;
+    if (!xhci_ringInit(&ep->ring)) {
+        slab_free(&xhci_epCache, ep);
+        return 0;
+    }
+    ep->complete = complete;
+    ep->arg = arg;
+    s->eps[dci] = ep;
+    return ep;
+}
+
+static void xhci_clearInput(xhci_slot_t *s)
+{
+    for (unsigned int i = 0; i < 33 * xhci_ctxSize; i++) ((volatile unsigned char *)s->in)[i] = 0;
+}
+
+int xhci_addressDevice(int slot, int port, int speed)
+{
+    xhci_slot_t *s = &xhci_slots[slot];
+    unsigned int maxPacket = speed == XHCI_SPEED_SUPER ? 512 : speed == XHCI_SPEED_HIGH ? 64 : 8;
+
+    xhci_ep_t *ep0 = xhci_newEndpoint(s, 1, xhci_controlDone, 0);
+    if (!ep0) return 0;
+    s->speed = speed;
+
+    xhci_clearInput(s);
+    xhci_ctx(s->in, 0)[1] = (1 << 0) | (1 << 1); // add slot and EP0
+
+    volatile unsigned int *sc = xhci_ctx(s->in, 1);
+    sc[0] = (1u << 27) | (speed << 20);
+    sc[1] = port << 16;
+
+    volatile unsigned int *ec = xhci_ctx(s->in, 2);
+    unsigned long ring = xhci_bus(ep0->ring.trbs);
+    ec[1] = (3 << 1) | (XHCI_EP_CONTROL << 3) | (maxPacket << 16);
+    ec[2] = (unsigned int)ring | 1;
+    ec[3] = ring >> 32;
+    ec[4] = 8;
+
+    return xhci_command(xhci_bus(s->in), TRB_TYPE(TRB_ADDRESS_DEVICE) | (slot << 24)) == XHCI_CC_SUCCESS;
+}
+
+int xhci_setMaxPacket0(int slot, unsigned int maxPacket)
+{
+    xhci_slot_t *s = &xhci_slots[slot];
+
+    xhci_clearInput(s);
+    xhci_ctx(s->in, 0)[1] = 1 << 1;
+
+    volatile unsigned int *ec = xhci_ctx(s->in, 2);
+    volatile unsigned int *out = xhci_ctx(s->out, 1);
+    for (int i = 0; i < 5; i++) ec[i] = out[i];
+    ec[1] = (ec[1] & 0xFFFF) | (maxPacket << 16);
+
+    return xhci_command(xhci_bus(s->in), TRB_TYPE(TRB_EVALUATE) | (slot << 24)) == XHCI_CC_SUCCESS;
+}
+
+int xhci_control(int slot, unsigned char requestType, unsigned char request, unsigned short value,
+                 unsigned short index, void *data, unsigned short length)
+{
+    if (slot < 1 || slot > xhci_slotCount || !xhci_slots[slot].eps[1] || length > PAGE_SIZE) return -1;
+
+    xhci_ring_t *r = &xhci_slots[slot].eps[1]->ring;
+    unsigned char *buf = xhci_ctlBuffer;
+    int in = requestType & 0x80;
+
+    if (xhci_ringFree(r) < 3) return -1;
+    if (!in) {
+        for (int i = 0; i < length; i++) buf[i] = ((unsigned char *)data)[i];
+    }
+
+    unsigned long setup = requestType | (request << 8) | ((unsigned long)value << 16) |
+                          ((unsigned long)index << 32) | ((unsigned long)length << 48);
+    unsigned int transferType = length ? (in ? 3 : 2) : 0;
+
+    xhci_ctlDone = 0;
+    xhci_ctlLength = 0;
+    xhci_ringPush(r, setup, 8, TRB_TYPE(TRB_SETUP) | TRB_IDT | (transferType << 16), 0);
+    if (length) {
+        xhci_ringPush(r, xhci_bus(buf), length,
+                      TRB_TYPE(TRB_DATA) | TRB_ISP | TRB_IOC | (in ? TRB_DIR_IN : 0), buf);
+    }
+    xhci_ringPush(r, 0, 0, TRB_TYPE(TRB_STATUS) | TRB_IOC | (length && in ? 0 : TRB_DIR_IN), 0);
+    xhci_doorbell(slot, 1);
+
+    unsigned long start = timer_now_us();
+    while (!__atomic_load_n(&xhci_ctlDone, __ATOMIC_ACQUIRE)) {
+        xhci_poll();
+        if (timer_now_us() - start > XHCI_TIMEOUT_US) {
+            xhci_ctlCode = 0;
+            break;
+        }
+    }
+
+    if (xhci_ctlCode != XHCI_CC_SUCCESS) {
+        xhci_recoverEndpoint(slot, 1);
+        return -1;
+    }
+
+    if (in) {
+        for (unsigned int i = 0; i < xhci_ctlLength; i++) ((unsigned char *)data)[i] = buf[i];
+    }
+    return length ? (int)xhci_ctlLength : 0;
+}
+
+// Endpoint interval in 2^n * 125 us frames, from the descriptor's bInterval
+static unsigned int xhci_interval(int speed, int type, unsigned int interval)
+{
+    if (type != XHCI_EP_INTR_IN && type != XHCI_EP_INTR_OUT &&
+        type != XHCI_EP_ISOCH_IN && type != XHCI_EP_ISOCH_OUT) return 0;
+
+    if (speed == XHCI_SPEED_HIGH || speed == XHCI_SPEED_SUPER) {
+        if (interval < 1) interval = 1;
+        return interval > 16 ? 15 : interval - 1;
+    }
+
+    // full/low speed: bInterval is in ms
+    unsigned int frames = interval * 8, n = 0;
+    while ((2u << n) <= frames) n++;
+    return n < 3 ? 3 : n > 10 ? 10 : n;
+}
+
+int xhci_configureEndpoint(int slot, unsigned char address, int type, unsigned int maxPacket,
+                           unsigned int interval, xhci_complete_fn complete, void *arg)
+{
+    if (slot < 1 || slot > xhci_slotCount) return 0;
+
+    xhci_slot_t *s = &xhci_slots[slot];
+    int dci = (address & 0xF) * 2 + ((address & 0x80) ? 1 : 0);
+    xhci_ep_t *ep = xhci_newEndpoint(s, dci, complete, arg);
+    if (!ep) return 0;
+
+    xhci_clearInput(s);
+    xhci_ctx(s->in, 0)[1] = (1 << 0) | (1u << dci);
+
+    // slot context as the controller has it, with room for the new endpoint
+    volatile unsigned int *sc = xhci_ctx(s->in, 1);
+    volatile unsigned int *out = xhci_ctx(s->out, 0);
+    for (int i = 0; i < 4; i++) sc[i] = out[i];
+    sc[3] = 0;
+    if ((unsigned int)dci > (sc[0] >> 27)) sc[0] = (sc[0] & ~(0x1Fu << 27)) | ((unsigned int)dci << 27);
+
+    volatile unsigned int *ec = xhci_ctx(s->in, dci + 1);
+    unsigned long ring = xhci_bus(ep->ring.trbs);
+    ec[0] = xhci_interval(s->speed, type, interval) << 16;
+    ec[1] = (3 << 1) | (type << 3) | (maxPacket << 16);
+    ec[2] = (unsigned int)ring | 1;
+    ec[3] = ring >> 32;
+    ec[4] = (maxPacket << 16) | maxPacket; // max ESIT payload, average TRB length
+
+    if (xhci_command(xhci_bus(s->in), TRB_TYPE(TRB_CONFIGURE_EP) | (slot << 24)) != XHCI_CC_SUCCESS) {
+        xhci_freeEndpoint(s, dci);
+        return 0;
+    }
+    return 1;
+}
+
+int xhci_queueTransfers(int slot, unsigned char address, void *const *buffers,
+                        const unsigned int *lengths, int count)
+{
+    int dci = (address & 0xF) * 2 + ((address & 0x80) ? 1 : 0);
+    xhci_ep_t *ep = slot >= 1 && slot <= xhci_slotCount ? xhci_slots[slot].eps[dci] : 0;
+
+    if (!ep || count <= 0 || count > XHCI_MAX_BATCH) return 0;
+
+    unsigned long flags = irq_save(); // completions update dequeue from the IRQ
+    if ((unsigned int)count > xhci_ringFree(&ep->ring)) {
+        irq_restore(flags);
+        return 0;
+    }
+
+    // one interrupt per batch: the others still post events, just quietly
+    for (int i = 0; i < count; i++) {
+        unsigned int control = TRB_TYPE(TRB_NORMAL) | TRB_ISP | TRB_IOC | (i < count - 1 ? TRB_BEI : 0);
+        xhci_ringPush(&ep->ring, xhci_bus(buffers[i]), lengths[i] & 0x1FFFF, control, buffers[i]);
+    }
+    irq_restore(flags);
+
+    xhci_doorbell(slot, dci);
+    return count;
+}
+
+// Controller
+
+int xhci_init(pcie_device_t *dev)
+{
+    if (xhci_ready) return 1;
+    if (!dev || !dev->bar_addr[0]) return 0;
+
+    xhci_pool = page_alloc(XHCI_POOL_ORDER);
+    if (!xhci_pool) {
+        LOG_ERROR("xHCI: No memory for rings");
+        return 0;
+    }
+    mmu_mapRegion((unsigned long)xhci_pool, PAGE_SIZE << XHCI_POOL_ORDER, MMU_NORMAL_NC);
+    xhci_poolNext = 0;
+    slab_cacheInit(&xhci_epCache, "xhci-ep", sizeof(xhci_ep_t), 8);
+
+    xhci_base = dev->bar_addr[0];
+    xhci_op = xhci_base + (rd(xhci_base + CAP_LENGTH) & 0xFF);
+    xhci_rt = xhci_base + (rd(xhci_base + CAP_RTSOFF) & ~0x1F);
+    xhci_db = xhci_base + (rd(xhci_base + CAP_DBOFF) & ~0x3);
+
+    unsigned int hcs1 = rd(xhci_base + CAP_HCSPARAMS1);
+    unsigned int hcs2 = rd(xhci_base + CAP_HCSPARAMS2);
+    unsigned int hcc1 = rd(xhci_base + CAP_HCCPARAMS1);
+
+    xhci_ports = hcs1 >> 24;
+    xhci_slotCount = (hcs1 & 0xFF) < XHCI_MAX_SLOTS ? (hcs1 & 0xFF) : XHCI_MAX_SLOTS;
+    xhci_ctxSize = (hcc1 & (1 << 2)) ? 64 : 32;
+
+    xhci_takeOwnership(hcc1 >> 16);
+
+    // stop, then reset
+    wr(xhci_op + OP_USBCMD, rd(xhci_op + OP_USBCMD) & ~USBCMD_RUN);
+    if (!xhci_waitReg(xhci_op + OP_USBSTS, USBSTS_HCH, USBSTS_HCH)) return 0;
+    wr(xhci_op + OP_USBCMD, USBCMD_HCRST);
+    if (!xhci_waitReg(xhci_op + OP_USBCMD, USBCMD_HCRST, 0) ||
+        !xhci_waitReg(xhci_op + OP_USBSTS, USBSTS_CNR, 0)) {
+        LOG_ERROR("xHCI: Reset timed out");
+        return 0;
+    }
+
+    wr(xhci_op + OP_CONFIG, xhci_slotCount);
+
+    xhci_dcbaa = xhci_dmaAlloc((XHCI_MAX_SLOTS + 1) * 8, 64);
+    xhci_ctlBuffer = xhci_dmaAlloc(PAGE_SIZE, PAGE_SIZE);
+
+    unsigned int scratch = (((hcs2 >> 21) & 0x1F) << 5) | (hcs2 >> 27);
+    if (scratch) {
+        volatile unsigned long *array = xhci_dmaAlloc(scratch * 8, 64);
+        for (unsigned int i = 0; array && i < scratch; i++) array[i] = xhci_bus(xhci_dmaAlloc(PAGE_SIZE, PAGE_SIZE));
+        xhci_dcbaa[0] = xhci_bus(array);
+    }
+    wr64(xhci_op + OP_DCBAAP, xhci_bus(xhci_dcbaa));
+
+    if (!xhci_ringInit(&xhci_cmdRing)) return 0;
+    wr64(xhci_op + OP_CRCR, xhci_bus(xhci_cmdRing.trbs) | 1);
+
+    // one event ring segment
+    xhci_events = xhci_dmaAlloc(XHCI_EVENT_TRBS * sizeof(xhci_trb_t), PAGE_SIZE);
+    volatile unsigned int *erst = xhci_dmaAlloc(16, 64);
+    if (!xhci_events || !erst) return 0;
+
+    erst[0] = (unsigned int)xhci_bus(xhci_events);
+    erst[1] = xhci_bus(xhci_events) >> 32;
+    erst[2] = XHCI_EVENT_TRBS;
+    xhci_evDequeue = 0;
+    xhci_evCycle = 1;
+
+    wr(xhci_rt + RT_ERSTSZ, 1);
+    wr64(xhci_rt + RT_ERDP, xhci_bus(xhci_events));
+    wr64(xhci_rt + RT_ERSTBA, xhci_bus(erst));
+    wr(xhci_rt + RT_IMOD, XHCI_IMOD_INTERVAL);
+    wr(xhci_rt + RT_IMAN, IMAN_IE | IMAN_IP);
+
+    wr(xhci_op + OP_USBCMD, USBCMD_RUN | USBCMD_INTE);
+    if (!xhci_waitReg(xhci_op + OP_USBSTS, USBSTS_HCH, 0)) return 0;
+
+    xhci_ready = 1;
+    for (int port = 1; port <= xhci_ports; port++) {
+        if (!(rd(xhci_portReg(port)) & PORTSC_PP)) xhci_portWrite(port, PORTSC_PP);
+    }
+
+    LOG_INFO("xHCI: %d ports, %d slots, %d-byte contexts, %d scratchpads",
+             xhci_ports, xhci_slotCount, xhci_ctxSize, scratch);
+    return 1;
+}
@@ -0,0 +1,83 @@
+#ifndef XHCI_H
+#define XHCI_H
+
+// xHCI host controller (the VL805 on the Pi 4, qemu-xhci under QEMU)
+//
+// Rings are single segments closed by a link TRB. Transfers are queued in
+// batches: all TRBs of a batch are written first and the doorbell is rung
+// once, and every TRB but the last sets BEI so the batch raises a single
+// interrupt. Events are dequeued in bulk (ERDP is written once per pass)
+// and the interrupter is moderated, so a stream of input reports doesn't
+// cost one interrupt per packet.
+//
+// All memory the controller reads or writes comes from one non-cacheable
+// pool, see xhci_dmaAlloc.
+
+#include "../../include/pcie.h"
+
+#define XHCI_RING_TRBS      256         // per ring, including the link TRB
+#define XHCI_EVENT_TRBS     256
+#define XHCI_MAX_SLOTS      32
+#define XHCI_MAX_BATCH      32
+#define XHCI_IMOD_INTERVAL  2000        // 250 ns units: at most one interrupt per 500 us
+#define XHCI_TIMEOUT_US     500000      // commands and control transfers
+
+// Port speeds as reported in PORTSC
+enum {
+    XHCI_SPEED_FULL  = 1,
+    XHCI_SPEED_LOW   = 2,
+    XHCI_SPEED_HIGH  = 3,
+    XHCI_SPEED_SUPER = 4
+};
+
+// Endpoint context types
+enum {
+    XHCI_EP_ISOCH_OUT = 1,
+    XHCI_EP_BULK_OUT  = 2,
+    XHCI_EP_INTR_OUT  = 3,
+    XHCI_EP_CONTROL   = 4,
+    XHCI_EP_ISOCH_IN  = 5,
+    XHCI_EP_BULK_IN   = 6,
+    XHCI_EP_INTR_IN   = 7
+};
+
+// Completion codes
+enum {
+    XHCI_CC_SUCCESS = 1,
+    XHCI_CC_SHORT   = 13
+};
+
+// Called from xhci_poll (so possibly in the interrupt handler) for every
+// finished transfer TRB; length is what actually moved
+typedef void (*xhci_complete_fn)(void *arg, void *buffer, unsigned int length, int code);
+
+int xhci_init(pcie_device_t *dev);
+void xhci_enableInterrupts(void);
+int xhci_poll(void);                    // handles every pending event, returns how many
+
+void *xhci_dmaAlloc(unsigned long size, unsigned long align); // never freed
+
+// Root hub ports, 1-based
+int xhci_portCount(void);
+int xhci_portConnected(int port);
+int xhci_portSpeed(int port);
+int xhci_portChanged(void);             // connect changes since the last call
+int xhci_resetPort(int port);           // returns the speed, 0 if nothing is enabled
+
+// Devices
+int xhci_enableSlot(void);              // slot id, 0 on failure
+void xhci_disableSlot(int slot);
+int xhci_addressDevice(int slot, int port, int speed);
+int xhci_setMaxPacket0(int slot, unsigned int maxPacket);
+// Control transfer on endpoint 0, returns the bytes moved or -1
+int xhci_control(int slot, unsigned char requestType, unsigned char request, unsigned short value,
+                 unsigned short index, void *data, unsigned short length);
+
+// Endpoints (address as in the descriptor, 0x81 = EP1 IN)
+int xhci_configureEndpoint(int slot, unsigned char address, int type, unsigned int maxPacket,
+                           unsigned int interval, xhci_complete_fn complete, void *arg);
+// Queues count transfers and rings the doorbell once; buffers must come from xhci_dmaAlloc
+int xhci_queueTransfers(int slot, unsigned char address, void *const *buffers,
+                        const unsigned int *lengths, int count);
+
+#endif
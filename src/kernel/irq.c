@@ -0,0 +1,177 @@
+// GIC-400 and IRQ dispatch
+// src/kernel/irq.c
+
+#include "../include/io.h"
+#include "../include/irq.h"
+#include "panic.h"
+
+enum {
+    GIC_BASE        = 0xFF840000,
+    GICD_BASE       = GIC_BASE + 0x1000,
+    GICC_BASE       = GIC_BASE + 0x2000,
+
+    GICD_CTLR       = GICD_BASE + 0x000,
+    GICD_TYPER      = GICD_BASE + 0x004,
+    GICD_ISENABLER  = GICD_BASE + 0x100,
+    GICD_ICENABLER  = GICD_BASE + 0x180,
+    GICD_ICPENDR    = GICD_BASE + 0x280,
+    GICD_IPRIORITYR = GICD_BASE + 0x400,
+    GICD_ITARGETSR  = GICD_BASE + 0x800,
+    GICD_ICFGR      = GICD_BASE + 0xC00,
+
+    GICC_CTLR       = GICC_BASE + 0x000,
+    GICC_PMR        = GICC_BASE + 0x004,
+    GICC_IAR        = GICC_BASE + 0x00C,
+    GICC_EOIR       = GICC_BASE + 0x010,
+
+    GIC_SPURIOUS    = 1020,
+    GIC_PRIORITY    = 0xA0
+};
+
+extern char exception_vectors[];
+
+static struct {
+    irq_handler_t handler;
+    void *arg;
+} irq_table[IRQ_MAX];
+
+static int irq_el = 1;
+
+void irq_init(void)
+{
+    unsigned long el;
+
+    asm volatile("mrs %0, CurrentEL" : "=r"(el));
+    irq_el = ((el >> 2) & 3) == 2 ? 2 : 1;
+
+    if (irq_el == 2) {
+        unsigned long hcr;
+        asm volatile("msr vbar_el2, %0" :: "r"((unsigned long)exception_vectors));
+        // IMO: physical IRQs are taken to EL2 while we run there
+        asm volatile("mrs %0, hcr_el2" : "=r"(hcr));
+        hcr |= (1UL << 4);
+        asm volatile("msr hcr_el2, %0" :: "r"(hcr));
+    } else {
+        asm volatile("msr vbar_el1, %0" :: "r"((unsigned long)exception_vectors));
+    }
+    asm volatile("isb");
+
+    unsigned int lines = ((mmio_read(GICD_TYPER) & 0x1F) + 1) * 32;
+    if (lines > IRQ_MAX) lines = IRQ_MAX;
+
+    mmio_write(GICD_CTLR, 0);
+
+    for (unsigned int i = 0; i < lines; i += 32) {
+        mmio_write(GICD_ICENABLER + i / 8, 0xFFFFFFFF);
+        mmio_write(GICD_ICPENDR + i / 8, 0xFFFFFFFF);
+    }
+    for (unsigned int i = 0; i < lines; i += 4) {
+        mmio_write(GICD_IPRIORITYR + i, GIC_PRIORITY * 0x01010101u);
+        if (i >= 32) mmio_write(GICD_ITARGETSR + i, 0x01010101); // SPIs go to core 0
+    }
+    for (unsigned int i = 32; i < lines; i += 16) {
+        mmio_write(GICD_ICFGR + i / 4, 0); // level triggered
+    }
+
+    mmio_write(GICD_CTLR, 1);
+    mmio_write(GICC_PMR, 0xF0);
+    mmio_write(GICC_CTLR, 1);
+
+    for (int i = 0; i < IRQ_MAX; i++) irq_table[i].handler = 0;
+}
+
+void irq_register(unsigned int irq, irq_handler_t handler, void *arg)
+{
+    if (irq >= IRQ_MAX) return;
+
+    irq_table[irq].arg = arg;
+    irq_table[irq].handler = handler;
+    mmio_write(GICD_ISENABLER + (irq / 32) * 4, 1u << (irq % 32));
+}
+
+void irq_unregister(unsigned int irq)
+{
+    if (irq >= IRQ_MAX) return;
+
+    mmio_write(GICD_ICENABLER + (irq / 32) * 4, 1u << (irq % 32));
+    irq_table[irq].handler = 0;
+}
+
+void irq_enable(void)  { asm volatile("msr daifclr, #2" ::: "memory"); }
+void irq_disable(void) { asm volatile("msr daifset, #2" ::: "memory"); }
+
+int irq_enabled(void)
+{
+    unsigned long daif;
+    asm volatile("mrs %0, daif" : "=r"(daif));
+    return !(daif & (1 << 7));
+}
+
+unsigned long irq_save(void)
+{
+    unsigned long daif;
+    asm volatile("mrs %0, daif\n\tmsr daifset, #2" : "=r"(daif) :: "memory");
+    return daif;
+}
+
+void irq_restore(unsigned long flags)
+{
+    asm volatile("msr daif, %0" :: "r"(flags) : "memory");
+}
+
+// Called from vectors.S with IRQs masked
+void irq_handle(void)
+{
+    for (;;) {
+        unsigned int iar = mmio_read(GICC_IAR);
+        unsigned int id = iar & 0x3FF;
+
+        if (id >= GIC_SPURIOUS) return;
+
+        if (id < IRQ_MAX && irq_table[id].handler) {
+            irq_table[id].handler(irq_table[id].arg);
+        }
+        mmio_write(GICC_EOIR, iar);
+    }
+}
+
+static void hex64(char *out, unsigned long v)
+{
+    for (int i = 15; i >= 0; i--) {
+        unsigned int nibble = (v >> (i * 4)) & 0xF;
+        out[15-i] = (nibble < 10) ? ('0' + nibble) : ('A' + nibble - 10);
+    }
+    out[16] = '\0';
+}
+
+// Called from vectors.S for synchronous exceptions, FIQs and SErrors
+void exception_unhandled(unsigned long type)
+{
+    static const char *names[] = { "SYNC", "IRQ", "FIQ", "SERROR" };
+    unsigned long esr, elr;
+    char reason[64];
+    int n = 0;
+
+    if (irq_el == 2) {
+        asm volatile("mrs %0, esr_el2" : "=r"(esr));
+        asm volatile("mrs %0, elr_el2" : "=r"(elr));
+    } else {
+        asm volatile("mrs %0, esr_el1" : "=r"(esr));
+        asm volatile("mrs %0, elr_el1" : "=r"(elr));
+    }
+
+    for (const char *s = "ESR 0x"; *s; s++) reason[n++] = *s;
+    hex64(&reason[n], esr);
+    n += 16;
+    for (const char *s = " ELR 0x"; *s; s++) reason[n++] = *s;
+    hex64(&reason[n], elr);
+
+    uart_writeText("Unhandled exception: ");
+    uart_writeText((char*)names[type & 3]);
+    uart_writeText(" ");
+    uart_writeText(reason);
+    uart_writeText("\n");
+    uart_drainOutputQueue(); // IRQs are masked here, nobody else will
+
+    kernel_panic_screen("KERNEL PANIC - UNHANDLED EXCEPTION", reason, names[type & 3], 0);
+}
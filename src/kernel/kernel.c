@@ -5,29 +5,69 @@
 #include "../include/desktop.h"
 #include "../include/login_window.h"
 #include "../include/usb.h"  // Neuer USB Header
+#include "../include/mmu.h"
+#include "../include/smp.h"
+#include "../include/timer.h"
+#include "../include/irq.h"
+#include "../include/mb.h"
+#include "../include/dma.h"
+#include "../include/mem.h"
+#include "../include/pcie.h"
+#include "../include/emmc.h"
+#include "../include/fat.h"
 #include "panic.h"
 
 void bootscreen() {
+    mmu_init(); // caches on before anything else touches memory
+    timer_init();
     uart_init();
+
+    irq_init();
+    irq_register(IRQ_TIMER_PHYS, timer_irq, 0);
+    uart_enableInterrupts();
+    mbox_enableInterrupts();
+    irq_enable();
+
+    int memReady = page_init();
+
     fb_init();
-    clearScreen(0x00);
+    dma_init();
+    dma_enableInterrupts();
+    clearScreenAsync(0x00); // the engine clears while the other cores come up
 
+    smp_init();
+    pcie_init(); // link training runs while the engine clears the screen
     drawStringSized(10, 10, "uart initialized", 0x0F, 12);
     drawStringSized(10, 25, "fb initialized", 0x0F, 12);
+    drawStringSized(10, 40, "smp initialized", 0x0F, 12);
+    drawStringSized(10, 55, memReady ? "mem initialized" : "mem query failed", 0x0F, 12);
+    fb_present();
 
-    for (volatile int i = 0; i < 500000000; i++);
+    usb_init(); // enumerates every port before it returns
+    if (emmc_init()) {
+        emmc_enableInterrupts();
+        fat_mount();
+    }
+    sleep_ms(2000);
     // we just wait a little bit so the user can read the messages
 }
 
+#ifdef SMP_DEMO
+void smp_demo(void);
+#endif
+
 int main() {
     bootscreen();
 
-    clearScreen(0x00);
-    login();
-
-    for (volatile int i = 0; i < 1000000000; i++);
-    //later we just wait until the password was entered
+#ifdef SMP_DEMO
+    smp_demo();
+#endif
+#ifdef EMMC_BENCH
+    emmc_benchmark();
+#endif
 
+    clearScreenAsync(0x00);
+    login(); // returns once the password was entered
 
     //PANIC("USB_INIT");
     //kernel_panic_screen("KERNEL PANIC - ERRNO 0X00AAAA", "usb_init (l;devices) at 21",  __FILE__, __LINE__);
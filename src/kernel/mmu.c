@@ -0,0 +1,194 @@
+// Early-boot MMU and cache setup
+// src/kernel/mmu.c
+//
+// Identity map with 4 KB granule and a 39-bit address space:
+//   0x0_0000_0000 - 0x0_FBFF_FFFF  normal, write-back cacheable (RAM)
+//   0x0_FC00_0000 - 0x0_FFFF_FFFF  device nGnRE (BCM2711 peripherals, GIC)
+//   0x6_0000_0000 - 0x6_3FFF_FFFF  device nGnRE (PCIe outbound window)
+// The first 4 GB use 2 MB blocks so individual regions (the framebuffer)
+// can be switched to another memory type later; the PCIe window is one 1 GB
+// block. Works at EL1 or EL2, whichever the boot stub left us in.
+
+#include "../include/mmu.h"
+
+#define MMU_DEVICE_START  0xFC000000UL
+#define MMU_PCIE_WINDOW   0x600000000UL
+
+enum {
+    PT_BLOCK  = 1UL << 0,
+    PT_TABLE  = 3UL << 0,
+    PT_AP_EL2 = 1UL << 6,   // AP[1] is RES1 in the EL2 regime
+    PT_ISH    = 3UL << 8,
+    PT_AF     = 1UL << 10
+};
+
+#define PT_ATTR(idx) ((unsigned long)(idx) << 2)
+#define PT_XN        ((1UL << 53) | (1UL << 54))
+
+// MAIR: attr0 device nGnRE, attr1 normal WB RA/WA, attr2 normal non-cacheable
+#define MMU_MAIR_VALUE  (0x04UL | (0xFFUL << 8) | (0x44UL << 16))
+
+// T0SZ=25 (39-bit VA), inner/outer WB WA walks, inner shareable, 4 KB granule
+#define MMU_TCR_COMMON  (25UL | (1UL << 8) | (1UL << 10) | (3UL << 12))
+#define MMU_TCR_EL1     (MMU_TCR_COMMON | (1UL << 23) | (1UL << 32))   // EPD1, IPS=36 bit
+#define MMU_TCR_EL2     (MMU_TCR_COMMON | (1UL << 16) | (1UL << 23) | (1UL << 31)) // PS=36 bit, RES1
+
+#define SCTLR_M (1UL << 0)
+#define SCTLR_C (1UL << 2)
+#define SCTLR_I (1UL << 12)
+
+static unsigned long mmu_l1[512] __attribute__((aligned(4096)));
+static unsigned long mmu_l2[4][512] __attribute__((aligned(4096)));
+
+static int mmu_el = 1;
+static int mmu_on = 0;
+
+static unsigned long current_el(void)
+{
+    unsigned long el;
+    asm volatile("mrs %0, CurrentEL" : "=r"(el));
+    return (el >> 2) & 3;
+}
+
+static unsigned long dcache_line(void)
+{
+    unsigned long ctr;
+    asm volatile("mrs %0, ctr_el0" : "=r"(ctr));
+    return 4UL << ((ctr >> 16) & 0xF);
+}
+
+void dcache_clean(const volatile void *addr, unsigned long size)
+{
+    unsigned long line = dcache_line();
+    unsigned long a = (unsigned long)addr & ~(line - 1);
+
+    for (; a < (unsigned long)addr + size; a += line) asm volatile("dc cvac, %0" :: "r"(a) : "memory");
+    asm volatile("dsb sy" ::: "memory");
+}
+
+void dcache_invalidate(const volatile void *addr, unsigned long size)
+{
+    unsigned long line = dcache_line();
+    unsigned long a = (unsigned long)addr & ~(line - 1);
+
+    for (; a < (unsigned long)addr + size; a += line) asm volatile("dc ivac, %0" :: "r"(a) : "memory");
+    asm volatile("dsb sy" ::: "memory");
+}
+
+void dcache_cleanInvalidate(const volatile void *addr, unsigned long size)
+{
+    unsigned long line = dcache_line();
+    unsigned long a = (unsigned long)addr & ~(line - 1);
+
+    for (; a < (unsigned long)addr + size; a += line) asm volatile("dc civac, %0" :: "r"(a) : "memory");
+    asm volatile("dsb sy" ::: "memory");
+}
+
+static void tlb_flush(void)
+{
+    asm volatile("dsb ishst" ::: "memory");
+    // inner shareable: other cores may hold the old entries too
+    if (mmu_el == 2) asm volatile("tlbi alle2is" ::: "memory");
+    else asm volatile("tlbi vmalle1is" ::: "memory");
+    asm volatile("dsb ish\n\tisb" ::: "memory");
+}
+
+static unsigned long mmu_block(unsigned long pa, int type)
+{
+    unsigned long desc = pa | PT_BLOCK | PT_AF | PT_ATTR(type);
+
+    if (type == MMU_DEVICE) desc |= PT_XN;
+    else desc |= PT_ISH;
+    if (mmu_el == 2) desc |= PT_AP_EL2;
+
+    return desc;
+}
+
+// Programs this core's translation registers with the shared tables
+static void mmu_enableHere(void)
+{
+    unsigned long sctlr;
+
+    if (current_el() == 2) {
+        asm volatile("msr mair_el2, %0" :: "r"(MMU_MAIR_VALUE));
+        asm volatile("msr tcr_el2, %0" :: "r"(MMU_TCR_EL2));
+        asm volatile("msr ttbr0_el2, %0" :: "r"((unsigned long)mmu_l1));
+        asm volatile("isb");
+        tlb_flush();
+        asm volatile("mrs %0, sctlr_el2" : "=r"(sctlr));
+        sctlr |= SCTLR_M | SCTLR_C | SCTLR_I;
+        asm volatile("msr sctlr_el2, %0\n\tisb" :: "r"(sctlr) : "memory");
+    } else {
+        asm volatile("msr mair_el1, %0" :: "r"(MMU_MAIR_VALUE));
+        asm volatile("msr tcr_el1, %0" :: "r"(MMU_TCR_EL1));
+        asm volatile("msr ttbr0_el1, %0" :: "r"((unsigned long)mmu_l1));
+        asm volatile("isb");
+        tlb_flush();
+        asm volatile("mrs %0, sctlr_el1" : "=r"(sctlr));
+        sctlr |= SCTLR_M | SCTLR_C | SCTLR_I;
+        asm volatile("msr sctlr_el1, %0\n\tisb" :: "r"(sctlr) : "memory");
+    }
+}
+
+int mmu_enabled(void)
+{
+    return mmu_on;
+}
+
+void mmu_init(void)
+{
+    if (mmu_on) return;
+
+    mmu_el = current_el() == 2 ? 2 : 1;
+
+    // first 4 GB: 2 MB blocks
+    for (unsigned long gb = 0; gb < 4; gb++) {
+        for (unsigned long i = 0; i < 512; i++) {
+            unsigned long pa = (gb << 30) | (i << 21);
+            mmu_l2[gb][i] = mmu_block(pa, pa >= MMU_DEVICE_START ? MMU_DEVICE : MMU_NORMAL);
+        }
+        mmu_l1[gb] = (unsigned long)mmu_l2[gb] | PT_TABLE;
+    }
+
+    // PCIe outbound window
+    mmu_l1[MMU_PCIE_WINDOW >> 30] = mmu_block(MMU_PCIE_WINDOW, MMU_DEVICE);
+
+    // The walker reads the tables through the cache, make sure it sees them
+    dcache_cleanInvalidate(mmu_l1, sizeof(mmu_l1));
+    dcache_cleanInvalidate(mmu_l2, sizeof(mmu_l2));
+
+    mmu_enableHere();
+    mmu_on = 1;
+}
+
+// Secondary cores come up with the MMU off; they reuse the boot core's tables
+void mmu_initSecondary(void)
+{
+    if (!mmu_on) return;
+
+    mmu_enableHere();
+}
+
+// Changes the memory type of [base, base+size) within the first 4 GB,
+// rounded out to 2 MB blocks
+void mmu_mapRegion(unsigned long base, unsigned long size, int type)
+{
+    unsigned long start = base >> 21;
+    unsigned long end = (base + size + (1UL << 21) - 1) >> 21;
+
+    if (!mmu_on || end > 4 * 512) return;
+
+    // break-before-make: invalidate the old blocks everywhere first
+    for (unsigned long i = start; i < end; i++) mmu_l2[i >> 9][i & 511] = 0;
+    dcache_clean(&mmu_l2[start >> 9][start & 511], (end - start) * 8);
+    tlb_flush();
+
+    for (unsigned long i = start; i < end; i++) mmu_l2[i >> 9][i & 511] = mmu_block(i << 21, type);
+    dcache_clean(&mmu_l2[start >> 9][start & 511], (end - start) * 8);
+    tlb_flush();
+
+    // Nothing may stay cached for a range that becomes non-cacheable. Only now:
+    // while the cacheable mapping was live, speculation could refill lines.
+    // DC CIVAC goes to the point of coherency whatever the new attributes are.
+    dcache_cleanInvalidate((void *)(start << 21), (end - start) << 21);
+}
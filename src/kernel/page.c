@@ -0,0 +1,169 @@
+// Physical page allocator
+// src/kernel/page.c
+//
+// Binary buddy system over the ARM memory reported by the firmware. Block
+// indices count pages from page_base, which is aligned to the largest block,
+// so every block is aligned to its own size in physical memory too (the
+// slab code relies on that). Pages before the end of the kernel image are
+// part of the index space but never freed, so nothing merges into them.
+// One byte per page records whether a free block starts there and its order;
+// the free lists are linked through the free pages themselves.
+
+#include "../include/mb.h"
+#include "../include/smp.h"
+#include "../include/mem.h"
+
+extern char _end[]; // end of the kernel image and bss, from link.ld
+
+#define PAGE_FREE 0x80
+
+typedef struct page_link {
+    struct page_link *next;
+    struct page_link *prev;
+} page_link_t;
+
+static unsigned long page_base;
+static unsigned long page_count;
+static unsigned long page_total;
+static unsigned long page_freeCount;
+static unsigned char *page_info;
+static page_link_t *page_lists[PAGE_MAX_ORDER + 1];
+static unsigned long page_blocks[PAGE_MAX_ORDER + 1];
+static volatile int page_lock = 0;
+
+static inline page_link_t *page_ptr(unsigned long idx)
+{
+    return (page_link_t *)(page_base + (idx << PAGE_SHIFT));
+}
+
+static void page_push(unsigned long idx, unsigned int order)
+{
+    page_link_t *p = page_ptr(idx);
+
+    p->prev = 0;
+    p->next = page_lists[order];
+    if (p->next) p->next->prev = p;
+    page_lists[order] = p;
+
+    page_info[idx] = PAGE_FREE | order;
+    page_blocks[order]++;
+}
+
+static void page_remove(unsigned long idx, unsigned int order)
+{
+    page_link_t *p = page_ptr(idx);
+
+    if (p->prev) p->prev->next = p->next;
+    else page_lists[order] = p->next;
+    if (p->next) p->next->prev = p->prev;
+
+    page_info[idx] = order;
+    page_blocks[order]--;
+}
+
+int page_init(void)
+{
+    mbox_msg_t msg;
+
+    mbox_msg_init(&msg);
+    int mem = mbox_msg_addTag(&msg, MBOX_TAG_GETARMMEM, 0, 0, 2);
+    if (mem < 0 || !mbox_submit(&msg, MBOX_CH_PROP) || !mbox_wait(&msg)) return 0;
+
+    unsigned long blockSize = PAGE_SIZE << PAGE_MAX_ORDER;
+    unsigned long start = msg.buf[mem];
+    unsigned long end = (start + msg.buf[mem + 1]) & ~(PAGE_SIZE - 1);
+
+    if (start < (unsigned long)_end) start = (unsigned long)_end;
+    start = (start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (start >= end) return 0;
+
+    page_base = start & ~(blockSize - 1);
+    page_count = (end - page_base) >> PAGE_SHIFT;
+
+    // the per-page bytes take the first usable pages
+    page_info = (unsigned char *)start;
+    for (unsigned long i = 0; i < page_count; i++) page_info[i] = 0;
+    start = (start + page_count + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    // seed with the largest aligned blocks that fit
+    unsigned long idx = (start - page_base) >> PAGE_SHIFT;
+    while (idx < page_count) {
+        unsigned int order = PAGE_MAX_ORDER;
+
+        while ((idx & ((1UL << order) - 1)) || idx + (1UL << order) > page_count) order--;
+        page_push(idx, order);
+        idx += 1UL << order;
+    }
+
+    page_total = page_freeCount = page_count - ((start - page_base) >> PAGE_SHIFT);
+    return 1;
+}
+
+void *page_alloc(unsigned int order)
+{
+    if (order > PAGE_MAX_ORDER) return 0;
+
+    unsigned long flags = smp_lock(&page_lock);
+    unsigned int o = order;
+
+    while (o <= PAGE_MAX_ORDER && !page_lists[o]) o++;
+    if (o > PAGE_MAX_ORDER) {
+        smp_unlock(&page_lock, flags);
+        return 0;
+    }
+
+    unsigned long idx = ((unsigned long)page_lists[o] - page_base) >> PAGE_SHIFT;
+    page_remove(idx, o);
+
+    // split down, the upper halves go back on the lists
+    while (o > order) {
+        o--;
+        page_push(idx + (1UL << o), o);
+    }
+    page_freeCount -= 1UL << order;
+
+    smp_unlock(&page_lock, flags);
+    return page_ptr(idx);
+}
+
+void page_free(void *addr, unsigned int order)
+{
+    if (!addr || order > PAGE_MAX_ORDER) return;
+
+    unsigned long flags = smp_lock(&page_lock);
+    unsigned long idx = ((unsigned long)addr - page_base) >> PAGE_SHIFT;
+
+    page_freeCount += 1UL << order;
+
+    // merge with the buddy as long as it is free and whole
+    while (order < PAGE_MAX_ORDER) {
+        unsigned long buddy = idx ^ (1UL << order);
+
+        if (buddy + (1UL << order) > page_count || page_info[buddy] != (PAGE_FREE | order)) break;
+        page_remove(buddy, order);
+        idx &= ~(1UL << order);
+        order++;
+    }
+    page_push(idx, order);
+
+    smp_unlock(&page_lock, flags);
+}
+
+void page_getStats(page_stats_t *stats)
+{
+    unsigned long flags = smp_lock(&page_lock);
+
+    stats->total = page_total;
+    stats->free = page_freeCount;
+    stats->largestOrder = 0;
+    for (unsigned int o = 0; o <= PAGE_MAX_ORDER; o++) {
+        stats->freeBlocks[o] = page_blocks[o];
+        if (page_blocks[o]) stats->largestOrder = o;
+    }
+
+    // Free memory that can't be handed out as one of the biggest blocks
+    unsigned long big = page_blocks[stats->largestOrder] << stats->largestOrder;
+    stats->fragmentation = page_freeCount ? (unsigned int)(100 - big * 100 / page_freeCount) : 0;
+
+    smp_unlock(&page_lock, flags);
+}
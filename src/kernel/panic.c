@@ -1,4 +1,5 @@
 #include "../include/fb.h"
+#include "../include/timer.h"
 #include "panic.h"
 
 static inline int clamp(int v, int lo, int hi) { return v < lo ? lo : (v > hi ? hi : v); }
@@ -27,9 +28,9 @@ void drawEmexLogo() {
     int logo_w = 250;
     int logo_h = 250;
 
-    int x2 = SCREEN_WIDTH - 100;
+    int x2 = fb_getWidth() - 100;
     int x1 = x2 - logo_w;
-    int y1 = (SCREEN_HEIGHT / 2) - (logo_h / 2);
+    int y1 = (fb_getHeight() / 2) - (logo_h / 2);
     int y2 = y1 + logo_h;
 
     drawLogoE(x1, y1, x2, y2);
@@ -42,16 +43,17 @@ void kernel_panic_screen(const char* title, const char* reason, const char* file
     const unsigned char subtext = 14;     // yellow
 
     clearScreen(bg);
+    fb_present();
 
-    for (volatile int i = 0; i < 111500000; i++);
+    sleep_ms(500);
 
     int card_margin = 80;
     int card_radius = 20;
     int card_border_thick = 3;
     int x1 = card_margin;
     int y1 = card_margin;
-    int x2 = SCREEN_WIDTH - card_margin;
-    int y2 = SCREEN_HEIGHT - card_margin;
+    int x2 = fb_getWidth() - card_margin;
+    int y2 = fb_getHeight() - card_margin;
 
     drawRoundedRect(x1, y1, x2, y2, card_radius, card_fill, 1, 00, 0);
 
@@ -62,7 +64,8 @@ void kernel_panic_screen(const char* title, const char* reason, const char* file
     //drawEmexLogo();
     // i don't like the E design so i out comment it for now...
 
-    drawStringSized(100, 960, (char*)"emexOS rpi4 - system halted.", 15, 16);
+    drawStringSized(100, fb_getHeight() - 120, (char*)"emexOS rpi4 - system halted.", 15, 16);
+    fb_present();
 
     for (;;) {
         asm volatile("wfi");
@@ -0,0 +1,247 @@
+// Slab caches and bump arenas on top of the page allocator
+// src/kernel/slab.c
+
+#include "../include/smp.h"
+#include "../include/mem.h"
+
+#define SLAB_MIN_OBJECTS 8 // grow the slab order until at least this many fit
+
+struct slab {
+    slab_cache_t *cache;
+    slab_t *next;
+    slab_t *prev;
+    void *freeList;
+    unsigned int inUse;
+};
+
+struct arena_chunk {
+    arena_chunk_t *next;
+};
+
+static inline unsigned long alignUp(unsigned long v, unsigned long align)
+{
+    return (v + align - 1) & ~(align - 1);
+}
+
+static void slab_link(slab_t **list, slab_t *s)
+{
+    s->prev = 0;
+    s->next = *list;
+    if (s->next) s->next->prev = s;
+    *list = s;
+}
+
+static void slab_unlink(slab_t **list, slab_t *s)
+{
+    if (s->prev) s->prev->next = s->next;
+    else *list = s->next;
+    if (s->next) s->next->prev = s->prev;
+}
+
+void slab_cacheInit(slab_cache_t *cache, const char *name, unsigned int size, unsigned int align)
+{
+    if (align < sizeof(void *)) align = sizeof(void *);
+    if (size < sizeof(void *)) size = sizeof(void *);
+
+    cache->name = name;
+    cache->size = alignUp(size, align);
+    cache->offset = alignUp(sizeof(slab_t), align);
+
+    cache->order = 0;
+    cache->perSlab = 0;
+
+    // an object that doesn't fit the largest block leaves the cache unusable
+    // (perSlab 0), slab_alloc then always fails
+    if (alignUp(size, align) <= (PAGE_SIZE << PAGE_MAX_ORDER) - cache->offset) {
+        while (cache->order < PAGE_MAX_ORDER &&
+               ((PAGE_SIZE << cache->order) - cache->offset) / cache->size < SLAB_MIN_OBJECTS) {
+            cache->order++;
+        }
+        cache->perSlab = ((PAGE_SIZE << cache->order) - cache->offset) / cache->size;
+    }
+
+    cache->partial = cache->full = cache->empty = 0;
+    cache->slabs = cache->inUse = cache->allocs = 0;
+    cache->lock = 0;
+}
+
+static slab_t *slab_grow(slab_cache_t *cache)
+{
+    slab_t *s = page_alloc(cache->order);
+    if (!s) return 0;
+
+    s->cache = cache;
+    s->inUse = 0;
+    s->freeList = 0;
+
+    // link back to front so objects are handed out in address order
+    unsigned char *obj = (unsigned char *)s + cache->offset + (cache->perSlab - 1) * cache->size;
+    for (unsigned int i = 0; i < cache->perSlab; i++, obj -= cache->size) {
+        *(void **)obj = s->freeList;
+        s->freeList = obj;
+    }
+
+    cache->slabs++;
+    return s;
+}
+
+void *slab_alloc(slab_cache_t *cache)
+{
+    if (!cache->perSlab) return 0;
+
+    unsigned long flags = smp_lock(&cache->lock);
+    slab_t *s = cache->partial;
+
+    if (!s) {
+        s = cache->empty;
+        if (s) cache->empty = 0;
+        else s = slab_grow(cache);
+
+        if (!s) {
+            smp_unlock(&cache->lock, flags);
+            return 0;
+        }
+        slab_link(&cache->partial, s);
+    }
+
+    void *obj = s->freeList;
+    s->freeList = *(void **)obj;
+
+    if (++s->inUse == cache->perSlab) {
+        slab_unlink(&cache->partial, s);
+        slab_link(&cache->full, s);
+    }
+    cache->inUse++;
+    cache->allocs++;
+
+    smp_unlock(&cache->lock, flags);
+    return obj;
+}
+
+void slab_free(slab_cache_t *cache, void *obj)
+{
+    if (!obj) return;
+
+    // slabs are aligned to their size, the header is at the start
+    slab_t *s = (slab_t *)((unsigned long)obj & ~((PAGE_SIZE << cache->order) - 1));
+    void *release = 0;
+    unsigned long flags = smp_lock(&cache->lock);
+
+    if (s->inUse == cache->perSlab) {
+        slab_unlink(&cache->full, s);
+        slab_link(&cache->partial, s);
+    }
+
+    *(void **)obj = s->freeList;
+    s->freeList = obj;
+    s->inUse--;
+    cache->inUse--;
+
+    // keep one empty slab around so a cache at the boundary doesn't thrash
+    if (s->inUse == 0) {
+        slab_unlink(&cache->partial, s);
+        if (cache->empty) {
+            release = s;
+            cache->slabs--;
+        } else {
+            cache->empty = s;
+        }
+    }
+
+    smp_unlock(&cache->lock, flags);
+    if (release) page_free(release, cache->order);
+}
+
+void slab_cacheShrink(slab_cache_t *cache)
+{
+    unsigned long flags = smp_lock(&cache->lock);
+    slab_t *s = cache->empty;
+
+    if (s) {
+        cache->empty = 0;
+        cache->slabs--;
+    }
+
+    smp_unlock(&cache->lock, flags);
+    if (s) page_free(s, cache->order);
+}
+
+void slab_getStats(slab_cache_t *cache, slab_stats_t *stats)
+{
+    unsigned long flags = smp_lock(&cache->lock);
+
+    stats->slabs = cache->slabs;
+    stats->inUse = cache->inUse;
+    stats->capacity = cache->slabs * cache->perSlab;
+    stats->allocs = cache->allocs;
+    stats->bytes = cache->slabs * (PAGE_SIZE << cache->order);
+
+    smp_unlock(&cache->lock, flags);
+}
+
+// Arenas
+
+void arena_init(arena_t *arena, unsigned int order)
+{
+    arena->first = arena->current = 0;
+    arena->next = arena->end = 0;
+    arena->order = order > PAGE_MAX_ORDER ? PAGE_MAX_ORDER : order;
+    arena->used = arena->highWater = 0;
+}
+
+static void arena_enter(arena_t *arena, arena_chunk_t *chunk)
+{
+    arena->current = chunk;
+    arena->next = (unsigned char *)chunk + alignUp(sizeof(*chunk), 16);
+    arena->end = (unsigned char *)chunk + (PAGE_SIZE << arena->order);
+}
+
+void *arena_alloc(arena_t *arena, unsigned long size, unsigned long align)
+{
+    if (align < sizeof(void *)) align = sizeof(void *);
+    if (size + align > (PAGE_SIZE << arena->order) - alignUp(sizeof(arena_chunk_t), 16)) return 0;
+
+    for (int tries = 0; tries < 2; tries++) {
+        if (arena->current) {
+            unsigned char *p = (unsigned char *)alignUp((unsigned long)arena->next, align);
+
+            if (p + size <= arena->end) {
+                arena->next = p + size;
+                arena->used += size;
+                if (arena->used > arena->highWater) arena->highWater = arena->used;
+                return p;
+            }
+        }
+
+        // next chunk: one kept from before the last reset, or a new one
+        arena_chunk_t *chunk = arena->current ? arena->current->next : arena->first;
+        if (!chunk) {
+            chunk = page_alloc(arena->order);
+            if (!chunk) return 0;
+
+            chunk->next = 0;
+            if (arena->current) arena->current->next = chunk;
+            else arena->first = chunk;
+        }
+        arena_enter(arena, chunk);
+    }
+    return 0;
+}
+
+void arena_reset(arena_t *arena)
+{
+    if (arena->first) arena_enter(arena, arena->first);
+    arena->used = 0;
+}
+
+void arena_release(arena_t *arena)
+{
+    arena_chunk_t *chunk = arena->first;
+
+    while (chunk) {
+        arena_chunk_t *next = chunk->next;
+        page_free(chunk, arena->order);
+        chunk = next;
+    }
+    arena_init(arena, arena->order);
+}
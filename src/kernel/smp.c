@@ -0,0 +1,189 @@
+// SMP bring-up and work queue
+// src/kernel/smp.c
+//
+// Cores 1-3 are released through the firmware spin table. Each gets its own
+// stack, turns on the MMU with the boot core's tables and then sleeps in wfe
+// until work shows up in a lock-free multi-producer/multi-consumer ring
+// (bounded, sequence number per slot).
+
+#include "../include/io.h"
+#include "../include/mmu.h"
+#include "../include/fb_neon.h"
+#include "../include/smp.h"
+#include "../include/timer.h"
+
+extern void smp_secondaryEntry(void);
+
+// Firmware spin table: core N polls this address until it becomes non-zero
+static const unsigned long smp_spinTable[SMP_MAX_CORES] = { 0xD8, 0xE0, 0xE8, 0xF0 };
+
+unsigned char smp_stacks[SMP_MAX_CORES * SMP_STACK_SIZE] __attribute__((aligned(16)));
+unsigned int smp_bootEL = 1;
+
+static int smp_online = 1;
+
+typedef struct {
+    smp_job_fn fn;
+    void *arg;
+    int part;
+    int parts;
+    int *pending;
+} smp_job_t;
+
+typedef struct {
+    unsigned int seq;
+    smp_job_t job;
+} smp_slot_t;
+
+static smp_slot_t smp_queue[SMP_QUEUE_SIZE];
+static unsigned int smp_head = 0; // next slot to fill
+static unsigned int smp_tail = 0; // next slot to take
+
+static inline void smp_sev(void) { asm volatile("dsb ish\n\tsev" ::: "memory"); }
+static inline void smp_wfe(void) { asm volatile("wfe" ::: "memory"); }
+
+int smp_coreId(void)
+{
+    unsigned long mpidr;
+    asm volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
+    return mpidr & 3;
+}
+
+int smp_coreCount(void)
+{
+    return __atomic_load_n(&smp_online, __ATOMIC_ACQUIRE);
+}
+
+static int smp_push(const smp_job_t *job)
+{
+    unsigned int pos = __atomic_load_n(&smp_head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        smp_slot_t *slot = &smp_queue[pos & (SMP_QUEUE_SIZE - 1)];
+        int diff = (int)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&smp_head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->job = *job;
+                __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0; // full
+        } else {
+            pos = __atomic_load_n(&smp_head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static int smp_pop(smp_job_t *job)
+{
+    unsigned int pos = __atomic_load_n(&smp_tail, __ATOMIC_RELAXED);
+
+    for (;;) {
+        smp_slot_t *slot = &smp_queue[pos & (SMP_QUEUE_SIZE - 1)];
+        int diff = (int)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&smp_tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *job = slot->job;
+                __atomic_store_n(&slot->seq, pos + SMP_QUEUE_SIZE, __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0; // empty
+        } else {
+            pos = __atomic_load_n(&smp_tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void smp_run(const smp_job_t *job)
+{
+    job->fn(job->arg, job->part, job->parts);
+
+    if (job->pending) {
+        __atomic_sub_fetch(job->pending, 1, __ATOMIC_RELEASE);
+        smp_sev(); // the submitter may be waiting in wfe
+    }
+}
+
+void smp_secondaryMain(unsigned long core)
+{
+    mmu_initSecondary();
+#ifdef FB_NEON
+    fb_neon_enable(); // FP/SIMD traps are per core
+#endif
+
+    __atomic_add_fetch(&smp_online, 1, __ATOMIC_RELEASE);
+    smp_sev();
+
+    for (;;) {
+        smp_job_t job;
+
+        if (smp_pop(&job)) smp_run(&job);
+        else smp_wfe();
+    }
+}
+
+int smp_submit(smp_job_fn fn, void *arg, int part, int parts, int *pending)
+{
+    smp_job_t job = { fn, arg, part, parts, pending };
+
+    if (!smp_push(&job)) return 0;
+
+    smp_sev();
+    return 1;
+}
+
+void smp_parallel(smp_job_fn fn, void *arg, int parts)
+{
+    int pending = parts;
+    smp_job_t job;
+
+    if (parts <= 0) return;
+
+    // hand out parts 1..n-1, do part 0 here; a full queue just means we do more ourselves
+    for (int part = 1; part < parts; part++) {
+        if (!smp_submit(fn, arg, part, parts, &pending)) {
+            fn(arg, part, parts);
+            __atomic_sub_fetch(&pending, 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    fn(arg, 0, parts);
+    __atomic_sub_fetch(&pending, 1, __ATOMIC_RELEASE);
+
+    while (__atomic_load_n(&pending, __ATOMIC_ACQUIRE) > 0) {
+        if (smp_pop(&job)) smp_run(&job);
+        else smp_wfe();
+    }
+}
+
+int smp_init(void)
+{
+    unsigned long el;
+
+    asm volatile("mrs %0, CurrentEL" : "=r"(el));
+    smp_bootEL = (el >> 2) & 3;
+
+    for (unsigned int i = 0; i < SMP_QUEUE_SIZE; i++) smp_queue[i].seq = i;
+
+    // The secondaries run with caches off until mmu_initSecondary, so
+    // everything they read before that has to be in memory
+    dcache_clean(&smp_bootEL, sizeof(smp_bootEL));
+
+    for (int core = 1; core < SMP_MAX_CORES; core++) {
+        volatile unsigned long *spin = (volatile unsigned long *)smp_spinTable[core];
+
+        *spin = (unsigned long)smp_secondaryEntry;
+        dcache_clean(spin, sizeof(*spin));
+    }
+    smp_sev();
+
+    // give them a moment to check in
+    unsigned long start = timer_now_us();
+    while (smp_coreCount() < SMP_MAX_CORES && timer_now_us() - start < 100000) smp_wfe();
+
+    return smp_coreCount();
+}
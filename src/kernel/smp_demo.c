@@ -0,0 +1,63 @@
+// Full-screen fill across 1, 2 and 4 cores
+// src/kernel/smp_demo.c
+//
+// Built with `make smp-demo`; prints the timings on the serial console.
+
+#ifdef SMP_DEMO
+
+#include "../include/io.h"
+#include "../include/log.h"
+#include "../include/fb.h"
+#include "../include/smp.h"
+#include "../include/timer.h"
+
+extern unsigned int width, height, pitch;
+extern unsigned char *fb;
+
+// One horizontal band of the screen; arg is a pixel value of the current format
+static void demo_fillBand(void *arg, int part, int parts)
+{
+    unsigned int color = *(unsigned int *)arg;
+    unsigned int y0 = height * part / parts;
+    unsigned int y1 = height * (part + 1) / parts;
+    int rgb565 = fb_getFormat() == FB_FORMAT_RGB565 || fb_getFormat() == FB_FORMAT_BGR565;
+    unsigned int words = rgb565 ? width / 2 : width;
+
+    if (rgb565) color |= color << 16; // two pixels per word
+
+    for (unsigned int y = y0; y < y1; y++) {
+        fb_fill32((unsigned int *)(fb + y * pitch), words, color);
+        if (rgb565 && (width & 1)) *(unsigned short *)(fb + y * pitch + (width - 1) * 2) = color;
+    }
+}
+
+void smp_demo(void)
+{
+    static const int cores[] = { 1, 2, 4 };
+    unsigned long base = 0;
+    unsigned int color = 0;
+
+    LOG_INFO("SMP demo: %d cores online", smp_coreCount());
+
+    for (int c = 0; c < 3; c++) {
+        if (cores[c] > smp_coreCount()) break;
+
+        const int rounds = 20;
+        unsigned long start = timer_now_us();
+        for (int i = 0; i < rounds; i++) {
+            color = fb_color(0x00101010 * (i & 15));
+            smp_parallel(demo_fillBand, &color, cores[c]);
+        }
+        unsigned long us = (timer_now_us() - start) / rounds;
+        if (c == 0) base = us;
+
+        LOG_INFO("SMP demo: full-screen fill on %d core(s): %lu us, speedup x%lu.%02lu",
+                 cores[c], us, base / (us ? us : 1), (base * 100 / (us ? us : 1)) % 100);
+        uart_update();
+    }
+
+    fb_markDirty(0, 0, width - 1, height - 1);
+    fb_present();
+}
+
+#endif
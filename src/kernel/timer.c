@@ -0,0 +1,205 @@
+// Generic timer service
+// src/kernel/timer.c
+//
+// Time comes from CNTPCT, which ticks at CNTFRQ no matter how fast the core
+// runs, so delays are the same on QEMU and on a Pi 4. Waiting is done with
+// wfe: the counter event stream wakes the core roughly every 10 us (and any
+// sev/interrupt wakes it earlier), so idle waits don't spin the pipeline.
+// The earliest callback deadline is also loaded into CNTP_CVAL; once the GIC
+// routes that interrupt, timer_idle sleeps in wfi until exactly then.
+
+#include "../include/timer.h"
+#include "../include/irq.h"
+
+// Event stream on counter bit 9: every 512 ticks, ~10 us at 54 MHz
+#define TIMER_EVENT_BIT 9
+
+typedef struct {
+    timer_callback_t fn;
+    void *arg;
+    unsigned long deadline; // in ticks
+    unsigned long period;   // in ticks, 0 = one-shot
+} timer_slot_t;
+
+static timer_slot_t timer_slots[TIMER_MAX_CALLBACKS];
+static unsigned long timer_hz = 1;
+static unsigned long timer_boot = 0;
+static volatile int timer_woken = 0;
+
+unsigned long timer_ticks(void)
+{
+    unsigned long t;
+    asm volatile("isb\n\tmrs %0, cntpct_el0" : "=r"(t) :: "memory");
+    return t;
+}
+
+unsigned long timer_freq(void)
+{
+    return timer_hz;
+}
+
+unsigned long timer_now_us(void)
+{
+    unsigned long t = timer_ticks() - timer_boot;
+    return (t / timer_hz) * 1000000 + (t % timer_hz) * 1000000 / timer_hz;
+}
+
+static unsigned long us_to_ticks(unsigned long us)
+{
+    return (us / 1000000) * timer_hz + (us % 1000000) * timer_hz / 1000000;
+}
+
+void timer_init(void)
+{
+    unsigned long el, ctl;
+
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(timer_hz));
+    if (!timer_hz) timer_hz = 54000000; // BCM2711 crystal, in case the firmware didn't set it
+    timer_boot = timer_ticks();
+
+    // EVNTEN | EVNTI; at EL2 also keep the counter/timer open to EL1
+    asm volatile("mrs %0, CurrentEL" : "=r"(el));
+    if (((el >> 2) & 3) == 2) {
+        asm volatile("mrs %0, cnthctl_el2" : "=r"(ctl));
+        ctl &= ~(0xFUL << 4);
+        ctl |= 3 | (1 << 2) | (TIMER_EVENT_BIT << 4);
+        asm volatile("msr cnthctl_el2, %0\n\tisb" :: "r"(ctl));
+    } else {
+        asm volatile("mrs %0, cntkctl_el1" : "=r"(ctl));
+        ctl &= ~(0xFUL << 4);
+        ctl |= (1 << 2) | (TIMER_EVENT_BIT << 4);
+        asm volatile("msr cntkctl_el1, %0\n\tisb" :: "r"(ctl));
+    }
+
+    for (int i = 0; i < TIMER_MAX_CALLBACKS; i++) timer_slots[i].fn = 0;
+}
+
+static void wait_until(unsigned long deadline)
+{
+    while ((long)(timer_ticks() - deadline) < 0) asm volatile("wfe");
+}
+
+void sleep_us(unsigned long us)
+{
+    wait_until(timer_ticks() + us_to_ticks(us));
+}
+
+void sleep_ms(unsigned long ms)
+{
+    sleep_us(ms * 1000);
+}
+
+// Loads the earliest deadline into the physical timer (or masks it)
+static void timer_arm(void)
+{
+    unsigned long next = 0;
+    int found = 0;
+
+    for (int i = 0; i < TIMER_MAX_CALLBACKS; i++) {
+        if (!timer_slots[i].fn) continue;
+        if (!found || (long)(timer_slots[i].deadline - next) < 0) next = timer_slots[i].deadline;
+        found = 1;
+    }
+
+    if (found) {
+        asm volatile("msr cntp_cval_el0, %0" :: "r"(next));
+        asm volatile("msr cntp_ctl_el0, %0\n\tisb" :: "r"(1UL)); // ENABLE, not masked
+    } else {
+        asm volatile("msr cntp_ctl_el0, %0\n\tisb" :: "r"(2UL)); // IMASK
+    }
+}
+
+int timer_add(unsigned long delay_us, unsigned long period_us, timer_callback_t fn, void *arg)
+{
+    for (int i = 0; i < TIMER_MAX_CALLBACKS; i++) {
+        if (timer_slots[i].fn) continue;
+
+        timer_slots[i].arg = arg;
+        timer_slots[i].deadline = timer_ticks() + us_to_ticks(delay_us);
+        timer_slots[i].period = us_to_ticks(period_us);
+        timer_slots[i].fn = fn;
+        timer_arm();
+        return i;
+    }
+    return -1;
+}
+
+void timer_cancel(int id)
+{
+    if (id < 0 || id >= TIMER_MAX_CALLBACKS) return;
+
+    timer_slots[id].fn = 0;
+    timer_arm();
+}
+
+void timer_poll(void)
+{
+    unsigned long now = timer_ticks();
+    int fired = 0;
+
+    for (int i = 0; i < TIMER_MAX_CALLBACKS; i++) {
+        timer_slot_t *t = &timer_slots[i];
+        timer_callback_t fn = t->fn;
+
+        if (!fn || (long)(now - t->deadline) < 0) continue;
+
+        if (t->period) {
+            t->deadline += t->period;
+            if ((long)(now - t->deadline) >= 0) t->deadline = now + t->period; // don't replay missed ticks
+        } else {
+            t->fn = 0;
+        }
+        fn(t->arg);
+        fired = 1;
+    }
+
+    if (fired) timer_arm();
+}
+
+void timer_idle(void)
+{
+    unsigned long next = 0;
+    int found = 0;
+
+    for (int i = 0; i < TIMER_MAX_CALLBACKS; i++) {
+        if (!timer_slots[i].fn) continue;
+        if (!found || (long)(timer_slots[i].deadline - next) < 0) next = timer_slots[i].deadline;
+        found = 1;
+    }
+
+    if (found && irq_enabled()) {
+        // CNTP is armed for `next`; other interrupts send us back to sleep unless they called timer_wake.
+        // The check and the wfi run with IRQs masked so a timer_wake in between can't be missed:
+        // a pending interrupt still ends the wfi and is taken once they are unmasked again.
+        for (;;) {
+            unsigned long flags = irq_save();
+            int done = (long)(timer_ticks() - next) >= 0 || timer_woken;
+            if (!done) asm volatile("wfi");
+            irq_restore(flags);
+            if (done) break;
+        }
+    } else if (found) {
+        wait_until(next);
+    } else if (!timer_woken) {
+        asm volatile("wfe");
+    }
+    timer_woken = 0;
+
+    timer_poll();
+}
+
+// Producers (input, I/O completions) call this, usually from an interrupt
+void timer_wake(void)
+{
+    timer_woken = 1;
+    asm volatile("dsb ish\n\tsev" ::: "memory");
+}
+
+// CNTP interrupt: only wakes the core. The level stays asserted while the
+// deadline has passed, so mask it; timer_poll re-arms from thread context,
+// which keeps callbacks out of interrupt context.
+void timer_irq(void *arg)
+{
+    (void)arg;
+    asm volatile("msr cntp_ctl_el0, %0\n\tisb" :: "r"(3UL)); // ENABLE | IMASK
+}
@@ -0,0 +1,180 @@
+// Sector cache with sequential read-ahead (see bcache.h)
+// src/lib/bcache.c
+
+#include "../include/mem.h"
+#include "../include/emmc.h"
+#include "../include/bcache.h"
+
+enum {
+    BCACHE_EMPTY   = 0,
+    BCACHE_LOADING = 1,     // request queued on the card
+    BCACHE_VALID   = 2
+};
+
+typedef struct bcache_entry {
+    unsigned long group;
+    unsigned char *data;
+    int state;
+    struct bcache_entry *hashNext;
+    struct bcache_entry *prev, *next;   // LRU order, most recent first
+    emmc_request_t req;
+} bcache_entry_t;
+
+#define BCACHE_ORDER 8 // BCACHE_GROUPS * 4 KB in pages
+
+static bcache_entry_t bcache_entries[BCACHE_GROUPS];
+static bcache_entry_t *bcache_buckets[BCACHE_BUCKETS];
+static bcache_entry_t *bcache_mru = 0, *bcache_lru = 0;
+static unsigned long bcache_lastGroup = ~0UL;
+static bcache_stats_t bcache_stats;
+static int bcache_ready = 0;
+
+static unsigned int bcache_hash(unsigned long group)
+{
+    return (group ^ (group >> 6)) & (BCACHE_BUCKETS - 1);
+}
+
+static bcache_entry_t *bcache_lookup(unsigned long group)
+{
+    for (bcache_entry_t *e = bcache_buckets[bcache_hash(group)]; e; e = e->hashNext) {
+        if (e->group == group) return e;
+    }
+    return 0;
+}
+
+static void bcache_unhash(bcache_entry_t *e)
+{
+    bcache_entry_t **p = &bcache_buckets[bcache_hash(e->group)];
+
+    while (*p && *p != e) p = &(*p)->hashNext;
+    if (*p) *p = e->hashNext;
+    e->state = BCACHE_EMPTY;
+}
+
+static void bcache_unlink(bcache_entry_t *e)
+{
+    if (e->prev) e->prev->next = e->next;
+    else bcache_mru = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else bcache_lru = e->prev;
+}
+
+static void bcache_touch(bcache_entry_t *e)
+{
+    if (bcache_mru == e) return;
+
+    bcache_unlink(e);
+    e->prev = 0;
+    e->next = bcache_mru;
+    bcache_mru->prev = e;
+    bcache_mru = e;
+}
+
+// Reuses the least recently used entry that isn't being loaded
+static bcache_entry_t *bcache_evict(void)
+{
+    bcache_entry_t *e = bcache_lru;
+
+    while (e && e->state == BCACHE_LOADING && e->req.status == EMMC_PENDING) e = e->prev;
+    if (!e) return 0;
+
+    if (e->state != BCACHE_EMPTY) {
+        bcache_unhash(e);
+        bcache_stats.evictions++;
+    }
+    return e;
+}
+
+// Queues the read of a group; the entry stays LOADING until someone needs it
+static bcache_entry_t *bcache_load(unsigned long group)
+{
+    unsigned long lba = group * BCACHE_SECTORS, blocks = emmc_blockCount();
+    bcache_entry_t *e;
+
+    if (lba >= blocks || !(e = bcache_evict())) return 0;
+
+    e->group = group;
+    e->state = BCACHE_LOADING;
+    e->hashNext = bcache_buckets[bcache_hash(group)];
+    bcache_buckets[bcache_hash(group)] = e;
+
+    e->req.lba = lba;
+    e->req.count = blocks - lba < BCACHE_SECTORS ? blocks - lba : BCACHE_SECTORS;
+    e->req.buffer = e->data;
+    e->req.write = 0;
+    e->req.done = 0;
+    if (!emmc_submit(&e->req)) {
+        bcache_unhash(e);
+        return 0;
+    }
+
+    bcache_touch(e);
+    return e;
+}
+
+static void bcache_readAhead(unsigned long group)
+{
+    for (unsigned long g = group + 1; g <= group + BCACHE_READAHEAD; g++) {
+        if (bcache_lookup(g)) continue;
+        if (!bcache_load(g)) break;
+        bcache_stats.readahead++;
+    }
+}
+
+const unsigned char *bcache_read(unsigned long lba)
+{
+    unsigned long group = lba / BCACHE_SECTORS;
+
+    if (!bcache_ready) return 0;
+
+    bcache_entry_t *e = bcache_lookup(group);
+    if (e) {
+        bcache_stats.hits++;
+    } else {
+        bcache_stats.misses++;
+        if (!(e = bcache_load(group))) return 0;
+    }
+
+    if (e->state == BCACHE_LOADING) {
+        if (emmc_wait(&e->req) != EMMC_OK) {
+            bcache_unhash(e);
+            return 0;
+        }
+        e->state = BCACHE_VALID;
+    }
+    bcache_touch(e);
+
+    // a sequential reader gets the next groups queued while it works on this one
+    if (group == bcache_lastGroup + 1) bcache_readAhead(group);
+    bcache_lastGroup = group;
+
+    return e->data + (lba % BCACHE_SECTORS) * EMMC_BLOCK_SIZE;
+}
+
+void bcache_getStats(bcache_stats_t *stats)
+{
+    *stats = bcache_stats;
+}
+
+int bcache_init(void)
+{
+    if (bcache_ready) return 1;
+
+    unsigned char *data = page_alloc(BCACHE_ORDER);
+    if (!data) return 0;
+
+    for (int i = 0; i < BCACHE_GROUPS; i++) {
+        bcache_entry_t *e = &bcache_entries[i];
+
+        e->data = data + i * BCACHE_SECTORS * EMMC_BLOCK_SIZE;
+        e->state = BCACHE_EMPTY;
+        e->req.status = EMMC_OK;
+        e->prev = i ? &bcache_entries[i - 1] : 0;
+        e->next = i < BCACHE_GROUPS - 1 ? &bcache_entries[i + 1] : 0;
+    }
+    bcache_mru = &bcache_entries[0];
+    bcache_lru = &bcache_entries[BCACHE_GROUPS - 1];
+
+    bcache_ready = 1;
+    return 1;
+}
@@ -0,0 +1,235 @@
+#include "../include/io.h"
+#include "../include/mmu.h"
+#include "../include/irq.h"
+#include "../include/dma.h"
+
+enum {
+    DMA_BASE       = PERIPHERAL_BASE + 0x7000,
+    DMA_CH         = DMA_BASE + DMA_CHANNEL * 0x100,
+    DMA_CS         = DMA_CH + 0x00,
+    DMA_CONBLK_AD  = DMA_CH + 0x04,
+    DMA_DEBUG      = DMA_CH + 0x20,
+    DMA_ENABLE     = DMA_BASE + 0xFF0
+};
+
+enum {
+    DMA_CS_ACTIVE     = 1 << 0,
+    DMA_CS_END        = 1 << 1,  // write 1 to clear
+    DMA_CS_INT        = 1 << 2,  // write 1 to clear
+    DMA_CS_ERROR      = 1 << 8,
+    DMA_CS_PRIORITY   = 8 << 16,
+    DMA_CS_PANIC_PRIO = 15 << 20,
+    DMA_CS_WAIT_WRITES = 1 << 28, // don't signal END before the writes landed
+    DMA_CS_RESET      = 1u << 31,
+
+    DMA_TI_INTEN      = 1 << 0,
+    DMA_TI_TDMODE     = 1 << 1,  // 2D: TXFR_LEN is rows/bytes, STRIDE applies
+    DMA_TI_WAIT_RESP  = 1 << 3,
+    DMA_TI_DEST_INC   = 1 << 4,
+    DMA_TI_DEST_WIDTH = 1 << 5,  // 128-bit writes
+    DMA_TI_SRC_INC    = 1 << 8,
+    DMA_TI_SRC_WIDTH  = 1 << 9,  // 128-bit reads
+    DMA_TI_BURST      = 8 << 12, // 8 beats per burst
+
+    DMA_DEBUG_CLEAR   = 7        // read/FIFO/last-not-set errors
+};
+
+#define DMA_MAX_ROWS 0x3FFF // YLENGTH is 14 bits in 2D mode
+
+// Control blocks must be 32-byte aligned, the engine reads them from memory
+typedef struct {
+    unsigned int ti;
+    unsigned int source;
+    unsigned int dest;
+    unsigned int length;
+    unsigned int stride;
+    unsigned int next;
+    unsigned int reserved[2];
+} __attribute__((aligned(32))) dma_cb_t;
+
+// Operation f (its fence) lives in slot f % DMA_MAX_CBS. Fences up to
+// dma_completed are done, up to dma_started are on the engine, the rest
+// are chained up and wait for the engine to go idle.
+static dma_cb_t dma_cbs[DMA_MAX_CBS];
+static unsigned int __attribute__((aligned(16))) dma_patterns[DMA_MAX_CBS][4];
+static unsigned int dma_submitted = 0;
+static unsigned int dma_started = 0;
+static volatile unsigned int dma_completed = 0;
+static int dma_ready = 0;
+
+// ARM physical address -> legacy DMA bus address (uncached alias)
+static inline unsigned int dma_bus(const volatile void *p)
+{
+    return ((unsigned int)(unsigned long)p & 0x3FFFFFFF) | 0xC0000000;
+}
+
+static void dma_reset(void)
+{
+    mmio_write(DMA_CS, DMA_CS_RESET);
+    while (mmio_read(DMA_CS) & DMA_CS_RESET);
+    mmio_write(DMA_DEBUG, DMA_DEBUG_CLEAR);
+    mmio_write(DMA_CS, DMA_CS_END | DMA_CS_INT);
+}
+
+void dma_init(void)
+{
+    mmio_write(DMA_ENABLE, mmio_read(DMA_ENABLE) | (1 << DMA_CHANNEL));
+    dma_reset();
+
+    dma_submitted = dma_started = dma_completed = 0;
+    dma_ready = 1;
+}
+
+int dma_available(void)
+{
+    return dma_ready;
+}
+
+// Hands everything chained since the last start to the engine, if it's idle
+static void dma_kick(void)
+{
+    if (dma_started != dma_completed || dma_started == dma_submitted) return;
+
+    mmio_write(DMA_CONBLK_AD, dma_bus(&dma_cbs[(dma_started + 1) % DMA_MAX_CBS]));
+    mmio_write(DMA_CS, DMA_CS_ACTIVE | DMA_CS_PRIORITY | DMA_CS_PANIC_PRIO | DMA_CS_WAIT_WRITES);
+    dma_started = dma_submitted;
+}
+
+int dma_poll(void)
+{
+    unsigned long flags = irq_save();
+    int completed = 0;
+
+    if (dma_started != dma_completed) {
+        unsigned int cs = mmio_read(DMA_CS);
+
+        if (cs & DMA_CS_ERROR) {
+            dma_reset(); // the chain is lost; its fences complete so nobody waits forever
+        } else if (cs & DMA_CS_ACTIVE) {
+            irq_restore(flags);
+            return 0;
+        } else {
+            mmio_write(DMA_CS, DMA_CS_END | DMA_CS_INT);
+        }
+
+        completed = dma_started - dma_completed;
+        dma_completed = dma_started;
+    }
+
+    dma_kick();
+    irq_restore(flags);
+    return completed;
+}
+
+static void dma_irqHandler(void *arg)
+{
+    (void)arg;
+    dma_poll();
+}
+
+void dma_enableInterrupts(void)
+{
+    irq_register(IRQ_DMA0 + DMA_CHANNEL, dma_irqHandler, 0);
+}
+
+int dma_done(unsigned int fence)
+{
+    if ((int)(dma_completed - fence) >= 0) return 1;
+
+    dma_poll();
+    return (int)(dma_completed - fence) >= 0;
+}
+
+void dma_wait(unsigned int fence)
+{
+    while (!dma_done(fence)) {
+        asm volatile("yield");
+    }
+}
+
+// Queues one control block and returns its fence
+static unsigned int dma_submit(unsigned int ti, unsigned int source, unsigned int dest,
+                               unsigned int bytesPerRow, unsigned int rows, unsigned int stride,
+                               const unsigned int *pattern)
+{
+    // a full ring drains first, the engine is always making progress
+    while (dma_submitted - dma_completed >= DMA_MAX_CBS - 1) dma_poll();
+
+    unsigned long flags = irq_save();
+    unsigned int fence = ++dma_submitted;
+    unsigned int slot = fence % DMA_MAX_CBS;
+    dma_cb_t *cb = &dma_cbs[slot];
+
+    if (pattern) {
+        for (int i = 0; i < 4; i++) dma_patterns[slot][i] = pattern[i];
+        dcache_clean(dma_patterns[slot], sizeof(dma_patterns[slot]));
+        source = dma_bus(dma_patterns[slot]);
+    }
+
+    cb->ti = ti | DMA_TI_TDMODE | DMA_TI_WAIT_RESP | DMA_TI_INTEN | DMA_TI_BURST;
+    cb->source = source;
+    cb->dest = dest;
+    cb->length = ((rows - 1) << 16) | bytesPerRow;
+    cb->stride = stride;
+    cb->next = 0;
+    dcache_clean(cb, sizeof(*cb));
+
+    // chain onto the previous block if the engine hasn't been given it yet
+    if (fence - 1 != dma_started) {
+        dma_cb_t *prev = &dma_cbs[(fence - 1) % DMA_MAX_CBS];
+        prev->next = dma_bus(cb);
+        dcache_clean(prev, sizeof(*prev));
+    }
+
+    dma_kick();
+    irq_restore(flags);
+    return fence;
+}
+
+unsigned int dma_fill2d(void *dst, unsigned int dstPitch, unsigned int bytesPerRow,
+                        unsigned int rows, unsigned int pattern)
+{
+    unsigned int words[4] = { pattern, pattern, pattern, pattern };
+    unsigned char *d = (unsigned char *)dst;
+    unsigned int fence = 0;
+
+    if (bytesPerRow == 0 || bytesPerRow > 0xFFFF) return 0;
+
+    // the source doesn't move: every 128-bit read returns the same pattern
+    while (rows > 0) {
+        unsigned int n = rows > DMA_MAX_ROWS ? DMA_MAX_ROWS : rows;
+
+        fence = dma_submit(DMA_TI_DEST_INC | DMA_TI_DEST_WIDTH | DMA_TI_SRC_WIDTH,
+                           0, dma_bus(d), bytesPerRow, n,
+                           ((dstPitch - bytesPerRow) & 0xFFFF) << 16, words);
+        d += n * dstPitch;
+        rows -= n;
+    }
+    return fence;
+}
+
+unsigned int dma_copy2d(void *dst, unsigned int dstPitch, const void *src, unsigned int srcPitch,
+                        unsigned int bytesPerRow, unsigned int rows)
+{
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
+    unsigned int fence = 0;
+
+    if (bytesPerRow == 0 || bytesPerRow > 0xFFFF) return 0;
+
+    // the engine reads memory, not our cache
+    dcache_clean(s, (unsigned long)(rows - 1) * srcPitch + bytesPerRow);
+
+    while (rows > 0) {
+        unsigned int n = rows > DMA_MAX_ROWS ? DMA_MAX_ROWS : rows;
+
+        fence = dma_submit(DMA_TI_DEST_INC | DMA_TI_DEST_WIDTH | DMA_TI_SRC_INC | DMA_TI_SRC_WIDTH,
+                           dma_bus(s), dma_bus(d), bytesPerRow, n,
+                           (((dstPitch - bytesPerRow) & 0xFFFF) << 16) | ((srcPitch - bytesPerRow) & 0xFFFF),
+                           0);
+        d += n * dstPitch;
+        s += n * srcPitch;
+        rows -= n;
+    }
+    return fence;
+}
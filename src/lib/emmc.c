@@ -0,0 +1,649 @@
+// SD card driver for the BCM2711 EMMC2 controller (see emmc.h)
+// src/lib/emmc.c
+
+#include "../include/io.h"
+#include "../include/irq.h"
+#include "../include/mb.h"
+#include "../include/mmu.h"
+#include "../include/mem.h"
+#include "../include/smp.h"
+#include "../include/timer.h"
+#include "../include/log.h"
+#include "../include/emmc.h"
+
+enum {
+    EMMC_BASE        = PERIPHERAL_BASE + 0x340000,
+    EMMC_ARG2        = EMMC_BASE + 0x00,
+    EMMC_BLKSIZECNT  = EMMC_BASE + 0x04,
+    EMMC_ARG1        = EMMC_BASE + 0x08,
+    EMMC_CMDTM       = EMMC_BASE + 0x0C,
+    EMMC_RESP0       = EMMC_BASE + 0x10,
+    EMMC_RESP1       = EMMC_BASE + 0x14,
+    EMMC_RESP2       = EMMC_BASE + 0x18,
+    EMMC_RESP3       = EMMC_BASE + 0x1C,
+    EMMC_DATA        = EMMC_BASE + 0x20,
+    EMMC_STATUS      = EMMC_BASE + 0x24,
+    EMMC_CONTROL0    = EMMC_BASE + 0x28,
+    EMMC_CONTROL1    = EMMC_BASE + 0x2C,
+    EMMC_INTERRUPT   = EMMC_BASE + 0x30,
+    EMMC_IRPT_MASK   = EMMC_BASE + 0x34,
+    EMMC_IRPT_EN     = EMMC_BASE + 0x38,
+    EMMC_CONTROL2    = EMMC_BASE + 0x3C,
+    EMMC_CAPS0       = EMMC_BASE + 0x40,
+    EMMC_ADMA_ADDR   = EMMC_BASE + 0x58
+};
+
+enum {
+    STATUS_CMD_INHIBIT = 1 << 0,
+    STATUS_DAT_INHIBIT = 1 << 1,
+
+    C0_BUS_4BIT   = 1 << 1,
+    C0_HIGH_SPEED = 1 << 2,
+    C0_ADMA2      = 2 << 3,
+    C0_POWER_ON   = 1 << 8,
+    C0_VOLT_3V3   = 7 << 9,
+
+    C1_CLK_INTLEN = 1 << 0,
+    C1_CLK_STABLE = 1 << 1,
+    C1_CLK_EN     = 1 << 2,
+    C1_TOUNIT_MAX = 0xE << 16,
+    C1_SRST_HC    = 1 << 24,
+    C1_SRST_CMD   = 1 << 25,
+    C1_SRST_DATA  = 1 << 26,
+
+    INT_CMD_DONE  = 1 << 0,
+    INT_DATA_DONE = 1 << 1,
+    INT_WRITE_RDY = 1 << 4,
+    INT_READ_RDY  = 1 << 5,
+    INT_ERROR     = 0xFFFF8000,  // summary bit and every error source
+
+    CAPS_ADMA2    = 1 << 19
+};
+
+// CMDTM: command index and response type in the upper half, transfer mode below
+enum {
+    TM_DMA     = 1 << 0,
+    TM_BLKCNT  = 1 << 1,
+    TM_AUTO12  = 1 << 2,
+    TM_READ    = 1 << 4,
+    TM_MULTI   = 1 << 5,
+
+    RSP_136    = 1 << 16,
+    RSP_48     = 2 << 16,
+    RSP_48B    = 3 << 16,
+    RSP_CRC    = 1 << 19,
+    RSP_INDEX  = 1 << 20,
+    CMD_DATA   = 1 << 21
+};
+
+#define CMD(n) ((unsigned int)(n) << 24)
+
+enum {
+    CMD_GO_IDLE       = CMD(0),
+    CMD_ALL_SEND_CID  = CMD(2) | RSP_136 | RSP_CRC,
+    CMD_SEND_RCA      = CMD(3) | RSP_48 | RSP_CRC | RSP_INDEX,
+    CMD_SWITCH_FUNC   = CMD(6) | RSP_48 | RSP_CRC | RSP_INDEX | CMD_DATA | TM_READ,
+    CMD_SELECT        = CMD(7) | RSP_48B | RSP_CRC | RSP_INDEX,
+    CMD_SEND_IF_COND  = CMD(8) | RSP_48 | RSP_CRC | RSP_INDEX,
+    CMD_SEND_CSD      = CMD(9) | RSP_136 | RSP_CRC,
+    CMD_STOP          = CMD(12) | RSP_48B | RSP_CRC | RSP_INDEX,
+    CMD_SET_BLOCKLEN  = CMD(16) | RSP_48 | RSP_CRC | RSP_INDEX,
+    CMD_READ_MULTI    = CMD(18) | RSP_48 | RSP_CRC | RSP_INDEX | CMD_DATA | TM_READ | TM_MULTI | TM_BLKCNT | TM_AUTO12,
+    CMD_WRITE_MULTI   = CMD(25) | RSP_48 | RSP_CRC | RSP_INDEX | CMD_DATA | TM_MULTI | TM_BLKCNT | TM_AUTO12,
+    CMD_APP           = CMD(55) | RSP_48 | RSP_CRC | RSP_INDEX,
+    ACMD_BUS_WIDTH    = CMD(6) | RSP_48 | RSP_CRC | RSP_INDEX,
+    ACMD_SEND_OP_COND = CMD(41) | RSP_48
+};
+
+// ADMA2 descriptor (32-bit addressing)
+typedef struct {
+    unsigned short attr;
+    unsigned short length;
+    unsigned int address;
+} emmc_adma_t;
+
+enum {
+    ADMA_VALID = 1 << 0,
+    ADMA_END   = 1 << 1,
+    ADMA_TRAN  = 2 << 4
+};
+
+#define EMMC_ADMA_CHUNK  (32 * 1024)
+#define EMMC_ADMA_DESCS  (EMMC_MAX_BLOCKS * EMMC_BLOCK_SIZE / EMMC_ADMA_CHUNK + 1)
+#define EMMC_CLOCK_EMMC2 12          // mailbox clock id
+#define EMMC_DMA_LIMIT   0x40000000UL // EMMC2 only reaches the first GB
+
+static emmc_adma_t emmc_adma[EMMC_ADMA_DESCS] __attribute__((aligned(64)));
+
+static int emmc_ready = 0;
+static int emmc_useAdma = 0;
+static int emmc_irqOn = 0;
+static int emmc_highCapacity = 0;
+static unsigned int emmc_rca = 0;
+static unsigned int emmc_baseClock = 0;
+static unsigned long emmc_blocks = 0;
+
+// Request queue: emmc_active is on the controller, the rest wait in order
+static volatile int emmc_lock = 0;
+static emmc_request_t *emmc_active = 0;
+static emmc_request_t *emmc_queueHead = 0, *emmc_queueTail = 0;
+static unsigned long emmc_activeStart = 0;
+
+// Waits for any bit of mask (or an error) in INTERRUPT; returns it, 0 on timeout
+static unsigned int emmc_waitInterrupt(unsigned int mask)
+{
+    unsigned long start = timer_now_us();
+    unsigned int v;
+
+    while (!((v = mmio_read(EMMC_INTERRUPT)) & (mask | INT_ERROR))) {
+        if (timer_now_us() - start > EMMC_TIMEOUT_US) return 0;
+    }
+    return v;
+}
+
+static int emmc_waitClear(long reg, unsigned int mask)
+{
+    unsigned long start = timer_now_us();
+
+    while (mmio_read(reg) & mask) {
+        if (timer_now_us() - start > EMMC_TIMEOUT_US) return 0;
+    }
+    return 1;
+}
+
+static void emmc_resetLines(void)
+{
+    mmio_write(EMMC_CONTROL1, mmio_read(EMMC_CONTROL1) | C1_SRST_CMD | C1_SRST_DATA);
+    emmc_waitClear(EMMC_CONTROL1, C1_SRST_CMD | C1_SRST_DATA);
+    mmio_write(EMMC_INTERRUPT, 0xFFFFFFFF);
+}
+
+// Issues a command and waits for its response (and the busy phase of R1b)
+static int emmc_command(unsigned int cmd, unsigned int arg)
+{
+    int busy = (cmd & CMD_DATA) || (cmd & RSP_48B) == RSP_48B;
+    unsigned int inhibit = STATUS_CMD_INHIBIT | (busy ? STATUS_DAT_INHIBIT : 0);
+
+    if (!emmc_waitClear(EMMC_STATUS, inhibit)) return 0;
+
+    mmio_write(EMMC_INTERRUPT, 0xFFFFFFFF);
+    mmio_write(EMMC_ARG1, arg);
+    mmio_write(EMMC_CMDTM, cmd);
+
+    unsigned int v = emmc_waitInterrupt(INT_CMD_DONE);
+    if (!v || (v & INT_ERROR)) {
+        emmc_resetLines();
+        return 0;
+    }
+    mmio_write(EMMC_INTERRUPT, INT_CMD_DONE);
+
+    if ((cmd & RSP_48B) == RSP_48B && !(cmd & CMD_DATA)) {
+        v = emmc_waitInterrupt(INT_DATA_DONE);
+        mmio_write(EMMC_INTERRUPT, INT_DATA_DONE);
+        if (!v || (v & INT_ERROR)) return 0;
+    }
+    return 1;
+}
+
+static int emmc_appCommand(unsigned int cmd, unsigned int arg)
+{
+    return emmc_command(CMD_APP, emmc_rca << 16) && emmc_command(cmd, arg);
+}
+
+// SDHCI 3.0 10-bit divided clock: f = base / (2 * n), n = 0 is base itself
+static int emmc_setClock(unsigned int hz)
+{
+    unsigned int n = 0;
+
+    if (hz < emmc_baseClock) {
+        n = (emmc_baseClock + 2 * hz - 1) / (2 * hz);
+        if (n > 0x3FF) n = 0x3FF;
+    }
+
+    unsigned int c1 = mmio_read(EMMC_CONTROL1);
+    mmio_write(EMMC_CONTROL1, c1 & ~C1_CLK_EN);
+
+    c1 &= ~(0xFFFF | (0xF << 16));
+    c1 |= ((n & 0xFF) << 8) | ((n >> 8) << 6) | C1_CLK_INTLEN | C1_TOUNIT_MAX;
+    mmio_write(EMMC_CONTROL1, c1);
+
+    unsigned long start = timer_now_us();
+    while (!(mmio_read(EMMC_CONTROL1) & C1_CLK_STABLE)) {
+        if (timer_now_us() - start > EMMC_TIMEOUT_US) return 0;
+    }
+
+    mmio_write(EMMC_CONTROL1, c1 | C1_CLK_EN);
+    sleep_us(10);
+    return 1;
+}
+
+static unsigned int emmc_queryBaseClock(void)
+{
+    mbox_msg_t msg;
+
+    mbox_msg_init(&msg);
+    int clk = mbox_msg_addTag(&msg, MBOX_TAG_GETCLKRATE, (unsigned int[]){ EMMC_CLOCK_EMMC2 }, 1, 2);
+    if (clk >= 0 && mbox_submit(&msg, MBOX_CH_PROP) && mbox_wait(&msg) && msg.buf[clk + 1]) {
+        return msg.buf[clk + 1];
+    }
+
+    // QEMU has no such clock; the capabilities carry the base clock in MHz
+    unsigned int mhz = (mmio_read(EMMC_CAPS0) >> 8) & 0xFF;
+    return (mhz ? mhz : 100) * 1000000;
+}
+
+// PIO data phase of a command that is already issued (blockSize bytes per block)
+static int emmc_pioData(unsigned char *buffer, unsigned int blockSize, unsigned int count, int write)
+{
+    unsigned int ready = write ? INT_WRITE_RDY : INT_READ_RDY;
+
+    for (unsigned int b = 0; b < count; b++) {
+        unsigned int v = emmc_waitInterrupt(ready);
+        if (!v || (v & INT_ERROR)) return 0;
+        mmio_write(EMMC_INTERRUPT, ready);
+
+        for (unsigned int i = 0; i < blockSize; i += 4, buffer += 4) {
+            if (write) {
+                mmio_write(EMMC_DATA, buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((unsigned int)buffer[3] << 24));
+            } else {
+                unsigned int w = mmio_read(EMMC_DATA);
+                buffer[0] = w;
+                buffer[1] = w >> 8;
+                buffer[2] = w >> 16;
+                buffer[3] = w >> 24;
+            }
+        }
+    }
+
+    unsigned int v = emmc_waitInterrupt(INT_DATA_DONE);
+    mmio_write(EMMC_INTERRUPT, INT_DATA_DONE);
+    return v && !(v & INT_ERROR);
+}
+
+static unsigned int emmc_address(unsigned long lba)
+{
+    return emmc_highCapacity ? lba : lba * EMMC_BLOCK_SIZE; // SDSC cards take byte addresses
+}
+
+static int emmc_pioTransfer(emmc_request_t *req)
+{
+    unsigned int cmd = req->write ? CMD_WRITE_MULTI : CMD_READ_MULTI;
+
+    mmio_write(EMMC_BLKSIZECNT, EMMC_BLOCK_SIZE | (req->count << 16));
+    if (!emmc_command(cmd, emmc_address(req->lba))) return EMMC_ERROR;
+
+    if (!emmc_pioData(req->buffer, EMMC_BLOCK_SIZE, req->count, req->write)) {
+        emmc_resetLines();
+        emmc_command(CMD_STOP, 0);
+        return EMMC_ERROR;
+    }
+    return EMMC_OK;
+}
+
+// DMA only into whole cache lines: the invalidate after a read would drop
+// anything else that shares the first or last line with the buffer
+static int emmc_dmaAddressable(const void *buffer, unsigned long size)
+{
+    unsigned long a = (unsigned long)buffer;
+    return !(a & 63) && !(size & 63) && a + size <= EMMC_DMA_LIMIT;
+}
+
+// Programs the descriptor table and starts the command; the interrupt (or
+// emmc_poll) sees INT_DATA_DONE once the whole request has moved
+static void emmc_dmaStart(emmc_request_t *req)
+{
+    unsigned long size = (unsigned long)req->count * EMMC_BLOCK_SIZE;
+    unsigned long bus = ((unsigned long)req->buffer & 0x3FFFFFFF) | 0xC0000000;
+    int n = 0;
+
+    if (req->write) dcache_clean(req->buffer, size);
+    else dcache_cleanInvalidate(req->buffer, size); // no dirty line may be evicted over the data
+
+    for (unsigned long off = 0; off < size; off += EMMC_ADMA_CHUNK, n++) {
+        unsigned long len = size - off < EMMC_ADMA_CHUNK ? size - off : EMMC_ADMA_CHUNK;
+        emmc_adma[n].attr = ADMA_VALID | ADMA_TRAN;
+        emmc_adma[n].length = len;
+        emmc_adma[n].address = bus + off;
+    }
+    emmc_adma[n - 1].attr |= ADMA_END;
+    dcache_clean(emmc_adma, sizeof(emmc_adma));
+
+    mmio_write(EMMC_INTERRUPT, 0xFFFFFFFF);
+    mmio_write(EMMC_IRPT_EN, emmc_irqOn ? INT_DATA_DONE | INT_ERROR : 0);
+    mmio_write(EMMC_ADMA_ADDR, (unsigned int)(((unsigned long)emmc_adma & 0x3FFFFFFF) | 0xC0000000));
+    mmio_write(EMMC_BLKSIZECNT, EMMC_BLOCK_SIZE | (req->count << 16));
+    mmio_write(EMMC_ARG1, emmc_address(req->lba));
+    mmio_write(EMMC_CMDTM, (req->write ? CMD_WRITE_MULTI : CMD_READ_MULTI) | TM_DMA);
+
+    emmc_activeStart = timer_now_us();
+}
+
+// Queue handling, called with emmc_lock held. Finished requests are chained
+// on *done so their callbacks run after the lock is dropped.
+static void emmc_startNext(emmc_request_t **done)
+{
+    while (!emmc_active && emmc_queueHead) {
+        emmc_request_t *req = emmc_queueHead;
+
+        emmc_queueHead = req->next;
+        if (!emmc_queueHead) emmc_queueTail = 0;
+
+        unsigned long size = (unsigned long)req->count * EMMC_BLOCK_SIZE;
+        if (emmc_useAdma && emmc_dmaAddressable(req->buffer, size) &&
+            emmc_waitClear(EMMC_STATUS, STATUS_CMD_INHIBIT | STATUS_DAT_INHIBIT)) {
+            emmc_active = req;
+            emmc_dmaStart(req);
+            return;
+        }
+
+        req->status = emmc_pioTransfer(req);
+        req->next = *done;
+        *done = req;
+    }
+}
+
+static void emmc_finishActive(emmc_request_t **done)
+{
+    emmc_request_t *req = emmc_active;
+    unsigned int v = mmio_read(EMMC_INTERRUPT);
+    int timedOut = timer_now_us() - emmc_activeStart > EMMC_TIMEOUT_US;
+
+    if (!(v & (INT_DATA_DONE | INT_ERROR)) && !timedOut) return;
+
+    mmio_write(EMMC_IRPT_EN, 0);
+    mmio_write(EMMC_INTERRUPT, 0xFFFFFFFF);
+
+    if ((v & INT_ERROR) || !(v & INT_DATA_DONE)) {
+        LOG_WARN("EMMC: Transfer at %lu failed, interrupt %x", req->lba, v);
+        emmc_resetLines();
+        emmc_command(CMD_STOP, 0);
+        req->status = EMMC_ERROR;
+    } else {
+        if (!req->write) dcache_invalidate(req->buffer, (unsigned long)req->count * EMMC_BLOCK_SIZE);
+        req->status = EMMC_OK;
+    }
+
+    emmc_active = 0;
+    req->next = *done;
+    *done = req;
+}
+
+static void emmc_complete(emmc_request_t *done)
+{
+    while (done) {
+        emmc_request_t *next = done->next;
+        if (done->done) done->done(done);
+        done = next;
+    }
+}
+
+int emmc_poll(void)
+{
+    emmc_request_t *done = 0;
+    int n = 0;
+
+    if (!emmc_ready) return 0;
+
+    unsigned long flags = smp_lock(&emmc_lock);
+    if (emmc_active) emmc_finishActive(&done);
+    emmc_startNext(&done);
+    smp_unlock(&emmc_lock, flags);
+
+    for (emmc_request_t *r = done; r; r = r->next) n++;
+    emmc_complete(done);
+    return n;
+}
+
+static void emmc_irqHandler(void *arg)
+{
+    (void)arg;
+    emmc_poll();
+}
+
+void emmc_enableInterrupts(void)
+{
+    if (!emmc_ready) return;
+
+    irq_register(IRQ_EMMC2, emmc_irqHandler, 0);
+    emmc_irqOn = 1;
+}
+
+int emmc_submit(emmc_request_t *req)
+{
+    emmc_request_t *done = 0;
+
+    if (!emmc_ready || !req->count || req->count > EMMC_MAX_BLOCKS ||
+        req->lba + req->count > emmc_blocks) {
+        req->status = EMMC_ERROR;
+        return 0;
+    }
+
+    req->status = EMMC_PENDING;
+    req->next = 0;
+
+    unsigned long flags = smp_lock(&emmc_lock);
+    if (emmc_queueTail) emmc_queueTail->next = req;
+    else emmc_queueHead = req;
+    emmc_queueTail = req;
+    emmc_startNext(&done);
+    smp_unlock(&emmc_lock, flags);
+
+    emmc_complete(done);
+    return 1;
+}
+
+int emmc_wait(emmc_request_t *req)
+{
+    while (__atomic_load_n(&req->status, __ATOMIC_ACQUIRE) == EMMC_PENDING) {
+        if (!emmc_poll()) asm volatile("wfe"); // woken by the interrupt or the event stream
+    }
+    return req->status;
+}
+
+// field by field: there is no memset for the compiler to call
+static void emmc_requestInit(emmc_request_t *req, unsigned long lba, unsigned int count, void *buffer, int write)
+{
+    req->lba = lba;
+    req->count = count;
+    req->buffer = buffer;
+    req->write = write;
+    req->done = 0;
+    req->arg = 0;
+    req->status = EMMC_OK;
+    req->next = 0;
+}
+
+int emmc_read(unsigned long lba, unsigned int count, void *buffer)
+{
+    emmc_request_t req;
+
+    emmc_requestInit(&req, lba, count, buffer, 0);
+    if (!emmc_submit(&req)) return EMMC_ERROR;
+    return emmc_wait(&req);
+}
+
+int emmc_write(unsigned long lba, unsigned int count, const void *buffer)
+{
+    emmc_request_t req;
+
+    emmc_requestInit(&req, lba, count, (void *)buffer, 1);
+    if (!emmc_submit(&req)) return EMMC_ERROR;
+    return emmc_wait(&req);
+}
+
+unsigned long emmc_blockCount(void)
+{
+    return emmc_blocks;
+}
+
+// Capacity from the CSD. The response registers hold CSD bits 127:8, so CSD
+// bit n is response bit n - 8.
+static unsigned long emmc_csdBlocks(void)
+{
+    unsigned int r1 = mmio_read(EMMC_RESP1), r2 = mmio_read(EMMC_RESP2), r3 = mmio_read(EMMC_RESP3);
+
+    if (((r3 >> 22) & 3) == 1) {
+        unsigned long size = (r1 >> 8) & 0x3FFFFF; // C_SIZE, CSD 69:48
+        return (size + 1) * 1024;
+    }
+
+    unsigned int size = (r1 >> 22) | ((r2 & 3) << 10);   // C_SIZE, CSD 73:62
+    unsigned int mult = (r1 >> 7) & 7;                  // C_SIZE_MULT, CSD 49:47
+    unsigned int blockLen = (r2 >> 8) & 0xF;            // READ_BL_LEN, CSD 83:80
+    return ((unsigned long)(size + 1) << (mult + 2)) << blockLen >> 9;
+}
+
+// CMD6: switch to high speed (50 MHz); 0 if the card can't
+static int emmc_highSpeed(void)
+{
+    static unsigned char status[64] __attribute__((aligned(64)));
+
+    mmio_write(EMMC_BLKSIZECNT, sizeof(status) | (1 << 16));
+    if (!emmc_command(CMD_SWITCH_FUNC, 0x80FFFFF1)) return 0;
+    if (!emmc_pioData(status, sizeof(status), 1, 0)) return 0;
+
+    if ((status[16] & 0xF) != 1) return 0; // function group 1 didn't switch
+
+    mmio_write(EMMC_CONTROL0, mmio_read(EMMC_CONTROL0) | C0_HIGH_SPEED);
+    return emmc_setClock(50000000);
+}
+
+int emmc_init(void)
+{
+    if (emmc_ready) return 1;
+
+    mmio_write(EMMC_CONTROL1, C1_SRST_HC);
+    if (!emmc_waitClear(EMMC_CONTROL1, C1_SRST_HC)) {
+        LOG_WARN("EMMC: Controller reset timed out");
+        return 0;
+    }
+
+    mmio_write(EMMC_CONTROL0, C0_POWER_ON | C0_VOLT_3V3);
+    mmio_write(EMMC_CONTROL2, 0);
+    mmio_write(EMMC_IRPT_EN, 0);
+    mmio_write(EMMC_IRPT_MASK, 0xFFFFFFFF);
+    mmio_write(EMMC_INTERRUPT, 0xFFFFFFFF);
+
+    emmc_baseClock = emmc_queryBaseClock();
+    if (!emmc_setClock(400000)) {
+        LOG_WARN("EMMC: Clock not stable");
+        return 0;
+    }
+
+    // identification
+    emmc_rca = 0;
+    emmc_command(CMD_GO_IDLE, 0);
+    int v2 = emmc_command(CMD_SEND_IF_COND, 0x1AA) && (mmio_read(EMMC_RESP0) & 0xFFF) == 0x1AA;
+
+    unsigned long start = timer_now_us();
+    unsigned int ocr = 0;
+    do {
+        if (!emmc_appCommand(ACMD_SEND_OP_COND, 0x00FF8000 | (v2 ? 1 << 30 : 0))) {
+            LOG_INFO("EMMC: No card");
+            return 0;
+        }
+        ocr = mmio_read(EMMC_RESP0);
+        if (!(ocr & (1u << 31))) sleep_ms(10);
+    } while (!(ocr & (1u << 31)) && timer_now_us() - start < EMMC_TIMEOUT_US);
+
+    if (!(ocr & (1u << 31))) {
+        LOG_WARN("EMMC: Card stayed busy");
+        return 0;
+    }
+    emmc_highCapacity = (ocr >> 30) & 1;
+
+    if (!emmc_command(CMD_ALL_SEND_CID, 0) || !emmc_command(CMD_SEND_RCA, 0)) return 0;
+    emmc_rca = mmio_read(EMMC_RESP0) >> 16;
+
+    if (!emmc_command(CMD_SEND_CSD, emmc_rca << 16)) return 0;
+    emmc_blocks = emmc_csdBlocks();
+
+    if (!emmc_command(CMD_SELECT, emmc_rca << 16)) return 0;
+
+    // data transfer mode: 4-bit bus, 512-byte blocks, then as fast as the card goes
+    if (emmc_appCommand(ACMD_BUS_WIDTH, 2)) {
+        mmio_write(EMMC_CONTROL0, mmio_read(EMMC_CONTROL0) | C0_BUS_4BIT);
+    }
+    if (!emmc_highCapacity) emmc_command(CMD_SET_BLOCKLEN, EMMC_BLOCK_SIZE);
+
+    int fast = emmc_highSpeed();
+    if (!fast) emmc_setClock(25000000);
+
+    emmc_useAdma = (mmio_read(EMMC_CAPS0) & CAPS_ADMA2) != 0;
+    if (emmc_useAdma) mmio_write(EMMC_CONTROL0, mmio_read(EMMC_CONTROL0) | C0_ADMA2);
+
+    emmc_ready = 1;
+    LOG_INFO("EMMC: %lu MB %s card, %s, %s", emmc_blocks >> 11, emmc_highCapacity ? "SDHC" : "SDSC",
+             fast ? "50 MHz" : "25 MHz", emmc_useAdma ? "ADMA2" : "PIO");
+    return 1;
+}
+
+// Benchmark
+
+#define EMMC_BENCH_DEPTH 4              // requests in flight
+#define EMMC_BENCH_SEQ   (16UL << 20)   // bytes read sequentially
+#define EMMC_BENCH_RAND  512            // 4 KB random reads
+
+static void emmc_report(const char *what, unsigned long bytes, unsigned long us)
+{
+    unsigned long rate = us ? bytes * 100 / us : 0; // bytes per us = MB/s
+
+    LOG_INFO("EMMC: %s %lu.%02lu MB/s (%lu KB in %lu us)", what, rate / 100, rate % 100, bytes >> 10, us);
+}
+
+// Reads count chunks of `blocks` each, sequentially or at random aligned
+// offsets, keeping EMMC_BENCH_DEPTH requests queued; returns the time taken
+static unsigned long emmc_benchRun(unsigned char *buffer, unsigned int blocks, unsigned int count, int random)
+{
+    emmc_request_t reqs[EMMC_BENCH_DEPTH];
+    unsigned long span = emmc_blocks / blocks, seed = 0x2545F491;
+    unsigned long start = timer_now_us();
+    int ok = 1;
+
+    for (int i = 0; i < EMMC_BENCH_DEPTH; i++) emmc_requestInit(&reqs[i], 0, 0, 0, 0);
+
+    for (unsigned int i = 0; i < count && ok; i++) {
+        emmc_request_t *req = &reqs[i % EMMC_BENCH_DEPTH];
+        unsigned long lba = (unsigned long)i * blocks;
+
+        if (emmc_wait(req) != EMMC_OK) {
+            ok = 0;
+            break;
+        }
+
+        if (random) {
+            seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+            lba = (seed % span) * blocks;
+        }
+        emmc_requestInit(req, lba, blocks, buffer + (i % EMMC_BENCH_DEPTH) * blocks * EMMC_BLOCK_SIZE, 0);
+        if (!emmc_submit(req)) ok = 0;
+    }
+
+    // even after an error: the others are still queued on the stack and DMAing into buffer
+    for (int i = 0; i < EMMC_BENCH_DEPTH; i++) {
+        if (emmc_wait(&reqs[i]) != EMMC_OK) ok = 0;
+    }
+    return ok ? timer_now_us() - start : 0;
+}
+
+void emmc_benchmark(void)
+{
+    unsigned int seqBlocks = 256; // 128 KB requests
+    unsigned char *buffer = page_alloc(8); // 1 MB: EMMC_BENCH_DEPTH requests of either kind
+
+    if (!emmc_ready || !buffer) {
+        LOG_WARN("EMMC: Nothing to benchmark");
+        return;
+    }
+
+    unsigned int chunks = EMMC_BENCH_SEQ / (seqBlocks * EMMC_BLOCK_SIZE);
+    if ((unsigned long)chunks * seqBlocks > emmc_blocks) chunks = emmc_blocks / seqBlocks;
+
+    unsigned long us = emmc_benchRun(buffer, seqBlocks, chunks, 0);
+    if (us) emmc_report("sequential read", (unsigned long)chunks * seqBlocks * EMMC_BLOCK_SIZE, us);
+
+    us = emmc_benchRun(buffer, 8, EMMC_BENCH_RAND, 1);
+    if (us) emmc_report("4K random read", EMMC_BENCH_RAND * 4096UL, us);
+
+    page_free(buffer, 8);
+}
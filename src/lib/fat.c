@@ -0,0 +1,489 @@
+// Read-only FAT32 (see fat.h)
+// src/lib/fat.c
+
+#include "../include/emmc.h"
+#include "../include/bcache.h"
+#include "../include/log.h"
+#include "../include/fat.h"
+
+enum {
+    FAT_ATTR_VOLUME = 0x08,
+    FAT_ATTR_DIR    = 0x10,
+    FAT_ATTR_LFN    = 0x0F,
+
+    FAT_ENTRY_FREE  = 0xE5,
+    FAT_EOC         = 0x0FFFFFF8,   // and above: end of chain
+    FAT_MASK        = 0x0FFFFFFF,
+
+    FAT_INFLIGHT    = 4             // fat_readInto requests on the card at once
+};
+
+struct fat_chain {
+    unsigned int firstCluster;      // 0 if the entry is free
+    unsigned int clusters;          // covered by extents
+    unsigned int lastCluster;       // on disk, where the FAT walk continues if !complete
+    unsigned int users;
+    unsigned long lastUse;
+    int complete;
+    int count;
+    fat_extent_t extents[FAT_MAX_EXTENTS];
+};
+
+static struct {
+    int mounted;
+    unsigned long fatLba;
+    unsigned long dataLba;
+    unsigned int sectorsPerCluster;
+    unsigned int clusterShift;      // log2 of the cluster size in bytes
+    unsigned int clusterCount;
+    unsigned int rootCluster;
+} fat_vol;
+
+static fat_chain_t fat_chains[FAT_CHAIN_CACHE];
+static unsigned long fat_chainClock = 0;
+static emmc_request_t fat_reqs[FAT_INFLIGHT];
+
+static unsigned int fat_le16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned int fat_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static void fat_copy(unsigned char *dst, const unsigned char *src, unsigned int n)
+{
+    while (n--) *dst++ = *src++;
+}
+
+static char fat_lower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + 32 : c;
+}
+
+static unsigned long fat_clusterLba(unsigned int cluster)
+{
+    return fat_vol.dataLba + (unsigned long)(cluster - 2) * fat_vol.sectorsPerCluster;
+}
+
+// Next cluster in the chain, 0 at the end or on a bad entry
+static unsigned int fat_next(unsigned int cluster)
+{
+    const unsigned char *p = bcache_read(fat_vol.fatLba + cluster / 128);
+    if (!p) return 0;
+
+    unsigned int next = fat_le32(p + (cluster % 128) * 4) & FAT_MASK;
+    if (next < 2 || next >= FAT_EOC || next >= fat_vol.clusterCount + 2) return 0;
+    return next;
+}
+
+// Walks the chain once and keeps it as runs of consecutive clusters
+static void fat_chainBuild(fat_chain_t *c, unsigned int first)
+{
+    unsigned int cluster = first, index = 0;
+
+    c->firstCluster = first;
+    c->count = 0;
+    c->complete = 0;
+
+    while (cluster) {
+        fat_extent_t *e = c->count ? &c->extents[c->count - 1] : 0;
+
+        if (e && cluster == e->cluster + e->count) {
+            e->count++;
+        } else if (c->count == FAT_MAX_EXTENTS) {
+            break;  // the rest is walked on demand from lastCluster
+        } else {
+            e = &c->extents[c->count++];
+            e->fileCluster = index;
+            e->cluster = cluster;
+            e->count = 1;
+        }
+
+        c->lastCluster = cluster;
+        index++;
+        if (index > fat_vol.clusterCount) break; // loop in a corrupt FAT
+        cluster = fat_next(cluster);
+    }
+
+    c->clusters = index;
+    c->complete = !cluster;
+}
+
+static fat_chain_t *fat_chainGet(unsigned int first)
+{
+    fat_chain_t *victim = 0;
+
+    if (first < 2) return 0;
+
+    for (int i = 0; i < FAT_CHAIN_CACHE; i++) {
+        fat_chain_t *c = &fat_chains[i];
+
+        if (c->firstCluster == first) {
+            victim = c;
+            break;
+        }
+        if (!c->users && (!victim || c->lastUse < victim->lastUse)) victim = c;
+    }
+    if (!victim) return 0; // every chain is open, the file walks the FAT itself
+
+    if (victim->firstCluster != first) fat_chainBuild(victim, first);
+    victim->users++;
+    victim->lastUse = ++fat_chainClock;
+    return victim;
+}
+
+// Disk cluster holding a file cluster, and how many consecutive ones follow
+// it on disk (at least 1). 0 past the end of the chain.
+static unsigned int fat_cluster(fat_file_t *file, unsigned int index, unsigned int *run)
+{
+    fat_chain_t *c = file->chain;
+    unsigned int cluster = file->firstCluster, at = 0;
+
+    *run = 1;
+    if (cluster < 2) return 0;
+
+    if (c) {
+        if (index < c->clusters) {
+            for (int i = 0; i < c->count; i++) {
+                fat_extent_t *e = &c->extents[i];
+                if (index < e->fileCluster + e->count) {
+                    *run = e->fileCluster + e->count - index;
+                    return e->cluster + index - e->fileCluster;
+                }
+            }
+        }
+        if (c->complete) return 0;
+        cluster = c->lastCluster;
+        at = c->clusters - 1;
+    }
+
+    while (cluster && at < index) {
+        cluster = fat_next(cluster);
+        at++;
+    }
+    return cluster;
+}
+
+static void fat_fileInit(fat_file_t *file, unsigned int cluster, unsigned int size, int isDir)
+{
+    file->firstCluster = cluster;
+    file->size = isDir ? 0xFFFFFFFF : size; // directories end with their chain
+    file->pos = 0;
+    file->isDir = isDir;
+    file->chain = fat_chainGet(cluster);
+}
+
+// Copies from the sector under file->pos through the cache, returns the bytes
+// copied, 0 at the end of the chain and -1 on a read error
+static long fat_readSector(fat_file_t *file, unsigned char *dst, unsigned long length)
+{
+    unsigned int clusterBytes = 1U << fat_vol.clusterShift, run;
+    unsigned int offset = file->pos & (clusterBytes - 1);
+    unsigned int cluster = fat_cluster(file, file->pos >> fat_vol.clusterShift, &run);
+
+    if (!cluster) return 0;
+
+    const unsigned char *p = bcache_read(fat_clusterLba(cluster) + offset / EMMC_BLOCK_SIZE);
+    if (!p) return -1;
+
+    unsigned int at = file->pos % EMMC_BLOCK_SIZE, n = EMMC_BLOCK_SIZE - at;
+    if (n > length) n = length;
+
+    fat_copy(dst, p + at, n);
+    file->pos += n;
+    return n;
+}
+
+static unsigned long fat_clamp(fat_file_t *file, unsigned long length)
+{
+    if (file->pos >= file->size) return 0;
+    if (length > file->size - file->pos) length = file->size - file->pos;
+    return length;
+}
+
+long fat_read(fat_file_t *file, void *buffer, unsigned long length)
+{
+    unsigned char *dst = buffer;
+    unsigned long done = 0;
+
+    if (!fat_vol.mounted) return -1;
+    length = fat_clamp(file, length);
+
+    while (done < length) {
+        long n = fat_readSector(file, dst + done, length - done);
+        if (n < 0) return -1;
+        if (!n) break;
+        done += n;
+    }
+    return done;
+}
+
+static int fat_drain(int *inflight)
+{
+    int ok = 1;
+
+    for (int i = 0; i < *inflight; i++) {
+        if (emmc_wait(&fat_reqs[i]) != EMMC_OK) ok = 0;
+    }
+    *inflight = 0;
+    return ok;
+}
+
+long fat_readInto(fat_file_t *file, void *buffer, unsigned long length)
+{
+    unsigned char *dst = buffer;
+    unsigned long done = 0;
+    unsigned int clusterBytes = 1U << fat_vol.clusterShift;
+    int inflight = 0;
+
+    if (!fat_vol.mounted) return -1;
+    length = fat_clamp(file, length);
+
+    while (done < length) {
+        unsigned long left = length - done;
+
+        // partial sectors at either end go through the cache; the card must be
+        // done with the buffer first, the copy may share a cache line with it
+        if (file->pos % EMMC_BLOCK_SIZE || left < EMMC_BLOCK_SIZE) {
+            if (!fat_drain(&inflight)) return -1;
+
+            long n = fat_readSector(file, dst + done, left);
+            if (n < 0) return -1;
+            if (!n) break;
+            done += n;
+            continue;
+        }
+
+        unsigned int run, offset = file->pos & (clusterBytes - 1);
+        unsigned int cluster = fat_cluster(file, file->pos >> fat_vol.clusterShift, &run);
+        if (!cluster) break;
+
+        // whole sectors up to the end of this run of clusters, in as few requests as possible
+        unsigned long bytes = (unsigned long)run * clusterBytes - offset;
+        if (bytes > left) bytes = left;
+        unsigned int blocks = bytes / EMMC_BLOCK_SIZE;
+        if (blocks > EMMC_MAX_BLOCKS) blocks = EMMC_MAX_BLOCKS;
+
+        if (inflight == FAT_INFLIGHT && !fat_drain(&inflight)) return -1;
+
+        emmc_request_t *req = &fat_reqs[inflight];
+        req->lba = fat_clusterLba(cluster) + offset / EMMC_BLOCK_SIZE;
+        req->count = blocks;
+        req->buffer = dst + done;
+        req->write = 0;
+        req->done = 0;
+        req->arg = 0;
+        if (!emmc_submit(req)) {
+            fat_drain(&inflight);
+            return -1;
+        }
+        inflight++;
+
+        done += blocks * EMMC_BLOCK_SIZE;
+        file->pos += blocks * EMMC_BLOCK_SIZE;
+    }
+
+    if (!fat_drain(&inflight)) return -1;
+    return done;
+}
+
+int fat_seek(fat_file_t *file, unsigned int pos)
+{
+    if (!file->isDir && pos > file->size) return 0;
+    file->pos = pos;
+    return 1;
+}
+
+void fat_close(fat_file_t *file)
+{
+    if (file->chain) file->chain->users--;
+    file->chain = 0;
+    file->firstCluster = 0;
+}
+
+static unsigned char fat_lfnChecksum(const unsigned char *shortName)
+{
+    unsigned char sum = 0;
+
+    for (int i = 0; i < 11; i++) sum = ((sum & 1) << 7) + (sum >> 1) + shortName[i];
+    return sum;
+}
+
+int fat_readDir(fat_file_t *dir, fat_dirent_t *entry)
+{
+    static const unsigned char lfnOffsets[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+    unsigned char e[32];
+    char lfn[FAT_NAME_MAX];
+    int lfnValid = 0;
+    unsigned char lfnSum = 0;
+
+    if (!dir->isDir) return 0;
+
+    while (fat_read(dir, e, sizeof(e)) == sizeof(e)) {
+        if (e[0] == 0) return 0;
+        if (e[0] == FAT_ENTRY_FREE) {
+            lfnValid = 0;
+            continue;
+        }
+
+        // long name pieces come last first, 13 UTF-16 characters each
+        if ((e[11] & 0x3F) == FAT_ATTR_LFN) {
+            int seq = e[0] & 0x1F;
+            if (e[0] & 0x40) {
+                for (int i = 0; i < FAT_NAME_MAX; i++) lfn[i] = 0;
+                lfnValid = 1;
+                lfnSum = e[13];
+            }
+            if (!lfnValid || !seq || e[13] != lfnSum) {
+                lfnValid = 0;
+                continue;
+            }
+            for (int i = 0; i < 13; i++) {
+                int at = (seq - 1) * 13 + i;
+                unsigned int ch = fat_le16(e + lfnOffsets[i]);
+                if (at < FAT_NAME_MAX - 1 && ch && ch != 0xFFFF) lfn[at] = ch < 0x80 ? ch : '?';
+            }
+            continue;
+        }
+
+        if (e[11] & FAT_ATTR_VOLUME) {
+            lfnValid = 0;
+            continue;
+        }
+
+        int n = 0;
+        if (lfnValid && fat_lfnChecksum(e) == lfnSum) {
+            while (n < FAT_NAME_MAX - 1 && lfn[n]) {
+                entry->name[n] = lfn[n];
+                n++;
+            }
+        } else {
+            // 8.3, lower case as most tools show it
+            for (int i = 0; i < 8 && e[i] != ' '; i++) entry->name[n++] = fat_lower(e[i]);
+            if (e[8] != ' ') entry->name[n++] = '.';
+            for (int i = 8; i < 11 && e[i] != ' '; i++) entry->name[n++] = fat_lower(e[i]);
+        }
+        entry->name[n] = 0;
+
+        entry->cluster = (fat_le16(e + 20) << 16) | fat_le16(e + 26);
+        entry->size = fat_le32(e + 28);
+        entry->isDir = (e[11] & FAT_ATTR_DIR) != 0;
+        if (entry->isDir && !entry->cluster) entry->cluster = fat_vol.rootCluster; // ".." of a top level directory
+        return 1;
+    }
+    return 0;
+}
+
+// Compares the next path component, case-insensitively as FAT does
+static int fat_nameMatch(const char *name, const char *path, int length)
+{
+    for (int i = 0; i < length; i++) {
+        if (fat_lower(name[i]) != fat_lower(path[i])) return 0;
+    }
+    return name[length] == 0;
+}
+
+int fat_open(fat_file_t *file, const char *path)
+{
+    fat_dirent_t entry;
+
+    file->chain = 0;
+    if (!fat_vol.mounted) return 0;
+
+    fat_fileInit(file, fat_vol.rootCluster, 0, 1);
+
+    while (*path) {
+        while (*path == '/') path++;
+        if (!*path) break;
+
+        int length = 0;
+        while (path[length] && path[length] != '/') length++;
+
+        if (!file->isDir) {
+            fat_close(file);
+            return 0;
+        }
+
+        int found = 0;
+        while (fat_readDir(file, &entry)) {
+            if (fat_nameMatch(entry.name, path, length)) {
+                found = 1;
+                break;
+            }
+        }
+        fat_close(file);
+        if (!found) return 0;
+
+        fat_fileInit(file, entry.cluster, entry.size, entry.isDir);
+        path += length;
+    }
+    return 1;
+}
+
+// BPB of a FAT32 volume starting at lba, copied out before the sector can be evicted
+static int fat_parseBpb(unsigned long lba)
+{
+    const unsigned char *b = bcache_read(lba);
+    if (!b) return 0;
+
+    if (fat_le16(b + 510) != 0xAA55 || (b[0] != 0xEB && b[0] != 0xE9)) return 0;
+    if (fat_le16(b + 11) != EMMC_BLOCK_SIZE) return 0;
+
+    unsigned int spc = b[13], reserved = fat_le16(b + 14), fats = b[16];
+    unsigned int fatSize = fat_le32(b + 36), total = fat_le32(b + 32);
+
+    // FAT32 has no fixed root directory and only the 32 bit FAT size
+    if (!spc || (spc & (spc - 1)) || !fats || !fatSize || fat_le16(b + 17) || fat_le16(b + 22)) return 0;
+
+    fat_vol.fatLba = lba + reserved;
+    fat_vol.dataLba = fat_vol.fatLba + (unsigned long)fats * fatSize;
+    fat_vol.sectorsPerCluster = spc;
+    fat_vol.rootCluster = fat_le32(b + 44);
+    fat_vol.clusterCount = (total - reserved - fats * fatSize) / spc;
+
+    fat_vol.clusterShift = 9;
+    while ((1U << (fat_vol.clusterShift - 9)) < spc) fat_vol.clusterShift++;
+    return fat_vol.clusterCount > 0;
+}
+
+int fat_mount(void)
+{
+    if (fat_vol.mounted) return 1;
+    if (!emmc_blockCount() || !bcache_init()) return 0;
+
+    // a card formatted without a partition table has the BPB in sector 0
+    unsigned long start = 0;
+    int ok = fat_parseBpb(0);
+
+    if (!ok) {
+        const unsigned char *mbr = bcache_read(0);
+        unsigned long starts[4];
+        int count = 0;
+
+        if (!mbr || fat_le16(mbr + 510) != 0xAA55) {
+            LOG_WARN("FAT: No partition table");
+            return 0;
+        }
+        for (int i = 0; i < 4; i++) {
+            const unsigned char *p = mbr + 0x1BE + i * 16;
+            if (p[4] == 0x0B || p[4] == 0x0C) starts[count++] = fat_le32(p + 8);
+        }
+        for (int i = 0; i < count && !ok; i++) {
+            start = starts[i];
+            ok = fat_parseBpb(start);
+        }
+    }
+
+    if (!ok) {
+        LOG_WARN("FAT: No FAT32 volume found");
+        return 0;
+    }
+
+    fat_vol.mounted = 1;
+    LOG_INFO("FAT: Volume at sector %lu, %u clusters of %u bytes",
+             start, fat_vol.clusterCount, 1U << fat_vol.clusterShift);
+    return 1;
+}
@@ -1,69 +1,380 @@
 #include "../include/io.h"
 #include "../include/mb.h"
+#include "../include/fb.h"
 #include "../include/font/terminal.h"
-
-#define SCREEN_WIDTH 1920
-#define SCREEN_HEIGHT 1080
+#include "../include/fb_neon.h"
+#include "../include/mmu.h"
+#include "../include/dma.h"
 
 unsigned int width, height, pitch, isrgb;
 unsigned char *fb;
 
-void fb_init()
+// Pixel format of the current surface. fb_pal holds the 16 VGA colours
+// already converted to it, so primitives never swizzle per pixel.
+static int fb_format = FB_FORMAT_XRGB8888;
+static int fb_bpp = 4; // bytes per pixel
+static unsigned int fb_pal[16];
+
+static void fb_setFormat(int format);
+static inline void fb_copyPixels(unsigned char *dst, const unsigned char *src, int n);
+
+// Double buffering: the virtual screen is two frames tall, the scanout shows
+// one half (fb_front) while everything draws into the other one (fb).
+static unsigned char *fb_pages[2];
+static int fb_backPage = 0;
+static int fb_doubleBuffered = 0;
+
+// Everything drawn into the back page since the last fb_present
+static fb_damage_t fb_frameDamage;
+
+// Clip/viewport stack. Draw calls take coordinates relative to the top
+// entry's origin; its clip rect is in screen coordinates and is applied to
+// whole primitives and spans, never per pixel.
+typedef struct {
+    fb_rect_t clip;
+    int ox, oy;
+} fb_view_t;
+
+static fb_view_t fb_views[FB_CLIP_DEPTH];
+static fb_view_t *fb_view = &fb_views[0];
+static int fb_viewOverflow = 0; // pushes that didn't fit, popped first
+
+// Areas of the back page with a DMA operation still in flight. CPU drawing
+// that touches one of them waits for its fence first, anything else runs
+// alongside the engine.
+#define FB_MAX_ASYNC 16
+
+static struct {
+    fb_rect_t rect;
+    unsigned int fence;
+} fb_async[FB_MAX_ASYNC];
+static int fb_asyncCount = 0;
+static int fb_dmaSurface = 0; // only the mailbox framebuffer is uncached, so DMA-safe
+
+static void fb_asyncWaitAll(void);
+static unsigned int fb_blitRect(const fb_rect_t *r, const unsigned char *src, unsigned int srcPitch);
+
+// Cursor overlay (bottom of the file). It only ever lives on the page being
+// shown: fb_present composites it onto the new frame before the flip and
+// takes it off the old one afterwards.
+static int fb_cursorDrawn = 0;
+static void fb_cursorStage(unsigned char *page);
+static void fb_cursorCommit(int flipped);
+static void fb_cursorPatch(void);
+static void fb_cursorUncover(const fb_rect_t *r);
+static void fb_cursorShowPending(void);
+static void fb_cursorConvert(void);
+
+// Asks the firmware for a w x h mode at the given depth (16 or 32) and takes
+// whatever it actually sets up. If the depth is refused the other one is tried.
+int fb_initMode(unsigned int w, unsigned int h, unsigned int depth)
 {
-    mbox[0] = 35*4; // Length of message in bytes
-    mbox[1] = MBOX_REQUEST;
+    unsigned int depths[2] = { depth, depth == 16 ? 32 : 16 };
+
+    fb_asyncWaitAll();
+
+    for (int i = 0; i < 2; i++) {
+        mbox[0] = 35*4; // Length of message in bytes
+        mbox[1] = MBOX_REQUEST;
+
+        mbox[2] = MBOX_TAG_SETPHYWH; // Tag identifier
+        mbox[3] = 8; // Value size in bytes
+        mbox[4] = 0;
+        mbox[5] = w; // Value(width)
+        mbox[6] = h; // Value(height)
+
+        mbox[7] = MBOX_TAG_SETVIRTWH;
+        mbox[8] = 8;
+        mbox[9] = 8;
+        mbox[10] = w;
+        mbox[11] = h * 2; // two pages for fb_present
+
+        mbox[12] = MBOX_TAG_SETVIRTOFF;
+        mbox[13] = 8;
+        mbox[14] = 8;
+        mbox[15] = 0; // Value(x)
+        mbox[16] = 0; // Value(y)
+
+        mbox[17] = MBOX_TAG_SETDEPTH;
+        mbox[18] = 4;
+        mbox[19] = 4;
+        mbox[20] = depths[i]; // Bits per pixel
+
+        mbox[21] = MBOX_TAG_SETPXLORDR;
+        mbox[22] = 4;
+        mbox[23] = 4;
+        mbox[24] = 1; // RGB
+
+        mbox[25] = MBOX_TAG_GETFB;
+        mbox[26] = 8;
+        mbox[27] = 8;
+        mbox[28] = 4096; // FrameBufferInfo.pointer
+        mbox[29] = 0;    // FrameBufferInfo.size
+
+        mbox[30] = MBOX_TAG_GETPITCH;
+        mbox[31] = 4;
+        mbox[32] = 4;
+        mbox[33] = 0; // Bytes per line
+
+        mbox[34] = MBOX_TAG_LAST;
+
+        // Check call is successful and we have a pointer with a depth we can draw
+        if (!mbox_call(MBOX_CH_PROP) || mbox[28] == 0) continue;
+        if (mbox[20] != 16 && mbox[20] != 32) continue;
 
-    mbox[2] = MBOX_TAG_SETPHYWH; // Tag identifier
-    mbox[3] = 8; // Value size in bytes
-    mbox[4] = 0;
-    mbox[5] = 1920; // Value(width)
-    mbox[6] = 1080; // Value(height)
-
-    mbox[7] = MBOX_TAG_SETVIRTWH;
-    mbox[8] = 8;
-    mbox[9] = 8;
-    mbox[10] = 1920;
-    mbox[11] = 1080;
-
-    mbox[12] = MBOX_TAG_SETVIRTOFF;
-    mbox[13] = 8;
-    mbox[14] = 8;
-    mbox[15] = 0; // Value(x)
-    mbox[16] = 0; // Value(y)
-
-    mbox[17] = MBOX_TAG_SETDEPTH;
-    mbox[18] = 4;
-    mbox[19] = 4;
-    mbox[20] = 32; // Bits per pixel
-
-    mbox[21] = MBOX_TAG_SETPXLORDR;
-    mbox[22] = 4;
-    mbox[23] = 4;
-    mbox[24] = 1; // RGB
-
-    mbox[25] = MBOX_TAG_GETFB;
-    mbox[26] = 8;
-    mbox[27] = 8;
-    mbox[28] = 4096; // FrameBufferInfo.pointer
-    mbox[29] = 0;    // FrameBufferInfo.size
-
-    mbox[30] = MBOX_TAG_GETPITCH;
-    mbox[31] = 4;
-    mbox[32] = 4;
-    mbox[33] = 0; // Bytes per line
-
-    mbox[34] = MBOX_TAG_LAST;
-
-    // Check call is successful and we have a pointer with depth 32
-    if (mbox_call(MBOX_CH_PROP) && mbox[20] == 32 && mbox[28] != 0) {
         mbox[28] &= 0x3FFFFFFF; // Convert GPU address to ARM address
-        width = mbox[10];       // Actual physical width
-        height = mbox[11];      // Actual physical height
+        width = mbox[5];        // Actual physical width
+        height = mbox[6];       // Actual physical height
         pitch = mbox[33];       // Number of bytes per line
         isrgb = mbox[24];       // Pixel order
-        fb = (unsigned char *)((long)mbox[28]);
+
+        // Page 0 is on screen (offset 0), page 1 is the first back buffer.
+        // If the firmware refused the double height we just draw to the screen.
+        fb_pages[0] = (unsigned char *)((long)mbox[28]);
+        fb_doubleBuffered = mbox[11] >= height * 2;
+        fb_pages[1] = fb_doubleBuffered ? fb_pages[0] + height * pitch : fb_pages[0];
+        fb_backPage = fb_doubleBuffered ? 1 : 0;
+        fb = fb_pages[fb_backPage];
+        fb_setFormat(mbox[20] == 16 ? (isrgb ? FB_FORMAT_RGB565 : FB_FORMAT_BGR565)
+                                    : (isrgb ? FB_FORMAT_XRGB8888 : FB_FORMAT_XBGR8888));
+
+        // Write-combining: CPU stores stream straight to the scanout memory
+        mmu_mapRegion((unsigned long)fb_pages[0], mbox[29], MMU_NORMAL_NC);
+        fb_dmaSurface = 1;
+        fb_cursorDrawn = 0; // new memory, nothing of the old sprite is on it
+
+#ifdef FB_NEON
+        fb_setAccel(FB_ACCEL_NEON);
+#endif
+        fb_damageClear(&fb_frameDamage);
+        fb_resetClip();
+        return 1;
+    }
+
+    return 0;
+}
+
+void fb_init()
+{
+    fb_initMode(FB_DEFAULT_WIDTH, FB_DEFAULT_HEIGHT, FB_DEFAULT_DEPTH);
+}
+
+// Draws into caller-provided memory instead of the mailbox framebuffer, e.g.
+// an offscreen surface or the host benchmark. Single-buffered: fb_present
+// only forgets the damage.
+void fb_initMemory(void *buffer, unsigned int w, unsigned int h, unsigned int p)
+{
+    fb_initSurface(buffer, w, h, p, FB_FORMAT_XRGB8888);
+}
+
+void fb_initSurface(void *buffer, unsigned int w, unsigned int h, unsigned int p, int format)
+{
+    fb_asyncWaitAll();
+    fb_dmaSurface = 0;
+
+    width = w;
+    height = h;
+    pitch = p;
+    fb_setFormat(format);
+
+    fb_pages[0] = fb_pages[1] = (unsigned char *)buffer;
+    fb_backPage = 0;
+    fb_doubleBuffered = 0;
+    fb = fb_pages[0];
+    fb_cursorDrawn = 0;
+    fb_damageClear(&fb_frameDamage);
+    fb_resetClip();
+}
+
+// Shows the back buffer by moving the virtual Y offset onto it: one mailbox
+// call per frame, no intermediate pixel writes ever reach the scanout.
+void fb_present()
+{
+    fb_asyncWaitAll(); // the frame isn't finished while the engine still draws into it
+
+    if (!fb_doubleBuffered) {
+        fb_cursorShowPending(); // drawing may have uncovered it
+        fb_damageClear(&fb_frameDamage);
+        return;
+    }
+
+    unsigned char *shown = fb_pages[fb_backPage];
+
+    // the cursor goes onto the new frame before it's shown, so it never blinks
+    fb_cursorStage(shown);
+
+    mbox[0] = 8*4;
+    mbox[1] = MBOX_REQUEST;
+
+    mbox[2] = MBOX_TAG_SETVIRTOFF;
+    mbox[3] = 8;
+    mbox[4] = 8;
+    mbox[5] = 0;                           // Value(x)
+    mbox[6] = fb_backPage ? height : 0;    // Value(y)
+
+    mbox[7] = MBOX_TAG_LAST;
+
+    if (!mbox_call(MBOX_CH_PROP)) { // keep drawing into the same page
+        fb_cursorCommit(0);
+        return;
+    }
+
+    fb_backPage ^= 1;
+    fb = fb_pages[fb_backPage];
+    fb_cursorCommit(1); // the page we draw into next is clean again
+
+    // The new back page still holds the frame before last, which only
+    // differs from the screen where this frame drew. Copy just those areas
+    // so callers can keep drawing incrementally on top of what is shown.
+    // With DMA the copies run in the background; drawing waits only where
+    // it lands on an area that hasn't arrived yet.
+    for (int i = 0; i < fb_frameDamage.count; i++) {
+        fb_rect_t *r = &fb_frameDamage.rects[i];
+
+        if (fb_blitRect(r, shown + r->y1 * pitch + r->x1 * fb_bpp, pitch)) continue;
+
+        for (int y = r->y1; y <= r->y2; y++) {
+            fb_copyPixels(fb + y * pitch + r->x1 * fb_bpp,
+                          shown + y * pitch + r->x1 * fb_bpp, r->x2 - r->x1 + 1);
+        }
     }
+    fb_cursorPatch(); // the copies took the sprite along where they overlap it
+    fb_damageClear(&fb_frameDamage);
+}
 
+void fb_markDirty(int x1, int y1, int x2, int y2)
+{
+    fb_damageAdd(&fb_frameDamage, x1, y1, x2, y2);
+}
+
+void fb_resetClip(void)
+{
+    fb_view = &fb_views[0];
+    fb_view->clip.x1 = 0;
+    fb_view->clip.y1 = 0;
+    fb_view->clip.x2 = width - 1;
+    fb_view->clip.y2 = height - 1;
+    fb_view->ox = 0;
+    fb_view->oy = 0;
+    fb_viewOverflow = 0;
+}
+
+static int fb_push(int x, int y, int w, int h, int translate)
+{
+    if (fb_view == &fb_views[FB_CLIP_DEPTH - 1]) {
+        fb_viewOverflow++; // keep push/pop balanced, the old clip stays
+        return 0;
+    }
+
+    fb_rect_t r = { x + fb_view->ox, y + fb_view->oy,
+                    x + fb_view->ox + w - 1, y + fb_view->oy + h - 1 };
+    fb_view_t *next = fb_view + 1;
+
+    if (!fb_rectIntersect(&next->clip, &fb_view->clip, &r)) {
+        next->clip.x1 = next->clip.y1 = 0;
+        next->clip.x2 = next->clip.y2 = -1; // nothing visible
+    }
+    next->ox = translate ? r.x1 : fb_view->ox;
+    next->oy = translate ? r.y1 : fb_view->oy;
+    fb_view = next;
+    return 1;
+}
+
+int fb_pushClip(int x, int y, int w, int h)
+{
+    return fb_push(x, y, w, h, 0);
+}
+
+int fb_pushViewport(int x, int y, int w, int h)
+{
+    return fb_push(x, y, w, h, 1);
+}
+
+void fb_popClip(void)
+{
+    if (fb_viewOverflow) fb_viewOverflow--;
+    else if (fb_view != &fb_views[0]) fb_view--;
+}
+
+void fb_getClip(fb_rect_t *out)
+{
+    out->x1 = fb_view->clip.x1 - fb_view->ox;
+    out->y1 = fb_view->clip.y1 - fb_view->oy;
+    out->x2 = fb_view->clip.x2 - fb_view->ox;
+    out->y2 = fb_view->clip.y2 - fb_view->oy;
+}
+
+// Async bookkeeping
+
+static void fb_asyncPrune(void)
+{
+    int n = 0;
+
+    for (int i = 0; i < fb_asyncCount; i++) {
+        if (!dma_done(fb_async[i].fence)) fb_async[n++] = fb_async[i];
+    }
+    fb_asyncCount = n;
+}
+
+// Waits for the DMA operations that overlap r (screen coordinates)
+static void fb_asyncSync(const fb_rect_t *r)
+{
+    fb_rect_t hit;
+
+    for (int i = fb_asyncCount - 1; i >= 0; i--) {
+        // fences complete in order, the newest overlapping one covers the rest
+        if (fb_rectIntersect(&hit, r, &fb_async[i].rect)) {
+            dma_wait(fb_async[i].fence);
+            break;
+        }
+    }
+    fb_asyncPrune();
+}
+
+static void fb_asyncWaitAll(void)
+{
+    if (fb_asyncCount) dma_wait(fb_async[fb_asyncCount - 1].fence);
+    fb_asyncCount = 0;
+}
+
+static void fb_asyncAdd(const fb_rect_t *r, unsigned int fence)
+{
+    if (fb_asyncCount == FB_MAX_ASYNC) fb_asyncPrune();
+    if (fb_asyncCount == FB_MAX_ASYNC) {
+        dma_wait(fb_async[0].fence);
+        fb_asyncPrune();
+    }
+    fb_async[fb_asyncCount].rect = *r;
+    fb_async[fb_asyncCount].fence = fence;
+    fb_asyncCount++;
+}
+
+static inline int fb_useDma(void)
+{
+    return fb_dmaSurface && dma_available();
+}
+
+// Clips a box (screen coordinates) to the view and records the visible part
+// as damage, without waiting for DMA. Returns 0 if nothing is visible.
+static int fb_clipDamage(fb_rect_t *vis, int x1, int y1, int x2, int y2)
+{
+    fb_rect_t box = { x1, y1, x2, y2 };
+
+    if (!fb_rectIntersect(vis, &box, &fb_view->clip)) return 0;
+    fb_markDirty(vis->x1, vis->y1, vis->x2, vis->y2);
+    if (fb_cursorDrawn && !fb_doubleBuffered) fb_cursorUncover(vis); // drawing on the shown page
+    return 1;
+}
+
+// Clips a primitive's box (screen coordinates) to the view and records the
+// visible part as damage. Returns 0 if nothing is visible, so the caller can
+// return before touching any memory; otherwise pending DMA into the visible
+// part has finished.
+static int fb_clipBox(fb_rect_t *vis, int x1, int y1, int x2, int y2)
+{
+    if (!fb_clipDamage(vis, x1, y1, x2, y2)) return 0;
+    if (fb_asyncCount) fb_asyncSync(vis);
+    return 1;
 }
 
 int getFontPixel(char c, int x, int y) {
@@ -79,32 +390,611 @@ int getFontPixel(char c, int x, int y) {
     return (line >> x) & 1;
 }
 
+static inline int fb_inClip(int x, int y)
+{
+    return x >= fb_view->clip.x1 && x <= fb_view->clip.x2 &&
+           y >= fb_view->clip.y1 && y <= fb_view->clip.y2;
+}
+
+static inline unsigned char *fb_addr(int x, int y)
+{
+    return fb + y * pitch + x * fb_bpp;
+}
+
+static inline void fb_store(int x, int y, unsigned int color)
+{
+    if (fb_bpp == 2) *(unsigned short *)fb_addr(x, y) = color;
+    else *(unsigned int *)fb_addr(x, y) = color;
+}
+
+// Screen coordinates, clipped
+static inline void fb_putPixel(int x, int y, unsigned char attr)
+{
+    if (!fb_inClip(x, y)) return;
+
+    fb_store(x, y, fb_pal[attr & 0x0f]);
+}
+
 void drawPixel(int x, int y, unsigned char attr)
 {
-    int offs = (y * pitch) + (x * 4);
-    *((unsigned int*)(fb + offs)) = vgapal[attr & 0x0f];
+    fb_rect_t vis;
+
+    x += fb_view->ox;
+    y += fb_view->oy;
+    if (!fb_clipBox(&vis, x, y, x, y)) return;
+
+    fb_putPixel(x, y, attr);
+}
+
+// Span layer
+//
+// Every primitive below is built on horizontal spans: the palette entry is
+// resolved once per span, rows are addressed through pitch, and the inner
+// loops move 64 bits per store (four RGB565 or two 32bpp pixels). The loops
+// are unrolled by hand so the compiler doesn't turn them into memset/memcpy
+// calls (we have neither).
+
+static inline unsigned int *fb_row(int y)
+{
+    return (unsigned int *)(fb + y * pitch);
 }
 
-void clearScreen(unsigned char color) {
-    for (int y = 0; y < SCREEN_HEIGHT; y++) {
-        for (int x = 0; x < SCREEN_WIDTH; x++) {
-            drawPixel(x, y, color);
+static void fb_fill32_scalar(unsigned int *dst, int n, unsigned int color)
+{
+    if (n <= 0) return;
+
+    if ((unsigned long)dst & 7) {
+        *dst++ = color;
+        n--;
+    }
+
+    unsigned long pattern = ((unsigned long)color << 32) | color;
+    unsigned long *d = (unsigned long *)dst;
+
+    while (n >= 8) {
+        d[0] = pattern;
+        d[1] = pattern;
+        d[2] = pattern;
+        d[3] = pattern;
+        d += 4;
+        n -= 8;
+    }
+    if (n & 4) { d[0] = pattern; d[1] = pattern; d += 2; }
+    if (n & 2) { *d++ = pattern; }
+    if (n & 1) { *(unsigned int *)d = color; }
+}
+
+static void fb_copy32_scalar(unsigned int *dst, const unsigned int *src, int n)
+{
+    if (n <= 0) return;
+
+    // 64-bit moves only pay off when both sides share the same alignment
+    if ((((unsigned long)dst ^ (unsigned long)src) & 7) == 0) {
+        if ((unsigned long)dst & 7) {
+            *dst++ = *src++;
+            n--;
+        }
+
+        unsigned long *d = (unsigned long *)dst;
+        const unsigned long *s = (const unsigned long *)src;
+
+        while (n >= 8) {
+            unsigned long a = s[0], b = s[1], c = s[2], e = s[3];
+            d[0] = a;
+            d[1] = b;
+            d[2] = c;
+            d[3] = e;
+            d += 4;
+            s += 4;
+            n -= 8;
+        }
+        dst = (unsigned int *)d;
+        src = (const unsigned int *)s;
+    }
+
+    while (n >= 4) {
+        unsigned int a = src[0], b = src[1], c = src[2], e = src[3];
+        dst[0] = a;
+        dst[1] = b;
+        dst[2] = c;
+        dst[3] = e;
+        dst += 4;
+        src += 4;
+        n -= 4;
+    }
+    if (n > 0) dst[0] = src[0];
+    if (n > 1) dst[1] = src[1];
+    if (n > 2) dst[2] = src[2];
+}
+
+// Expands one font row into runs of equal colour, each bit `scale` pixels wide
+static void fb_glyphRow_scalar(unsigned int *dst, unsigned char bits, int scale,
+                               unsigned int fg, unsigned int bg)
+{
+    int dx = 0;
+
+    if (scale == 1) {
+        for (dx = 0; dx < FONT_WIDTH; dx++) dst[dx] = ((bits >> dx) & 1) ? fg : bg;
+        return;
+    }
+
+    while (dx < FONT_WIDTH) {
+        int on = (bits >> dx) & 1;
+        int run = dx;
+        while (run < FONT_WIDTH && ((bits >> run) & 1) == on) run++;
+        fb_fill32_scalar(dst + dx * scale, (run - dx) * scale, on ? fg : bg);
+        dx = run;
+    }
+}
+
+// Kernel table, switched between the scalar loops above and fb_neon.c
+static struct {
+    void (*fill32)(unsigned int *dst, int n, unsigned int color);
+    void (*copy32)(unsigned int *dst, const unsigned int *src, int n);
+    void (*glyphRow)(unsigned int *dst, unsigned char bits, int scale,
+                     unsigned int fg, unsigned int bg);
+} fb_kernels = { fb_fill32_scalar, fb_copy32_scalar, fb_glyphRow_scalar };
+
+static int fb_accel = FB_ACCEL_SCALAR;
+
+int fb_setAccel(int accel)
+{
+#ifdef FB_NEON
+    if (accel == FB_ACCEL_NEON) {
+        fb_neon_enable();
+        fb_kernels.fill32 = fb_fill32_neon;
+        fb_kernels.copy32 = fb_copy32_neon;
+        fb_kernels.glyphRow = fb_glyphRow_neon;
+        fb_accel = FB_ACCEL_NEON;
+        return fb_accel;
+    }
+#endif
+    (void)accel;
+    fb_kernels.fill32 = fb_fill32_scalar;
+    fb_kernels.copy32 = fb_copy32_scalar;
+    fb_kernels.glyphRow = fb_glyphRow_scalar;
+    fb_accel = FB_ACCEL_SCALAR;
+    return fb_accel;
+}
+
+int fb_getAccel(void)
+{
+    return fb_accel;
+}
+
+void fb_fill32(unsigned int *dst, int n, unsigned int color)
+{
+    fb_kernels.fill32(dst, n, color);
+}
+
+void fb_copy32(unsigned int *dst, const unsigned int *src, int n)
+{
+    fb_kernels.copy32(dst, src, n);
+}
+
+// 16bpp spans run through the 32-bit kernels two pixels at a time; only a
+// misaligned first or odd last pixel is stored on its own.
+static void fb_fill16(unsigned short *dst, int n, unsigned int color)
+{
+    if (n <= 0) return;
+
+    if ((unsigned long)dst & 2) {
+        *dst++ = color;
+        n--;
+    }
+    fb_kernels.fill32((unsigned int *)dst, n >> 1, color | (color << 16));
+    if (n & 1) dst[n - 1] = color;
+}
+
+static void fb_copy16(unsigned short *dst, const unsigned short *src, int n)
+{
+    if (n <= 0) return;
+
+    if (((unsigned long)dst ^ (unsigned long)src) & 2) {
+        // the pair trick needs both sides equally aligned
+        while (n >= 4) {
+            unsigned short a = src[0], b = src[1], c = src[2], e = src[3];
+            dst[0] = a;
+            dst[1] = b;
+            dst[2] = c;
+            dst[3] = e;
+            dst += 4;
+            src += 4;
+            n -= 4;
         }
+        if (n > 0) dst[0] = src[0];
+        if (n > 1) dst[1] = src[1];
+        if (n > 2) dst[2] = src[2];
+        return;
+    }
+
+    if ((unsigned long)dst & 2) {
+        *dst++ = *src++;
+        n--;
     }
+    fb_kernels.copy32((unsigned int *)dst, (const unsigned int *)src, n >> 1);
+    if (n & 1) dst[n - 1] = src[n - 1];
+}
+
+// n pixels of the current format
+static inline void fb_fillPixels(unsigned char *dst, int n, unsigned int color)
+{
+    if (fb_bpp == 2) fb_fill16((unsigned short *)dst, n, color);
+    else fb_kernels.fill32((unsigned int *)dst, n, color);
+}
+
+static inline void fb_copyPixels(unsigned char *dst, const unsigned char *src, int n)
+{
+    if (fb_bpp == 2) fb_copy16((unsigned short *)dst, (const unsigned short *)src, n);
+    else fb_kernels.copy32((unsigned int *)dst, (const unsigned int *)src, n);
+}
+
+// Format handling
+
+unsigned int fb_color(unsigned int rgb)
+{
+    unsigned int r = (rgb >> 16) & 0xff, g = (rgb >> 8) & 0xff, b = rgb & 0xff;
+
+    switch (fb_format) {
+    case FB_FORMAT_XBGR8888: return (b << 16) | (g << 8) | r;
+    case FB_FORMAT_RGB565:   return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+    case FB_FORMAT_BGR565:   return ((b >> 3) << 11) | ((g >> 2) << 5) | (r >> 3);
+    default:                 return rgb & 0xffffff;
+    }
+}
+
+static void fb_setFormat(int format)
+{
+    fb_format = format;
+    fb_bpp = (format == FB_FORMAT_RGB565 || format == FB_FORMAT_BGR565) ? 2 : 4;
+    isrgb = format == FB_FORMAT_XRGB8888 || format == FB_FORMAT_RGB565;
+
+    for (int i = 0; i < 16; i++) fb_pal[i] = fb_color(vgapal[i]);
+    fb_cursorConvert();
+
+    // cached glyph tiles hold pixels of the old format
+    fb_glyphCacheFlush();
+}
+
+int fb_getFormat(void)
+{
+    return fb_format;
+}
+
+unsigned int fb_getWidth(void)
+{
+    return width;
+}
+
+unsigned int fb_getHeight(void)
+{
+    return height;
+}
+
+// Unrecorded span for primitives that mark their whole bounding box once.
+// Screen coordinates; this is where every primitive gets clipped.
+static inline void fb_hspan(int x1, int x2, int y, unsigned int color)
+{
+    const fb_rect_t *c = &fb_view->clip;
+
+    if (y < c->y1 || y > c->y2) return;
+    if (x1 < c->x1) x1 = c->x1;
+    if (x2 > c->x2) x2 = c->x2;
+    if (x1 > x2) return;
+
+    fb_fillPixels(fb_addr(x1, y), x2 - x1 + 1, color);
+}
+
+void fb_span(int x1, int x2, int y, unsigned int color)
+{
+    fb_rect_t vis;
+
+    x1 += fb_view->ox;
+    x2 += fb_view->ox;
+    y += fb_view->oy;
+    if (!fb_clipBox(&vis, x1, y, x2, y)) return;
+
+    fb_fillPixels(fb_addr(vis.x1, y), vis.x2 - vis.x1 + 1, fb_color(color));
+}
+
+static void fb_fillVisible(const fb_rect_t *vis, unsigned int color)
+{
+    int w = vis->x2 - vis->x1 + 1;
+    unsigned char *row = fb_addr(vis->x1, vis->y1);
+
+    for (int i = vis->y1; i <= vis->y2; i++) {
+        fb_fillPixels(row, w, color);
+        row += pitch;
+    }
+}
+
+void fb_fillRect(int x, int y, int w, int h, unsigned int color)
+{
+    fb_rect_t vis;
+
+    if (w <= 0 || h <= 0) return;
+
+    x += fb_view->ox;
+    y += fb_view->oy;
+    if (!fb_clipBox(&vis, x, y, x + w - 1, y + h - 1)) return;
+
+    fb_fillVisible(&vis, fb_color(color));
+}
+
+// DMA versions of fb_fillRect and a blit. They return a fence right after
+// queueing the work; CPU drawing on the same area waits for it on its own,
+// so callers only need fb_fenceWait before touching fb memory themselves.
+// Without DMA (not initialised, offscreen surface) they draw on the CPU and
+// return 0, which counts as done.
+fb_fence_t fb_fillRectAsync(int x, int y, int w, int h, unsigned int color)
+{
+    fb_rect_t vis;
+
+    if (w <= 0 || h <= 0) return 0;
+
+    x += fb_view->ox;
+    y += fb_view->oy;
+    if (!fb_clipDamage(&vis, x, y, x + w - 1, y + h - 1)) return 0;
+
+    color = fb_color(color);
+    if (fb_useDma()) {
+        unsigned int pattern = fb_bpp == 2 ? color | (color << 16) : color;
+        unsigned int fence = dma_fill2d(fb_addr(vis.x1, vis.y1), pitch,
+                                        (vis.x2 - vis.x1 + 1) * fb_bpp, vis.y2 - vis.y1 + 1, pattern);
+        if (fence) {
+            fb_asyncAdd(&vis, fence);
+            return fence;
+        }
+    }
+
+    if (fb_asyncCount) fb_asyncSync(&vis);
+    fb_fillVisible(&vis, color);
+    return 0;
+}
+
+// DMA copy of src into the visible rect r; returns 0 if the CPU has to do it
+static unsigned int fb_blitRect(const fb_rect_t *r, const unsigned char *src, unsigned int srcPitch)
+{
+    if (!fb_useDma()) return 0;
+
+    unsigned int fence = dma_copy2d(fb_addr(r->x1, r->y1), pitch, src, srcPitch,
+                                    (r->x2 - r->x1 + 1) * fb_bpp, r->y2 - r->y1 + 1);
+    if (!fence) return 0;
+
+    fb_asyncAdd(r, fence);
+    return fence;
+}
+
+// src holds w x h pixels in the surface format, srcPitch bytes per row
+fb_fence_t fb_blitAsync(int x, int y, const void *src, unsigned int srcPitch, int w, int h)
+{
+    fb_rect_t vis;
+
+    if (w <= 0 || h <= 0) return 0;
+
+    x += fb_view->ox;
+    y += fb_view->oy;
+    if (!fb_clipDamage(&vis, x, y, x + w - 1, y + h - 1)) return 0;
+
+    const unsigned char *s = (const unsigned char *)src + (vis.y1 - y) * srcPitch + (vis.x1 - x) * fb_bpp;
+    fb_fence_t fence = fb_blitRect(&vis, s, srcPitch);
+    if (fence) return fence;
+
+    if (fb_asyncCount) fb_asyncSync(&vis);
+    for (int row = vis.y1; row <= vis.y2; row++, s += srcPitch) {
+        fb_copyPixels(fb_addr(vis.x1, row), s, vis.x2 - vis.x1 + 1);
+    }
+    return 0;
+}
+
+int fb_fenceDone(fb_fence_t fence)
+{
+    return dma_done(fence);
+}
+
+void fb_fenceWait(fb_fence_t fence)
+{
+    dma_wait(fence);
+    if (fb_asyncCount) fb_asyncPrune();
+}
+
+void clearScreen(unsigned char color) {
+    fb_rect_t c;
+
+    fb_getClip(&c); // the whole screen, or just the current viewport
+    fb_fillRect(c.x1, c.y1, c.x2 - c.x1 + 1, c.y2 - c.y1 + 1, vgapal[color & 0x0f]);
+}
+
+fb_fence_t clearScreenAsync(unsigned char color) {
+    fb_rect_t c;
+
+    fb_getClip(&c);
+    return fb_fillRectAsync(c.x1, c.y1, c.x2 - c.x1 + 1, c.y2 - c.y1 + 1, vgapal[color & 0x0f]);
 }
 
 void drawRect(int x1, int y1, int x2, int y2, unsigned char attr, int fill)
 {
-    int y=y1;
+    fb_rect_t vis;
 
-    while (y <= y2) {
-       int x=x1;
-       while (x <= x2) {
-	  if ((x == x1 || x == x2) || (y == y1 || y == y2)) drawPixel(x, y, attr);
-	  else if (fill) drawPixel(x, y, (attr & 0xf0) >> 4);
-          x++;
-       }
-       y++;
+    if (x1 > x2 || y1 > y2) return;
+
+    x1 += fb_view->ox; x2 += fb_view->ox;
+    y1 += fb_view->oy; y2 += fb_view->oy;
+    if (!fb_clipBox(&vis, x1, y1, x2, y2)) return;
+
+    unsigned int border = fb_pal[attr & 0x0f];
+    unsigned int inner = fb_pal[(attr & 0xf0) >> 4];
+
+    // which parts of the side columns and the inside survive the clip
+    int left = x1 >= vis.x1;
+    int right = x2 <= vis.x2 && x2 != x1;
+    int fa = x1 + 1 > vis.x1 ? x1 + 1 : vis.x1;
+    int fe = x2 - 1 < vis.x2 ? x2 - 1 : vis.x2;
+    int ya = y1 + 1 > vis.y1 ? y1 + 1 : vis.y1;
+    int ye = y2 - 1 < vis.y2 ? y2 - 1 : vis.y2;
+
+    fb_hspan(x1, x2, y1, border);
+    for (int y = ya; y <= ye; y++) {
+        if (left) fb_store(x1, y, border);
+        if (fill && fa <= fe) fb_fillPixels(fb_addr(fa, y), fe - fa + 1, inner);
+        if (right) fb_store(x2, y, border);
+    }
+    if (y2 != y1) fb_hspan(x1, x2, y2, border);
+}
+
+// Rounded rectangles and circles are rasterized per scanline: each row is
+// reduced to at most five spans (border | fill | border | fill | border) and
+// the arc extents are stepped from row to row instead of being recomputed.
+
+// Moves a previous floor(sqrt()) result to floor(sqrt(n)). Neighbouring rows
+// of an arc differ by a few pixels, so this is a handful of steps per row.
+static inline int sqrt_step(int root, int n)
+{
+    if (root < 0) root = 0;
+    while (root > 0 && root * root > n) root--;
+    while ((root + 1) * (root + 1) <= n) root++;
+    return root;
+}
+
+static unsigned int isqrt64(unsigned long n)
+{
+    unsigned long rem = n, root = 0, bit = 1UL << 62;
+
+    while (bit > rem) bit >>= 2;
+    while (bit) {
+        if (rem >= root + bit) {
+            rem -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+// src over dst with coverage 0..256; works for both channel orders
+static inline unsigned int fb_blend(unsigned int dst, unsigned int src, unsigned int cover)
+{
+    unsigned int rb = (((src & 0xFF00FF) * cover + (dst & 0xFF00FF) * (256 - cover)) >> 8) & 0xFF00FF;
+    unsigned int g  = (((src & 0x00FF00) * cover + (dst & 0x00FF00) * (256 - cover)) >> 8) & 0x00FF00;
+    return rb | g;
+}
+
+static inline unsigned int fb_blend565(unsigned int dst, unsigned int src, unsigned int cover)
+{
+    unsigned int rb = (((src & 0xF81F) * cover + (dst & 0xF81F) * (256 - cover)) >> 8) & 0xF81F;
+    unsigned int g  = (((src & 0x07E0) * cover + (dst & 0x07E0) * (256 - cover)) >> 8) & 0x07E0;
+    return rb | g;
+}
+
+static inline void fb_blendPixel(int x, int y, unsigned int color, unsigned int cover)
+{
+    if (fb_bpp == 2) {
+        unsigned short *p = (unsigned short *)fb_addr(x, y);
+        *p = fb_blend565(*p, color, cover);
+    } else {
+        unsigned int *p = (unsigned int *)fb_addr(x, y);
+        *p = fb_blend(*p, color, cover);
+    }
+}
+
+// Splits [xa, xb] into border | fill | border around the fill interval [fa, fe]
+static void rr_emit(int xa, int xb, int fa, int fe, int y,
+                    unsigned int border, unsigned int inner, int fill)
+{
+    if (xa > xb) return;
+
+    if (fa < xa) fa = xa;
+    if (fe > xb) fe = xb;
+
+    if (fa > fe) {
+        fb_hspan(xa, xb, y, border);
+        return;
+    }
+    if (fa > xa) fb_hspan(xa, fa - 1, y, border);
+    if (fill) fb_hspan(fa, fe, y, inner);
+    if (fe < xb) fb_hspan(fe + 1, xb, y, border);
+}
+
+static void rr_raster(int x1, int y1, int x2, int y2, int radius,
+                      unsigned char fillAttr, int fill,
+                      unsigned char borderAttr, int borderThickness, int antialias)
+{
+    fb_rect_t vis;
+
+    if (borderThickness < 1) borderThickness = 1;
+
+    x1 += fb_view->ox; x2 += fb_view->ox;
+    y1 += fb_view->oy; y2 += fb_view->oy;
+    if (!fb_clipBox(&vis, x1, y1, x2, y2)) return;
+
+    unsigned int border = fb_pal[borderAttr & 0x0f];
+    unsigned int inner = fb_pal[(fillAttr & 0xf0) >> 4];
+    int r = radius;
+    int bt = borderThickness;
+    int outer2 = r * r;
+    int inner2 = (r - bt) * (r - bt);
+    int a = 0;   // floor(sqrt(outer2 - dy*dy)), carried from row to row
+    int bf = 0;  // floor(sqrt(inner2 - dy*dy - 1)), so ceil(sqrt(..)) == bf + 1
+
+    // rows outside the clip are skipped, sqrt_step catches up on the jump
+    for (int y = vis.y1; y <= vis.y2; y++) {
+        int rowBorder = (y < y1 + bt) || (y > y2 - bt);
+        int cy;
+
+        // Zeilen ohne Ecke sind ein einziger gerader Abschnitt
+        if (y < y1 + r) cy = y1 + r;
+        else if (y > y2 - r) cy = y2 - r;
+        else {
+            if (rowBorder) fb_hspan(x1, x2, y, border);
+            else rr_emit(x1, x2, x1 + bt, x2 - bt, y, border, inner, fill);
+            continue;
+        }
+
+        // Ecken: links hat Vorrang vor rechts, wie im alten Pixel-Test
+        int leftEnd = x1 + r - 1 < x2 ? x1 + r - 1 : x2;
+        int rightStart = x2 - r + 1 > leftEnd + 1 ? x2 - r + 1 : leftEnd + 1;
+
+        int dy = y - cy;
+        int out = outer2 - dy * dy;
+        int in = inner2 - dy * dy;
+        int b = 0;                           // |dx| >= b ist Rand
+
+        if (out >= 0) a = sqrt_step(a, out); // |dx| <= a liegt innerhalb
+        if (in > 0) {
+            bf = sqrt_step(bf, in - 1);
+            b = bf + 1;
+        }
+
+        if (out >= 0) {
+            // oben/unten links: dx = x - (x1 + r)
+            int start = x1 + r - a > x1 ? x1 + r - a : x1;
+            rr_emit(start, leftEnd, x1 + r - b + 1, leftEnd, y, border, inner, fill);
+
+            // oben/unten rechts: dx = x - (x2 - r)
+            int end = x2 - r + a < x2 ? x2 - r + a : x2;
+            rr_emit(rightStart, end, rightStart, x2 - r + b - 1, y, border, inner, fill);
+
+            // the pixel just outside the arc gets the fractional part of the extent
+            if (antialias) {
+                unsigned int cover = isqrt64((unsigned long)out << 16) - ((unsigned int)a << 8);
+                int lx = x1 + r - a - 1;
+                int rx = x2 - r + a + 1;
+
+                if (cover && lx >= x1 && lx <= leftEnd && fb_inClip(lx, y))
+                    fb_blendPixel(lx, y, border, cover);
+                if (cover && rx <= x2 && rx >= rightStart && fb_inClip(rx, y))
+                    fb_blendPixel(rx, y, border, cover);
+            }
+        }
+
+        // gerader Teil zwischen den Ecken
+        if (rowBorder) {
+            if (leftEnd + 1 <= rightStart - 1) fb_hspan(leftEnd + 1, rightStart - 1, y, border);
+        } else {
+            rr_emit(leftEnd + 1, rightStart - 1, x1 + bt, x2 - bt, y, border, inner, fill);
+        }
     }
 }
 
@@ -112,76 +1002,192 @@ void drawRoundedRect(int x1, int y1, int x2, int y2, int radius,
                      unsigned char fillAttr, int fill,
                      unsigned char borderAttr, int borderThickness) {
     if (borderAttr < 0) borderAttr = fillAttr; // Default: Rand = Füllung
-    if (borderThickness < 1) borderThickness = 1;
 
-    for (int y = y1; y <= y2; y++) {
-        for (int x = x1; x <= x2; x++) {
-            int inCorner = 0;
-            int isBorder = 0;
-
-            // check corners
-            if (x < x1 + radius && y < y1 + radius) { // oben links
-                int dx = x - (x1 + radius);
-                int dy = y - (y1 + radius);
-                int dist2 = dx*dx + dy*dy;
-                if (dist2 > radius*radius) continue; // außerhalb
-                if (dist2 >= (radius-borderThickness)*(radius-borderThickness)) isBorder = 1;
-            } else if (x > x2 - radius && y < y1 + radius) { // oben rechts
-                int dx = x - (x2 - radius);
-                int dy = y - (y1 + radius);
-                int dist2 = dx*dx + dy*dy;
-                if (dist2 > radius*radius) continue;
-                if (dist2 >= (radius-borderThickness)*(radius-borderThickness)) isBorder = 1;
-            } else if (x < x1 + radius && y > y2 - radius) { // unten links
-                int dx = x - (x1 + radius);
-                int dy = y - (y2 - radius);
-                int dist2 = dx*dx + dy*dy;
-                if (dist2 > radius*radius) continue;
-                if (dist2 >= (radius-borderThickness)*(radius-borderThickness)) isBorder = 1;
-            } else if (x > x2 - radius && y > y2 - radius) { // unten rechts
-                int dx = x - (x2 - radius);
-                int dy = y - (y2 - radius);
-                int dist2 = dx*dx + dy*dy;
-                if (dist2 > radius*radius) continue;
-                if (dist2 >= (radius-borderThickness)*(radius-borderThickness)) isBorder = 1;
-            } else {
-                // gerader Teil
-                if ((x < x1 + borderThickness) || (x > x2 - borderThickness) ||
-                    (y < y1 + borderThickness) || (y > y2 - borderThickness)) {
-                    isBorder = 1;
-                }
-            }
+    rr_raster(x1, y1, x2, y2, radius, fillAttr, fill, borderAttr, borderThickness, 0);
+}
 
-            if (isBorder) {
-                drawPixel(x, y, borderAttr);
-            } else if (fill) {
-                drawPixel(x, y, (fillAttr & 0xf0) >> 4);
-            }
+// Same shape as drawRoundedRect, with the outer edge of the corners blended
+// into what is already in the framebuffer
+void drawRoundedRectAA(int x1, int y1, int x2, int y2, int radius,
+                       unsigned char fillAttr, int fill,
+                       unsigned char borderAttr, int borderThickness) {
+    rr_raster(x1, y1, x2, y2, radius, fillAttr, fill, borderAttr, borderThickness, 1);
+}
+
+// Line engine
+//
+// Lines are clipped once with Cohen-Sutherland, then horizontal lines become a
+// single span, vertical lines a column walk, and everything else a Bresenham
+// loop that steps a pixel pointer instead of recomputing y * pitch + x * bpp.
+
+enum {
+    CS_LEFT   = 1,
+    CS_RIGHT  = 2,
+    CS_TOP    = 4,
+    CS_BOTTOM = 8
+};
+
+static inline int cs_code(int x, int y, const fb_rect_t *c)
+{
+    int code = 0;
+
+    if (x < c->x1) code |= CS_LEFT;
+    else if (x > c->x2) code |= CS_RIGHT;
+    if (y < c->y1) code |= CS_TOP;
+    else if (y > c->y2) code |= CS_BOTTOM;
+    return code;
+}
+
+// a + b * num / den, rounded to the nearest integer
+static inline int cs_lerp(int a, long b, long num, long den)
+{
+    long t = b * num;
+
+    if (den < 0) {
+        t = -t;
+        den = -den;
+    }
+    return a + (int)(t >= 0 ? (t + den / 2) / den : -((-t + den / 2) / den));
+}
+
+int fb_clipLine(int *x1, int *y1, int *x2, int *y2, const fb_rect_t *clip)
+{
+    int c1 = cs_code(*x1, *y1, clip);
+    int c2 = cs_code(*x2, *y2, clip);
+
+    for (;;) {
+        if (!(c1 | c2)) return 1;   // ganz drin
+        if (c1 & c2) return 0;      // ganz draußen
+
+        int code = c1 ? c1 : c2;
+        int dx = *x2 - *x1, dy = *y2 - *y1;
+        int x, y;
+
+        if (code & CS_TOP) {
+            y = clip->y1;
+            x = cs_lerp(*x1, dx, y - *y1, dy);
+        } else if (code & CS_BOTTOM) {
+            y = clip->y2;
+            x = cs_lerp(*x1, dx, y - *y1, dy);
+        } else if (code & CS_LEFT) {
+            x = clip->x1;
+            y = cs_lerp(*y1, dy, x - *x1, dx);
+        } else {
+            x = clip->x2;
+            y = cs_lerp(*y1, dy, x - *x1, dx);
+        }
+
+        if (code == c1) {
+            *x1 = x; *y1 = y;
+            c1 = cs_code(x, y, clip);
+        } else {
+            *x2 = x; *y2 = y;
+            c2 = cs_code(x, y, clip);
         }
     }
 }
 
+// Bresenham along the major axis, the minor one carried in the error term.
+// bpp is a constant at each call site, so the store is not a per-pixel branch.
+static inline __attribute__((always_inline))
+void fb_lineWalk(unsigned char *p, int dx, int dy, long sx, long sy,
+                 unsigned int color, const int bpp)
+{
+    long major = dx >= dy ? sx : sy;
+    long minor = dx >= dy ? sy : sx;
+    int n = dx >= dy ? dx : dy;
+    int m = dx >= dy ? dy : dx;
+    int err = 2 * m - n;
+
+    // vertical lines (m == 0) never take the minor step: a plain column walk
+    for (int i = 0; i <= n; i++, p += major) {
+        if (bpp == 2) *(unsigned short *)p = color;
+        else *(unsigned int *)p = color;
+        if (err > 0) {
+            p += minor;
+            err -= 2 * n;
+        }
+        err += 2 * m;
+    }
+}
+
+// Draws an already clipped line, endpoints included
+static void fb_line(int x1, int y1, int x2, int y2, unsigned int color)
+{
+    if (y1 == y2) {
+        if (x1 > x2) { int t = x1; x1 = x2; x2 = t; }
+        fb_hspan(x1, x2, y1, color);
+        return;
+    }
+
+    int dx = x2 > x1 ? x2 - x1 : x1 - x2;
+    int dy = y2 > y1 ? y2 - y1 : y1 - y2;
+    long sx = x2 >= x1 ? fb_bpp : -fb_bpp;
+    long sy = y2 > y1 ? (long)pitch : -(long)pitch;
+
+    if (fb_bpp == 2) fb_lineWalk(fb_addr(x1, y1), dx, dy, sx, sy, color, 2);
+    else fb_lineWalk(fb_addr(x1, y1), dx, dy, sx, sy, color, 4);
+}
+
+// Clips and draws one segment given in view coordinates, growing *box
+// (screen coordinates) by what was drawn
+static inline void fb_lineClipped(int x1, int y1, int x2, int y2, unsigned int color,
+                                  fb_rect_t *box)
+{
+    x1 += fb_view->ox; x2 += fb_view->ox;
+    y1 += fb_view->oy; y2 += fb_view->oy;
+    if (!fb_clipLine(&x1, &y1, &x2, &y2, &fb_view->clip)) return;
+
+    fb_rect_t seg = { x1 < x2 ? x1 : x2, y1 < y2 ? y1 : y2, x1 > x2 ? x1 : x2, y1 > y2 ? y1 : y2 };
+    if (fb_asyncCount) fb_asyncSync(&seg);
+
+    fb_line(x1, y1, x2, y2, color);
+
+    if (seg.x1 < box->x1) box->x1 = seg.x1;
+    if (seg.y1 < box->y1) box->y1 = seg.y1;
+    if (seg.x2 > box->x2) box->x2 = seg.x2;
+    if (seg.y2 > box->y2) box->y2 = seg.y2;
+}
+
+static inline void fb_boxEmpty(fb_rect_t *box)
+{
+    box->x1 = box->y1 = 0x7fffffff;
+    box->x2 = box->y2 = -0x7fffffff;
+}
+
 void drawLine(int x1, int y1, int x2, int y2, unsigned char attr)
 {
-    int dx, dy, p, x, y;
+    fb_rect_t box;
 
-    dx = x2-x1;
-    dy = y2-y1;
-    x = x1;
-    y = y1;
-    p = 2*dy-dx;
+    fb_boxEmpty(&box);
+    fb_lineClipped(x1, y1, x2, y2, fb_pal[attr & 0x0f], &box);
+    if (box.x1 <= box.x2) fb_markDirty(box.x1, box.y1, box.x2, box.y2);
+}
 
-    while (x<x2) {
-       if (p >= 0) {
-          drawPixel(x,y,attr);
-          y++;
-          p = p+2*dy-2*dx;
-       } else {
-          drawPixel(x,y,attr);
-          p = p+2*dy;
-       }
-       x++;
+// count segments, pts[2*i] -> pts[2*i+1]
+void drawLines(const fb_point_t *pts, int count, unsigned char attr)
+{
+    unsigned int color = fb_pal[attr & 0x0f];
+    fb_rect_t box;
+
+    fb_boxEmpty(&box);
+    for (int i = 0; i < count; i++, pts += 2) {
+        fb_lineClipped(pts[0].x, pts[0].y, pts[1].x, pts[1].y, color, &box);
     }
+    if (box.x1 <= box.x2) fb_markDirty(box.x1, box.y1, box.x2, box.y2);
+}
+
+// count points joined by count - 1 segments
+void drawPolyline(const fb_point_t *pts, int count, unsigned char attr)
+{
+    unsigned int color = fb_pal[attr & 0x0f];
+    fb_rect_t box;
+
+    fb_boxEmpty(&box);
+    for (int i = 1; i < count; i++) {
+        fb_lineClipped(pts[i - 1].x, pts[i - 1].y, pts[i].x, pts[i].y, color, &box);
+    }
+    if (box.x1 <= box.x2) fb_markDirty(box.x1, box.y1, box.x2, box.y2);
 }
 
 void drawCircle(int x0, int y0, int radius, unsigned char attr, int fill)
@@ -190,21 +1196,57 @@ void drawCircle(int x0, int y0, int radius, unsigned char attr, int fill)
     int y = 0;
     int err = 0;
 
+    fb_rect_t vis;
+
+    x0 += fb_view->ox;
+    y0 += fb_view->oy;
+    if (!fb_clipBox(&vis, x0 - radius, y0 - radius, x0 + radius, y0 + radius)) return;
+
+    // Fill: one span per row. Rows y0±y are widest the first time y is seen,
+    // rows y0±x the last time x is seen (y only grows while x only shrinks).
+    if (fill) {
+        unsigned int inner = fb_pal[(attr & 0xf0) >> 4];
+        int lastY = -1;
+
+        while (x >= y) {
+            int cx = x, cy = y;
+
+            if (cy != lastY) {
+                fb_hspan(x0 - cx, x0 + cx, y0 + cy, inner);
+                if (cy) fb_hspan(x0 - cx, x0 + cx, y0 - cy, inner);
+                lastY = cy;
+            }
+
+            if (err <= 0) {
+                y += 1;
+                err += 2*y + 1;
+            }
+            if (err > 0) {
+                x -= 1;
+                err -= 2*x + 1;
+            }
+
+            if (x != cx || x < y) {
+                fb_hspan(x0 - cy, x0 + cy, y0 + cx, inner);
+                fb_hspan(x0 - cy, x0 + cy, y0 - cx, inner);
+            }
+        }
+
+        x = radius;
+        y = 0;
+        err = 0;
+    }
+
+    // Umriss erst nach der Füllung, damit keine Spanne ihn überschreibt
     while (x >= y) {
-	if (fill) {
-	   drawLine(x0 - y, y0 + x, x0 + y, y0 + x, (attr & 0xf0) >> 4);
-	   drawLine(x0 - x, y0 + y, x0 + x, y0 + y, (attr & 0xf0) >> 4);
-	   drawLine(x0 - x, y0 - y, x0 + x, y0 - y, (attr & 0xf0) >> 4);
-	   drawLine(x0 - y, y0 - x, x0 + y, y0 - x, (attr & 0xf0) >> 4);
-	}
-	drawPixel(x0 - y, y0 + x, attr);
-	drawPixel(x0 + y, y0 + x, attr);
-	drawPixel(x0 - x, y0 + y, attr);
-        drawPixel(x0 + x, y0 + y, attr);
-	drawPixel(x0 - x, y0 - y, attr);
-	drawPixel(x0 + x, y0 - y, attr);
-	drawPixel(x0 - y, y0 - x, attr);
-	drawPixel(x0 + y, y0 - x, attr);
+	fb_putPixel(x0 - y, y0 + x, attr);
+	fb_putPixel(x0 + y, y0 + x, attr);
+	fb_putPixel(x0 - x, y0 + y, attr);
+        fb_putPixel(x0 + x, y0 + y, attr);
+	fb_putPixel(x0 - x, y0 - y, attr);
+	fb_putPixel(x0 + x, y0 - y, attr);
+	fb_putPixel(x0 - y, y0 - x, attr);
+	fb_putPixel(x0 + y, y0 - x, attr);
 
 	if (err <= 0) {
 	    y += 1;
@@ -218,17 +1260,74 @@ void drawCircle(int x0, int y0, int radius, unsigned char attr, int fill)
     }
 }
 
+// Glyph cut by the clip edge: runs of equal bits become clipped spans
+static void fb_glyphRuns(const unsigned char *glyph, int x, int y, int scale,
+                            unsigned int fg, unsigned int bg)
+{
+    for (int dy = 0; dy < FONT_HEIGHT; dy++, glyph += FONT_BPL) {
+        for (int sy = 0; sy < scale; sy++) {
+            int dx = 0;
+
+            while (dx < FONT_WIDTH) {
+                int on = (*glyph >> dx) & 1;
+                int run = dx;
+                while (run < FONT_WIDTH && ((*glyph >> run) & 1) == on) run++;
+                fb_hspan(x + dx * scale, x + run * scale - 1, y + dy * scale + sy, on ? fg : bg);
+                dx = run;
+            }
+        }
+    }
+}
+
+// 16bpp version of the glyphRow kernel
+static void fb_glyphRow16(unsigned short *dst, unsigned char bits, int scale,
+                          unsigned int fg, unsigned int bg)
+{
+    int dx = 0;
+
+    if (scale == 1) {
+        for (dx = 0; dx < FONT_WIDTH; dx++) dst[dx] = ((bits >> dx) & 1) ? fg : bg;
+        return;
+    }
+
+    while (dx < FONT_WIDTH) {
+        int on = (bits >> dx) & 1;
+        int run = dx;
+        while (run < FONT_WIDTH && ((bits >> run) & 1) == on) run++;
+        fb_fill16(dst + dx * scale, (run - dx) * scale, on ? fg : bg);
+        dx = run;
+    }
+}
+
+static inline void fb_glyphRow(unsigned char *dst, unsigned char bits, int scale,
+                               unsigned int fg, unsigned int bg)
+{
+    if (fb_bpp == 2) fb_glyphRow16((unsigned short *)dst, bits, scale, fg, bg);
+    else fb_kernels.glyphRow((unsigned int *)dst, bits, scale, fg, bg);
+}
+
+static inline int fb_rectInside(const fb_rect_t *vis, int x1, int y1, int x2, int y2)
+{
+    return vis->x1 == x1 && vis->y1 == y1 && vis->x2 == x2 && vis->y2 == y2;
+}
+
 void drawChar(unsigned char ch, int x, int y, unsigned char attr)
 {
     unsigned char *glyph = (unsigned char *)&font + (ch < FONT_NUMGLYPHS ? ch : 0) * FONT_BPG;
+    unsigned int fg = fb_pal[attr & 0x0f];
+    unsigned int bg = fb_pal[(attr & 0xf0) >> 4];
+    fb_rect_t vis;
 
-    for (int i=0;i<FONT_HEIGHT;i++) {
-	for (int j=0;j<FONT_WIDTH;j++) {
-	    unsigned char mask = 1 << j;
-	    unsigned char col = (*glyph & mask) ? attr & 0x0f : (attr & 0xf0) >> 4;
+    x += fb_view->ox;
+    y += fb_view->oy;
+    if (!fb_clipBox(&vis, x, y, x + FONT_WIDTH - 1, y + FONT_HEIGHT - 1)) return;
+    if (!fb_rectInside(&vis, x, y, x + FONT_WIDTH - 1, y + FONT_HEIGHT - 1)) {
+        fb_glyphRuns(glyph, x, y, 1, fg, bg);
+        return;
+    }
 
-	    drawPixel(x+j, y+i, col);
-	}
+    for (int i=0;i<FONT_HEIGHT;i++) {
+	fb_glyphRow(fb_addr(x, y + i), *glyph, 1, fg, bg);
 	glyph += FONT_BPL;
     }
 }
@@ -237,23 +1336,42 @@ void drawCharSized(unsigned char ch, int x, int y, unsigned char attr, int size)
 {
     unsigned char *glyph = (unsigned char *)&font + (ch < FONT_NUMGLYPHS ? ch : 0) * FONT_BPG;
     int scale = size / FONT_WIDTH;
+    unsigned int fg = fb_pal[attr & 0x0f];
+    unsigned int bg = fb_pal[(attr & 0xf0) >> 4];
+
+    fb_rect_t vis;
+
+    if (scale <= 0) return;
+
+    x += fb_view->ox;
+    y += fb_view->oy;
+    if (!fb_clipBox(&vis, x, y, x + FONT_WIDTH*scale - 1, y + FONT_HEIGHT*scale - 1)) return;
+
+    // cached tile: one row copy per visible pixel row, no bit expansion at all.
+    // Tiles are 32bpp, 16bpp surfaces expand the glyph below instead.
+    const unsigned int *tile = fb_bpp == 4 ? fb_glyphCacheGet(ch, glyph, scale, fg, bg) : 0;
+    if (tile) {
+        int w = FONT_WIDTH * scale;
+        tile += (vis.y1 - y) * w + (vis.x1 - x);
+        for (int row = vis.y1; row <= vis.y2; row++) {
+            fb_copy32(fb_row(row) + vis.x1, tile, vis.x2 - vis.x1 + 1);
+            tile += w;
+        }
+        return;
+    }
+
+    if (!fb_rectInside(&vis, x, y, x + FONT_WIDTH*scale - 1, y + FONT_HEIGHT*scale - 1)) {
+        fb_glyphRuns(glyph, x, y, scale, fg, bg);
+        return;
+    }
 
     for (int dy = 0; dy < FONT_HEIGHT; dy++) {
-        for (int dx = 0; dx < FONT_WIDTH; dx++) {
-            unsigned char mask = 1 << dx;
-            if (*glyph & mask) {
-                for (int sy = 0; sy < scale; sy++) {
-                    for (int sx = 0; sx < scale; sx++) {
-                        drawPixel(x + dx*scale + sx, y + dy*scale + sy, attr & 0x0f);
-                    }
-                }
-            } else {
-                for (int sy = 0; sy < scale; sy++) {
-                    for (int sx = 0; sx < scale; sx++) {
-                        drawPixel(x + dx*scale + sx, y + dy*scale + sy, (attr & 0xf0) >> 4);
-                    }
-                }
-            }
+        unsigned char *first = fb_addr(x, y + dy*scale);
+
+        // expand the font row once, then replicate it for the other sub-rows
+        fb_glyphRow(first, *glyph, scale, fg, bg);
+        for (int sy = 1; sy < scale; sy++) {
+            fb_copyPixels(fb_addr(x, y + dy*scale + sy), first, FONT_WIDTH * scale);
         }
         glyph += FONT_BPL;
     }
@@ -291,3 +1409,207 @@ void drawStringSized(int x, int y, char *s, unsigned char attr, int size)
         s++;
     }
 }
+
+// Cursor overlay
+//
+// The sprite is composited straight into the page on screen, and the pixels
+// it covers are kept in a save-under buffer. Moving it restores the old
+// rectangle and saves and blends the new one: at most 3 * 4 KB of memory
+// traffic, whatever is on screen. Single-buffered surfaces have only one
+// page, so a primitive that lands on the cursor takes it off first and
+// fb_present puts it back.
+
+typedef struct {
+    fb_rect_t rect;     // visible part, screen coordinates
+    int ox, oy;         // top left corner of the sprite
+    unsigned int pixels[FB_CURSOR_SIZE * FB_CURSOR_SIZE];
+} fb_saveUnder_t;
+
+static unsigned int fb_cursorArgb[FB_CURSOR_SIZE * FB_CURSOR_SIZE];
+static unsigned int fb_cursorColor[FB_CURSOR_SIZE * FB_CURSOR_SIZE]; // surface format
+static unsigned int fb_cursorCover[FB_CURSOR_SIZE * FB_CURSOR_SIZE]; // 0..256
+
+static fb_saveUnder_t fb_under[2];
+static fb_saveUnder_t *fb_cursorUnder = &fb_under[0]; // what the shown sprite covers
+static int fb_cursorVisible = 0;
+static int fb_cursorStaged = 0;
+static int fb_cursorX = 0, fb_cursorY = 0, fb_cursorHotX = 0, fb_cursorHotY = 0;
+
+static void fb_cursorConvert(void)
+{
+    for (int i = 0; i < FB_CURSOR_SIZE * FB_CURSOR_SIZE; i++) {
+        unsigned int a = fb_cursorArgb[i] >> 24;
+
+        fb_cursorColor[i] = fb_color(fb_cursorArgb[i]);
+        fb_cursorCover[i] = a + (a >> 7);
+    }
+}
+
+static inline unsigned char *fb_pagePixel(unsigned char *page, int x, int y)
+{
+    return page + y * pitch + x * fb_bpp;
+}
+
+// Where the sprite goes at the current position; 0 if it is off screen
+static int fb_cursorPlace(fb_saveUnder_t *u)
+{
+    fb_rect_t screen = { 0, 0, width - 1, height - 1 };
+
+    u->ox = fb_cursorX - fb_cursorHotX;
+    u->oy = fb_cursorY - fb_cursorHotY;
+
+    fb_rect_t box = { u->ox, u->oy, u->ox + FB_CURSOR_SIZE - 1, u->oy + FB_CURSOR_SIZE - 1 };
+    return fb_rectIntersect(&u->rect, &box, &screen);
+}
+
+// Saves what is under the sprite and blends the sprite over it
+static void fb_cursorDraw(unsigned char *page, fb_saveUnder_t *u)
+{
+    for (int y = u->rect.y1; y <= u->rect.y2; y++) {
+        int i = (y - u->oy) * FB_CURSOR_SIZE + (u->rect.x1 - u->ox);
+        unsigned char *p = fb_pagePixel(page, u->rect.x1, y);
+
+        for (int x = u->rect.x1; x <= u->rect.x2; x++, i++, p += fb_bpp) {
+            unsigned int cover = fb_cursorCover[i];
+
+            if (fb_bpp == 2) {
+                unsigned int d = *(unsigned short *)p;
+                u->pixels[i] = d;
+                if (cover) *(unsigned short *)p = cover == 256 ? fb_cursorColor[i] : fb_blend565(d, fb_cursorColor[i], cover);
+            } else {
+                unsigned int d = *(unsigned int *)p;
+                u->pixels[i] = d;
+                if (cover) *(unsigned int *)p = cover == 256 ? fb_cursorColor[i] : fb_blend(d, fb_cursorColor[i], cover);
+            }
+        }
+    }
+}
+
+// Puts the saved pixels back, limited to r
+static void fb_cursorRestore(unsigned char *page, const fb_saveUnder_t *u, const fb_rect_t *r)
+{
+    fb_rect_t hit;
+
+    if (!fb_rectIntersect(&hit, r, &u->rect)) return;
+
+    for (int y = hit.y1; y <= hit.y2; y++) {
+        const unsigned int *src = &u->pixels[(y - u->oy) * FB_CURSOR_SIZE + (hit.x1 - u->ox)];
+        unsigned char *p = fb_pagePixel(page, hit.x1, y);
+
+        for (int x = hit.x1; x <= hit.x2; x++, p += fb_bpp) {
+            if (fb_bpp == 2) *(unsigned short *)p = *src++;
+            else *(unsigned int *)p = *src++;
+        }
+    }
+}
+
+// Redraws the sprite on the shown page at the current position
+static void fb_cursorUpdate(void)
+{
+    unsigned char *page = fb_pages[fb_backPage ^ 1]; // same page when single-buffered
+    fb_saveUnder_t *next = fb_cursorUnder == &fb_under[0] ? &fb_under[1] : &fb_under[0];
+    int drawn = fb_cursorVisible && fb_cursorPlace(next);
+
+    // fb_present's copies read the shown page; they must not pick up the sprite
+    if (fb_asyncCount) {
+        if (fb_cursorDrawn) fb_asyncSync(&fb_cursorUnder->rect);
+        if (drawn) fb_asyncSync(&next->rect);
+    }
+
+    if (fb_cursorDrawn) fb_cursorRestore(page, fb_cursorUnder, &fb_cursorUnder->rect);
+    if (drawn) fb_cursorDraw(page, next);
+
+    fb_cursorUnder = next;
+    fb_cursorDrawn = drawn;
+}
+
+// fb_present, before the flip: composite onto the frame about to be shown
+static void fb_cursorStage(unsigned char *page)
+{
+    fb_saveUnder_t *next = fb_cursorUnder == &fb_under[0] ? &fb_under[1] : &fb_under[0];
+
+    fb_cursorStaged = fb_cursorVisible && fb_cursorPlace(next);
+    if (fb_cursorStaged) fb_cursorDraw(page, next);
+}
+
+// fb_present, after the flip (or after it failed). fb is the back page again.
+static void fb_cursorCommit(int flipped)
+{
+    fb_saveUnder_t *next = fb_cursorUnder == &fb_under[0] ? &fb_under[1] : &fb_under[0];
+
+    if (!flipped) {
+        if (fb_cursorStaged) fb_cursorRestore(fb, next, &next->rect);
+        fb_cursorStaged = 0;
+        return;
+    }
+
+    if (fb_cursorDrawn) fb_cursorRestore(fb, fb_cursorUnder, &fb_cursorUnder->rect);
+    fb_cursorUnder = next;
+    fb_cursorDrawn = fb_cursorStaged;
+    fb_cursorStaged = 0;
+}
+
+// fb_present, after queueing the damage copies from the shown page
+static void fb_cursorPatch(void)
+{
+    fb_rect_t hit;
+
+    if (!fb_cursorDrawn) return;
+
+    for (int i = 0; i < fb_frameDamage.count; i++) {
+        if (!fb_rectIntersect(&hit, &fb_frameDamage.rects[i], &fb_cursorUnder->rect)) continue;
+
+        if (fb_asyncCount) fb_asyncSync(&hit);
+        fb_cursorRestore(fb, fb_cursorUnder, &hit);
+    }
+}
+
+// Single-buffered: a primitive is about to draw over r on the shown page
+static void fb_cursorUncover(const fb_rect_t *r)
+{
+    fb_rect_t hit;
+
+    if (!fb_rectIntersect(&hit, r, &fb_cursorUnder->rect)) return;
+
+    if (fb_asyncCount) fb_asyncSync(&fb_cursorUnder->rect);
+    fb_cursorRestore(fb, fb_cursorUnder, &fb_cursorUnder->rect);
+    fb_cursorDrawn = 0;
+}
+
+static void fb_cursorShowPending(void)
+{
+    if (fb_cursorVisible && !fb_cursorDrawn) fb_cursorUpdate();
+}
+
+void fb_cursorSetImage(const unsigned int *argb, int hotX, int hotY)
+{
+    for (int i = 0; i < FB_CURSOR_SIZE * FB_CURSOR_SIZE; i++) fb_cursorArgb[i] = argb[i];
+    fb_cursorConvert();
+    fb_cursorHotX = hotX;
+    fb_cursorHotY = hotY;
+
+    if (fb_cursorDrawn) fb_cursorUpdate();
+}
+
+void fb_cursorMove(int x, int y)
+{
+    if (x == fb_cursorX && y == fb_cursorY) return;
+
+    fb_cursorX = x;
+    fb_cursorY = y;
+    if (fb_cursorVisible) fb_cursorUpdate();
+}
+
+void fb_cursorShow(int visible)
+{
+    if (fb_cursorVisible == !!visible) return;
+
+    fb_cursorVisible = !!visible;
+    fb_cursorUpdate();
+}
+
+void fb_cursorGetPos(int *x, int *y)
+{
+    *x = fb_cursorX;
+    *y = fb_cursorY;
+}
@@ -0,0 +1,89 @@
+// Dirty rectangle lists
+// src/lib/fb_damage.c
+//
+// A damage list is a handful of screen rectangles. Rectangles that overlap or
+// touch are merged on insert, and when the list is full the new rectangle is
+// folded into whichever entry grows the least, so the list never overflows
+// and never loses an area.
+
+#include "../include/fb.h"
+
+extern unsigned int width, height;
+
+static int rect_area(const fb_rect_t *r)
+{
+    return (r->x2 - r->x1 + 1) * (r->y2 - r->y1 + 1);
+}
+
+static int rect_touches(const fb_rect_t *a, const fb_rect_t *b)
+{
+    return a->x1 <= b->x2 + 1 && b->x1 <= a->x2 + 1 &&
+           a->y1 <= b->y2 + 1 && b->y1 <= a->y2 + 1;
+}
+
+static void rect_union(fb_rect_t *a, const fb_rect_t *b)
+{
+    if (b->x1 < a->x1) a->x1 = b->x1;
+    if (b->y1 < a->y1) a->y1 = b->y1;
+    if (b->x2 > a->x2) a->x2 = b->x2;
+    if (b->y2 > a->y2) a->y2 = b->y2;
+}
+
+int fb_rectIntersect(fb_rect_t *out, const fb_rect_t *a, const fb_rect_t *b)
+{
+    out->x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+    out->y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+    out->x2 = a->x2 < b->x2 ? a->x2 : b->x2;
+    out->y2 = a->y2 < b->y2 ? a->y2 : b->y2;
+    return out->x1 <= out->x2 && out->y1 <= out->y2;
+}
+
+void fb_damageClear(fb_damage_t *d)
+{
+    d->count = 0;
+}
+
+void fb_damageAdd(fb_damage_t *d, int x1, int y1, int x2, int y2)
+{
+    fb_rect_t r = { x1, y1, x2, y2 };
+
+    // clip to the screen
+    if (r.x1 < 0) r.x1 = 0;
+    if (r.y1 < 0) r.y1 = 0;
+    if (r.x2 >= (int)width) r.x2 = width - 1;
+    if (r.y2 >= (int)height) r.y2 = height - 1;
+    if (r.x1 > r.x2 || r.y1 > r.y2) return;
+
+    // absorb everything the new rectangle touches; a merge can make it touch
+    // entries it missed before, so rescan until nothing changes
+    int merged = 1;
+    while (merged) {
+        merged = 0;
+        for (int i = 0; i < d->count; i++) {
+            if (rect_touches(&d->rects[i], &r)) {
+                rect_union(&r, &d->rects[i]);
+                d->rects[i] = d->rects[--d->count];
+                merged = 1;
+                break;
+            }
+        }
+    }
+
+    if (d->count < FB_MAX_DAMAGE) {
+        d->rects[d->count++] = r;
+        return;
+    }
+
+    int best = 0;
+    int bestGrowth = -1;
+    for (int i = 0; i < d->count; i++) {
+        fb_rect_t u = d->rects[i];
+        rect_union(&u, &r);
+        int growth = rect_area(&u) - rect_area(&d->rects[i]);
+        if (bestGrowth < 0 || growth < bestGrowth) {
+            best = i;
+            bestGrowth = growth;
+        }
+    }
+    rect_union(&d->rects[best], &r);
+}
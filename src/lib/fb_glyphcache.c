@@ -0,0 +1,180 @@
+// Glyph atlas cache
+// src/lib/fb_glyphcache.c
+//
+// drawCharSized used to expand the 8x8 font bitmap on every call. Here each
+// (glyph, scale, fg, bg) combination is rasterized once into a 32bpp tile
+// that drawCharSized copies row by row. Tiles live in a fixed arena that is
+// handed out in 64-pixel chunks; when a tile doesn't fit, the least recently
+// used tiles are evicted until it does.
+
+#include "../include/fb.h"
+
+enum {
+    GLYPH_CHUNK_PIXELS = 64,                      // one 8x8 tile at scale 1
+    GLYPH_ARENA_CHUNKS = 4096,                    // 1 MB of tiles
+    GLYPH_MAX_ENTRIES  = 512,
+    GLYPH_BUCKETS      = 256,
+    GLYPH_NONE         = 0xFFFF
+};
+
+typedef struct {
+    unsigned int fg, bg;
+    unsigned int lastUse;
+    unsigned short chunk;     // first chunk in the arena
+    unsigned short chunks;
+    unsigned short next;      // hash chain
+    unsigned char ch;
+    unsigned char scale;      // 0 = free entry
+} glyph_entry_t;
+
+static unsigned int glyph_arena[GLYPH_ARENA_CHUNKS * GLYPH_CHUNK_PIXELS] __attribute__((aligned(16)));
+static unsigned char glyph_chunkUsed[GLYPH_ARENA_CHUNKS];
+static glyph_entry_t glyph_entries[GLYPH_MAX_ENTRIES];
+static unsigned short glyph_buckets[GLYPH_BUCKETS];
+
+static unsigned int glyph_clock = 0;
+static int glyph_ready = 0;
+static int glyph_enabled = 1;
+static fb_glyph_stats_t glyph_stats;
+
+static unsigned int glyph_hash(unsigned char ch, int scale, unsigned int fg, unsigned int bg)
+{
+    unsigned int h = ch * 31u + scale;
+    h = h * 0x9E3779B1u ^ fg;
+    h = h * 0x9E3779B1u ^ bg;
+    return (h ^ (h >> 16)) & (GLYPH_BUCKETS - 1);
+}
+
+void fb_glyphCacheFlush(void)
+{
+    for (int i = 0; i < GLYPH_ARENA_CHUNKS; i++) glyph_chunkUsed[i] = 0;
+    for (int i = 0; i < GLYPH_MAX_ENTRIES; i++) glyph_entries[i].scale = 0;
+    for (int i = 0; i < GLYPH_BUCKETS; i++) glyph_buckets[i] = GLYPH_NONE;
+
+    glyph_stats.tiles = 0;
+    glyph_stats.bytesUsed = 0;
+    glyph_ready = 1;
+}
+
+void fb_glyphCacheEnable(int on)
+{
+    glyph_enabled = on;
+}
+
+void fb_glyphCacheStats(fb_glyph_stats_t *out)
+{
+    *out = glyph_stats;
+}
+
+static void glyph_evict(int index)
+{
+    glyph_entry_t *e = &glyph_entries[index];
+    unsigned short *link = &glyph_buckets[glyph_hash(e->ch, e->scale, e->fg, e->bg)];
+
+    while (*link != index) link = &glyph_entries[*link].next;
+    *link = e->next;
+
+    for (int i = 0; i < e->chunks; i++) glyph_chunkUsed[e->chunk + i] = 0;
+
+    glyph_stats.tiles--;
+    glyph_stats.bytesUsed -= e->chunks * GLYPH_CHUNK_PIXELS * 4;
+    glyph_stats.evictions++;
+    e->scale = 0;
+}
+
+static int glyph_evictOldest(void)
+{
+    int oldest = -1;
+
+    for (int i = 0; i < GLYPH_MAX_ENTRIES; i++) {
+        if (!glyph_entries[i].scale) continue;
+        if (oldest < 0 || glyph_entries[i].lastUse < glyph_entries[oldest].lastUse) oldest = i;
+    }
+    if (oldest < 0) return 0;
+
+    glyph_evict(oldest);
+    return 1;
+}
+
+// First fit over the chunk map, -1 if no run of `count` free chunks exists
+static int glyph_findChunks(int count)
+{
+    int run = 0;
+
+    for (int i = 0; i < GLYPH_ARENA_CHUNKS; i++) {
+        run = glyph_chunkUsed[i] ? 0 : run + 1;
+        if (run == count) return i - count + 1;
+    }
+    return -1;
+}
+
+static void glyph_rasterize(unsigned int *tile, const unsigned char *glyph, int scale,
+                            unsigned int fg, unsigned int bg)
+{
+    int w = 8 * scale;
+
+    for (int dy = 0; dy < 8; dy++) {
+        unsigned int *first = tile + dy * scale * w;
+        unsigned char bits = glyph[dy];
+
+        for (int dx = 0; dx < 8; dx++) {
+            fb_fill32(first + dx * scale, scale, ((bits >> dx) & 1) ? fg : bg);
+        }
+        for (int sy = 1; sy < scale; sy++) {
+            fb_copy32(first + sy * w, first, w);
+        }
+    }
+}
+
+const unsigned int* fb_glyphCacheGet(unsigned char ch, const unsigned char *glyph, int scale,
+                                     unsigned int fg, unsigned int bg)
+{
+    if (!glyph_enabled || scale < 1 || scale > FB_GLYPH_MAX_SCALE) return (const unsigned int*)0;
+    if (!glyph_ready) fb_glyphCacheFlush();
+
+    unsigned int bucket = glyph_hash(ch, scale, fg, bg);
+
+    for (unsigned short i = glyph_buckets[bucket]; i != GLYPH_NONE; i = glyph_entries[i].next) {
+        glyph_entry_t *e = &glyph_entries[i];
+        if (e->ch == ch && e->scale == scale && e->fg == fg && e->bg == bg) {
+            e->lastUse = ++glyph_clock;
+            glyph_stats.hits++;
+            return &glyph_arena[e->chunk * GLYPH_CHUNK_PIXELS];
+        }
+    }
+
+    glyph_stats.misses++;
+
+    // Need a free entry and a contiguous run of chunks; evict LRU tiles until both exist
+    int chunks = scale * scale;
+    int index = -1;
+    int chunk;
+
+    for (;;) {
+        for (int i = 0; index < 0 && i < GLYPH_MAX_ENTRIES; i++) {
+            if (!glyph_entries[i].scale) index = i;
+        }
+        chunk = glyph_findChunks(chunks);
+        if (index >= 0 && chunk >= 0) break;
+        if (!glyph_evictOldest()) return (const unsigned int*)0;
+    }
+
+    glyph_entry_t *e = &glyph_entries[index];
+    e->ch = ch;
+    e->scale = scale;
+    e->fg = fg;
+    e->bg = bg;
+    e->chunk = chunk;
+    e->chunks = chunks;
+    e->lastUse = ++glyph_clock;
+    e->next = glyph_buckets[bucket];
+    glyph_buckets[bucket] = index;
+
+    for (int i = 0; i < chunks; i++) glyph_chunkUsed[chunk + i] = 1;
+    glyph_stats.tiles++;
+    glyph_stats.bytesUsed += chunks * GLYPH_CHUNK_PIXELS * 4;
+
+    unsigned int *tile = &glyph_arena[chunk * GLYPH_CHUNK_PIXELS];
+    glyph_rasterize(tile, glyph, scale, fg, bg);
+    return tile;
+}
@@ -0,0 +1,133 @@
+// NEON framebuffer kernels
+// src/lib/fb_neon.c
+//
+// This is the only file built without +nosimd (see the Makefile), so the
+// 128-bit vector types below end up in q registers. Everything else in the
+// kernel stays integer-only and never touches the FP/SIMD state.
+
+#include "../include/fb_neon.h"
+
+#ifdef FB_NEON
+
+typedef unsigned int u32x4 __attribute__((vector_size(16)));
+typedef unsigned int u32x4u __attribute__((vector_size(16), aligned(4))); // unaligned access
+
+static const u32x4 glyph_lo = { 1, 2, 4, 8 };
+static const u32x4 glyph_hi = { 16, 32, 64, 128 };
+
+// SIMD instructions trap until CPACR_EL1.FPEN (or CPTR_EL2.TFP at EL2) allows them
+void fb_neon_enable(void)
+{
+#ifndef FB_HOST
+    unsigned long el;
+
+    asm volatile("mrs %0, CurrentEL" : "=r"(el));
+    el = (el >> 2) & 3;
+
+    if (el == 1) {
+        unsigned long cpacr;
+        asm volatile("mrs %0, cpacr_el1" : "=r"(cpacr));
+        cpacr |= (3UL << 20);
+        asm volatile("msr cpacr_el1, %0\n\tisb" :: "r"(cpacr));
+    } else if (el == 2) {
+        unsigned long cptr;
+        asm volatile("mrs %0, cptr_el2" : "=r"(cptr));
+        cptr &= ~(1UL << 10);
+        asm volatile("msr cptr_el2, %0\n\tisb" :: "r"(cptr));
+    }
+#endif
+}
+
+void fb_fill32_neon(unsigned int *dst, int n, unsigned int color)
+{
+    u32x4 v = { color, color, color, color };
+
+    if (n <= 0) return;
+
+    // align to 16 bytes so the main loop uses aligned q stores
+    while (((unsigned long)dst & 15) && n) {
+        *dst++ = color;
+        n--;
+    }
+
+    u32x4 *d = (u32x4 *)dst;
+    while (n >= 16) {
+        d[0] = v;
+        d[1] = v;
+        d[2] = v;
+        d[3] = v;
+        d += 4;
+        n -= 16;
+    }
+    if (n & 8) { d[0] = v; d[1] = v; d += 2; }
+    if (n & 4) { *d++ = v; }
+
+    dst = (unsigned int *)d;
+    if (n & 2) { dst[0] = color; dst[1] = color; dst += 2; }
+    if (n & 1) { dst[0] = color; }
+}
+
+void fb_copy32_neon(unsigned int *dst, const unsigned int *src, int n)
+{
+    if (n <= 0) return;
+
+    while (((unsigned long)dst & 15) && n) {
+        *dst++ = *src++;
+        n--;
+    }
+
+    // destination is aligned, the source may not be
+    u32x4 *d = (u32x4 *)dst;
+    const u32x4u *s = (const u32x4u *)src;
+    while (n >= 16) {
+        u32x4 a = s[0], b = s[1], c = s[2], e = s[3];
+        d[0] = a;
+        d[1] = b;
+        d[2] = c;
+        d[3] = e;
+        d += 4;
+        s += 4;
+        n -= 16;
+    }
+    while (n >= 4) {
+        *d++ = *s++;
+        n -= 4;
+    }
+
+    dst = (unsigned int *)d;
+    src = (const unsigned int *)s;
+    if (n > 0) dst[0] = src[0];
+    if (n > 1) dst[1] = src[1];
+    if (n > 2) dst[2] = src[2];
+}
+
+// Expands one 8-bit font row to 32bpp: each bit selects fg or bg for `scale` pixels
+void fb_glyphRow_neon(unsigned int *dst, unsigned char bits, int scale,
+                      unsigned int fg, unsigned int bg)
+{
+    u32x4 b = { bits, bits, bits, bits };
+    u32x4 f = { fg, fg, fg, fg };
+    u32x4 k = { bg, bg, bg, bg };
+
+    if (scale == 1) {
+        u32x4 m0 = (u32x4)((b & glyph_lo) != 0);
+        u32x4 m1 = (u32x4)((b & glyph_hi) != 0);
+        u32x4u *d = (u32x4u *)dst;
+
+        d[0] = (f & m0) | (k & ~m0);
+        d[1] = (f & m1) | (k & ~m1);
+        return;
+    }
+
+    // Larger glyphs: one run per run of equal bits
+    int dx = 0;
+    while (dx < 8) {
+        int on = (bits >> dx) & 1;
+        int run = dx;
+        while (run < 8 && ((bits >> run) & 1) == on) run++;
+        fb_fill32_neon(dst + dx * scale, (run - dx) * scale, on ? fg : bg);
+        dx = run;
+    }
+}
+
+#endif
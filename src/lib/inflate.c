@@ -0,0 +1,327 @@
+// Streaming DEFLATE decoder (see inflate.h)
+// src/lib/inflate.c
+
+#include "../include/inflate.h"
+
+enum {
+    INFLATE_ZLIB,       // two byte zlib header next
+    INFLATE_BLOCK,      // block header next
+    INFLATE_STORED,
+    INFLATE_HUFFMAN,
+    INFLATE_DONE,
+    INFLATE_ERROR
+};
+
+#define INFLATE_MASK (INFLATE_WINDOW - 1)
+
+static const unsigned short inflate_lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char inflate_lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short inflate_distBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char inflate_distExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const unsigned char inflate_clenOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// Tops the bit buffer up to at least n bits, or as far as the input goes
+static void inflate_need(inflate_t *s, unsigned int n)
+{
+    while (s->bitCount < n) {
+        if (s->in == s->inEnd) {
+            unsigned long length = 0;
+            const unsigned char *chunk = s->fill ? s->fill(s->arg, &length) : 0;
+            if (!chunk || !length) return;
+            s->in = chunk;
+            s->inEnd = chunk + length;
+        }
+        s->bitBuf |= (unsigned long)*s->in++ << s->bitCount;
+        s->bitCount += 8;
+    }
+}
+
+static unsigned int inflate_bits(inflate_t *s, unsigned int n)
+{
+    inflate_need(s, n);
+    if (s->bitCount < n) {
+        s->state = INFLATE_ERROR; // ran out of input
+        return 0;
+    }
+
+    unsigned int v = s->bitBuf & ((1UL << n) - 1);
+    s->bitBuf >>= n;
+    s->bitCount -= n;
+    return v;
+}
+
+// Canonical code from a list of code lengths; 0 if the lengths are over-subscribed
+static int inflate_build(inflate_huff_t *h, const unsigned char *lengths, int n)
+{
+    unsigned short offsets[16], next[16];
+    int left = 1;
+
+    for (int i = 0; i < 16; i++) h->count[i] = 0;
+    for (int i = 0; i < n; i++) h->count[lengths[i]]++;
+    h->count[0] = 0;
+
+    for (int len = 1; len < 16; len++) {
+        left = (left << 1) - h->count[len];
+        if (left < 0) return 0;
+    }
+
+    offsets[1] = 0;
+    next[1] = 0;
+    for (int len = 1; len < 15; len++) {
+        offsets[len + 1] = offsets[len] + h->count[len];
+        next[len + 1] = (next[len] + h->count[len]) << 1;
+    }
+
+    for (int i = 0; i < (1 << INFLATE_FAST_BITS); i++) h->fast[i] = 0;
+
+    for (int sym = 0; sym < n; sym++) {
+        int len = lengths[sym];
+        if (!len) continue;
+
+        h->symbol[offsets[len]++] = sym;
+        if (len > INFLATE_FAST_BITS) continue;
+
+        // the stream sends codes most significant bit first, the table is
+        // indexed by the bit buffer which holds them reversed
+        unsigned int code = next[len]++, rev = 0;
+        for (int i = 0; i < len; i++) rev |= ((code >> i) & 1) << (len - 1 - i);
+        for (unsigned int i = rev; i < (1 << INFLATE_FAST_BITS); i += 1U << len) {
+            h->fast[i] = sym | (len << 9);
+        }
+    }
+    return 1;
+}
+
+static int inflate_decode(inflate_t *s, const inflate_huff_t *h)
+{
+    inflate_need(s, INFLATE_FAST_BITS);
+
+    unsigned int e = h->fast[s->bitBuf & ((1 << INFLATE_FAST_BITS) - 1)];
+    if (e) {
+        unsigned int len = e >> 9;
+        if (len > s->bitCount) {
+            s->state = INFLATE_ERROR;
+            return -1;
+        }
+        s->bitBuf >>= len;
+        s->bitCount -= len;
+        return e & 0x1FF;
+    }
+
+    // long code, one bit at a time through the canonical ranges
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; len++) {
+        code |= inflate_bits(s, 1);
+        int count = h->count[len];
+        if (code - count < first) return h->symbol[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    s->state = INFLATE_ERROR;
+    return -1;
+}
+
+static void inflate_fixed(inflate_t *s)
+{
+    unsigned char lengths[288];
+    int i = 0;
+
+    while (i < 144) lengths[i++] = 8;
+    while (i < 256) lengths[i++] = 9;
+    while (i < 280) lengths[i++] = 7;
+    while (i < 288) lengths[i++] = 8;
+    inflate_build(&s->lit, lengths, 288);
+
+    for (i = 0; i < 30; i++) lengths[i] = 5;
+    inflate_build(&s->dist, lengths, 30);
+}
+
+static int inflate_dynamic(inflate_t *s)
+{
+    unsigned char lengths[288 + 32];
+    int nlit = inflate_bits(s, 5) + 257;
+    int ndist = inflate_bits(s, 5) + 1;
+    int nclen = inflate_bits(s, 4) + 4;
+
+    if (nlit > 286 || ndist > 30) return 0;
+
+    for (int i = 0; i < 19; i++) lengths[inflate_clenOrder[i]] = i < nclen ? inflate_bits(s, 3) : 0;
+    if (!inflate_build(&s->lit, lengths, 19)) return 0;
+
+    // literal/length and distance lengths form one run-length coded list
+    for (int i = 0; i < nlit + ndist;) {
+        int sym = inflate_decode(s, &s->lit), repeat, value = 0;
+
+        if (sym < 0) return 0;
+        if (sym < 16) {
+            lengths[i++] = sym;
+            continue;
+        }
+        if (sym == 16) {
+            if (!i) return 0;
+            value = lengths[i - 1];
+            repeat = 3 + inflate_bits(s, 2);
+        } else if (sym == 17) {
+            repeat = 3 + inflate_bits(s, 3);
+        } else {
+            repeat = 11 + inflate_bits(s, 7);
+        }
+        if (i + repeat > nlit + ndist) return 0;
+        while (repeat--) lengths[i++] = value;
+    }
+    if (s->state == INFLATE_ERROR || !lengths[256]) return 0;
+
+    return inflate_build(&s->lit, lengths, nlit) && inflate_build(&s->dist, lengths + nlit, ndist);
+}
+
+static void inflate_header(inflate_t *s)
+{
+    if (s->final) {
+        s->state = INFLATE_DONE;
+        return;
+    }
+
+    s->final = inflate_bits(s, 1);
+    int type = inflate_bits(s, 2);
+    if (s->state == INFLATE_ERROR) return;
+
+    if (type == 0) {
+        // byte aligned LEN and its complement
+        inflate_bits(s, s->bitCount & 7);
+        unsigned int len = inflate_bits(s, 16), nlen = inflate_bits(s, 16);
+        if (s->state == INFLATE_ERROR || len != (~nlen & 0xFFFF)) {
+            s->state = INFLATE_ERROR;
+            return;
+        }
+        s->stored = len;
+        s->state = INFLATE_STORED;
+    } else if (type == 1) {
+        inflate_fixed(s);
+        s->state = INFLATE_HUFFMAN;
+    } else if (type == 2 && inflate_dynamic(s)) {
+        s->state = INFLATE_HUFFMAN;
+    } else {
+        s->state = INFLATE_ERROR;
+    }
+}
+
+// One literal or match; returns the literal, or -1 with copyLength set
+static int inflate_symbol(inflate_t *s)
+{
+    int sym = inflate_decode(s, &s->lit);
+
+    if (sym < 256) return sym;  // also -1 on error
+    if (sym == 256) {
+        s->state = INFLATE_BLOCK;
+        return -1;
+    }
+
+    sym -= 257;
+    if (sym >= 29) {
+        s->state = INFLATE_ERROR;
+        return -1;
+    }
+    unsigned int length = inflate_lengthBase[sym] + inflate_bits(s, inflate_lengthExtra[sym]);
+
+    int d = inflate_decode(s, &s->dist);
+    if (d < 0 || d >= 30) {
+        s->state = INFLATE_ERROR;
+        return -1;
+    }
+    unsigned int distance = inflate_distBase[d] + inflate_bits(s, inflate_distExtra[d]);
+
+    if (distance > s->total || s->state == INFLATE_ERROR) {
+        s->state = INFLATE_ERROR;
+        return -1;
+    }
+    s->copyLength = length;
+    s->copyDistance = distance;
+    return -1;
+}
+
+long inflate_read(inflate_t *s, void *out, unsigned long length)
+{
+    unsigned char *dst = out, *window = s->window;
+    unsigned long n = 0;
+    unsigned int pos = s->windowPos;
+
+    while (n < length) {
+        if (s->copyLength) {
+            unsigned int from = pos - s->copyDistance;
+            while (s->copyLength && n < length) {
+                unsigned char b = window[from++ & INFLATE_MASK];
+                window[pos++ & INFLATE_MASK] = b;
+                dst[n++] = b;
+                s->copyLength--;
+                s->total++;
+            }
+            continue;
+        }
+
+        if (s->state == INFLATE_HUFFMAN) {
+            int c = inflate_symbol(s);
+            if (c >= 0) {
+                window[pos++ & INFLATE_MASK] = c;
+                dst[n++] = c;
+                s->total++;
+            }
+        } else if (s->state == INFLATE_STORED) {
+            if (!s->stored) {
+                s->state = INFLATE_BLOCK;
+                continue;
+            }
+            int c = inflate_bits(s, 8);
+            if (s->state == INFLATE_ERROR) break;
+            window[pos++ & INFLATE_MASK] = c;
+            dst[n++] = c;
+            s->stored--;
+            s->total++;
+        } else if (s->state == INFLATE_BLOCK) {
+            inflate_header(s);
+        } else if (s->state == INFLATE_ZLIB) {
+            unsigned int cmf = inflate_bits(s, 8), flg = inflate_bits(s, 8);
+            // deflate, window no larger than ours, no preset dictionary
+            if ((cmf & 0x0F) != 8 || (cmf >> 4) > 7 || (flg & 0x20) || ((cmf << 8) | flg) % 31) {
+                s->state = INFLATE_ERROR;
+            } else if (s->state != INFLATE_ERROR) {
+                s->state = INFLATE_BLOCK;
+            }
+        } else {
+            break;
+        }
+    }
+
+    s->windowPos = pos & INFLATE_MASK;
+    if (s->state == INFLATE_ERROR) return -1;
+    return n;
+}
+
+void inflate_init(inflate_t *s, const unsigned char *(*fill)(void *arg, unsigned long *length),
+                  void *arg, int zlib)
+{
+    s->fill = fill;
+    s->arg = arg;
+    s->in = s->inEnd = 0;
+    s->bitBuf = 0;
+    s->bitCount = 0;
+    s->state = zlib ? INFLATE_ZLIB : INFLATE_BLOCK;
+    s->final = 0;
+    s->stored = 0;
+    s->copyLength = 0;
+    s->copyDistance = 0;
+    s->total = 0;
+    s->windowPos = 0;
+}
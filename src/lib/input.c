@@ -0,0 +1,124 @@
+// Input event queue (see input.h)
+// src/lib/input.c
+
+#include "../include/input.h"
+#include "../include/timer.h"
+
+// open: 0 closed, 1 motion that may still grow, 2 producer adding to it
+typedef struct {
+    input_event_t ev;
+    volatile int open;
+} input_slot_t;
+
+static input_slot_t input_queue[INPUT_QUEUE_SIZE];
+static volatile unsigned int input_head = 0;    // written by the producer only
+static volatile unsigned int input_tail = 0;    // written by the consumer only
+static int input_lastMotion = -1;               // producer's open motion slot
+static volatile unsigned long input_lost = 0;
+static volatile int input_keyboards = 0, input_mice = 0;
+
+static int input_publish(const input_event_t *ev, int open)
+{
+    unsigned int head = input_head;
+
+    if (head - __atomic_load_n(&input_tail, __ATOMIC_ACQUIRE) >= INPUT_QUEUE_SIZE) {
+        input_lost++;
+        input_lastMotion = -1;
+        return 0;
+    }
+
+    input_slot_t *s = &input_queue[head & (INPUT_QUEUE_SIZE - 1)];
+    s->ev = *ev;
+    s->open = open;
+    input_lastMotion = open ? (int)(head & (INPUT_QUEUE_SIZE - 1)) : -1;
+    __atomic_store_n(&input_head, head + 1, __ATOMIC_RELEASE);
+
+    timer_wake();
+    return 1;
+}
+
+int input_push(const input_event_t *ev)
+{
+    return input_publish(ev, 0);
+}
+
+int input_pushMotion(unsigned long time, int dx, int dy)
+{
+    if (!dx && !dy) return 1;
+
+    if (input_lastMotion >= 0) {
+        input_slot_t *s = &input_queue[input_lastMotion];
+        int expected = 1;
+
+        if (__atomic_compare_exchange_n(&s->open, &expected, 2, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            int x = s->ev.dx + dx, y = s->ev.dy + dy;
+
+            if (x >= -32768 && x <= 32767 && y >= -32768 && y <= 32767) {
+                s->ev.dx = x;
+                s->ev.dy = y;
+                __atomic_store_n(&s->open, 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+            __atomic_store_n(&s->open, 0, __ATOMIC_RELEASE); // full, start a new one
+        }
+        // the consumer took it already
+    }
+
+    input_event_t ev = { 0 };
+    ev.time = time;
+    ev.type = INPUT_MOTION;
+    ev.dx = dx;
+    ev.dy = dy;
+    return input_publish(&ev, 1);
+}
+
+int input_read(input_event_t *events, int max)
+{
+    unsigned int tail = input_tail;
+    unsigned int head = __atomic_load_n(&input_head, __ATOMIC_ACQUIRE);
+    int n = 0;
+
+    while (tail != head && n < max) {
+        input_slot_t *s = &input_queue[tail & (INPUT_QUEUE_SIZE - 1)];
+
+        // close an open motion slot; if the producer is adding to it, that's a few instructions
+        for (;;) {
+            int expected = 1;
+            if (__atomic_compare_exchange_n(&s->open, &expected, 0, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) break;
+            if (expected == 0) break;
+        }
+
+        events[n++] = s->ev;
+        tail++;
+    }
+
+    // one release for the whole batch
+    __atomic_store_n(&input_tail, tail, __ATOMIC_RELEASE);
+    return n;
+}
+
+int input_pending(void)
+{
+    return __atomic_load_n(&input_head, __ATOMIC_ACQUIRE) - input_tail;
+}
+
+unsigned long input_dropped(void)
+{
+    return input_lost;
+}
+
+void input_addDevices(int keyboards, int mice)
+{
+    __atomic_add_fetch(&input_keyboards, keyboards, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&input_mice, mice, __ATOMIC_RELAXED);
+}
+
+int input_keyboardCount(void)
+{
+    return input_keyboards;
+}
+
+int input_mouseCount(void)
+{
+    return input_mice;
+}
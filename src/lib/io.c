@@ -1,4 +1,6 @@
 #include "../include/io.h"
+#include "../include/irq.h"
+#include "../include/log.h"
 
 // GPIO
 
@@ -89,7 +91,17 @@ enum {
     AUX_MU_STAT_REG = AUX_BASE + 100,
     AUX_MU_BAUD_REG = AUX_BASE + 104,
     AUX_UART_CLOCK  = 500000000,
-    UART_MAX_QUEUE  = 16 * 1024
+    UART_MAX_QUEUE  = 16 * 1024,
+    UART_MAX_INPUT  = 256
+};
+
+enum {
+    AUX_MU_IER_RX   = 1 << 0,
+    AUX_MU_IER_TX   = 1 << 1,
+    AUX_MU_IER_ON   = 3 << 2,   // BCM2835 errata: bits 2-3 set whenever RX/TX are
+    AUX_MU_IIR_NONE = 1 << 0,   // no interrupt pending
+    AUX_MU_IIR_TX   = 1 << 1,   // transmit holding register empty
+    AUX_MU_IIR_RX   = 2 << 1    // receiver holds a byte
 };
 
 #define AUX_MU_BAUD(baud) ((AUX_UART_CLOCK/(baud*8))-1)
@@ -98,6 +110,12 @@ unsigned char uart_output_queue[UART_MAX_QUEUE];
 unsigned int uart_output_queue_write = 0;
 unsigned int uart_output_queue_read = 0;
 
+// Interrupt mode: the AUX IRQ drains the output queue and fills the input ring
+unsigned char uart_input_queue[UART_MAX_INPUT];
+volatile unsigned int uart_input_queue_write = 0;
+volatile unsigned int uart_input_queue_read = 0;
+static volatile int uart_irqMode = 0;
+
 void uart_init() {
     mmio_write(AUX_ENABLES, 1);    //enable UART1
     mmio_write(AUX_MU_IER_REG, 0);
@@ -116,10 +134,24 @@ unsigned int uart_isOutputQueueEmpty() {
     return uart_output_queue_read == uart_output_queue_write;
 }
 
-unsigned int uart_isReadByteReady()  { return mmio_read(AUX_MU_LSR_REG) & 0x01; }
+unsigned int uart_outputQueueFree() {
+    return (uart_output_queue_read - uart_output_queue_write - 1) & (UART_MAX_QUEUE - 1);
+}
+
+unsigned int uart_isReadByteReady() {
+    if (uart_irqMode) return uart_input_queue_read != uart_input_queue_write;
+    return mmio_read(AUX_MU_LSR_REG) & 0x01;
+}
 unsigned int uart_isWriteByteReady() { return mmio_read(AUX_MU_LSR_REG) & 0x20; }
 
 unsigned char uart_readByte() {
+    if (uart_irqMode) {
+        while (uart_input_queue_read == uart_input_queue_write) asm volatile("wfi");
+        unsigned char ch = uart_input_queue[uart_input_queue_read];
+        uart_input_queue_read = (uart_input_queue_read + 1) & (UART_MAX_INPUT - 1);
+        return ch;
+    }
+
     while (!uart_isReadByteReady());
     return (unsigned char)mmio_read(AUX_MU_IO_REG);
 }
@@ -136,13 +168,36 @@ void uart_loadOutputFifo() {
     }
 }
 
-void uart_writeByteBlocking(unsigned char ch) {
-    unsigned int next = (uart_output_queue_write + 1) & (UART_MAX_QUEUE - 1); // Don't overrun
+// Makes sure the TX interrupt runs; it drains the queue and the log ring
+void uart_startOutput() {
+    if (uart_irqMode) {
+        unsigned long flags = irq_save();
+        mmio_write(AUX_MU_IER_REG, AUX_MU_IER_ON | AUX_MU_IER_RX | AUX_MU_IER_TX);
+        irq_restore(flags);
+    }
+}
 
-    while (next == uart_output_queue_read) uart_loadOutputFifo();
+void uart_writeByteBlocking(unsigned char ch) {
+    for (;;) {
+        // IRQs off while claiming the slot, the TX interrupt writes log lines too
+        unsigned long flags = irq_save();
+        unsigned int next = (uart_output_queue_write + 1) & (UART_MAX_QUEUE - 1); // Don't overrun
+
+        if (next != *(volatile unsigned int *)&uart_output_queue_read) {
+            uart_output_queue[uart_output_queue_write] = ch;
+            asm volatile("dmb ish" ::: "memory");
+            uart_output_queue_write = next;
+            irq_restore(flags);
+            break;
+        }
+        irq_restore(flags);
+
+        // the TX interrupt owns the read side while it is enabled
+        if (uart_irqMode && irq_enabled()) asm volatile("wfi");
+        else uart_loadOutputFifo();
+    }
 
-    uart_output_queue[uart_output_queue_write] = ch;
-    uart_output_queue_write = next;
+    uart_startOutput();
 }
 
 void uart_writeText(char *buffer) {
@@ -153,10 +208,55 @@ void uart_writeText(char *buffer) {
 }
 
 void uart_drainOutputQueue() {
-    while (!uart_isOutputQueueEmpty()) uart_loadOutputFifo();
+    for (;;) {
+        log_flush();
+        if (uart_isOutputQueueEmpty()) break;
+        while (!uart_isOutputQueueEmpty()) uart_loadOutputFifo();
+    }
+}
+
+static void uart_irqHandler(void *arg) {
+    (void)arg;
+
+    while (!(mmio_read(AUX_MU_IIR_REG) & AUX_MU_IIR_NONE)) {
+        unsigned int iir = mmio_read(AUX_MU_IIR_REG) & 6;
+
+        if (iir == AUX_MU_IIR_RX) {
+            unsigned char ch = (unsigned char)mmio_read(AUX_MU_IO_REG);
+            unsigned int next = (uart_input_queue_write + 1) & (UART_MAX_INPUT - 1);
+            if (next != uart_input_queue_read) { // drop input nobody reads
+                uart_input_queue[uart_input_queue_write] = ch;
+                uart_input_queue_write = next;
+            }
+        } else if (iir == AUX_MU_IIR_TX) {
+            uart_loadOutputFifo();
+            if (uart_isOutputQueueEmpty()) log_flush(); // format more log records only when there's room
+            if (uart_isOutputQueueEmpty()) mmio_write(AUX_MU_IER_REG, AUX_MU_IER_ON | AUX_MU_IER_RX);
+        } else {
+            break;
+        }
+    }
+}
+
+// Hands the output queue and RX over to the AUX interrupt; irq_init must have run
+void uart_enableInterrupts() {
+    irq_register(IRQ_AUX, uart_irqHandler, 0);
+    uart_irqMode = 1;
+    mmio_write(AUX_MU_IER_REG, AUX_MU_IER_ON | AUX_MU_IER_RX | AUX_MU_IER_TX); // TX once, for anything logged so far
 }
 
 void uart_update() {
+    log_flush();
+
+    if (uart_irqMode) {
+        // output drains in the background, only echo input here
+        if (uart_isReadByteReady()) {
+            unsigned char ch = uart_readByte();
+            if (ch == '\r') uart_writeText("\n"); else uart_writeByteBlocking(ch);
+        }
+        return;
+    }
+
     uart_loadOutputFifo();
 
     if (uart_isReadByteReady()) {
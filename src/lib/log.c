@@ -0,0 +1,236 @@
+// Structured kernel log
+// src/lib/log.c
+//
+// The ring is the same bounded MPMC scheme as the SMP work queue (sequence
+// number per slot), used here with any number of producers on any core or
+// in IRQ handlers and a single drainer at a time. Slots store their sequence
+// number minus their index, so the zeroed ring is ready without an init call
+// and the first record can come from anywhere.
+
+#include "../include/io.h"
+#include "../include/timer.h"
+#include "../include/log.h"
+
+typedef struct {
+    unsigned int seq;
+    unsigned char level;
+    unsigned char nargs;
+    unsigned long time;             // us since boot
+    const char *fmt;                // doubles as the message id
+    unsigned long args[LOG_MAX_ARGS];
+} log_slot_t;
+
+static log_slot_t log_ring[LOG_RING_SIZE];
+static unsigned int log_head = 0;   // next slot to fill
+static unsigned int log_tail = 0;   // next slot to print, drainer only
+static unsigned long log_lost = 0;
+static unsigned long log_reported = 0;
+static volatile int log_draining = 0;
+
+static inline unsigned int log_seq(const log_slot_t *slot)
+{
+    return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) + (unsigned int)(slot - log_ring);
+}
+
+static inline void log_setSeq(log_slot_t *slot, unsigned int seq)
+{
+    __atomic_store_n(&slot->seq, seq - (unsigned int)(slot - log_ring), __ATOMIC_RELEASE);
+}
+
+static log_slot_t *log_claim(unsigned int *claimed)
+{
+    unsigned int pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        log_slot_t *slot = &log_ring[pos & (LOG_RING_SIZE - 1)];
+        int diff = (int)(log_seq(slot) - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&log_head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *claimed = pos;
+                return slot;
+            }
+        } else if (diff < 0) {
+            return 0; // full
+        } else {
+            pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void log_write(int level, const char *fmt, ...)
+{
+    unsigned int pos;
+    log_slot_t *slot = log_claim(&pos);
+    if (!slot) {
+        __atomic_add_fetch(&log_lost, 1, __ATOMIC_RELAXED);
+        uart_startOutput();
+        return;
+    }
+
+    __builtin_va_list ap;
+    int n = 0;
+
+    slot->level = level;
+    slot->time = timer_now_us();
+    slot->fmt = fmt;
+
+    // only collect the arguments, with the types the format says they have
+    __builtin_va_start(ap, fmt);
+    for (const char *p = fmt; *p && n < LOG_MAX_ARGS; p++) {
+        if (*p != '%') continue;
+
+        int isLong = 0;
+        p++;
+        while (*p >= '0' && *p <= '9') p++;
+        while (*p == 'l') { isLong = 1; p++; }
+
+        switch (*p) {
+        case 'd': case 'i':
+            slot->args[n++] = isLong ? (unsigned long)__builtin_va_arg(ap, long)
+                                     : (unsigned long)(long)__builtin_va_arg(ap, int);
+            break;
+        case 'u': case 'x': case 'X': case 'c':
+            slot->args[n++] = isLong ? __builtin_va_arg(ap, unsigned long)
+                                     : __builtin_va_arg(ap, unsigned int);
+            break;
+        case 'p': case 's':
+            slot->args[n++] = (unsigned long)__builtin_va_arg(ap, const void *);
+            break;
+        case '\0':
+            p--;
+            break;
+        default:
+            break; // %% and unknown conversions take no argument
+        }
+    }
+    __builtin_va_end(ap);
+    slot->nargs = n;
+
+    log_setSeq(slot, pos + 1);
+    uart_startOutput(); // the TX interrupt picks it up
+}
+
+unsigned long log_dropped(void)
+{
+    return __atomic_load_n(&log_lost, __ATOMIC_RELAXED);
+}
+
+// Formatting, drain side only
+
+typedef struct {
+    char buf[LOG_LINE_MAX];
+    int len;
+} log_line_t;
+
+static void log_putc(log_line_t *l, char c)
+{
+    if (l->len < LOG_LINE_MAX - 2) l->buf[l->len++] = c; // room for "\n\0"
+}
+
+static void log_puts(log_line_t *l, const char *s)
+{
+    while (*s) log_putc(l, *s++);
+}
+
+static void log_putNum(log_line_t *l, unsigned long v, int neg, unsigned int base, int upper, int width, char pad)
+{
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char tmp[24];
+    int n = 0;
+
+    do {
+        tmp[n++] = digits[v % base];
+        v /= base;
+    } while (v);
+
+    if (neg) width--;
+    if (neg && pad == '0') log_putc(l, '-');
+    for (int i = n; i < width; i++) log_putc(l, pad);
+    if (neg && pad != '0') log_putc(l, '-');
+    while (n) log_putc(l, tmp[--n]);
+}
+
+static void log_format(log_line_t *l, const log_slot_t *r)
+{
+    static const char *tags[] = { "ERROR: ", "WARN: ", "", "" };
+    int arg = 0;
+
+    l->len = 0;
+    log_putc(l, '[');
+    log_putNum(l, r->time / 1000000, 0, 10, 0, 5, ' ');
+    log_putc(l, '.');
+    log_putNum(l, r->time % 1000000, 0, 10, 0, 6, '0');
+    log_puts(l, "] ");
+    log_puts(l, tags[r->level & 3]);
+
+    for (const char *p = r->fmt; *p; p++) {
+        if (*p != '%') {
+            log_putc(l, *p);
+            continue;
+        }
+
+        char pad = ' ';
+        int width = 0, isLong = 0;
+
+        p++;
+        if (*p == '0') { pad = '0'; p++; }
+        while (*p >= '0' && *p <= '9') width = width * 10 + *p++ - '0';
+        while (*p == 'l') { isLong = 1; p++; }
+        if (!*p) break;
+
+        if (*p == '%') {
+            log_putc(l, '%');
+            continue;
+        }
+        unsigned long v = arg < r->nargs ? r->args[arg++] : 0;
+
+        switch (*p) {
+        case 'd': case 'i': {
+            long s = isLong ? (long)v : (long)(int)v;
+            log_putNum(l, s < 0 ? -(unsigned long)s : (unsigned long)s, s < 0, 10, 0, width, pad);
+            break;
+        }
+        case 'u': log_putNum(l, isLong ? v : (unsigned int)v, 0, 10, 0, width, pad); break;
+        case 'x': log_putNum(l, isLong ? v : (unsigned int)v, 0, 16, 0, width, pad); break;
+        case 'X': log_putNum(l, isLong ? v : (unsigned int)v, 0, 16, 1, width, pad); break;
+        case 'p': log_puts(l, "0x"); log_putNum(l, v, 0, 16, 0, 16, '0'); break;
+        case 'c': log_putc(l, (char)v); break;
+        case 's': log_puts(l, v ? (const char *)v : "(null)"); break;
+        default:  log_putc(l, '%'); log_putc(l, *p); break;
+        }
+    }
+
+    l->buf[l->len++] = '\n';
+    l->buf[l->len] = '\0';
+}
+
+void log_flush(void)
+{
+    log_line_t line;
+
+    if (__atomic_exchange_n(&log_draining, 1, __ATOMIC_ACQUIRE)) return; // someone else is at it
+
+    // worst case every byte is a '\n' that goes out as "\r\n"
+    while (uart_outputQueueFree() >= 2 * LOG_LINE_MAX) {
+        unsigned long lost = log_dropped();
+
+        if (lost != log_reported) {
+            log_slot_t note = { 0, LOG_LEVEL_WARN, 1, timer_now_us(), "log: %lu records dropped", { lost - log_reported } };
+
+            log_reported = lost;
+            log_format(&line, &note);
+        } else {
+            log_slot_t *slot = &log_ring[log_tail & (LOG_RING_SIZE - 1)];
+
+            if (log_seq(slot) != log_tail + 1) break; // empty
+
+            log_format(&line, slot);
+            log_setSeq(slot, log_tail + LOG_RING_SIZE);
+            log_tail++;
+        }
+        uart_writeText(line.buf);
+    }
+
+    __atomic_store_n(&log_draining, 0, __ATOMIC_RELEASE);
+}
@@ -1,7 +1,11 @@
 #include "../include/io.h"
+#include "../include/mmu.h"
+#include "../include/irq.h"
+#include "../include/mb.h"
 
-// The buffer must be 16-byte aligned as only the upper 28 bits of the address can be passed via the mailbox
-volatile unsigned int __attribute__((aligned(16))) mbox[36];
+// The buffer must be 16-byte aligned as only the upper 28 bits of the address can be passed via the mailbox.
+// It is also whole cache lines (64 bytes aligned, 48 words), since the reply is invalidated into the cache.
+volatile unsigned int __attribute__((aligned(64))) mbox[MBOX_WORDS];
 
 enum {
     VIDEOCORE_MBOX = (PERIPHERAL_BASE + 0x0000B880),
@@ -13,25 +17,161 @@ enum {
     MBOX_WRITE     = (VIDEOCORE_MBOX + 0x20),
     MBOX_RESPONSE  = 0x80000000,
     MBOX_FULL      = 0x80000000,
-    MBOX_EMPTY     = 0x40000000
+    MBOX_EMPTY     = 0x40000000,
+    MBOX_CONFIG_IRQ = 1           // interrupt when data is available
 };
 
+// Requests in flight, oldest first by seq. The VideoCore answers in order,
+// but the reply word is matched against the buffer address anyway.
+static struct {
+    volatile unsigned int *buf;
+    unsigned int size;            // bytes, for cache maintenance
+    unsigned int word;            // address | channel as written to MBOX_WRITE
+    volatile int *state;
+    unsigned int seq;
+    int sent;
+    int used;
+} mbox_inflight[MBOX_MAX_INFLIGHT];
+
+static unsigned int mbox_seq = 0;
+
+// Writes queued requests to the mailbox while it has room
+static void mbox_pump(void)
+{
+    for (;;) {
+        int next = -1;
+
+        for (int i = 0; i < MBOX_MAX_INFLIGHT; i++) {
+            if (!mbox_inflight[i].used || mbox_inflight[i].sent) continue;
+            if (next < 0 || (int)(mbox_inflight[i].seq - mbox_inflight[next].seq) < 0) next = i;
+        }
+        if (next < 0 || (mmio_read(MBOX_STATUS) & MBOX_FULL)) return;
+
+        mmio_write(MBOX_WRITE, mbox_inflight[next].word);
+        mbox_inflight[next].sent = 1;
+    }
+}
+
+static int mbox_enqueue(volatile unsigned int *buf, unsigned int size, unsigned char ch, volatile int *state)
+{
+    unsigned long flags = irq_save();
+    int slot = -1;
+
+    for (int i = 0; i < MBOX_MAX_INFLIGHT; i++) {
+        if (!mbox_inflight[i].used) { slot = i; break; }
+    }
+    if (slot < 0) {
+        irq_restore(flags);
+        return 0;
+    }
+
+    // The VideoCore reads the buffer from memory, not from our cache
+    dcache_clean(buf, size);
+
+    *state = MBOX_MSG_QUEUED;
+    mbox_inflight[slot].buf = buf;
+    mbox_inflight[slot].size = size;
+    mbox_inflight[slot].word = ((unsigned int)((long)buf) &~ 0xF) | (ch & 0xF); // 28-bit address (MSB) and 4-bit value (LSB)
+    mbox_inflight[slot].state = state;
+    mbox_inflight[slot].seq = mbox_seq++;
+    mbox_inflight[slot].sent = 0;
+    mbox_inflight[slot].used = 1;
+
+    mbox_pump();
+    irq_restore(flags);
+    return 1;
+}
+
+// Collects every reply that is waiting, returns how many requests completed
+int mbox_poll(void)
+{
+    unsigned long flags = irq_save();
+    int completed = 0;
+
+    while (!(mmio_read(MBOX_STATUS) & MBOX_EMPTY)) {
+        unsigned int word = mmio_read(MBOX_READ);
+
+        for (int i = 0; i < MBOX_MAX_INFLIGHT; i++) {
+            if (!mbox_inflight[i].used || !mbox_inflight[i].sent || mbox_inflight[i].word != word) continue;
+
+            dcache_invalidate(mbox_inflight[i].buf, mbox_inflight[i].size); // drop stale lines before reading the reply
+            *mbox_inflight[i].state = mbox_inflight[i].buf[1] == MBOX_RESPONSE ? MBOX_MSG_DONE : MBOX_MSG_ERROR;
+            mbox_inflight[i].used = 0;
+            completed++;
+            break;
+        }
+    }
+
+    mbox_pump();
+    irq_restore(flags);
+    return completed;
+}
+
+static void mbox_irqHandler(void *arg)
+{
+    (void)arg;
+    mbox_poll();
+}
+
+// Completes requests from the mailbox interrupt instead of waiting for mbox_poll
+void mbox_enableInterrupts(void)
+{
+    irq_register(IRQ_MAILBOX, mbox_irqHandler, 0);
+    mmio_write(MBOX_CONFIG, MBOX_CONFIG_IRQ);
+}
+
 unsigned int mbox_call(unsigned char ch)
 {
-    // 28-bit address (MSB) and 4-bit value (LSB)
-    unsigned int r = ((unsigned int)((long) &mbox) &~ 0xF) | (ch & 0xF);
+    volatile int state = MBOX_MSG_IDLE;
+
+    while (!mbox_enqueue(mbox, sizeof(mbox), ch, &state)) mbox_poll();
+    while (state == MBOX_MSG_QUEUED) mbox_poll();
 
-    // Wait until we can write
-    while (mmio_read(MBOX_STATUS) & MBOX_FULL);
+    return state == MBOX_MSG_DONE; // Is it successful?
+}
 
-    // Write the address of our buffer to the mailbox with the channel appended
-    mmio_write(MBOX_WRITE, r);
+// Property message builder
 
-    while (1) {
-        while (mmio_read(MBOX_STATUS) & MBOX_EMPTY);
+void mbox_msg_init(mbox_msg_t *msg)
+{
+    msg->buf[0] = 0;
+    msg->buf[1] = MBOX_REQUEST;
+    msg->words = 2;
+    msg->state = MBOX_MSG_IDLE;
+}
 
-        if (r == mmio_read(MBOX_READ)) return mbox[1]==MBOX_RESPONSE; // Is it successful?
+int mbox_msg_addTag(mbox_msg_t *msg, unsigned int tag, const unsigned int *values,
+                    unsigned int valueWords, unsigned int bufferWords)
+{
+    if (bufferWords < valueWords) bufferWords = valueWords;
+
+    // tag, size, code, values, and room for MBOX_TAG_LAST
+    if (msg->words + 3 + bufferWords + 1 > MBOX_MSG_WORDS) return -1;
+
+    msg->buf[msg->words++] = tag;
+    msg->buf[msg->words++] = bufferWords * 4;
+    msg->buf[msg->words++] = 0;
+
+    int index = msg->words;
+    for (unsigned int i = 0; i < bufferWords; i++) {
+        msg->buf[msg->words++] = i < valueWords && values ? values[i] : 0;
     }
+    return index;
+}
 
-    return 0;
+int mbox_submit(mbox_msg_t *msg, unsigned char ch)
+{
+    if (msg->state == MBOX_MSG_QUEUED) return 0;
+
+    msg->buf[msg->words] = MBOX_TAG_LAST;
+    msg->buf[0] = (msg->words + 1) * 4;
+
+    // the whole buffer, so cache maintenance never touches a partial line
+    return mbox_enqueue(msg->buf, sizeof(msg->buf), ch, &msg->state);
+}
+
+int mbox_wait(mbox_msg_t *msg)
+{
+    while (msg->state == MBOX_MSG_QUEUED) mbox_poll();
+    return msg->state == MBOX_MSG_DONE;
 }
@@ -1,226 +1,413 @@
-// Real hardware PCIe implementation with safe access patterns
+// BCM2711 PCIe root complex and bus enumeration
 // src/lib/pcie.c
+//
+// The root port's own registers sit at PCIE_RC_BASE; config space of every
+// device below it is reached through one 4 KB data window selected by
+// EXT_CFG_INDEX (bus/device/function). Memory BARs are assigned from the
+// 64 MB outbound window, which the CPU sees at PCIE_WINDOW_CPU. pcie_init
+// does the whole walk once and keeps the result in pcie_devices, so lookups
+// afterwards are plain table searches.
 
 #include "../include/io.h"
+#include "../include/mb.h"
+#include "../include/smp.h"
+#include "../include/timer.h"
+#include "../include/log.h"
 #include "../include/pcie.h"
 
-// Raspberry Pi 4 PCIe controller base addresses
-#define PCIE_ROOT_PORT_BASE     0xFD500000
-#define PCIE_CONFIG_BASE        0x600000000ULL
+#define PCIE_RC_BASE      0xFD500000UL
+
+// Outbound window: CPU 0x6_0000_0000 -> PCIe 0xF800_0000 (mapped as device by mmu.c)
+#define PCIE_WINDOW_CPU   0x600000000UL
+#define PCIE_WINDOW_BUS   0xF8000000UL
+#define PCIE_WINDOW_SIZE  0x04000000UL
+
+#define PCIE_LINK_TIMEOUT_US 100000
+
+enum {
+    PCIE_RC_CFG_VENDOR_SPECIFIC_REG1 = PCIE_RC_BASE + 0x0188,
+    PCIE_RC_CFG_PRIV1_ID_VAL3        = PCIE_RC_BASE + 0x043C,
+    PCIE_MISC_MISC_CTRL              = PCIE_RC_BASE + 0x4008,
+    PCIE_MISC_CPU_2_PCIE_MEM_WIN0_LO = PCIE_RC_BASE + 0x400C,
+    PCIE_MISC_CPU_2_PCIE_MEM_WIN0_HI = PCIE_RC_BASE + 0x4010,
+    PCIE_MISC_RC_BAR1_CONFIG_LO      = PCIE_RC_BASE + 0x402C,
+    PCIE_MISC_RC_BAR2_CONFIG_LO      = PCIE_RC_BASE + 0x4034,
+    PCIE_MISC_RC_BAR2_CONFIG_HI      = PCIE_RC_BASE + 0x4038,
+    PCIE_MISC_RC_BAR3_CONFIG_LO      = PCIE_RC_BASE + 0x403C,
+    PCIE_MISC_RC_BAR3_CONFIG_HI      = PCIE_RC_BASE + 0x4040,
+    PCIE_MISC_PCIE_STATUS            = PCIE_RC_BASE + 0x4068,
+    PCIE_MISC_REVISION               = PCIE_RC_BASE + 0x406C,
+    PCIE_MISC_WIN0_BASE_LIMIT        = PCIE_RC_BASE + 0x4070,
+    PCIE_MISC_WIN0_BASE_HI           = PCIE_RC_BASE + 0x4080,
+    PCIE_MISC_WIN0_LIMIT_HI          = PCIE_RC_BASE + 0x4084,
+    PCIE_MISC_HARD_PCIE_HARD_DEBUG   = PCIE_RC_BASE + 0x4204,
+    PCIE_INTR2_CPU_CLR               = PCIE_RC_BASE + 0x4308,
+    PCIE_INTR2_CPU_MASK_SET          = PCIE_RC_BASE + 0x4310,
+    PCIE_EXT_CFG_DATA                = PCIE_RC_BASE + 0x8000,
+    PCIE_EXT_CFG_INDEX               = PCIE_RC_BASE + 0x9000,
+    PCIE_RGR1_SW_INIT_1              = PCIE_RC_BASE + 0x9210
+};
+
+enum {
+    MISC_CTRL_SCB_ACCESS_EN   = 1 << 12,
+    MISC_CTRL_CFG_READ_UR     = 1 << 13,  // unsupported requests read as all ones
+    MISC_CTRL_BURST_MASK      = 3 << 20,  // 0 = 128 bytes
+    MISC_CTRL_SCB0_SIZE_SHIFT = 27,
+
+    STATUS_PHYLINKUP          = 1 << 4,
+    STATUS_DL_ACTIVE          = 1 << 5,
+    STATUS_RC_MODE            = 1 << 7,
+
+    HARD_DEBUG_CLKREQ_EN      = 1 << 1,
+    HARD_DEBUG_SERDES_IDDQ    = 1 << 27,
+
+    SW_INIT_PERST             = 1 << 0,
+    SW_INIT_BRIDGE            = 1 << 1,
+
+    VENDOR_REG1_ENDIAN_MASK   = 3 << 2    // 0 = little endian
+};
+
+// Standard config header offsets
+enum {
+    CFG_ID          = 0x00,
+    CFG_CLASS       = 0x08,
+    CFG_HEADER      = 0x0C,               // header type in bits 23:16
+    CFG_BAR0        = 0x10,
+    CFG_BUS_NUMBERS = 0x18,               // bridges: primary, secondary, subordinate
+    CFG_IO_WINDOW   = 0x1C,
+    CFG_MEM_WINDOW  = 0x20,
+    CFG_PREF_WINDOW = 0x24,
+    CFG_PREF_BASE_HI  = 0x28,
+    CFG_PREF_LIMIT_HI = 0x2C,
+    CFG_CAP_PTR     = 0x34,
+
+    CAP_ID_PCIE     = 0x10,
+    PCIE_PORT_ROOT       = 4,
+    PCIE_PORT_DOWNSTREAM = 6
+};
 
-// Important: On RPi4, we need to access PCIe through the root port
-#define PCIE_BRIDGE_CONFIG_BASE 0xFD500000
-
-// PCIe device information
 static pcie_device_t pcie_devices[MAX_PCIE_DEVICES];
 static int pcie_device_count = 0;
 static int pcie_initialized = 0;
 
-extern void uart_writeText(char *buffer);
+static unsigned int pcie_nextBus;
+static unsigned long pcie_nextMem;                // next free bus address in the window
+static volatile int pcie_cfgLock = 0;             // index and data are two accesses
 
-// Safe memory access with exception handling
-static int safe_mmio_test(unsigned long addr) {
-    // Try to read and see if we get a valid response
-    volatile unsigned int *ptr = (volatile unsigned int*)addr;
+// Config access
 
-    // Simple test: try to read the address
-    // If this causes a bus error, we'll handle it
-    unsigned int test_val = *ptr;
+static int pcie_cfgValid(unsigned int bus, unsigned int device, unsigned int function)
+{
+    // the root bus only has the root port; there is no bus 0 device 1
+    if (bus == 0) return device == 0 && function == 0;
+    return bus <= 255 && device <= 31 && function <= 7;
+}
 
-    // Basic sanity check - if we get all 1s, it might be unmapped
-    if (test_val == 0xFFFFFFFF) {
-        return 0;
-    }
+static unsigned long pcie_cfgSelect(unsigned int bus, unsigned int device, unsigned int function, unsigned int offset)
+{
+    if (bus == 0) return PCIE_RC_BASE + (offset & 0xFFC);
 
-    return 1;
+    mmio_write(PCIE_EXT_CFG_INDEX, (bus << 20) | (device << 15) | (function << 12));
+    return PCIE_EXT_CFG_DATA + (offset & 0xFFC);
 }
 
-static unsigned int safe_config_read32(unsigned int bus, unsigned int device, unsigned int function, unsigned int offset) {
-    // For RPi4, PCIe config space access goes through the bridge
-    // The bridge itself is at bus 0, device 0
+static unsigned int pcie_cfgRead(unsigned int bus, unsigned int device, unsigned int function, unsigned int offset)
+{
+    if (!pcie_cfgValid(bus, device, function)) return 0xFFFFFFFF;
 
-    if (bus > 1 || device > 31 || function > 7 || offset > 0xFF) {
-        return 0xFFFFFFFF;
-    }
+    unsigned long flags = smp_lock(&pcie_cfgLock);
+    unsigned int value = mmio_read(pcie_cfgSelect(bus, device, function, offset));
+    smp_unlock(&pcie_cfgLock, flags);
+    return value;
+}
 
-    // Calculate config space address
-    // Type 0 configuration for bus 0, Type 1 for other buses
-    unsigned long config_addr;
+static void pcie_cfgWrite(unsigned int bus, unsigned int device, unsigned int function, unsigned int offset, unsigned int value)
+{
+    if (!pcie_cfgValid(bus, device, function)) return;
 
-    if (bus == 0) {
-        // Type 0 configuration
-        if (device == 0) {
-            // This is the bridge itself
-            config_addr = PCIE_BRIDGE_CONFIG_BASE + offset;
-        } else {
-            // Direct attached device
-            config_addr = PCIE_BRIDGE_CONFIG_BASE + 0x8000 + (device << 11) + (function << 8) + offset;
-        }
-    } else {
-        // Type 1 configuration - through the bridge
-        return 0xFFFFFFFF; // Not implemented yet
-    }
+    unsigned long flags = smp_lock(&pcie_cfgLock);
+    mmio_write(pcie_cfgSelect(bus, device, function, offset), value);
+    smp_unlock(&pcie_cfgLock, flags);
+}
 
-    // Test if the address is accessible
-    if (!safe_mmio_test(config_addr)) {
-        return 0xFFFFFFFF;
-    }
+// Root complex bring-up
 
-    return mmio_read(config_addr);
-}
+static int pcie_resetLink(void)
+{
+    unsigned int rev = mmio_read(PCIE_MISC_REVISION);
 
-static void safe_config_write32(unsigned int bus, unsigned int device, unsigned int function, unsigned int offset, unsigned int value) {
-    if (bus > 1 || device > 31 || function > 7 || offset > 0xFF) {
-        return;
+    if (rev == 0 || rev == 0xFFFFFFFF) {
+        LOG_WARN("PCIe: No root complex");
+        return 0;
     }
 
-    unsigned long config_addr;
-
-    if (bus == 0) {
-        if (device == 0) {
-            config_addr = PCIE_BRIDGE_CONFIG_BASE + offset;
-        } else {
-            config_addr = PCIE_BRIDGE_CONFIG_BASE + 0x8000 + (device << 11) + (function << 8) + offset;
+    // assert the bridge and endpoint resets, then take the bridge out
+    mmio_write(PCIE_RGR1_SW_INIT_1, mmio_read(PCIE_RGR1_SW_INIT_1) | SW_INIT_PERST | SW_INIT_BRIDGE);
+    sleep_us(200);
+    mmio_write(PCIE_RGR1_SW_INIT_1, mmio_read(PCIE_RGR1_SW_INIT_1) & ~SW_INIT_BRIDGE);
+
+    mmio_write(PCIE_MISC_HARD_PCIE_HARD_DEBUG, mmio_read(PCIE_MISC_HARD_PCIE_HARD_DEBUG) & ~HARD_DEBUG_SERDES_IDDQ);
+    sleep_us(100);
+
+    // Inbound: PCIe 0 - 3 GB onto the same CPU addresses, short of the
+    // outbound window. Sizes are encoded as log2(size) - 15 and must be powers
+    // of two, so RC BAR2 takes the first 2 GB and RC BAR3 the next one. The
+    // SCB0 size is that of the memory behind the controller, not a window.
+    unsigned int ctrl = mmio_read(PCIE_MISC_MISC_CTRL);
+    ctrl &= ~(MISC_CTRL_BURST_MASK | (0x1Fu << MISC_CTRL_SCB0_SIZE_SHIFT));
+    ctrl |= MISC_CTRL_SCB_ACCESS_EN | MISC_CTRL_CFG_READ_UR | ((32 - 15) << MISC_CTRL_SCB0_SIZE_SHIFT);
+    mmio_write(PCIE_MISC_MISC_CTRL, ctrl);
+
+    mmio_write(PCIE_MISC_RC_BAR2_CONFIG_LO, 0x00000000 | (31 - 15));
+    mmio_write(PCIE_MISC_RC_BAR2_CONFIG_HI, 0);
+    mmio_write(PCIE_MISC_RC_BAR3_CONFIG_LO, 0x80000000 | (30 - 15));
+    mmio_write(PCIE_MISC_RC_BAR3_CONFIG_HI, 0);
+    mmio_write(PCIE_MISC_RC_BAR1_CONFIG_LO, mmio_read(PCIE_MISC_RC_BAR1_CONFIG_LO) & ~0x1F);
+
+    // no legacy interrupts through the controller for now
+    mmio_write(PCIE_INTR2_CPU_MASK_SET, 0xFFFFFFFF);
+    mmio_write(PCIE_INTR2_CPU_CLR, 0xFFFFFFFF);
+
+    // release the endpoint and train the link
+    mmio_write(PCIE_RGR1_SW_INIT_1, mmio_read(PCIE_RGR1_SW_INIT_1) & ~SW_INIT_PERST);
+
+    unsigned long start = timer_now_us();
+    unsigned int status;
+    for (;;) {
+        status = mmio_read(PCIE_MISC_PCIE_STATUS);
+        if ((status & (STATUS_PHYLINKUP | STATUS_DL_ACTIVE)) == (STATUS_PHYLINKUP | STATUS_DL_ACTIVE)) break;
+        if (timer_now_us() - start > PCIE_LINK_TIMEOUT_US) {
+            LOG_WARN("PCIe: Link down (status %08x)", status);
+            return 0;
         }
-    } else {
-        return; // Not implemented
+        sleep_ms(5);
     }
 
-    if (!safe_mmio_test(config_addr)) {
-        return;
+    if (!(status & STATUS_RC_MODE)) {
+        LOG_ERROR("PCIe: Controller is not in root complex mode");
+        return 0;
     }
 
-    mmio_write(config_addr, value);
+    // Outbound window, base and limit in MB
+    unsigned long baseMB = PCIE_WINDOW_CPU >> 20;
+    unsigned long limitMB = (PCIE_WINDOW_CPU + PCIE_WINDOW_SIZE - 1) >> 20;
+    mmio_write(PCIE_MISC_CPU_2_PCIE_MEM_WIN0_LO, (unsigned int)PCIE_WINDOW_BUS);
+    mmio_write(PCIE_MISC_CPU_2_PCIE_MEM_WIN0_HI, (unsigned int)(PCIE_WINDOW_BUS >> 32));
+    mmio_write(PCIE_MISC_WIN0_BASE_LIMIT, ((limitMB & 0xFFF) << 20) | ((baseMB & 0xFFF) << 4));
+    mmio_write(PCIE_MISC_WIN0_BASE_HI, baseMB >> 12);
+    mmio_write(PCIE_MISC_WIN0_LIMIT_HI, limitMB >> 12);
+
+    // the root port identifies as a PCI-PCI bridge, little endian, clock requests on
+    mmio_write(PCIE_RC_CFG_PRIV1_ID_VAL3, (mmio_read(PCIE_RC_CFG_PRIV1_ID_VAL3) & ~0xFFFFFF) | 0x060400);
+    mmio_write(PCIE_RC_CFG_VENDOR_SPECIFIC_REG1, mmio_read(PCIE_RC_CFG_VENDOR_SPECIFIC_REG1) & ~VENDOR_REG1_ENDIAN_MASK);
+    mmio_write(PCIE_MISC_HARD_PCIE_HARD_DEBUG, mmio_read(PCIE_MISC_HARD_PCIE_HARD_DEBUG) | HARD_DEBUG_CLKREQ_EN);
+
+    LOG_INFO("PCIe: Link up, revision %x", rev);
+    return 1;
 }
 
-static int pcie_check_bridge_presence(void) {
-    uart_writeText("PCIe: Checking bridge presence\n");
+// Enumeration
 
-    // Try to read the vendor/device ID of the PCIe bridge
-    unsigned int vendor_device = safe_config_read32(0, 0, 0, 0x00);
+static unsigned int pcie_portType(unsigned int bus, unsigned int device, unsigned int function)
+{
+    unsigned int ptr = pcie_cfgRead(bus, device, function, CFG_CAP_PTR) & 0xFC;
 
-    uart_writeText("PCIe: Bridge vendor/device: ");
-    // Convert to hex string for debug
-    char hex_str[16];
-    for (int i = 7; i >= 0; i--) {
-        unsigned int nibble = (vendor_device >> (i * 4)) & 0xF;
-        hex_str[7-i] = (nibble < 10) ? ('0' + nibble) : ('A' + nibble - 10);
-    }
-    hex_str[8] = '\0';
-    uart_writeText(hex_str);
-    uart_writeText("\n");
-
-    // Check if we got a valid vendor ID (not 0x0000 or 0xFFFF)
-    unsigned short vendor_id = vendor_device & 0xFFFF;
-    if (vendor_id == 0x0000 || vendor_id == 0xFFFF) {
-        uart_writeText("PCIe: No valid bridge found\n");
-        return 0;
+    for (int guard = 0; ptr && guard < 48; guard++) {
+        unsigned int cap = pcie_cfgRead(bus, device, function, ptr);
+        if ((cap & 0xFF) == CAP_ID_PCIE) return (cap >> 20) & 0xF;
+        ptr = (cap >> 8) & 0xFC;
     }
-
-    uart_writeText("PCIe: Bridge found\n");
-    return 1;
+    return 0xF;
 }
 
-static void pcie_scan_device(unsigned int bus, unsigned int device, unsigned int function) {
-    if (pcie_device_count >= MAX_PCIE_DEVICES) {
-        uart_writeText("PCIe: Device array full\n");
-        return;
+// Sizes the memory BARs and places them in the outbound window
+static void pcie_assignBars(pcie_device_t *dev, int count)
+{
+    unsigned int b = dev->bus, d = dev->device, f = dev->function;
+    unsigned int cmd = pcie_cfgRead(b, d, f, PCIE_CFG_COMMAND);
+
+    // no decoding while the BARs hold the sizing pattern
+    pcie_cfgWrite(b, d, f, PCIE_CFG_COMMAND, cmd & ~(PCIE_CMD_MEMORY | 1));
+    int unassigned = 0;
+
+    for (int i = 0; i < count; i++) {
+        unsigned int reg = CFG_BAR0 + i * 4;
+        unsigned int orig = pcie_cfgRead(b, d, f, reg);
+
+        pcie_cfgWrite(b, d, f, reg, 0xFFFFFFFF);
+        unsigned int mask = pcie_cfgRead(b, d, f, reg);
+        pcie_cfgWrite(b, d, f, reg, orig);
+
+        if (mask == 0 || mask == 0xFFFFFFFF) continue;
+        if (mask & 1) continue; // I/O BAR, the BCM2711 has no I/O window
+
+        int is64 = ((mask >> 1) & 3) == 2;
+        unsigned long sizeMask = mask & ~0xFUL;
+
+        if (is64 && i + 1 < count) {
+            unsigned int origHi = pcie_cfgRead(b, d, f, reg + 4);
+            pcie_cfgWrite(b, d, f, reg + 4, 0xFFFFFFFF);
+            sizeMask |= (unsigned long)pcie_cfgRead(b, d, f, reg + 4) << 32;
+            pcie_cfgWrite(b, d, f, reg + 4, origHi);
+        } else {
+            sizeMask |= 0xFFFFFFFF00000000UL;
+        }
+
+        unsigned long size = ~sizeMask + 1;
+        unsigned long addr = (pcie_nextMem + size - 1) & ~(size - 1);
+
+        if (addr + size > PCIE_WINDOW_BUS + PCIE_WINDOW_SIZE) {
+            LOG_WARN("PCIe: %02x:%02x.%x BAR%d (%lu KB) doesn't fit", b, d, f, i, size >> 10);
+            unassigned = 1;
+        } else {
+            pcie_nextMem = addr + size;
+            dev->bar_addr[i] = PCIE_WINDOW_CPU + (addr - PCIE_WINDOW_BUS);
+            dev->bar_size[i] = size;
+            pcie_cfgWrite(b, d, f, reg, (unsigned int)addr | (mask & 0xF));
+            if (is64) pcie_cfgWrite(b, d, f, reg + 4, (unsigned int)(addr >> 32));
+        }
+
+        dev->bars[i] = pcie_cfgRead(b, d, f, reg);
+        if (is64) dev->bars[++i] = pcie_cfgRead(b, d, f, reg + 4);
     }
 
-    char debug_msg[64];
-    uart_writeText("PCIe: Scanning bus ");
-    debug_msg[0] = '0' + bus;
-    debug_msg[1] = ' ';
-    debug_msg[2] = 'd';
-    debug_msg[3] = 'e';
-    debug_msg[4] = 'v';
-    debug_msg[5] = ' ';
-    debug_msg[6] = '0' + device;
-    debug_msg[7] = '\n';
-    debug_msg[8] = '\0';
-    uart_writeText(debug_msg);
-
-    unsigned int vendor_device = safe_config_read32(bus, device, function, 0x00);
-    if (vendor_device == 0xFFFFFFFF) {
-        return; // No device
+    // a BAR left at whatever it held could decode over RAM or another device,
+    // and memory decode can only be switched for the whole function
+    if (unassigned) {
+        LOG_WARN("PCIe: %02x:%02x.%x memory decode left off", b, d, f);
+        pcie_cfgWrite(b, d, f, PCIE_CFG_COMMAND, (cmd & ~(PCIE_CMD_MEMORY | 1)) | PCIE_CMD_BUS_MASTER);
+    } else {
+        pcie_cfgWrite(b, d, f, PCIE_CFG_COMMAND, cmd | PCIE_CMD_MEMORY | PCIE_CMD_BUS_MASTER);
     }
+}
 
-    unsigned short vendor_id = vendor_device & 0xFFFF;
-    unsigned short device_id = (vendor_device >> 16) & 0xFFFF;
+static void pcie_scanBus(unsigned int bus, int onlyDevice0);
 
-    if (vendor_id == 0x0000 || vendor_id == 0xFFFF) {
-        return; // Invalid vendor ID
+static pcie_device_t *pcie_addDevice(unsigned int bus, unsigned int device, unsigned int function, unsigned int id)
+{
+    if (pcie_device_count >= MAX_PCIE_DEVICES) {
+        LOG_WARN("PCIe: Device array full");
+        return 0;
     }
 
-    uart_writeText("PCIe: Found device\n");
+    pcie_device_t *dev = &pcie_devices[pcie_device_count++];
+    unsigned int class_info = pcie_cfgRead(bus, device, function, CFG_CLASS);
 
-    pcie_device_t *dev = &pcie_devices[pcie_device_count];
     dev->bus = bus;
     dev->device = device;
     dev->function = function;
-    dev->vendor_id = vendor_id;
-    dev->device_id = device_id;
-
-    // Read class code
-    unsigned int class_info = safe_config_read32(bus, device, function, 0x08);
-    if (class_info != 0xFFFFFFFF) {
-        dev->class_code = (class_info >> 16) & 0xFFFF;
-        dev->subclass = (class_info >> 16) & 0xFF;
-        dev->prog_if = (class_info >> 8) & 0xFF;
+    dev->vendor_id = id & 0xFFFF;
+    dev->device_id = id >> 16;
+    dev->class_code = class_info >> 16;
+    dev->subclass = (class_info >> 16) & 0xFF;
+    dev->prog_if = (class_info >> 8) & 0xFF;
+    dev->header_type = (pcie_cfgRead(bus, device, function, CFG_HEADER) >> 16) & 0x7F;
+    dev->secondary_bus = 0;
+    for (int i = 0; i < 6; i++) {
+        dev->bars[i] = 0;
+        dev->bar_addr[i] = 0;
+        dev->bar_size[i] = 0;
+    }
+
+    LOG_INFO("PCIe: %02x:%02x.%x %04x:%04x class %04x", bus, device, function,
+             dev->vendor_id, dev->device_id, dev->class_code);
+    return dev;
+}
+
+static void pcie_setupBridge(pcie_device_t *dev)
+{
+    unsigned int b = dev->bus, d = dev->device, f = dev->function;
+    unsigned int secondary = ++pcie_nextBus;
+    unsigned int type = pcie_portType(b, d, f);
+
+    dev->secondary_bus = secondary;
+    pcie_assignBars(dev, 2);
+
+    // open the bus range all the way while the far side is scanned
+    unsigned int numbers = pcie_cfgRead(b, d, f, CFG_BUS_NUMBERS) & 0xFF000000;
+    pcie_cfgWrite(b, d, f, CFG_BUS_NUMBERS, numbers | (0xFF << 16) | (secondary << 8) | b);
+
+    // bridge memory windows have 1 MB granularity
+    pcie_nextMem = (pcie_nextMem + 0xFFFFF) & ~0xFFFFFUL;
+    unsigned long memBase = pcie_nextMem;
+
+    // a PCIe port's link has exactly one device on the other end
+    pcie_scanBus(secondary, type == PCIE_PORT_ROOT || type == PCIE_PORT_DOWNSTREAM);
+
+    pcie_cfgWrite(b, d, f, CFG_BUS_NUMBERS, numbers | (pcie_nextBus << 16) | (secondary << 8) | b);
+
+    pcie_nextMem = (pcie_nextMem + 0xFFFFF) & ~0xFFFFFUL;
+    if (pcie_nextMem > memBase) {
+        pcie_cfgWrite(b, d, f, CFG_MEM_WINDOW, ((pcie_nextMem - 1) & 0xFFF00000) | (memBase >> 16));
     } else {
-        dev->class_code = 0;
-        dev->subclass = 0;
-        dev->prog_if = 0;
+        pcie_cfgWrite(b, d, f, CFG_MEM_WINDOW, 0x0000FFF0); // base above limit: closed
     }
 
-    // Read BARs
-    for (int i = 0; i < 6; i++) {
-        dev->bars[i] = safe_config_read32(bus, device, function, 0x10 + i * 4);
-        if (dev->bars[i] == 0xFFFFFFFF) {
-            dev->bars[i] = 0;
+    // no I/O or prefetchable ranges, everything lives in the one window
+    pcie_cfgWrite(b, d, f, CFG_IO_WINDOW, (pcie_cfgRead(b, d, f, CFG_IO_WINDOW) & 0xFFFF0000) | 0x00F0);
+    pcie_cfgWrite(b, d, f, CFG_PREF_WINDOW, 0x0000FFF0);
+    pcie_cfgWrite(b, d, f, CFG_PREF_BASE_HI, 0);
+    pcie_cfgWrite(b, d, f, CFG_PREF_LIMIT_HI, 0);
+}
+
+static void pcie_scanFunction(unsigned int bus, unsigned int device, unsigned int function, unsigned int id)
+{
+    pcie_device_t *dev = pcie_addDevice(bus, device, function, id);
+    if (!dev) return;
+
+    if (dev->header_type == 1) pcie_setupBridge(dev);
+    else if (dev->header_type == 0) pcie_assignBars(dev, 6);
+}
+
+static void pcie_scanBus(unsigned int bus, int onlyDevice0)
+{
+    for (unsigned int device = 0; device < (onlyDevice0 ? 1u : 32u); device++) {
+        unsigned int id = pcie_cfgRead(bus, device, 0, CFG_ID);
+        if ((id & 0xFFFF) == 0xFFFF || (id & 0xFFFF) == 0) continue;
+
+        pcie_scanFunction(bus, device, 0, id);
+
+        if (!(pcie_cfgRead(bus, device, 0, CFG_HEADER) & 0x800000)) continue;
+        for (unsigned int function = 1; function < 8; function++) {
+            id = pcie_cfgRead(bus, device, function, CFG_ID);
+            if ((id & 0xFFFF) != 0xFFFF && (id & 0xFFFF) != 0) pcie_scanFunction(bus, device, function, id);
         }
     }
+}
+
+// The VL805 USB controller loads its firmware from the VideoCore, which
+// has to be told after every PCIe reset
+static void pcie_notifyXhciReset(void)
+{
+    pcie_device_t *dev = pcie_find_device_by_class(PCIE_CLASS_SERIAL_BUS, PCIE_SUBCLASS_USB);
+    mbox_msg_t msg;
+
+    if (!dev || dev->prog_if != PCIE_PROG_IF_XHCI) return;
 
-    pcie_device_count++;
-    uart_writeText("PCIe: Device added to list\n");
+    unsigned int addr = (dev->bus << 20) | (dev->device << 15) | (dev->function << 12);
+    mbox_msg_init(&msg);
+    mbox_msg_addTag(&msg, MBOX_TAG_NOTIFYXHCIRESET, &addr, 1, 1);
+    if (!mbox_submit(&msg, MBOX_CH_PROP) || !mbox_wait(&msg)) LOG_WARN("PCIe: xHCI firmware reload failed");
 }
 
 int pcie_init(void) {
-    uart_writeText("PCIe: Starting initialization\n");
-
     if (pcie_initialized) {
-        uart_writeText("PCIe: Already initialized\n");
-        return 1;
+        return pcie_device_count > 0;
     }
 
     pcie_device_count = 0;
+    pcie_initialized = 1;
 
-    // Check if PCIe bridge is present and accessible
-    if (!pcie_check_bridge_presence()) {
-        uart_writeText("PCIe: No bridge found, but marking as initialized\n");
-        pcie_initialized = 1;
-        return 1; // Not an error - some Pi models don't have PCIe
-    }
-
-    uart_writeText("PCIe: Scanning for devices\n");
+    if (!pcie_resetLink()) return 0; // not an error, QEMU and the CM4 Lite have none
 
-    // Scan bus 0 only for now
-    // Start with device 1 (device 0 is the bridge)
-    for (unsigned int device = 1; device < 4; device++) {
-        pcie_scan_device(0, device, 0);
+    pcie_nextBus = 0;
+    pcie_nextMem = PCIE_WINDOW_BUS;
+    pcie_scanBus(0, 1);
 
-        // Check if it's a multi-function device
-        unsigned int header_type = safe_config_read32(0, device, 0, 0x0E);
-        if (header_type != 0xFFFFFFFF && (header_type & 0x800000)) {
-            // Multi-function device - scan other functions
-            for (unsigned int function = 1; function < 8; function++) {
-                pcie_scan_device(0, device, function);
-            }
-        }
-    }
+    pcie_notifyXhciReset();
 
-    uart_writeText("PCIe: Scan complete\n");
-    pcie_initialized = 1;
+    LOG_INFO("PCIe: Scan complete, %d device(s), %lu KB of BARs", pcie_device_count,
+             (pcie_nextMem - PCIE_WINDOW_BUS) >> 10);
     return 1;
 }
 
@@ -238,7 +425,7 @@ pcie_device_t* pcie_get_device(int index) {
 pcie_device_t* pcie_find_device_by_class(unsigned short class_code, unsigned char subclass) {
     for (int i = 0; i < pcie_device_count; i++) {
         pcie_device_t *dev = &pcie_devices[i];
-        if ((dev->class_code >> 8) == (class_code >> 8) && dev->subclass == subclass) {
+        if ((dev->class_code >> 8) == class_code && dev->subclass == subclass) {
             return dev;
         }
     }
@@ -257,24 +444,32 @@ pcie_device_t* pcie_find_device_by_vendor(unsigned short vendor_id, unsigned sho
 
 unsigned int pcie_device_read_config32(pcie_device_t *dev, unsigned char offset) {
     if (!dev) return 0xFFFFFFFF;
-    return safe_config_read32(dev->bus, dev->device, dev->function, offset);
+    return pcie_cfgRead(dev->bus, dev->device, dev->function, offset);
 }
 
 void pcie_device_write_config32(pcie_device_t *dev, unsigned char offset, unsigned int value) {
     if (!dev) return;
-    safe_config_write32(dev->bus, dev->device, dev->function, offset, value);
+    pcie_cfgWrite(dev->bus, dev->device, dev->function, offset, value);
 }
 
 unsigned short pcie_device_read_config16(pcie_device_t *dev, unsigned char offset) {
     if (!dev) return 0xFFFF;
-    unsigned int data = safe_config_read32(dev->bus, dev->device, dev->function, offset & ~3);
-    if (data == 0xFFFFFFFF) return 0xFFFF;
-    return (data >> ((offset & 3) * 8)) & 0xFFFF;
+    unsigned int data = pcie_cfgRead(dev->bus, dev->device, dev->function, offset & ~3);
+    return (data >> ((offset & 2) * 8)) & 0xFFFF;
+}
+
+void pcie_device_write_config16(pcie_device_t *dev, unsigned char offset, unsigned short value) {
+    if (!dev) return;
+
+    // config writes are 32-bit here; the neighbour is read back and rewritten
+    unsigned int shift = (offset & 2) * 8;
+    unsigned int data = pcie_cfgRead(dev->bus, dev->device, dev->function, offset & ~3);
+    data = (data & ~(0xFFFFu << shift)) | ((unsigned int)value << shift);
+    pcie_cfgWrite(dev->bus, dev->device, dev->function, offset & ~3, data);
 }
 
 unsigned char pcie_device_read_config8(pcie_device_t *dev, unsigned char offset) {
     if (!dev) return 0xFF;
-    unsigned int data = safe_config_read32(dev->bus, dev->device, dev->function, offset & ~3);
-    if (data == 0xFFFFFFFF) return 0xFF;
+    unsigned int data = pcie_cfgRead(dev->bus, dev->device, dev->function, offset & ~3);
     return (data >> ((offset & 3) * 8)) & 0xFF;
 }